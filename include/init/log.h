@@ -0,0 +1,106 @@
+// log.h — Level-gated logging macros for init
+#ifndef MINIMAL_SYSTEMS_INIT_LOG_H_
+#define MINIMAL_SYSTEMS_INIT_LOG_H_
+
+#include <atomic>
+#include <cstdint>
+
+#include "log_new.h"
+
+/**
+ * Drop-in replacements for the LOGV..LOGF macros from log_new.h.
+ *
+ * Each call site is filtered twice before any of its arguments are evaluated:
+ *
+ *  - at compile time against LOG_MIN_LEVEL, which a file may define next to
+ *    its LOG_TAG and which otherwise defaults to INIT_LOG_MIN_LEVEL (INFO in
+ *    NDEBUG builds, VERBOSE otherwise). Levels below it compile to nothing.
+ *  - at run time against the level of LOG_TAG, read from the property
+ *    log.tag.<TAG>, falling back to log.tag. Values follow logcat: V, D, I,
+ *    W, E, F or S (silent), matched on the first letter. With neither set,
+ *    every level that survived compilation is printed.
+ *
+ * The runtime level is cached per translation unit and re-read only when
+ * PropertyManager reports a property change, so an enabled-level check is
+ * two relaxed atomic loads.
+ *
+ * Do not use these while holding PropertyManager's lock: a stale cache reads
+ * properties back through it.
+ */
+
+#ifndef LOG_TAG
+#define LOG_TAG "init"
+#endif
+
+#ifndef INIT_LOG_MIN_LEVEL
+#ifdef NDEBUG
+#define INIT_LOG_MIN_LEVEL LINUX_LOG_INFO
+#else
+#define INIT_LOG_MIN_LEVEL LINUX_LOG_VERBOSE
+#endif
+#endif
+
+#ifndef LOG_MIN_LEVEL
+#define LOG_MIN_LEVEL INIT_LOG_MIN_LEVEL
+#endif
+
+namespace minimal_systems {
+namespace init {
+
+/**
+ * Runtime level of one log tag, refreshed from properties on demand.
+ *
+ * Constant-initialized, so it is usable from other static initializers.
+ */
+class LogTagLevel {
+  public:
+    constexpr explicit LogTagLevel(const char* tag) : tag_(tag) {}
+
+    bool Enabled(int prio) {
+        if (generation_.load(std::memory_order_relaxed) != CurrentGeneration()) Refresh();
+        return prio >= level_.load(std::memory_order_relaxed);
+    }
+
+  private:
+    static uint64_t CurrentGeneration();
+    void Refresh();
+
+    const char* tag_;
+    std::atomic<int> level_{0};
+    // Generation the cached level was read at; ~0 forces the first refresh.
+    std::atomic<uint64_t> generation_{~uint64_t{0}};
+};
+
+namespace {
+// One cache per translation unit, keyed by the LOG_TAG in effect here.
+[[maybe_unused]] LogTagLevel log_tag_level(LOG_TAG);
+constexpr int kLogMinLevel = LOG_MIN_LEVEL;
+}  // namespace
+
+}  // namespace init
+}  // namespace minimal_systems
+
+#define INIT_LOG_PRINT(prio, ...)                                                          \
+    do {                                                                                   \
+        if constexpr ((prio) >= ::minimal_systems::init::kLogMinLevel) {                   \
+            if (::minimal_systems::init::log_tag_level.Enabled(prio)) {                    \
+                __linux_log_print((prio), LOG_TAG, __VA_ARGS__);                           \
+            }                                                                              \
+        }                                                                                  \
+    } while (0)
+
+#undef LOGV
+#undef LOGD
+#undef LOGI
+#undef LOGW
+#undef LOGE
+#undef LOGF
+
+#define LOGV(...) INIT_LOG_PRINT(LINUX_LOG_VERBOSE, __VA_ARGS__)
+#define LOGD(...) INIT_LOG_PRINT(LINUX_LOG_DEBUG, __VA_ARGS__)
+#define LOGI(...) INIT_LOG_PRINT(LINUX_LOG_INFO, __VA_ARGS__)
+#define LOGW(...) INIT_LOG_PRINT(LINUX_LOG_WARN, __VA_ARGS__)
+#define LOGE(...) INIT_LOG_PRINT(LINUX_LOG_ERROR, __VA_ARGS__)
+#define LOGF(...) INIT_LOG_PRINT(LINUX_LOG_FATAL, __VA_ARGS__)
+
+#endif  // MINIMAL_SYSTEMS_INIT_LOG_H_
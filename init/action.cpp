@@ -8,7 +8,7 @@
 #define LOG_TAG "action"
 
 #include "action.h"
-#include "log_new.h"
+#include <init/log.h>
 #include "property_manager.h"
 
 namespace minimal_systems {
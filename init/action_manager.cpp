@@ -2,8 +2,9 @@
 #define LOG_TAG "action_manager"
 #include "action_manager.h"
 #include "action.h"
+#include "boot_trace.h"
 #include "service.h"
-#include "log_new.h"
+#include <init/log.h>
 #include "property_manager.h"
 
 #include <sstream>
@@ -29,7 +30,8 @@ void ActionManager::QueueEventTrigger(const std::string& trigger_name) {
 
     for (const auto& block : trigger_blocks) {
         if (match_trigger(block, trigger_name)) {
-            action_queue_.emplace([this, block]() {
+            action_queue_.emplace([this, block, trigger_name]() {
+                ScopedBootTrace trace(kTraceTrigger, trigger_name);
                 LOGI("Executing trigger block with %zu command(s)", block.commands.size());
                 for (const auto& cmd : block.commands) {
                     LOGI("  -> Running: %s", cmd.c_str());
@@ -0,0 +1,536 @@
+// binary_log.cpp — Binary log writer and decoder
+//
+// This file sits underneath __linux_log_print() and must not log itself.
+
+#include "binary_log.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace minimal_systems {
+namespace init {
+
+namespace {
+
+constexpr size_t kMaxPayload = 1024;
+constexpr size_t kInternCacheSize = 64;
+
+// Argument kinds, one byte ahead of each encoded argument.
+enum : uint8_t {
+    kArgSigned = 'i',    // int64_t
+    kArgUnsigned = 'u',  // uint64_t
+    kArgDouble = 'f',    // double
+    kArgString = 's',    // uint16_t length, then the bytes
+};
+
+/**
+ * One printf conversion, "%[flags][width][.precision][length]conv".
+ *
+ * Both the writer and the decoder walk the format string with this, so they
+ * agree on how many arguments each conversion consumes and of what kind.
+ */
+struct Conversion {
+    size_t start;        // Offset of '%'.
+    size_t end;          // One past the conversion character.
+    std::string spec;    // Flags, width and precision, verbatim.
+    int stars;           // '*' width/precision arguments.
+    std::string length;  // Length modifier.
+    char conv;
+};
+
+bool NextConversion(const char* fmt, size_t* pos, Conversion* c) {
+    const char* p = strchr(fmt + *pos, '%');
+    if (!p) return false;
+
+    c->start = p - fmt;
+    c->spec.clear();
+    c->length.clear();
+    c->stars = 0;
+    ++p;
+    while (*p && strchr("-+ #0'123456789.*", *p)) {
+        if (*p == '*') c->stars++;
+        c->spec += *p++;
+    }
+    while (*p && strchr("hlLqjzt", *p)) c->length += *p++;
+    c->conv = *p;
+    if (*p) ++p;
+    c->end = p - fmt;
+    *pos = c->end;
+    return true;
+}
+
+bool IsSignedConv(char conv) {
+    return conv == 'd' || conv == 'i' || conv == 'c';
+}
+
+bool IsUnsignedConv(char conv) {
+    return conv == 'u' || conv == 'o' || conv == 'x' || conv == 'X' || conv == 'p';
+}
+
+bool IsDoubleConv(char conv) {
+    return conv && strchr("fFeEgGaA", conv);
+}
+
+class PayloadWriter {
+  public:
+    bool Put(uint8_t kind, const void* data, size_t len) {
+        if (len_ + 1 + len > sizeof(buf_)) return false;
+        buf_[len_++] = kind;
+        memcpy(buf_ + len_, data, len);
+        len_ += len;
+        return true;
+    }
+    bool PutSigned(int64_t v) { return Put(kArgSigned, &v, sizeof(v)); }
+    bool PutUnsigned(uint64_t v) { return Put(kArgUnsigned, &v, sizeof(v)); }
+    bool PutDouble(double v) { return Put(kArgDouble, &v, sizeof(v)); }
+    bool PutString(const char* s) {
+        size_t room = sizeof(buf_) - len_;
+        if (room < 1 + sizeof(uint16_t)) return false;
+        uint16_t n = static_cast<uint16_t>(
+                std::min(strlen(s), room - 1 - sizeof(uint16_t)));
+        buf_[len_++] = kArgString;
+        memcpy(buf_ + len_, &n, sizeof(n));
+        memcpy(buf_ + len_ + sizeof(n), s, n);
+        len_ += sizeof(n) + n;
+        return true;
+    }
+
+    const uint8_t* data() const { return buf_; }
+    size_t size() const { return len_; }
+
+  private:
+    uint8_t buf_[kMaxPayload];
+    size_t len_ = 0;
+};
+
+// Pulls the arguments `fmt` consumes out of `args`, in order.
+void EncodeArguments(const char* fmt, va_list args, int saved_errno, PayloadWriter* out) {
+    size_t pos = 0;
+    Conversion c;
+    while (NextConversion(fmt, &pos, &c)) {
+        for (int i = 0; i < c.stars; ++i) {
+            if (!out->PutSigned(va_arg(args, int))) return;
+        }
+        const std::string& l = c.length;
+        bool ok = true;
+        if (c.conv == '%') {
+            continue;
+        } else if (c.conv == 'm') {
+            ok = out->PutString(strerror(saved_errno));
+        } else if (c.conv == 's') {
+            if (l == "l") {
+                va_arg(args, const wchar_t*);
+                ok = out->PutString("(wide string)");
+            } else {
+                const char* s = va_arg(args, const char*);
+                ok = out->PutString(s ? s : "(null)");
+            }
+        } else if (c.conv == 'n') {
+            va_arg(args, void*);
+        } else if (c.conv == 'p') {
+            ok = out->PutUnsigned(reinterpret_cast<uintptr_t>(va_arg(args, void*)));
+        } else if (IsSignedConv(c.conv)) {
+            int64_t v;
+            if (l == "hh" && c.conv != 'c') v = static_cast<signed char>(va_arg(args, int));
+            else if (l == "h") v = static_cast<short>(va_arg(args, int));
+            else if (l == "l") v = va_arg(args, long);
+            else if (l == "ll" || l == "q") v = va_arg(args, long long);
+            else if (l == "z") v = va_arg(args, ssize_t);
+            else if (l == "j") v = va_arg(args, intmax_t);
+            else if (l == "t") v = va_arg(args, ptrdiff_t);
+            else v = va_arg(args, int);
+            ok = out->PutSigned(v);
+        } else if (IsUnsignedConv(c.conv)) {
+            uint64_t v;
+            if (l == "hh") v = static_cast<unsigned char>(va_arg(args, unsigned));
+            else if (l == "h") v = static_cast<unsigned short>(va_arg(args, unsigned));
+            else if (l == "l") v = va_arg(args, unsigned long);
+            else if (l == "ll" || l == "q") v = va_arg(args, unsigned long long);
+            else if (l == "z") v = va_arg(args, size_t);
+            else if (l == "j") v = va_arg(args, uintmax_t);
+            else if (l == "t") v = va_arg(args, ptrdiff_t);
+            else v = va_arg(args, unsigned);
+            ok = out->PutUnsigned(v);
+        } else if (IsDoubleConv(c.conv)) {
+            ok = out->PutDouble(l == "L" ? static_cast<double>(va_arg(args, long double))
+                                         : va_arg(args, double));
+        } else {
+            // Unknown conversion: the decoder prints the rest verbatim.
+            return;
+        }
+        if (!ok) return;
+    }
+}
+
+uint64_t BootTimeNs() {
+    struct timespec ts;
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+int64_t RealtimeOffsetNs() {
+    struct timespec rt;
+    clock_gettime(CLOCK_REALTIME, &rt);
+    int64_t realtime = static_cast<int64_t>(rt.tv_sec) * 1000000000ll + rt.tv_nsec;
+    return realtime - static_cast<int64_t>(BootTimeNs());
+}
+
+std::atomic<BinaryLogHeader*> g_log{nullptr};
+
+// Tag and format IDs defined by this process, keyed by text.
+std::mutex g_intern_lock;
+auto* g_interned = new std::unordered_map<std::string, uint32_t>[2];
+
+// Per-thread pointer cache in front of g_interned; hits skip the lock.
+struct InternCacheEntry {
+    const char* ptr;
+    const std::string* text;
+    uint32_t id;
+};
+thread_local InternCacheEntry t_intern_cache[2][kInternCacheSize];
+
+// Cached IDs of the calling thread. Forked children detach before logging.
+thread_local int32_t t_pid;
+thread_local int32_t t_tid;
+
+BinaryLogRecord* Reserve(BinaryLogHeader* log, size_t payload) {
+    size_t size = (sizeof(BinaryLogRecord) + payload + 7) & ~size_t{7};
+    uint64_t off = log->tail.fetch_add(size, std::memory_order_relaxed);
+    if (off + size > log->capacity) {
+        log->dropped.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    auto* rec = reinterpret_cast<BinaryLogRecord*>(reinterpret_cast<uint8_t*>(log) + off);
+    rec->size = static_cast<uint32_t>(size);
+    return rec;
+}
+
+uint8_t* Payload(BinaryLogRecord* rec) {
+    return reinterpret_cast<uint8_t*>(rec) + sizeof(*rec);
+}
+
+void Commit(BinaryLogRecord* rec, BinaryLogRecordType type) {
+    rec->type.store(type, std::memory_order_release);
+}
+
+void FillHeader(BinaryLogRecord* rec, int prio, uint32_t id, uint32_t tag_id, uint64_t now) {
+    rec->prio = static_cast<uint8_t>(prio);
+    rec->reserved = 0;
+    rec->id = id;
+    rec->tag_id = tag_id;
+    if (t_tid == 0) {
+        t_pid = getpid();
+        t_tid = static_cast<int32_t>(syscall(SYS_gettid));
+    }
+    rec->pid = t_pid;
+    rec->tid = t_tid;
+    rec->timestamp_ns = now;
+}
+
+// Returns the ID of `text` as a tag or format string, defining it if needed.
+uint32_t Intern(BinaryLogHeader* log, BinaryLogRecordType type, const char* text) {
+    size_t table = type == kRecordTag ? 0 : 1;
+    InternCacheEntry& slot =
+            t_intern_cache[table][(reinterpret_cast<uintptr_t>(text) >> 3) % kInternCacheSize];
+    if (slot.ptr == text && strcmp(text, slot.text->c_str()) == 0) return slot.id;
+
+    std::lock_guard<std::mutex> lock(g_intern_lock);
+    auto& ids = g_interned[table];
+    auto it = ids.find(text);
+    if (it == ids.end()) {
+        size_t len = strlen(text);
+        BinaryLogRecord* rec = Reserve(log, len);
+        if (!rec) return 0;
+        uint32_t id = log->next_id.fetch_add(1, std::memory_order_relaxed);
+        FillHeader(rec, 0, id, 0, BootTimeNs());
+        memcpy(Payload(rec), text, len);
+        Commit(rec, type);
+        it = ids.emplace(text, id).first;
+    }
+    slot = {text, &it->first, it->second};
+    return it->second;
+}
+
+}  // namespace
+
+bool BinaryLogOpen(const char* path, size_t capacity) {
+    if (g_log.load(std::memory_order_acquire)) return true;
+
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC | O_NOFOLLOW, 0600);
+    if (fd < 0) return false;
+
+    // Serialize creation against other processes opening the same file.
+    BinaryLogHeader* log = nullptr;
+    struct stat st;
+    if (flock(fd, LOCK_EX) == 0 && fstat(fd, &st) == 0) {
+        bool fresh = st.st_size == 0;
+        if (fresh && ftruncate(fd, capacity) != 0) {
+            fresh = false;
+            capacity = 0;
+        } else if (!fresh) {
+            capacity = st.st_size;
+        }
+        if (capacity >= sizeof(BinaryLogHeader)) {
+            void* map = mmap(nullptr, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (map != MAP_FAILED) log = static_cast<BinaryLogHeader*>(map);
+        }
+        if (log && fresh) {
+            log->magic = kBinaryLogMagic;
+            log->version = kBinaryLogVersion;
+            log->capacity = capacity;
+            log->realtime_offset_ns = RealtimeOffsetNs();
+            log->tail.store(sizeof(BinaryLogHeader), std::memory_order_relaxed);
+            log->next_id.store(1, std::memory_order_relaxed);
+            log->dropped.store(0, std::memory_order_relaxed);
+        } else if (log && (log->magic != kBinaryLogMagic || log->version != kBinaryLogVersion ||
+                           log->capacity != capacity)) {
+            munmap(log, capacity);
+            log = nullptr;
+        }
+        flock(fd, LOCK_UN);
+    }
+    close(fd);
+    if (!log) return false;
+
+    BinaryLogHeader* expected = nullptr;
+    if (!g_log.compare_exchange_strong(expected, log)) munmap(log, capacity);
+    return true;
+}
+
+void BinaryLogDetach() {
+    g_log.store(nullptr, std::memory_order_release);
+}
+
+bool BinaryLogActive() {
+    return g_log.load(std::memory_order_relaxed) != nullptr;
+}
+
+bool BinaryLogWrite(int prio, const char* tag, const char* fmt, va_list args) {
+    int saved_errno = errno;
+    BinaryLogHeader* log = g_log.load(std::memory_order_acquire);
+    if (!log || !fmt) return false;
+
+    uint64_t now = BootTimeNs();
+    uint32_t tag_id = Intern(log, kRecordTag, tag ? tag : "default");
+    uint32_t fmt_id = tag_id ? Intern(log, kRecordFormat, fmt) : 0;
+    if (!fmt_id) return false;
+
+    PayloadWriter payload;
+    va_list copy;
+    va_copy(copy, args);
+    EncodeArguments(fmt, copy, saved_errno, &payload);
+    va_end(copy);
+
+    BinaryLogRecord* rec = Reserve(log, payload.size());
+    if (!rec) return false;
+    FillHeader(rec, prio, fmt_id, tag_id, now);
+    memcpy(Payload(rec), payload.data(), payload.size());
+    Commit(rec, kRecordLine);
+    errno = saved_errno;
+    return true;
+}
+
+namespace {
+
+class PayloadReader {
+  public:
+    PayloadReader(const uint8_t* data, size_t len) : p_(data), end_(data + len) {}
+
+    template <typename T>
+    bool Get(uint8_t kind, T* v) {
+        if (end_ - p_ < static_cast<ptrdiff_t>(1 + sizeof(T)) || *p_ != kind) return false;
+        memcpy(v, p_ + 1, sizeof(T));
+        p_ += 1 + sizeof(T);
+        return true;
+    }
+    bool GetString(std::string* s) {
+        uint16_t n;
+        if (!Get(kArgString, &n) || end_ - p_ < n) return false;
+        s->assign(reinterpret_cast<const char*>(p_), n);
+        p_ += n;
+        return true;
+    }
+
+  private:
+    const uint8_t* p_;
+    const uint8_t* end_;
+};
+
+template <typename T>
+void AppendConversion(std::string* out, const std::string& spec, const int* stars, int nstars,
+                      T value) {
+    char buf[kMaxPayload];
+    int n;
+    if (nstars == 0) {
+        n = snprintf(buf, sizeof(buf), spec.c_str(), value);
+    } else if (nstars == 1) {
+        n = snprintf(buf, sizeof(buf), spec.c_str(), stars[0], value);
+    } else {
+        n = snprintf(buf, sizeof(buf), spec.c_str(), stars[0], stars[1], value);
+    }
+    if (n > 0) out->append(buf, std::min<size_t>(n, sizeof(buf) - 1));
+}
+
+// Re-applies `fmt` to the arguments EncodeArguments() recorded.
+std::string DecodeMessage(const std::string& fmt, PayloadReader in) {
+    std::string out;
+    size_t pos = 0, literal = 0;
+    Conversion c;
+    while (NextConversion(fmt.c_str(), &pos, &c)) {
+        out.append(fmt, literal, c.start - literal);
+        literal = c.end;
+
+        int stars[2] = {0, 0};
+        bool ok = c.stars <= 2;
+        for (int i = 0; ok && i < c.stars; ++i) {
+            int64_t v = 0;
+            ok = in.Get(kArgSigned, &v);
+            stars[i] = static_cast<int>(v);
+        }
+        std::string spec = "%" + c.spec;
+        if (!ok) {
+            // Truncated or corrupt record: show what is left unformatted.
+        } else if (c.conv == '%') {
+            out += '%';
+            continue;
+        } else if (c.conv == 'n') {
+            continue;
+        } else if (c.conv == 's' || c.conv == 'm') {
+            std::string s;
+            if ((ok = in.GetString(&s))) AppendConversion(&out, spec + 's', stars, c.stars, s.c_str());
+        } else if (c.conv == 'p') {
+            uint64_t v;
+            if ((ok = in.Get(kArgUnsigned, &v))) {
+                AppendConversion(&out, spec + 'p', stars, c.stars,
+                                 reinterpret_cast<void*>(static_cast<uintptr_t>(v)));
+            }
+        } else if (c.conv == 'c') {
+            int64_t v;
+            if ((ok = in.Get(kArgSigned, &v))) {
+                AppendConversion(&out, spec + 'c', stars, c.stars, static_cast<int>(v));
+            }
+        } else if (IsSignedConv(c.conv)) {
+            int64_t v;
+            if ((ok = in.Get(kArgSigned, &v))) {
+                AppendConversion(&out, spec + "ll" + c.conv, stars, c.stars,
+                                 static_cast<long long>(v));
+            }
+        } else if (IsUnsignedConv(c.conv)) {
+            uint64_t v;
+            if ((ok = in.Get(kArgUnsigned, &v))) {
+                AppendConversion(&out, spec + "ll" + c.conv, stars, c.stars,
+                                 static_cast<unsigned long long>(v));
+            }
+        } else if (IsDoubleConv(c.conv)) {
+            double v;
+            if ((ok = in.Get(kArgDouble, &v))) {
+                AppendConversion(&out, spec + c.conv, stars, c.stars, v);
+            }
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            literal = c.start;
+            break;
+        }
+    }
+    out.append(fmt, literal, std::string::npos);
+    while (!out.empty() && out.back() == '\n') out.pop_back();
+    return out;
+}
+
+}  // namespace
+
+bool BinaryLogDecode(const std::string& path,
+                     const std::function<void(const BinaryLogLine&)>& fn,
+                     BinaryLogSummary* summary, std::string* err) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        *err = "open " + path + ": " + strerror(errno);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(BinaryLogHeader)) {
+        close(fd);
+        *err = path + ": too small for a binary log";
+        return false;
+    }
+    void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        *err = "mmap " + path + ": " + strerror(errno);
+        return false;
+    }
+
+    const auto* log = static_cast<const BinaryLogHeader*>(map);
+    const auto* base = static_cast<const uint8_t*>(map);
+    if (log->magic != kBinaryLogMagic || log->version != kBinaryLogVersion) {
+        munmap(map, st.st_size);
+        *err = path + ": not a version " + std::to_string(kBinaryLogVersion) + " binary log";
+        return false;
+    }
+    size_t end = std::min<uint64_t>({log->tail.load(std::memory_order_acquire), log->capacity,
+                                     static_cast<uint64_t>(st.st_size)});
+
+    // Definitions can land after the first line that uses them, since writers
+    // race for space, so collect them all first.
+    std::unordered_map<uint32_t, std::string> strings;
+    std::vector<const BinaryLogRecord*> lines;
+    for (size_t off = sizeof(BinaryLogHeader); off + sizeof(BinaryLogRecord) <= end;) {
+        const auto* rec = reinterpret_cast<const BinaryLogRecord*>(base + off);
+        if (rec->size < sizeof(BinaryLogRecord) || off + rec->size > end) break;
+        uint8_t type = rec->type.load(std::memory_order_acquire);
+        const char* payload = reinterpret_cast<const char*>(rec + 1);
+        if (type == kRecordTag || type == kRecordFormat) {
+            const char* stop = static_cast<const char*>(
+                    memchr(payload, '\0', rec->size - sizeof(BinaryLogRecord)));
+            size_t len = stop ? stop - payload : rec->size - sizeof(BinaryLogRecord);
+            strings.emplace(rec->id, std::string(payload, len));
+        } else if (type == kRecordLine) {
+            lines.push_back(rec);
+        }
+        off += rec->size;
+    }
+
+    summary->realtime_offset_ns = log->realtime_offset_ns;
+    summary->dropped = log->dropped.load(std::memory_order_relaxed);
+    summary->lines = lines.size();
+
+    BinaryLogLine line;
+    for (const BinaryLogRecord* rec : lines) {
+        auto tag = strings.find(rec->tag_id);
+        auto fmt = strings.find(rec->id);
+        line.prio = rec->prio;
+        line.timestamp_ns = rec->timestamp_ns;
+        line.pid = rec->pid;
+        line.tid = rec->tid;
+        line.tag = tag != strings.end() ? tag->second : "?";
+        if (fmt == strings.end()) {
+            line.message = "<undefined format " + std::to_string(rec->id) + ">";
+        } else {
+            line.message = DecodeMessage(
+                    fmt->second, PayloadReader(reinterpret_cast<const uint8_t*>(rec + 1),
+                                               rec->size - sizeof(BinaryLogRecord)));
+        }
+        fn(line);
+    }
+
+    munmap(map, st.st_size);
+    return true;
+}
+
+}  // namespace init
+}  // namespace minimal_systems
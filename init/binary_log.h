@@ -0,0 +1,119 @@
+// binary_log.h — Compact binary log records for boot, and their offline decoder
+#ifndef MINIMAL_SYSTEMS_INIT_BINARY_LOG_H_
+#define MINIMAL_SYSTEMS_INIT_BINARY_LOG_H_
+
+#include <stdarg.h>
+#include <stdint.h>
+
+#include <atomic>
+#include <functional>
+#include <string>
+
+namespace minimal_systems {
+namespace init {
+
+/**
+ * On-disk layout of the binary log.
+ *
+ * The file is a fixed-size region mapped MAP_SHARED by every process that logs
+ * into it: first stage init, second stage init and ueventd append to the same
+ * file. Writers reserve space by bumping `tail`; once the region is full,
+ * further lines are counted in `dropped` and go to the text logger instead.
+ *
+ * Tags and format strings are written once per process as definition records
+ * and referenced by ID from line records. A line record carries the raw
+ * printf arguments; nothing is formatted until the file is decoded.
+ */
+constexpr uint32_t kBinaryLogMagic = 0x474c4249;  // "IBLG"
+constexpr uint32_t kBinaryLogVersion = 1;
+constexpr size_t kBinaryLogDefaultSize = 4 * 1024 * 1024;
+constexpr const char kBinaryLogDefaultPath[] = "/dev/init.binlog";
+
+// Environment variable naming the binary log, inherited across exec().
+constexpr const char kBinaryLogEnv[] = "INIT_BINARY_LOG";
+
+struct BinaryLogHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity;           // Size of the whole file, header included.
+    int64_t realtime_offset_ns;  // CLOCK_REALTIME - CLOCK_BOOTTIME at creation.
+    std::atomic<uint64_t> tail;  // Offset of the next free byte.
+    std::atomic<uint32_t> next_id;
+    std::atomic<uint32_t> dropped;
+};
+
+enum BinaryLogRecordType : uint8_t {
+    kRecordPending = 0,  // Reserved, still being written.
+    kRecordTag = 1,      // Defines tag `id`; payload is the tag text.
+    kRecordFormat = 2,   // Defines format string `id`; payload is its text.
+    kRecordLine = 3,     // One log line; payload is its encoded arguments.
+};
+
+struct BinaryLogRecord {
+    uint32_t size;                  // Whole record, 8-byte aligned.
+    std::atomic<uint8_t> type;      // Stored last; kRecordPending until complete.
+    uint8_t prio;
+    uint16_t reserved;
+    uint32_t id;                    // Defined ID, or the format ID of a line.
+    uint32_t tag_id;
+    int32_t pid;
+    int32_t tid;
+    uint64_t timestamp_ns;          // CLOCK_BOOTTIME.
+};
+
+static_assert(std::atomic<uint64_t>::is_always_lock_free &&
+                      std::atomic<uint32_t>::is_always_lock_free &&
+                      std::atomic<uint8_t>::is_always_lock_free,
+              "binary log atomics are shared between processes");
+static_assert(sizeof(BinaryLogRecord) == 32, "record header layout changed");
+
+/**
+ * Maps the binary log at `path`, creating it with `capacity` bytes if it
+ * does not exist yet. Safe to call from several processes at once.
+ */
+bool BinaryLogOpen(const char* path, size_t capacity = kBinaryLogDefaultSize);
+
+/**
+ * Stops writing binary records from this process, e.g. in a forked child
+ * whose intern tables may be mid-update. The mapping stays in place.
+ */
+void BinaryLogDetach();
+
+// True once BinaryLogOpen() has succeeded in this process.
+bool BinaryLogActive();
+
+/**
+ * Appends one line without formatting it. Returns false if the log is not
+ * open or full, in which case the caller should log the line as text.
+ */
+bool BinaryLogWrite(int prio, const char* tag, const char* fmt, va_list args);
+
+// One decoded line.
+struct BinaryLogLine {
+    int prio;
+    uint64_t timestamp_ns;  // CLOCK_BOOTTIME.
+    int32_t pid;
+    int32_t tid;
+    std::string tag;
+    std::string message;
+};
+
+struct BinaryLogSummary {
+    int64_t realtime_offset_ns = 0;
+    uint32_t dropped = 0;
+    size_t lines = 0;
+};
+
+/**
+ * Decodes the binary log at `path`, calling `fn` for each complete line in
+ * the order space was reserved. Records still pending are skipped. `summary`
+ * is filled in before the first call.
+ */
+bool BinaryLogDecode(const std::string& path,
+                     const std::function<void(const BinaryLogLine&)>& fn,
+                     BinaryLogSummary* summary, std::string* err);
+
+}  // namespace init
+}  // namespace minimal_systems
+
+#endif  // MINIMAL_SYSTEMS_INIT_BINARY_LOG_H_
@@ -1,14 +1,39 @@
-#include <chrono>
+/*
+ * Copyright (C) 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "boot_clock.h"
+
+#include <time.h>
+
+#include <ostream>
 
 namespace minimal_systems {
 namespace base {
 
-class boot_clock {
-  public:
-    using time_point = std::chrono::steady_clock::time_point;
+boot_clock::time_point boot_clock::now() {
+    timespec ts;
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+    return boot_clock::time_point(std::chrono::seconds(ts.tv_sec) +
+                                  std::chrono::nanoseconds(ts.tv_nsec));
+}
 
-    static time_point now() { return std::chrono::steady_clock::now(); }
-};
+std::ostream& operator<<(std::ostream& os, const Timer& t) {
+    os << t.duration().count() << "ms";
+    return os;
+}
 
 }  // namespace base
 }  // namespace minimal_systems
@@ -0,0 +1,209 @@
+// boot_trace.cpp — Boot-phase spans on CLOCK_BOOTTIME, exported as Chrome trace JSON
+
+#define LOG_TAG "boot_trace"
+
+#include "boot_trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+
+#include <init/log.h>
+#include "property_manager.h"
+
+namespace minimal_systems {
+namespace init {
+
+namespace {
+
+struct BootTraceEvent {
+    const char* category;
+    char name[64];
+    int32_t tid;
+    uint64_t begin_ns;
+    std::atomic<uint64_t> end_ns;  // 0 while the span is open.
+    std::atomic<bool> ready;       // Set once the fields above are written.
+};
+
+BootTraceEvent g_events[kBootTraceCapacity];
+std::atomic<uint32_t> g_next{0};
+std::atomic<uint32_t> g_dropped{0};
+
+thread_local int32_t t_tid = 0;
+
+int32_t CurrentTid() {
+    if (!t_tid) t_tid = static_cast<int32_t>(syscall(SYS_gettid));
+    return t_tid;
+}
+
+BootTraceId Claim(const char* category, std::string_view name, uint64_t begin_ns, int32_t tid) {
+    uint32_t slot = g_next.fetch_add(1, std::memory_order_relaxed);
+    if (slot >= kBootTraceCapacity) {
+        g_dropped.fetch_add(1, std::memory_order_relaxed);
+        return -1;
+    }
+    BootTraceEvent& event = g_events[slot];
+    size_t len = std::min(name.size(), sizeof(event.name) - 1);
+    memcpy(event.name, name.data(), len);
+    event.name[len] = '\0';
+    event.category = category;
+    event.tid = tid;
+    event.begin_ns = begin_ns;
+    event.end_ns.store(0, std::memory_order_relaxed);
+    event.ready.store(true, std::memory_order_release);
+    return static_cast<BootTraceId>(slot);
+}
+
+void AppendEscaped(std::string* out, const char* str) {
+    for (; *str; ++str) {
+        unsigned char c = static_cast<unsigned char>(*str);
+        if (c == '"' || c == '\\') {
+            *out += '\\';
+        } else if (c < 0x20) {
+            continue;
+        }
+        *out += static_cast<char>(c);
+    }
+}
+
+// Microseconds with nanosecond precision, the unit of "ts" and "dur".
+void AppendMicros(std::string* out, uint64_t ns) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%llu.%03u", static_cast<unsigned long long>(ns / 1000),
+             static_cast<unsigned>(ns % 1000));
+    *out += buf;
+}
+
+}  // namespace
+
+uint64_t BootTraceNowNs() {
+    timespec ts;
+    clock_gettime(CLOCK_BOOTTIME, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+BootTraceId BootTraceBegin(const char* category, std::string_view name) {
+    return Claim(category, name, BootTraceNowNs(), CurrentTid());
+}
+
+uint64_t BootTraceEnd(BootTraceId id) {
+    if (id < 0) return 0;
+    uint64_t now = BootTraceNowNs();
+    BootTraceEvent& event = g_events[id];
+    event.end_ns.store(now, std::memory_order_release);
+    return now - event.begin_ns;
+}
+
+void BootTraceAddSpan(const char* category, std::string_view name, uint64_t begin_ns,
+                      uint64_t end_ns, int32_t tid) {
+    BootTraceId id = Claim(category, name, begin_ns, tid);
+    if (id < 0) return;
+    g_events[id].end_ns.store(std::max(end_ns, begin_ns + 1), std::memory_order_release);
+}
+
+std::string BootTraceToJson() {
+    uint32_t count =
+            std::min<uint32_t>(g_next.load(std::memory_order_relaxed), kBootTraceCapacity);
+    int pid = static_cast<int>(getpid());
+
+    std::string json;
+    json.reserve(128 + count * 128);
+    json += "{\"traceEvents\":[\n";
+    char buf[128];
+    snprintf(buf, sizeof(buf),
+             "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+             "\"args\":{\"name\":\"init\"}}",
+             pid);
+    json += buf;
+
+    for (uint32_t i = 0; i < count; ++i) {
+        const BootTraceEvent& event = g_events[i];
+        if (!event.ready.load(std::memory_order_acquire)) continue;
+        uint64_t end_ns = event.end_ns.load(std::memory_order_acquire);
+
+        json += ",\n{\"name\":\"";
+        AppendEscaped(&json, event.name);
+        json += "\",\"cat\":\"";
+        json += event.category;
+        json += end_ns ? "\",\"ph\":\"X\",\"ts\":" : "\",\"ph\":\"B\",\"ts\":";
+        AppendMicros(&json, event.begin_ns);
+        if (end_ns) {
+            json += ",\"dur\":";
+            AppendMicros(&json, end_ns - event.begin_ns);
+        }
+        snprintf(buf, sizeof(buf), ",\"pid\":%d,\"tid\":%d}", pid, static_cast<int>(event.tid));
+        json += buf;
+    }
+
+    snprintf(buf, sizeof(buf),
+             "\n],\"displayTimeUnit\":\"ms\",\"otherData\":{\"clock\":\"boottime\","
+             "\"dropped\":%u}}\n",
+             g_dropped.load(std::memory_order_relaxed));
+    json += buf;
+    return json;
+}
+
+bool BootTraceWrite(const std::string& path) {
+    std::string json = BootTraceToJson();
+    int fd = TEMP_FAILURE_RETRY(
+            open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW, 0644));
+    if (fd < 0) {
+        LOGE("Could not open boot trace %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    bool ok = true;
+    for (size_t off = 0; off < json.size();) {
+        ssize_t n = TEMP_FAILURE_RETRY(write(fd, json.data() + off, json.size() - off));
+        if (n <= 0) {
+            ok = false;
+            break;
+        }
+        off += static_cast<size_t>(n);
+    }
+    close(fd);
+    if (!ok) {
+        LOGE("Failed to write boot trace %s", path.c_str());
+        return false;
+    }
+    LOGI("Wrote boot trace to %s", path.c_str());
+    return true;
+}
+
+void BootTraceCheckDump() {
+    static uint64_t seen_generation = 0;
+    static bool dumped_at_completion = false;
+
+    auto& props = PropertyManager::instance();
+    uint64_t generation = props.generation();
+    if (generation == seen_generation) return;
+    seen_generation = generation;
+
+    bool write = false;
+    if (!dumped_at_completion && props.get("sys.boot_completed") == "1") {
+        dumped_at_completion = true;
+        write = true;
+    }
+    if (props.get(kBootTraceDumpProperty) == "1") {
+        props.set(kBootTraceDumpProperty, "0");
+        write = true;
+    }
+    if (write) BootTraceWrite(kBootTraceDefaultPath);
+}
+
+ScopedBootPhase::~ScopedBootPhase() {
+    uint64_t ns = BootTraceEnd(id_);
+    if (id_ < 0) return;
+    std::string key = "ro.boottime.";
+    key += name_;
+    PropertyManager::instance().set(key, std::to_string(ns / 1000000));
+}
+
+}  // namespace init
+}  // namespace minimal_systems
@@ -0,0 +1,104 @@
+// boot_trace.h — Boot-phase spans on CLOCK_BOOTTIME, exported as Chrome trace JSON
+#ifndef MINIMAL_SYSTEMS_INIT_BOOT_TRACE_H_
+#define MINIMAL_SYSTEMS_INIT_BOOT_TRACE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <string_view>
+
+namespace minimal_systems {
+namespace init {
+
+/**
+ * Boot tracing.
+ *
+ * Spans are kept in a fixed, preallocated table: beginning one claims a slot
+ * with a single atomic increment and copies its name, ending one stores a
+ * timestamp. Nothing allocates or takes a lock, so spans can wrap hot paths on
+ * any thread. Once the table is full, further spans are counted and dropped.
+ *
+ * The table is written out as Chrome trace JSON, which chrome://tracing,
+ * Perfetto UI and catapult all load, when sys.boot_completed is set and
+ * whenever init.boottrace.dump is set to 1.
+ */
+constexpr size_t kBootTraceCapacity = 4096;
+constexpr const char kBootTraceDefaultPath[] = "/dev/.boottrace.json";
+constexpr const char kBootTraceDumpProperty[] = "init.boottrace.dump";
+
+// Span categories.
+constexpr const char kTracePhase[] = "phase";
+constexpr const char kTraceMount[] = "mount";
+constexpr const char kTraceModule[] = "module";
+constexpr const char kTraceParse[] = "parse";
+constexpr const char kTraceTrigger[] = "trigger";
+constexpr const char kTraceService[] = "service";
+
+// Slot of an open span; negative if it was dropped.
+using BootTraceId = int32_t;
+
+// CLOCK_BOOTTIME in nanoseconds.
+uint64_t BootTraceNowNs();
+
+/**
+ * Opens a span named `name` in `category`, which must be a string literal.
+ * Names longer than the slot are truncated.
+ */
+BootTraceId BootTraceBegin(const char* category, std::string_view name);
+
+// Closes a span and returns its duration in nanoseconds, or 0 if it was dropped.
+uint64_t BootTraceEnd(BootTraceId id);
+
+// Records a span timed elsewhere, e.g. from a load report.
+void BootTraceAddSpan(const char* category, std::string_view name, uint64_t begin_ns,
+                      uint64_t end_ns, int32_t tid);
+
+// Every recorded span as Chrome trace JSON. Open spans are written as begin events.
+std::string BootTraceToJson();
+
+// Writes BootTraceToJson() to `path`.
+bool BootTraceWrite(const std::string& path);
+
+/**
+ * Dumps the trace to kBootTraceDefaultPath if the properties ask for it.
+ * Cheap to call from the main loop; properties are only re-read after a change.
+ */
+void BootTraceCheckDump();
+
+/** Records a span for the lifetime of the object. */
+class ScopedBootTrace {
+  public:
+    ScopedBootTrace(const char* category, std::string_view name)
+        : id_(BootTraceBegin(category, name)) {}
+    ~ScopedBootTrace() { BootTraceEnd(id_); }
+
+    ScopedBootTrace(const ScopedBootTrace&) = delete;
+    ScopedBootTrace& operator=(const ScopedBootTrace&) = delete;
+
+  private:
+    BootTraceId id_;
+};
+
+/**
+ * A span in the "phase" category whose duration is also published, in
+ * milliseconds, as ro.boottime.<name>. `name` must be a string literal.
+ */
+class ScopedBootPhase {
+  public:
+    explicit ScopedBootPhase(std::string_view name)
+        : name_(name), id_(BootTraceBegin(kTracePhase, name)) {}
+    ~ScopedBootPhase();
+
+    ScopedBootPhase(const ScopedBootPhase&) = delete;
+    ScopedBootPhase& operator=(const ScopedBootPhase&) = delete;
+
+  private:
+    std::string_view name_;
+    BootTraceId id_;
+};
+
+}  // namespace init
+}  // namespace minimal_systems
+
+#endif  // MINIMAL_SYSTEMS_INIT_BOOT_TRACE_H_
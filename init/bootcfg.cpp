@@ -1,7 +1,7 @@
 #define LOG_TAG "bootcfg"
 
 #include "bootcfg.h"
-#include "log_new.h"
+#include <init/log.h>
 
 #include <fstream>
 #include <sstream>
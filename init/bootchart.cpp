@@ -0,0 +1,372 @@
+// bootchart.cpp — Samples /proc during boot and archives it in bootchart format
+
+#define LOG_TAG "bootchart"
+
+#include "bootchart.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/utsname.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#ifdef INIT_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#include <init/log.h>
+#include "boot_trace.h"
+#include "libbase.h"
+#include "property_manager.h"
+
+namespace minimal_systems {
+namespace init {
+
+namespace {
+
+struct Sample {
+    uint64_t jiffies;  // Centiseconds since boot, bootchart's time unit.
+    std::string stat;
+    std::string diskstats;
+    std::string ps;
+
+    size_t bytes() const { return stat.size() + diskstats.size() + ps.size(); }
+};
+
+// Appends the whole of a /proc file, re-read from offset 0.
+bool PreadAll(int fd, std::string* out) {
+    char buf[4096];
+    off_t off = 0;
+    while (true) {
+        ssize_t n = TEMP_FAILURE_RETRY(pread(fd, buf, sizeof(buf), off));
+        if (n < 0) return false;
+        if (n == 0) return off > 0;
+        out->append(buf, n);
+        off += n;
+    }
+}
+
+class Sampler {
+  public:
+    explicit Sampler(std::chrono::milliseconds interval) : interval_(interval) {}
+    ~Sampler();
+
+    bool Start();
+    bool Stop(const std::string& path);
+
+  private:
+    void Loop();
+    void TakeSample(Sample* sample);
+    void ReadProcesses(std::string* out);
+    std::string Archive();
+
+    std::chrono::milliseconds interval_;
+    std::mutex lock_;
+    std::condition_variable cv_;
+    bool stopping_ = false;
+    std::thread thread_;
+
+    // Owned by the sampler thread until it is joined.
+    int stat_fd_ = -1;
+    int diskstats_fd_ = -1;
+    DIR* proc_dir_ = nullptr;
+    std::unordered_map<pid_t, int> pid_fds_;
+    std::deque<Sample> ring_;
+    size_t ring_bytes_ = 0;
+    uint64_t dropped_ = 0;
+};
+
+Sampler::~Sampler() {
+    if (stat_fd_ >= 0) close(stat_fd_);
+    if (diskstats_fd_ >= 0) close(diskstats_fd_);
+    if (proc_dir_) closedir(proc_dir_);
+    for (const auto& [pid, fd] : pid_fds_) close(fd);
+}
+
+bool Sampler::Start() {
+    stat_fd_ = open("/proc/stat", O_RDONLY | O_CLOEXEC);
+    diskstats_fd_ = open("/proc/diskstats", O_RDONLY | O_CLOEXEC);
+    proc_dir_ = opendir("/proc");
+    if (stat_fd_ < 0 || !proc_dir_) {
+        LOGE("Could not open /proc for bootchart: %s", strerror(errno));
+        return false;
+    }
+    thread_ = std::thread(&Sampler::Loop, this);
+    pthread_setname_np(thread_.native_handle(), "bootchart");
+    return true;
+}
+
+void Sampler::Loop() {
+    std::unique_lock<std::mutex> lock(lock_);
+    while (!stopping_) {
+        lock.unlock();
+
+        // Reuse the buffers of the oldest sample once the ring is full.
+        Sample sample;
+        if (ring_bytes_ > kBootchartMaxBytes && !ring_.empty()) {
+            sample = std::move(ring_.front());
+            ring_.pop_front();
+            ring_bytes_ -= sample.bytes();
+            sample.stat.clear();
+            sample.diskstats.clear();
+            sample.ps.clear();
+            dropped_++;
+        }
+        TakeSample(&sample);
+        ring_bytes_ += sample.bytes();
+        ring_.push_back(std::move(sample));
+
+        lock.lock();
+        cv_.wait_for(lock, interval_, [this] { return stopping_; });
+    }
+}
+
+void Sampler::TakeSample(Sample* sample) {
+    sample->jiffies = BootTraceNowNs() / 10000000;
+    PreadAll(stat_fd_, &sample->stat);
+    if (diskstats_fd_ >= 0) PreadAll(diskstats_fd_, &sample->diskstats);
+    ReadProcesses(&sample->ps);
+}
+
+// Concatenates /proc/<pid>/stat for every process, keeping each file open.
+void Sampler::ReadProcesses(std::string* out) {
+    std::unordered_map<pid_t, int> live;
+    live.reserve(pid_fds_.size());
+
+    rewinddir(proc_dir_);
+    while (dirent* entry = readdir(proc_dir_)) {
+        char* end;
+        long pid = strtol(entry->d_name, &end, 10);
+        if (*end || pid <= 0) continue;
+
+        int fd;
+        auto it = pid_fds_.find(pid);
+        if (it != pid_fds_.end()) {
+            fd = it->second;
+            pid_fds_.erase(it);
+        } else {
+            char path[32];
+            snprintf(path, sizeof(path), "%ld/stat", pid);
+            fd = openat(dirfd(proc_dir_), path, O_RDONLY | O_CLOEXEC);
+            if (fd < 0) continue;
+        }
+        // A read fails once the process is gone; a new process reusing the
+        // pid is picked up on the next pass.
+        if (!PreadAll(fd, out)) {
+            close(fd);
+            continue;
+        }
+        live.emplace(pid, fd);
+    }
+
+    // Whatever is left exited since the last sample.
+    for (const auto& [pid, fd] : pid_fds_) close(fd);
+    pid_fds_.swap(live);
+}
+
+void AppendTarEntry(std::string* tar, const char* name, const std::string& data) {
+    char header[512] = {};
+    snprintf(header, 100, "%s", name);
+    snprintf(header + 100, 8, "%07o", 0644);
+    snprintf(header + 108, 8, "%07o", 0);
+    snprintf(header + 116, 8, "%07o", 0);
+    snprintf(header + 124, 12, "%011llo", static_cast<unsigned long long>(data.size()));
+    snprintf(header + 136, 12, "%011llo", static_cast<unsigned long long>(time(nullptr)));
+    header[156] = '0';
+    memcpy(header + 257, "ustar", 6);
+    memcpy(header + 263, "00", 2);
+
+    // The checksum is computed with its own field read as spaces.
+    memset(header + 148, ' ', 8);
+    unsigned sum = 0;
+    for (unsigned char c : header) sum += c;
+    snprintf(header + 148, 8, "%06o", sum);
+
+    tar->append(header, sizeof(header));
+    tar->append(data);
+    tar->append((512 - data.size() % 512) % 512, '\0');
+}
+
+std::string MakeHeader() {
+    std::string header = "version = minimal_systems init 1.0\n";
+
+    struct utsname uts;
+    if (uname(&uts) == 0) {
+        header += "title = Boot chart for ";
+        header += uts.nodename;
+        header += "\nsystem.uname = ";
+        header += std::string(uts.sysname) + " " + uts.release + " " + uts.version + " " +
+                  uts.machine;
+        header += "\n";
+    }
+
+    header += "system.release = " + PropertyManager::instance().get("ro.build.id") + "\n";
+
+    std::string cpuinfo;
+    if (base::ReadFileToString("/proc/cpuinfo", &cpuinfo)) {
+        size_t pos = cpuinfo.find("model name");
+        if (pos == std::string::npos) pos = cpuinfo.find("Hardware");
+        if (pos != std::string::npos) {
+            size_t colon = cpuinfo.find(':', pos);
+            size_t eol = cpuinfo.find('\n', pos);
+            if (colon != std::string::npos && colon < eol) {
+                size_t start = std::min(cpuinfo.find_first_not_of(" \t", colon + 1), eol);
+                header += "system.cpu = " + cpuinfo.substr(start, eol - start) + "\n";
+            }
+        }
+    }
+
+    std::string cmdline;
+    if (base::ReadFileToString("/proc/cmdline", &cmdline)) {
+        while (!cmdline.empty() && (cmdline.back() == '\n' || cmdline.back() == '\0')) {
+            cmdline.pop_back();
+        }
+        header += "system.kernel.options = " + cmdline + "\n";
+    }
+    return header;
+}
+
+// Every sample as "<jiffies>\n<file contents>\n", oldest first.
+std::string JoinLog(const std::deque<Sample>& ring, std::string Sample::*field) {
+    size_t size = 0;
+    for (const auto& sample : ring) size += (sample.*field).size() + 24;
+    std::string log;
+    log.reserve(size);
+    for (const auto& sample : ring) {
+        log += std::to_string(sample.jiffies);
+        log += '\n';
+        log += sample.*field;
+        log += '\n';
+    }
+    return log;
+}
+
+std::string Sampler::Archive() {
+    std::string tar;
+    AppendTarEntry(&tar, "header", MakeHeader());
+    AppendTarEntry(&tar, "proc_stat.log", JoinLog(ring_, &Sample::stat));
+    AppendTarEntry(&tar, "proc_diskstats.log", JoinLog(ring_, &Sample::diskstats));
+    AppendTarEntry(&tar, "proc_ps.log", JoinLog(ring_, &Sample::ps));
+    AppendTarEntry(&tar, "boottrace.json", BootTraceToJson());
+    tar.append(1024, '\0');
+    return tar;
+}
+
+#ifdef INIT_HAVE_ZLIB
+bool Gzip(const std::string& in, std::string* out) {
+    z_stream strm = {};
+    // 16 + MAX_WBITS selects the gzip wrapper.
+    if (deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 16 + MAX_WBITS, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        return false;
+    }
+    out->resize(deflateBound(&strm, in.size()));
+    strm.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+    strm.avail_in = in.size();
+    strm.next_out = reinterpret_cast<Bytef*>(out->data());
+    strm.avail_out = out->size();
+    int ret = deflate(&strm, Z_FINISH);
+    out->resize(strm.total_out);
+    deflateEnd(&strm);
+    return ret == Z_STREAM_END;
+}
+#endif
+
+bool WriteArchive(const std::string& path, const std::string& data) {
+    int fd = TEMP_FAILURE_RETRY(
+            open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW, 0644));
+    if (fd < 0) {
+        LOGE("Could not open bootchart archive %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    bool ok = true;
+    for (size_t off = 0; off < data.size();) {
+        ssize_t n = TEMP_FAILURE_RETRY(write(fd, data.data() + off, data.size() - off));
+        if (n <= 0) {
+            ok = false;
+            break;
+        }
+        off += static_cast<size_t>(n);
+    }
+    close(fd);
+    if (!ok) LOGE("Failed to write bootchart archive %s", path.c_str());
+    return ok;
+}
+
+bool Sampler::Stop(const std::string& path) {
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        stopping_ = true;
+    }
+    cv_.notify_all();
+    thread_.join();
+
+    std::string archive = Archive();
+#ifdef INIT_HAVE_ZLIB
+    std::string compressed;
+    if (!Gzip(archive, &compressed)) {
+        LOGE("Failed to compress bootchart archive");
+        return false;
+    }
+    archive.swap(compressed);
+#endif
+    if (!WriteArchive(path, archive)) return false;
+    LOGI("Wrote %zu bootchart samples to %s (%llu dropped)", ring_.size(), path.c_str(),
+         static_cast<unsigned long long>(dropped_));
+    return true;
+}
+
+std::mutex g_lock;
+std::unique_ptr<Sampler> g_sampler;
+bool g_started = false;
+
+}  // namespace
+
+bool BootchartStart(std::chrono::milliseconds interval) {
+    std::lock_guard<std::mutex> lock(g_lock);
+    if (g_started) return g_sampler != nullptr;
+    g_started = true;
+
+    auto sampler = std::make_unique<Sampler>(interval);
+    if (!sampler->Start()) return false;
+    g_sampler = std::move(sampler);
+    LOGI("Bootchart sampling every %lld ms", static_cast<long long>(interval.count()));
+    return true;
+}
+
+bool BootchartStop(const std::string& path) {
+    std::unique_ptr<Sampler> sampler;
+    {
+        std::lock_guard<std::mutex> lock(g_lock);
+        sampler = std::move(g_sampler);
+    }
+    if (!sampler) return false;
+    return sampler->Stop(path);
+}
+
+void BootchartCheckStop() {
+    static uint64_t seen_generation = 0;
+
+    auto& props = PropertyManager::instance();
+    uint64_t generation = props.generation();
+    if (generation == seen_generation) return;
+    seen_generation = generation;
+
+    if (props.get("sys.boot_completed") == "1") BootchartStop();
+}
+
+}  // namespace init
+}  // namespace minimal_systems
@@ -0,0 +1,48 @@
+// bootchart.h — Samples /proc during boot and archives it in bootchart format
+#ifndef MINIMAL_SYSTEMS_INIT_BOOTCHART_H_
+#define MINIMAL_SYSTEMS_INIT_BOOTCHART_H_
+
+#include <stddef.h>
+
+#include <chrono>
+#include <string>
+
+namespace minimal_systems {
+namespace init {
+
+/**
+ * Bootchart mode.
+ *
+ * Enabled with sysboot.bootchart=1. A sampler thread reads /proc/stat,
+ * /proc/diskstats and every /proc/<pid>/stat at a fixed interval into an
+ * in-memory ring that drops the oldest samples past kBootchartMaxBytes; the
+ * files stay open and are re-read with pread(). When sys.boot_completed is
+ * set, sampling stops and the ring is written as a gzip-compressed tar
+ * holding header, proc_stat.log, proc_diskstats.log and proc_ps.log, the
+ * layout pybootchartgui reads, plus boottrace.json with init's own phase
+ * spans.
+ */
+constexpr std::chrono::milliseconds kBootchartInterval{200};
+constexpr size_t kBootchartMaxBytes = 16 * 1024 * 1024;
+#ifdef INIT_HAVE_ZLIB
+constexpr const char kBootchartArchive[] = "/dev/.bootchart.tgz";
+#else
+constexpr const char kBootchartArchive[] = "/dev/.bootchart.tar";
+#endif
+
+/** Starts the sampler thread. Only the first call has an effect. */
+bool BootchartStart(std::chrono::milliseconds interval = kBootchartInterval);
+
+/** Stops the sampler and writes the archive to `path`; false if it was not running. */
+bool BootchartStop(const std::string& path = kBootchartArchive);
+
+/**
+ * Stops the sampler once sys.boot_completed is set. Cheap to call from the
+ * main loop; properties are only re-read after a change.
+ */
+void BootchartCheckStop();
+
+}  // namespace init
+}  // namespace minimal_systems
+
+#endif  // MINIMAL_SYSTEMS_INIT_BOOTCHART_H_
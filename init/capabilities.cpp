@@ -20,7 +20,7 @@
 #include <map>
 #include <memory>
 #include <string>
-#include "log_new.h"
+#include <init/log.h>
 namespace minimal_systems {
 namespace init {
 
@@ -0,0 +1,147 @@
+// firmware_handler.cpp — Streams firmware blobs into the kernel's sysfs loading interface
+
+#define LOG_TAG "ueventd"
+
+#include "firmware_handler.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstring>
+
+#include <init/log.h>
+
+namespace minimal_systems {
+namespace init {
+
+/**
+ * Copies `size` bytes from in_fd to out_fd.
+ *
+ * sendfile() lets the kernel move the pages straight from the page cache into
+ * the firmware buffer. Older kernels and some sysfs attributes reject it, in
+ * which case we fall back to a plain read/write loop.
+ */
+static bool CopyFirmware(int in_fd, int out_fd, size_t size) {
+    size_t remaining = size;
+    while (remaining > 0) {
+        ssize_t n = sendfile(out_fd, in_fd, nullptr, remaining);
+        if (n > 0) {
+            remaining -= static_cast<size_t>(n);
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EINVAL || errno == ENOSYS) && remaining == size) {
+            break;
+        }
+        LOGE("sendfile() of firmware failed: %s", strerror(errno));
+        return false;
+    }
+    if (remaining == 0) return true;
+
+    char buf[64 * 1024];
+    while (remaining > 0) {
+        ssize_t nr = TEMP_FAILURE_RETRY(read(in_fd, buf, sizeof(buf)));
+        if (nr <= 0) {
+            LOGE("Short read of firmware: %s", nr < 0 ? strerror(errno) : "EOF");
+            return false;
+        }
+        for (ssize_t off = 0; off < nr;) {
+            ssize_t nw = TEMP_FAILURE_RETRY(write(out_fd, buf + off, nr - off));
+            if (nw <= 0) {
+                LOGE("Write of firmware data failed: %s", strerror(errno));
+                return false;
+            }
+            off += nw;
+        }
+        remaining -= static_cast<size_t>(nr);
+    }
+    return true;
+}
+
+static void WriteLoading(int loading_fd, const char* value) {
+    if (TEMP_FAILURE_RETRY(write(loading_fd, value, strlen(value))) < 0) {
+        LOGE("Failed to write '%s' to firmware loading file: %s", value, strerror(errno));
+    }
+}
+
+FirmwareHandler::FirmwareHandler(std::vector<std::string> firmware_directories,
+                                 size_t num_workers)
+    : firmware_directories_(std::move(firmware_directories)), pool_(num_workers, "firmware") {}
+
+void FirmwareHandler::HandleUevent(const Uevent& uevent) {
+    if (uevent.subsystem != "firmware" || uevent.action != "add") return;
+    if (uevent.firmware.empty()) return;
+
+    std::string devpath = uevent.path;
+    std::string firmware = uevent.firmware;
+    pool_.Enqueue([this, devpath, firmware] { ProcessFirmwareEvent(devpath, firmware); });
+}
+
+void FirmwareHandler::ProcessFirmwareEvent(const std::string& devpath,
+                                           const std::string& firmware) {
+    auto start = std::chrono::steady_clock::now();
+
+    std::string root = "/sys" + devpath;
+    std::string loading = root + "/loading";
+    std::string data = root + "/data";
+
+    int loading_fd = open(loading.c_str(), O_WRONLY | O_CLOEXEC);
+    if (loading_fd < 0) {
+        LOGE("Couldn't open firmware loading fd for %s: %s", firmware.c_str(), strerror(errno));
+        return;
+    }
+
+    int data_fd = open(data.c_str(), O_WRONLY | O_CLOEXEC);
+    if (data_fd < 0) {
+        LOGE("Couldn't open firmware data fd for %s: %s", firmware.c_str(), strerror(errno));
+        close(loading_fd);
+        return;
+    }
+
+    bool loaded = false;
+    for (const auto& dir : firmware_directories_) {
+        std::string file = dir;
+        if (!file.empty() && file.back() != '/') file += '/';
+        file += firmware;
+
+        int fw_fd = open(file.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fw_fd < 0) continue;
+
+        struct stat sb{};
+        if (fstat(fw_fd, &sb) != 0 || !S_ISREG(sb.st_mode)) {
+            LOGE("Firmware %s is not a regular file", file.c_str());
+            close(fw_fd);
+            continue;
+        }
+
+        WriteLoading(loading_fd, "1");
+        if (CopyFirmware(fw_fd, data_fd, static_cast<size_t>(sb.st_size))) {
+            WriteLoading(loading_fd, "0");
+            loaded = true;
+            auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::steady_clock::now() - start);
+            LOGI("Loaded firmware %s from %s (%lld bytes, %lld ms)", firmware.c_str(),
+                 dir.c_str(), static_cast<long long>(sb.st_size),
+                 static_cast<long long>(ms.count()));
+        }
+        close(fw_fd);
+        // A partial write leaves the kernel buffer in an undefined state, so a
+        // failed copy is not retried from the next directory; it is aborted below.
+        break;
+    }
+
+    if (!loaded) {
+        LOGE("Firmware %s not found or failed to load", firmware.c_str());
+        WriteLoading(loading_fd, "-1");
+    }
+
+    close(data_fd);
+    close(loading_fd);
+}
+
+}  // namespace init
+}  // namespace minimal_systems
@@ -0,0 +1,44 @@
+// firmware_handler.h — Serves SUBSYSTEM=firmware uevents (request_firmware user-mode fallback)
+
+#ifndef MINIMAL_SYSTEMS_INIT_FIRMWARE_HANDLER_H_
+#define MINIMAL_SYSTEMS_INIT_FIRMWARE_HANDLER_H_
+
+#include <string>
+#include <vector>
+
+#include "thread_pool.h"
+#include "uevent.h"
+
+namespace minimal_systems {
+namespace init {
+
+class FirmwareHandler {
+  public:
+    /**
+     * @param firmware_directories Directories searched in order for the requested blob.
+     * @param num_workers Number of loads that may be in flight at once.
+     */
+    FirmwareHandler(std::vector<std::string> firmware_directories, size_t num_workers);
+
+    /**
+     * Queues a firmware load if the uevent is a firmware "add" request.
+     *
+     * Returns immediately; the blob is streamed to sysfs on a worker so a slow
+     * storage read never blocks the uevent dispatch loop.
+     */
+    void HandleUevent(const Uevent& uevent);
+
+    /** Blocks until every queued load has been answered. */
+    void Wait() { pool_.Wait(); }
+
+  private:
+    void ProcessFirmwareEvent(const std::string& devpath, const std::string& firmware);
+
+    std::vector<std::string> firmware_directories_;
+    ThreadPool pool_;
+};
+
+}  // namespace init
+}  // namespace minimal_systems
+
+#endif  // MINIMAL_SYSTEMS_INIT_FIRMWARE_HANDLER_H_
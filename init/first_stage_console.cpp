@@ -30,7 +30,7 @@
 #include <thread>
 #include <chrono>
 #include <iostream>
-#include "log_new.h"
+#include <init/log.h>
 #include "bootcfg.h"
 
 namespace {
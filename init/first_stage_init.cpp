@@ -32,14 +32,19 @@
 #include <string>
 #include <vector>
 
-#include "modprobe.h"
+#include <modprobe/modprobe.h>
 
 #include <bits/std_thread.h>
+#include "binary_log.h"
+#include "boot_trace.h"
+#include "bootchart.h"
 #include "first_stage_mount.h"
 #include "first_stage_console.h"
 #include "fs_mgr.h"
 #include "libbase.h"
-#include "log_new.h"
+#include <init/log.h>
+#include "logger_write.h"
+#include "module_loader.h"
 #include "property_manager.h"
 #include "reboot_utils.h"
 #include "util.h"
@@ -184,6 +189,20 @@ constexpr std::string_view GetPageSizeSuffix(std::string_view dirname) {
     return "";
 }
 
+// Adds each module load from the Modprobe load stats to the boot trace.
+void TraceModuleLoads(Modprobe& m) {
+    // The stats are taken on CLOCK_MONOTONIC; shift them onto CLOCK_BOOTTIME.
+    timespec mono;
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    int64_t offset = static_cast<int64_t>(BootTraceNowNs()) -
+                     (static_cast<int64_t>(mono.tv_sec) * 1000000000 + mono.tv_nsec);
+    for (const auto& stats : m.GetLoadStats()) {
+        uint64_t begin = stats.start_ns + offset;
+        BootTraceAddSpan(kTraceModule, stats.name, begin, begin + stats.open_ns + stats.finit_ns,
+                         stats.tid);
+    }
+}
+
 }  // namespace
 
 std::string GetModuleLoadList(BootMode boot_mode, const std::string& dir_path) {
@@ -214,6 +233,9 @@ std::string GetModuleLoadList(BootMode boot_mode, const std::string& dir_path) {
 
 #define MODULE_BASE_DIR "./lib/modules"
 
+// Per-module timings and critical path of the first-stage module load.
+static constexpr const char* kModuleLoadReport = "/dev/.module_load_report.json";
+
 bool LoadKernelModules(BootMode boot_mode, bool want_console, bool want_parallel,
                        int& modules_loaded) {
     struct utsname uts{};
@@ -275,8 +297,11 @@ bool LoadKernelModules(BootMode boot_mode, bool want_console, bool want_parallel
         std::string dir_path = MODULE_BASE_DIR "/";
         dir_path.append(module_dir);
         Modprobe m({dir_path}, GetModuleLoadList(boot_mode, dir_path));
+        ScopedModuleLoaderAttach attach(&m);
         bool retval = m.LoadListedModules(!want_console);
         modules_loaded = m.GetModuleCount();
+        m.WriteLoadReport(kModuleLoadReport);
+        TraceModuleLoads(m);
         if (modules_loaded > 0) {
             LOGI("Loaded %d modules from %s", modules_loaded, dir_path);
             return retval;
@@ -284,11 +309,14 @@ bool LoadKernelModules(BootMode boot_mode, bool want_console, bool want_parallel
     }
 
     Modprobe m({MODULE_BASE_DIR}, GetModuleLoadList(boot_mode, MODULE_BASE_DIR));
+    ScopedModuleLoaderAttach attach(&m);
     unsigned int hw_threads = std::thread::hardware_concurrency();
     int thread_count = static_cast<int>(hw_threads);
     bool retval = (want_parallel) ? m.LoadModulesParallel(thread_count)
                                   : m.LoadListedModules(!want_console);
     modules_loaded = m.GetModuleCount();
+    m.WriteLoadReport(kModuleLoadReport);
+    TraceModuleLoads(m);
     if (modules_loaded > 0) {
         LOGI("Loaded %d modules from %s", modules_loaded, MODULE_BASE_DIR);
         return retval;
@@ -360,7 +388,7 @@ static std::unique_ptr<FirstStageMount> CreateFirstStageMount(const std::string&
 */
 
 int FirstStageMain(int argc, char** argv) {
-    int dummy_count = 0;
+    ScopedBootPhase phase("init.first_stage");
     LOGD("Compiled on %s at %s\n", __DATE__, __TIME__);
 
     if (REBOOT_BOOTLOADER_ON_PANIC) {
@@ -376,6 +404,7 @@ int FirstStageMain(int argc, char** argv) {
         }                       \
     } while (0)
 
+    BootTraceId step = BootTraceBegin(kTracePhase, "early_mounts");
     umask(0);
     CHECKCALL(clearenv());
     CHECKCALL(setenv("PATH", _PATH_DEFPATH, 1));
@@ -432,10 +461,13 @@ int FirstStageMain(int argc, char** argv) {
     CHECKCALL(mount("efivarfs", "/sys/firmware/efi/efivars", "efivarfs", 0, NULL));
 
 #undef CHECKCALL
+    BootTraceEnd(step);
 
+    step = BootTraceBegin(kTracePhase, "kernel_logging");
     SetStdioToDevNull(argv);
 
     InitKernelLogging(argv);
+    BootTraceEnd(step);
 
     if (!errors.empty()) {
         for (const auto& [error_string, error_errno] : errors) {
@@ -457,6 +489,20 @@ int FirstStageMain(int argc, char** argv) {
 
     }
 
+    // Keep formatting out of boot: later stages inherit this through the environment
+    if (minimal_systems::bootcfg::IsEnabled("sysboot.init_binlog")) {
+        if (__linux_log_open_binary(minimal_systems::init::kBinaryLogDefaultPath) == 0) {
+            LOGI("Logging to %s", minimal_systems::init::kBinaryLogDefaultPath);
+        } else {
+            LOGW("Failed to open binary log %s: %s", minimal_systems::init::kBinaryLogDefaultPath,
+                 strerror(errno));
+        }
+    }
+
+    if (minimal_systems::bootcfg::IsEnabled("sysboot.bootchart")) {
+        BootchartStart();
+    }
+
     auto dir_deleter = [](DIR* d) {
         if (d) closedir(d);
     };
@@ -474,6 +520,7 @@ int FirstStageMain(int argc, char** argv) {
         old_root_dir.reset();
     }
 
+    step = BootTraceBegin(kTracePhase, "console");
     int want_console = 0;
     if (ALLOW_FIRST_STAGE_CONSOLE) {
         want_console = minimal_systems::init::FirstStageConsole(
@@ -485,7 +532,9 @@ int FirstStageMain(int argc, char** argv) {
     if (want_console) {
         minimal_systems::init::StartConsole(minimal_systems::bootcfg::Get(""));
     }
+    BootTraceEnd(step);
 
+    step = BootTraceBegin(kTracePhase, "device_setup");
     GetBootMode(cmdline, GetProperty("ro.bootmode"));
 
     GetPageSizeSuffix();
@@ -495,16 +544,32 @@ int FirstStageMain(int argc, char** argv) {
     DetectAndSetGPUType();
     FreeRamdisk();
     PrepareSwitchRoot();
+    BootTraceEnd(step);
 
-    LoadKernelModules(BootMode::NORMAL_MODE, false, false, dummy_count);  // dry-run
+    // Modules load in the background; each fstab entry waits only for the
+    // drivers it needs (see ModuleLoader::WaitForModule).
+    ModuleLoader::instance().Start([] {
+        ScopedBootTrace trace(kTracePhase, "load_modules");
+        int modules_loaded = 0;
+        return LoadKernelModules(BootMode::NORMAL_MODE, false, false, modules_loaded);
+    });
 
     // Perform first-stage mounting
-    if (!PerformFirstStageMount()) {
+    step = BootTraceBegin(kTracePhase, "first_stage_mount");
+    bool mounted = PerformFirstStageMount();
+    BootTraceEnd(step);
+    if (!mounted) {
         LOGE("FirstStageMount failed. Exiting...");
         return EXIT_FAILURE;
     }
     LOGI("First stage mount completed.");
 
+    step = BootTraceBegin(kTracePhase, "wait_for_modules");
+    if (!ModuleLoader::instance().WaitForAll()) {
+        LOGE("Some kernel modules failed to load");
+    }
+    BootTraceEnd(step);
+
     return 0;
 }
 
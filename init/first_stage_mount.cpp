@@ -4,17 +4,22 @@
 
 #include "first_stage_mount.h"
 
-#include <sys/stat.h>
 #include <algorithm>
+#include <atomic>
+#include <cstring>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <mutex>
 #include <sstream>
 #include <string>
 #include <vector>
 
 #include "fs_mgr.h"
-#include "log_new.h"
+#include <init/log.h>
+#include "module_loader.h"
 #include "property_manager.h"
+#include "thread_pool.h"
 #include "verify.h"
 
 namespace minimal_systems {
@@ -34,17 +39,118 @@ std::string normalize_path(const std::string& path) {
 }
 
 /**
- * Parse a given fstab file and mount entries marked with 'verify' or 'overlay'.
- *
- * Supports overlayfs mounts explicitly. Logs all issues and aborts on fatal errors.
+ * Check whether the running kernel already has a filesystem type registered.
+ */
+static bool IsFilesystemRegistered(const std::string& filesystem) {
+    std::ifstream file("/proc/filesystems");
+    std::string line;
+    while (std::getline(file, line)) {
+        auto tab = line.find('\t');
+        if (tab != std::string::npos && line.compare(tab + 1, std::string::npos, filesystem) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Wait for the kernel modules an fstab entry needs before it is mounted.
  *
- * @param filepath The absolute path to the fstab file.
+ * These are the modules named in a "modules=a:b" option (typically block or
+ * bus drivers) and, unless built in, the module providing the filesystem
+ * type, found through its "fs-<type>" alias. All other modules keep loading in
+ * the background.
+ */
+static void WaitForEntryModules(const std::string& filesystem, const std::string& options) {
+    auto& loader = ModuleLoader::instance();
+
+    std::stringstream option_stream(options);
+    std::string option;
+    while (std::getline(option_stream, option, ',')) {
+        if (option.rfind("modules=", 0) != 0) continue;
+        std::stringstream module_stream(option.substr(strlen("modules=")));
+        std::string module;
+        while (std::getline(module_stream, module, ':')) {
+            if (!module.empty() && !loader.WaitForModule(module)) {
+                LOGW("Module '%s' required by fstab is not loaded", module.c_str());
+            }
+        }
+    }
+
+    if (filesystem.empty() || IsFilesystemRegistered(filesystem)) return;
+    loader.WaitForModule("fs-" + filesystem);
+    if (!IsFilesystemRegistered(filesystem)) {
+        LOGW("Filesystem type '%s' is not registered with the kernel", filesystem.c_str());
+    }
+}
+
+/**
+ * Check whether a comma-separated option string contains `name` as a whole option.
+ */
+static bool HasOption(const std::string& options, const std::string& name) {
+    std::stringstream option_stream(options);
+    std::string option;
+    while (std::getline(option_stream, option, ',')) {
+        if (option == name) return true;
+    }
+    return false;
+}
+
+// Mounts mostly wait on devices, modules and fsck I/O, so this is not tied to the CPU count.
+static constexpr size_t kMaxMountThreads = 4;
+
+namespace {
+
+/** An fstab entry selected for first-stage mounting. */
+struct FstabEntry {
+    std::string device;
+    std::string mount_point;  // Canonical: no duplicate or trailing slashes.
+    std::string filesystem;
+    std::string options;
+    int pass = 0;  // fsck pass, fstab's sixth field.
+    int line_number = 0;
+};
+
+/** An entry and the entries that must wait for it to be mounted. */
+struct MountNode {
+    FstabEntry entry;
+    std::vector<size_t> children;
+    size_t parents = 0;              // Entries this one waits for.
+    std::atomic<size_t> pending{0};  // Parents not mounted yet.
+    bool skipped = false;            // Reported as skipped; guarded by the failures lock.
+};
+
+}  // namespace
+
+/**
+ * Strip duplicate and trailing slashes so mount points compare by component.
  */
-void parse_fstab_file(const std::string& filepath) {
+static std::string CanonicalMountPoint(const std::string& path) {
+    std::string result = normalize_path(path);
+    while (result.size() > 1 && result.back() == '/') result.pop_back();
+    return result;
+}
+
+/**
+ * True if `child` lies strictly below `parent`, e.g. /usr/share below /usr but
+ * not /usrlocal.
+ */
+static bool IsBelow(const std::string& parent, const std::string& child) {
+    if (child.size() <= parent.size() || child.compare(0, parent.size(), parent) != 0) {
+        return false;
+    }
+    return parent.back() == '/' || child[parent.size()] == '/';
+}
+
+/**
+ * Read the entries of an fstab file that first stage mounts: those marked
+ * with 'verify', and overlayfs entries.
+ */
+static bool ReadFstabEntries(const std::string& filepath, std::vector<FstabEntry>* entries) {
     std::ifstream file(filepath);
     if (!file.is_open()) {
         LOGE("Unable to open fstab file: '%s'. Check file path or permissions.", filepath.c_str());
-        return;
+        return false;
     }
 
     LOGI("Parsing fstab file: '%s'", filepath.c_str());
@@ -62,44 +168,237 @@ void parse_fstab_file(const std::string& filepath) {
 
         // Parse expected fields from fstab line
         std::istringstream iss(line);
-        std::string device, mount_point, filesystem, options;
-
-        if (!(iss >> device >> mount_point >> filesystem >> options)) {
+        FstabEntry entry;
+        if (!(iss >> entry.device >> entry.mount_point >> entry.filesystem >> entry.options)) {
             LOGE("Failed to parse fstab entry on line %d. Skipping.", line_number);
             continue;
         }
 
         // Only process entries marked with 'verify' unless it's an overlay
-        if (options.find("verify") == std::string::npos && filesystem != "overlay") {
+        if (!HasOption(entry.options, "verify") && entry.filesystem != "overlay") {
             continue;
         }
 
-        if (filesystem == "overlay") {
-            // Mount overlayfs partition
-            if (!minimal_systems::fs_mgr::MountOverlayFs(mount_point)) {
-                LOGE("Overlay mount failed for mount point '%s' on line %d. Aborting.",
-                     mount_point.c_str(), line_number);
-                std::exit(-1);
+        // Without dump and pass fields, / is checked first and the rest after it
+        int dump;
+        if (!(iss >> dump >> entry.pass)) {
+            entry.pass = entry.filesystem == "overlay" ? 0 : (entry.mount_point == "/" ? 1 : 2);
+        }
+        // Repairs would write under dm-verity's hash tree.
+        if (HasOption(entry.options, "dm_verity") && entry.pass > 0) {
+            LOGI("Not checking verified partition '%s' (line %d).", entry.device.c_str(),
+                 line_number);
+            entry.pass = 0;
+        }
+
+        entry.mount_point = CanonicalMountPoint(entry.mount_point);
+        entry.line_number = line_number;
+        entries->emplace_back(std::move(entry));
+    }
+    return true;
+}
+
+/**
+ * Find the entry `path` is mounted under: the one with the longest mount point
+ * at or above it (strictly above if `strict`), the last such entry in fstab
+ * order before `before` for an equal mount point. Entries `exclude` rejects
+ * are ignored.
+ *
+ * @return SIZE_MAX if no entry is above `path`.
+ */
+static size_t FindMountParent(const std::vector<MountNode>& nodes, const std::string& path,
+                              size_t before, const std::function<bool(size_t)>& exclude) {
+    size_t parent = SIZE_MAX;
+    const std::string* parent_mount_point = nullptr;
+    for (size_t j = 0; j < nodes.size(); ++j) {
+        const std::string& candidate = nodes[j].entry.mount_point;
+        bool above = (candidate == path) ? j < before : IsBelow(candidate, path);
+        if (!above || exclude(j)) continue;
+        // Prefer the deepest mount point, then the last entry for it.
+        if (!parent_mount_point || candidate.size() >= parent_mount_point->size()) {
+            parent = j;
+            parent_mount_point = &candidate;
+        }
+    }
+    return parent;
+}
+
+/**
+ * Arrange fstab entries into a dependency graph keyed by mount point prefix.
+ *
+ * Each entry's parent is the entry with the longest mount point above it, so
+ * / is mounted before /usr and /usr before /usr/share. Entries for the same
+ * mount point (an overlay over a partition) chain in fstab order. An overlay
+ * also waits for the entries holding its layer directories: the deepest one
+ * at or above kOverlayDir and any mounted below it. Entries mounted at or
+ * under the overlay itself are not considered there, as they go on top of it,
+ * which keeps the graph acyclic. Otherwise unrelated entries do not depend on
+ * each other.
+ *
+ * @return Indexes of the entries that wait for nothing.
+ */
+static std::vector<size_t> BuildMountGraph(std::vector<MountNode>* nodes) {
+    auto add_edge = [nodes](size_t parent, size_t child) {
+        auto& children = (*nodes)[parent].children;
+        if (std::find(children.begin(), children.end(), child) != children.end()) return;
+        children.emplace_back(child);
+        ++(*nodes)[child].parents;
+    };
+
+    for (size_t i = 0; i < nodes->size(); ++i) {
+        const FstabEntry& entry = (*nodes)[i].entry;
+        size_t parent = FindMountParent(*nodes, entry.mount_point, i, [](size_t) { return false; });
+        if (parent != SIZE_MAX) add_edge(parent, i);
+        if (entry.filesystem != "overlay") continue;
+
+        // Overlays and whatever is mounted on this one cannot hold its layers.
+        auto unrelated = [&](size_t j) {
+            const FstabEntry& candidate = (*nodes)[j].entry;
+            return candidate.filesystem == "overlay" ||
+                   candidate.mount_point == entry.mount_point ||
+                   IsBelow(entry.mount_point, candidate.mount_point);
+        };
+        const std::string overlay_dir = minimal_systems::fs_mgr::kOverlayDir;
+        size_t layers = FindMountParent(*nodes, overlay_dir, nodes->size(), unrelated);
+        if (layers != SIZE_MAX) add_edge(layers, i);
+        for (size_t j = 0; j < nodes->size(); ++j) {
+            if (!unrelated(j) && IsBelow(overlay_dir, (*nodes)[j].entry.mount_point)) {
+                add_edge(j, i);
             }
-            continue;  // Skip further handling for overlay entries
         }
+    }
+
+    std::vector<size_t> roots;
+    for (size_t i = 0; i < nodes->size(); ++i) {
+        if ((*nodes)[i].parents == 0) roots.emplace_back(i);
+    }
+    return roots;
+}
+
+/**
+ * Wait for an entry's modules, then mount it, through dm-verity if it is
+ * marked 'dm_verity'. Verified devices are always mounted read-only.
+ */
+static bool MountFstabEntry(const FstabEntry& entry) {
+    WaitForEntryModules(entry.filesystem, entry.options);
+
+    if (entry.filesystem == "overlay") {
+        return minimal_systems::fs_mgr::MountOverlayFs(entry.mount_point, entry.options);
+    }
 
-        // Warn if the device node does not exist
-        struct stat buffer;
-        if (stat(device.c_str(), &buffer) != 0) {
-            LOGW("Device '%s' does not exist or cannot be opened. Proceeding with mount attempt.",
-                 device.c_str());
+    std::string device = entry.device;
+    std::string options = entry.options;
+    if (HasOption(entry.options, "dm_verity")) {
+        if (!minimal_systems::fs_mgr::WaitForDevice(entry.device,
+                                                     minimal_systems::fs_mgr::kDeviceWaitTimeout)) {
+            LOGE("Device '%s' to verify did not appear.", entry.device.c_str());
+            return false;
         }
+        std::string name = entry.device.substr(entry.device.find_last_of('/') + 1);
+        if (!SetUpVerity(entry.device, name, &device)) {
+            return false;
+        }
+        options += ",ro";
+    }
 
-        // Attempt to mount the partition
-        if (!minimal_systems::fs_mgr::MountPartition(device, mount_point, filesystem, options)) {
-            LOGE("Mount operation failed for device '%s' at '%s' on line %d. Aborting.",
-                 device.c_str(), mount_point.c_str(), line_number);
-            std::exit(-1);
+    return minimal_systems::fs_mgr::MountPartition(device, entry.mount_point, entry.filesystem,
+                                                   options);
+}
+
+/**
+ * Parse a given fstab file and mount its first-stage and overlay entries.
+ *
+ * All filesystems are checked first, pass by pass (see FsckPartitions()).
+ * Entries are then mounted on a worker pool following BuildMountGraph(): an
+ * entry starts as soon as every entry it waits for is done, so independent
+ * subtrees are mounted in parallel. A failed entry takes everything waiting on
+ * it down with it; every failure is logged before returning.
+ *
+ * @param filepath The absolute path to the fstab file.
+ * @return True if every selected entry was mounted.
+ */
+bool parse_fstab_file(const std::string& filepath) {
+    std::vector<FstabEntry> entries;
+    if (!ReadFstabEntries(filepath, &entries)) {
+        return false;
+    }
+
+    std::vector<MountNode> nodes(entries.size());
+    for (size_t i = 0; i < entries.size(); ++i) {
+        nodes[i].entry = std::move(entries[i]);
+    }
+    std::vector<size_t> roots = BuildMountGraph(&nodes);
+    for (auto& node : nodes) {
+        node.pending = node.parents;
+    }
+
+    // fsck opens the device, so its drivers must be loaded first. The waits
+    // run inside each pass, concurrently with the other checks.
+    std::vector<minimal_systems::fs_mgr::FsckEntry> fsck_entries;
+    for (const auto& node : nodes) {
+        const FstabEntry& entry = node.entry;
+        if (entry.pass <= 0) continue;
+        minimal_systems::fs_mgr::FsckEntry fsck{entry.device, entry.filesystem, entry.pass};
+        fsck.prepare = [&entry] { WaitForEntryModules(entry.filesystem, entry.options); };
+        fsck_entries.emplace_back(std::move(fsck));
+    }
+    std::vector<std::string> fsck_failed;
+    minimal_systems::fs_mgr::FsckPartitions(fsck_entries, &fsck_failed);
+
+    std::mutex failures_lock;
+    std::vector<std::string> failures;
+
+    // Everything waiting on a failed entry is reported as skipped, once.
+    std::function<void(size_t)> skip_subtree = [&](size_t index) {
+        for (size_t child : nodes[index].children) {
+            if (nodes[child].skipped) continue;
+            nodes[child].skipped = true;
+            const FstabEntry& entry = nodes[child].entry;
+            failures.emplace_back(entry.mount_point + " (line " +
+                                  std::to_string(entry.line_number) + "): skipped, '" +
+                                  nodes[index].entry.mount_point + "' was not mounted");
+            skip_subtree(child);
+        }
+    };
+
+    {
+        ThreadPool pool(std::min(nodes.size(), kMaxMountThreads), "fstab");
+        std::function<void(size_t)> mount = [&](size_t index) {
+            const FstabEntry& entry = nodes[index].entry;
+            bool checked = entry.pass <= 0 || std::find(fsck_failed.begin(), fsck_failed.end(),
+                                                        entry.device) == fsck_failed.end();
+            if (!checked || !MountFstabEntry(entry)) {
+                std::lock_guard<std::mutex> guard(failures_lock);
+                failures.emplace_back(entry.mount_point + " (line " +
+                                      std::to_string(entry.line_number) + "): " +
+                                      entry.filesystem + (checked ? " mount" : " fsck") +
+                                      " of '" + entry.device + "' failed");
+                skip_subtree(index);
+                return;
+            }
+            for (size_t child : nodes[index].children) {
+                if (--nodes[child].pending == 0) {
+                    pool.Enqueue([&mount, child] { mount(child); });
+                }
+            }
+        };
+        for (size_t root : roots) {
+            pool.Enqueue([&mount, root] { mount(root); });
+        }
+        pool.Wait();
+    }
+
+    if (!failures.empty()) {
+        LOGE("%zu of %zu fstab entries from '%s' were not mounted:", failures.size(),
+             nodes.size(), filepath.c_str());
+        for (const auto& failure : failures) {
+            LOGE("  %s", failure.c_str());
         }
+        return false;
     }
 
     LOGI("Fstab file parsing completed.");
+    return true;
 }
 
 /**
@@ -108,7 +407,8 @@ void parse_fstab_file(const std::string& filepath) {
  * Attempts normalized and unnormalized paths. Falls back to /etc/fstab if all else fails.
  *
  * @param fstab_paths A list of possible fstab file locations.
- * @return True if a valid fstab was found and parsed successfully; otherwise, exits.
+ * @return True if a valid fstab was found and all of its entries were mounted;
+ *         exits if no fstab is found.
  */
 bool load_fstab(const std::vector<std::string>& fstab_paths) {
     auto& props = PropertyManager::instance();
@@ -121,8 +421,7 @@ bool load_fstab(const std::vector<std::string>& fstab_paths) {
         if (file) {
             LOGI("fstab '%s' found for hardware '%s' without normalization", path.c_str(),
                  hardware.c_str());
-            parse_fstab_file(path);
-            return true;
+            return parse_fstab_file(path);
         }
 
         // Try normalized version of the path
@@ -131,8 +430,7 @@ bool load_fstab(const std::vector<std::string>& fstab_paths) {
         if (file) {
             LOGI("fstab '%s' found for hardware '%s' with normalization", normalized_path.c_str(),
                  hardware.c_str());
-            parse_fstab_file(normalized_path);
-            return true;
+            return parse_fstab_file(normalized_path);
         }
 
         LOGW("fstab '%s' not found; continuing to next option", path.c_str());
@@ -142,8 +440,7 @@ bool load_fstab(const std::vector<std::string>& fstab_paths) {
     std::ifstream fallback_file("/etc/fstab");
     if (fallback_file) {
         LOGI("Using fallback fstab '/etc/fstab' for hardware '%s'", hardware.c_str());
-        parse_fstab_file("/etc/fstab");
-        return true;
+        return parse_fstab_file("/etc/fstab");
     }
 
     LOGE("No valid fstab found; device will reboot to bootloader.");
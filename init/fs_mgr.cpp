@@ -2,17 +2,30 @@
 #include "fs_mgr.h"
 
 #include <errno.h>
+#include <fcntl.h>
+#include <linux/mount.h>  // For the fsopen() family
 #include <sys/mount.h>  // For mount system call
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
-#include <cstdlib>  // For system() call (if needed for real fsck)
+#include <algorithm>
+#include <atomic>
 #include <cstring>
 #include <filesystem>
 #include <fstream>
+#include <future>
+#include <map>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <vector>
 
-#include "log_new.h"  // For LOGE, LOGI, LOGD, LOGW
+#include <init/log.h>  // For LOGE, LOGI, LOGD, LOGW
+#include <modprobe/exthandler.h>
+#include "boot_trace.h"
+#include "thread_pool.h"
 
 namespace minimal_systems {
 namespace fs_mgr {
@@ -62,86 +75,509 @@ bool GetBootconfig(const std::string& key, std::string* value) {
     return ParseKeyValue(bootconfig, key, value);
 }
 
-bool FsckPartition(const std::string& device, const std::string& filesystem) {
-    std::string command;
+static bool IsExtFs(const std::string& filesystem) {
+    return filesystem == "ext4" || filesystem == "ext3" || filesystem == "ext2";
+}
+
+static bool IsFatFs(const std::string& filesystem) {
+    return filesystem == "fat32" || filesystem == "vfat";
+}
+
+static uint16_t Le16(const uint8_t* p) {
+    return static_cast<uint16_t>(p[0] | p[1] << 8);
+}
+
+static uint32_t Le32(const uint8_t* p) {
+    return static_cast<uint32_t>(p[0]) | static_cast<uint32_t>(p[1]) << 8 |
+           static_cast<uint32_t>(p[2]) << 16 | static_cast<uint32_t>(p[3]) << 24;
+}
+
+static bool ReadAt(int fd, off_t offset, uint8_t* buf, size_t len) {
+    return TEMP_FAILURE_RETRY(pread(fd, buf, len, offset)) == static_cast<ssize_t>(len);
+}
+
+// The ext2/3/4 superblock: 1024 bytes at offset 1024.
+static FsState ReadExtState(int fd) {
+    constexpr uint16_t kExtMagic = 0xEF53;
+    constexpr uint16_t kExtValidFs = 0x0001;
+    constexpr uint16_t kExtErrorFs = 0x0002;
+    constexpr uint32_t kExtIncompatRecover = 0x0004;  // Journal needs replay.
 
-    if (filesystem == "ext4") {
-        command = "e2fsck -y " + device;
-    } else if (filesystem == "fat32") {
-        command = "dosfsck -a " + device;
+    uint8_t sb[1024];
+    if (!ReadAt(fd, 1024, sb, sizeof(sb)) || Le16(sb + 0x38) != kExtMagic) {
+        return FsState::kUnknown;
+    }
+    uint16_t state = Le16(sb + 0x3A);
+    int16_t mount_count = static_cast<int16_t>(Le16(sb + 0x34));
+    int16_t max_mount_count = static_cast<int16_t>(Le16(sb + 0x36));
+    if (!(state & kExtValidFs) || (state & kExtErrorFs) ||
+        (Le32(sb + 0x60) & kExtIncompatRecover)) {
+        return FsState::kDirty;
+    }
+    // A periodic check is due.
+    if (max_mount_count > 0 && mount_count >= max_mount_count) {
+        return FsState::kDirty;
+    }
+    return FsState::kClean;
+}
+
+// The FAT boot sector, and the clean-shutdown and hard-error bits of FAT[1].
+static FsState ReadFatState(int fd) {
+    uint8_t bs[512];
+    if (!ReadAt(fd, 0, bs, sizeof(bs)) || bs[510] != 0x55 || bs[511] != 0xAA) {
+        return FsState::kUnknown;
+    }
+    uint16_t bytes_per_sector = Le16(bs + 0x0B);
+    uint16_t reserved_sectors = Le16(bs + 0x0E);
+    bool fat32 = Le16(bs + 0x16) == 0;
+    if (bytes_per_sector < 512 || reserved_sectors == 0) {
+        return FsState::kUnknown;
+    }
+
+    // Linux marks a mounted FAT volume dirty in the boot sector's state byte.
+    if (bs[fat32 ? 0x41 : 0x25] & 0x01) {
+        return FsState::kDirty;
+    }
+
+    off_t fat_offset = static_cast<off_t>(reserved_sectors) * bytes_per_sector;
+    uint8_t fat[8];
+    if (!ReadAt(fd, fat_offset, fat, sizeof(fat))) {
+        return FsState::kUnknown;
+    }
+    if (fat32) {
+        constexpr uint32_t kClean = 0x08000000, kNoError = 0x04000000;
+        uint32_t entry = Le32(fat + 4);
+        return (entry & kClean) && (entry & kNoError) ? FsState::kClean : FsState::kDirty;
+    }
+    constexpr uint16_t kClean = 0x8000, kNoError = 0x4000;
+    uint16_t entry = Le16(fat + 2);
+    return (entry & kClean) && (entry & kNoError) ? FsState::kClean : FsState::kDirty;
+}
+
+FsState ReadFilesystemState(const std::string& device, const std::string& filesystem) {
+    if (!IsExtFs(filesystem) && !IsFatFs(filesystem)) {
+        return FsState::kUnknown;
+    }
+    int fd = TEMP_FAILURE_RETRY(open(device.c_str(), O_RDONLY | O_CLOEXEC));
+    if (fd < 0) {
+        LOGW("Cannot open '%s' to read its filesystem state: %s", device.c_str(),
+             strerror(errno));
+        return FsState::kUnknown;
+    }
+    FsState state = IsExtFs(filesystem) ? ReadExtState(fd) : ReadFatState(fd);
+    close(fd);
+    return state;
+}
+
+// Finds a checker binary; the handler runner does not search PATH.
+static std::string FindFsckTool(const std::vector<std::string>& names) {
+    static const char* const kDirs[] = {"/sbin/", "/usr/sbin/", "/bin/", "/usr/bin/",
+                                        "/system/bin/"};
+    for (const auto& name : names) {
+        for (const char* dir : kDirs) {
+            std::string path = dir + name;
+            if (access(path.c_str(), X_OK) == 0) return path;
+        }
+    }
+    return "";
+}
+
+static std::string FsckCommand(const std::string& device, const std::string& filesystem) {
+    if (IsExtFs(filesystem)) {
+        std::string tool = FindFsckTool({"e2fsck", "fsck.ext4"});
+        return tool.empty() ? "" : tool + " -y " + device;
+    }
+    std::string tool = FindFsckTool({"fsck.fat", "dosfsck", "fsck.vfat"});
+    return tool.empty() ? "" : tool + " -a " + device;
+}
+
+/**
+ * Interprets the checker's exit status. e2fsck exits with 1 or 2 when it
+ * corrected errors, fsck.fat with 1; anything else means the filesystem is
+ * still damaged or the check did not run.
+ */
+static bool FsckSucceeded(const std::string& device, const std::string& filesystem,
+                          const ExternalHandlerResult& result) {
+    for (const auto* output : {&result.stdout_content, &result.stderr_content}) {
+        std::istringstream lines(*output);
+        for (std::string line; std::getline(lines, line);) {
+            if (!line.empty()) LOGI("fsck %s: %s", device.c_str(), line.c_str());
+        }
+    }
+    if (!result.spawned) {
+        LOGE("Could not start fsck for '%s'.", device.c_str());
+        return false;
+    }
+    if (result.timed_out) {
+        LOGE("fsck of '%s' timed out.", device.c_str());
+        return false;
+    }
+    if (!WIFEXITED(result.status)) {
+        LOGE("fsck of '%s' was killed by signal %d.", device.c_str(), WTERMSIG(result.status));
+        return false;
+    }
+    int code = WEXITSTATUS(result.status);
+    bool ok = IsExtFs(filesystem) ? (code & ~3) == 0 : code <= 1;
+    if (!ok) {
+        LOGE("Filesystem check failed for device: '%s' with filesystem '%s'. Return code: %d.",
+             device.c_str(), filesystem.c_str(), code);
     } else {
+        LOGI("Filesystem check completed successfully for device: '%s' with filesystem '%s'%s.",
+             device.c_str(), filesystem.c_str(), code ? " (errors corrected)" : "");
+    }
+    return ok;
+}
+
+/**
+ * Starts fsck for a device unless its superblock says it is clean.
+ *
+ * @return False if the filesystem needs no check (or cannot be checked);
+ *         otherwise true with `result` resolving when fsck exits.
+ */
+static bool StartFsck(const std::string& device, const std::string& filesystem,
+                      std::future<ExternalHandlerResult>* result) {
+    if (!IsExtFs(filesystem) && !IsFatFs(filesystem)) {
         LOGW("Unsupported filesystem '%s' for fsck on device '%s'. Skipping fsck.",
              filesystem.c_str(), device.c_str());
-        return true;  // Skipping unsupported filesystem
+        return false;
+    }
+    if (ReadFilesystemState(device, filesystem) == FsState::kClean) {
+        LOGI("Filesystem on '%s' is clean; skipping fsck.", device.c_str());
+        return false;
+    }
+    std::string command = FsckCommand(device, filesystem);
+    if (command.empty()) {
+        LOGW("No fsck tool for '%s' on '%s'. Skipping fsck.", filesystem.c_str(), device.c_str());
+        return false;
     }
+    LOGI("Running '%s'.", command.c_str());
+    *result = ExternalHandlerRunner::instance().RunAsync(command, 0, 0, {}, kFsckTimeout);
+    return true;
+}
 
-    // TODO: Uncomment the following lines to execute the command
-    /*
-    int ret = system(command.c_str());
-    if (ret != 0) {
-        LOGE("Filesystem check failed for device: '%s' with filesystem '%s'. Return code: %d.",
-             device.c_str(), filesystem.c_str(), ret);
+bool FsckPartition(const std::string& device, const std::string& filesystem) {
+    std::future<ExternalHandlerResult> result;
+    if (!StartFsck(device, filesystem, &result)) {
+        return true;
+    }
+    return FsckSucceeded(device, filesystem, result.get());
+}
+
+/**
+ * Prepares an entry, waits for its device and checks it.
+ */
+static bool CheckFsckEntry(const FsckEntry& entry) {
+    if (entry.prepare) entry.prepare();
+    if (!WaitForDevice(entry.device, kDeviceWaitTimeout)) {
+        LOGE("Device '%s' to check did not appear.", entry.device.c_str());
         return false;
     }
-    LOGI("Filesystem check completed successfully for device: '%s' with filesystem '%s'.",
-         device.c_str(), filesystem.c_str());
-    */
+    return FsckPartition(entry.device, entry.filesystem);
+}
+
+bool FsckPartitions(const std::vector<FsckEntry>& entries, std::vector<std::string>* failed) {
+    std::map<int, std::vector<const FsckEntry*>> passes;
+    for (const auto& entry : entries) {
+        if (entry.pass > 0) passes[entry.pass].emplace_back(&entry);
+    }
 
+    // Like fsck -A: passes run in order, the entries of one pass concurrently.
+    for (const auto& [pass, group] : passes) {
+        LOGI("fsck pass %d: %zu filesystems.", pass, group.size());
+        std::vector<char> ok(group.size());
+        {
+            init::ThreadPool pool(group.size(), "fsck");
+            for (size_t i = 0; i < group.size(); ++i) {
+                pool.Enqueue([&ok, &group, i] { ok[i] = CheckFsckEntry(*group[i]); });
+            }
+            pool.Wait();
+        }
+        for (size_t i = 0; i < group.size(); ++i) {
+            if (!ok[i]) failed->emplace_back(group[i]->device);
+        }
+    }
+    return failed->empty();
+}
+
+namespace {
+
+struct FlagOption {
+    const char* name;
+    unsigned long set;
+    unsigned long clear;
+};
+
+constexpr FlagOption kFlagOptions[] = {
+        {"defaults", 0, 0},
+        {"ro", MS_RDONLY, 0},
+        {"rw", 0, MS_RDONLY},
+        {"nosuid", MS_NOSUID, 0},
+        {"suid", 0, MS_NOSUID},
+        {"nodev", MS_NODEV, 0},
+        {"dev", 0, MS_NODEV},
+        {"noexec", MS_NOEXEC, 0},
+        {"exec", 0, MS_NOEXEC},
+        {"sync", MS_SYNCHRONOUS, 0},
+        {"async", 0, MS_SYNCHRONOUS},
+        {"dirsync", MS_DIRSYNC, 0},
+        {"mand", MS_MANDLOCK, 0},
+        {"nomand", 0, MS_MANDLOCK},
+        {"noatime", MS_NOATIME, 0},
+        {"atime", 0, MS_NOATIME},
+        {"nodiratime", MS_NODIRATIME, 0},
+        {"diratime", 0, MS_NODIRATIME},
+        {"relatime", MS_RELATIME, 0},
+        {"norelatime", 0, MS_RELATIME},
+        {"strictatime", MS_STRICTATIME, 0},
+        {"lazytime", MS_LAZYTIME, 0},
+        {"nolazytime", 0, MS_LAZYTIME},
+        {"silent", MS_SILENT, 0},
+        {"bind", MS_BIND, 0},
+        {"rbind", MS_BIND | MS_REC, 0},
+        {"remount", MS_REMOUNT, 0},
+};
+
+// fstab options that direct init rather than the kernel.
+constexpr const char* kInitOptions[] = {"verify", "dm_verity", "wait",
+                                        "check",  "nofail",    "first_stage_mount"};
+
+// Kernel filesystem types MountPartition() handles, by fstab name.
+const std::map<std::string, std::string> kKernelFsTypes = {
+        {"ext2", "ext2"},   {"ext3", "ext3"},         {"ext4", "ext4"},   {"fat32", "vfat"},
+        {"vfat", "vfat"},   {"f2fs", "f2fs"},         {"erofs", "erofs"}, {"squashfs", "squashfs"},
+        {"tmpfs", "tmpfs"}, {"overlay", "overlay"},
+};
+
+// Errors a device that is still being probed, or a filesystem driver still loading, can cause.
+bool IsTransientMountError(int err) {
+    return err == ENOENT || err == ENXIO || err == ENODEV || err == ENOMEDIUM;
+}
+
+#if defined(__NR_fsopen) && defined(__NR_fsconfig) && defined(__NR_fsmount) && \
+        defined(__NR_move_mount)
+// Cleared the first time the kernel reports the new mount API as missing.
+std::atomic<bool> g_fs_api_supported{true};
+
+int FsOpen(const char* fs_name, unsigned int flags) {
+    return static_cast<int>(syscall(__NR_fsopen, fs_name, flags));
+}
+
+int FsConfig(int fd, unsigned int cmd, const char* key, const char* value) {
+    return static_cast<int>(syscall(__NR_fsconfig, fd, cmd, key, value, 0));
+}
+
+int FsMount(int fd, unsigned int flags, unsigned int attr_flags) {
+    return static_cast<int>(syscall(__NR_fsmount, fd, flags, attr_flags));
+}
+
+int MoveMount(int from_fd, const char* to_path) {
+    return static_cast<int>(syscall(__NR_move_mount, from_fd, "", AT_FDCWD, to_path,
+                                    MOVE_MOUNT_F_EMPTY_PATH));
+}
+
+// Logs the messages the kernel queued on an fs context, e.g. an unknown option.
+void LogFsContextMessages(int fs_fd, const std::string& mount_point) {
+    char buf[256];
+    ssize_t n;
+    while ((n = read(fs_fd, buf, sizeof(buf) - 1)) > 0) {
+        while (n > 0 && buf[n - 1] == '\n') --n;
+        buf[n] = '\0';
+        LOGE("mount %s: %s", mount_point.c_str(), buf);
+    }
+}
+
+/**
+ * Mounts with fsopen()/fsconfig()/fsmount()/move_mount(). Options are handed
+ * over one at a time as parsed, so the kernel does not string-parse them.
+ * Sets errno to ENOSYS if the kernel lacks the API.
+ */
+bool MountWithFsApi(const std::string& source, const std::string& target,
+                    const std::string& type, const MountOptions& options) {
+    int fs_fd = FsOpen(type.c_str(), FSOPEN_CLOEXEC);
+    if (fs_fd < 0) {
+        if (errno == ENOSYS) g_fs_api_supported = false;
+        return false;
+    }
+
+    bool ok = FsConfig(fs_fd, FSCONFIG_SET_STRING, "source", source.c_str()) == 0;
+    // Superblock flags; the per-mount ones become mount attributes below.
+    const std::pair<unsigned long, const char*> sb_flags[] = {
+            {MS_RDONLY, "ro"},
+            {MS_SYNCHRONOUS, "sync"},
+            {MS_DIRSYNC, "dirsync"},
+            {MS_LAZYTIME, "lazytime"},
+            {MS_MANDLOCK, "mand"},
+    };
+    for (const auto& [flag, name] : sb_flags) {
+        if (ok && (options.flags & flag)) {
+            ok = FsConfig(fs_fd, FSCONFIG_SET_FLAG, name, nullptr) == 0;
+        }
+    }
+    std::stringstream data(options.data);
+    for (std::string option; ok && std::getline(data, option, ',');) {
+        if (option.empty()) continue;
+        size_t eq = option.find('=');
+        if (eq == std::string::npos) {
+            ok = FsConfig(fs_fd, FSCONFIG_SET_FLAG, option.c_str(), nullptr) == 0;
+        } else {
+            ok = FsConfig(fs_fd, FSCONFIG_SET_STRING, option.substr(0, eq).c_str(),
+                          option.c_str() + eq + 1) == 0;
+        }
+    }
+    if (ok) ok = FsConfig(fs_fd, FSCONFIG_CMD_CREATE, nullptr, nullptr) == 0;
+
+    int mount_fd = -1;
+    if (ok) {
+        unsigned int attrs = 0;
+        if (options.flags & MS_RDONLY) attrs |= MOUNT_ATTR_RDONLY;
+        if (options.flags & MS_NOSUID) attrs |= MOUNT_ATTR_NOSUID;
+        if (options.flags & MS_NODEV) attrs |= MOUNT_ATTR_NODEV;
+        if (options.flags & MS_NOEXEC) attrs |= MOUNT_ATTR_NOEXEC;
+        if (options.flags & MS_NODIRATIME) attrs |= MOUNT_ATTR_NODIRATIME;
+        if (options.flags & MS_NOATIME) {
+            attrs |= MOUNT_ATTR_NOATIME;
+        } else if (options.flags & MS_STRICTATIME) {
+            attrs |= MOUNT_ATTR_STRICTATIME;
+        }
+        mount_fd = FsMount(fs_fd, FSMOUNT_CLOEXEC, attrs);
+        ok = mount_fd >= 0;
+    }
+    if (ok) ok = MoveMount(mount_fd, target.c_str()) == 0;
+
+    int saved_errno = errno;
+    if (!ok) LogFsContextMessages(fs_fd, target);
+    if (mount_fd >= 0) close(mount_fd);
+    close(fs_fd);
+    errno = saved_errno;
+    return ok;
+}
+#endif
+
+/**
+ * Mounts `source` on `target`, retrying transient failures until `timeout`.
+ * Uses the new mount API when the kernel has it; bind mounts and remounts
+ * always go through mount(2).
+ */
+bool DoMount(const std::string& source, const std::string& target, const std::string& type,
+             const MountOptions& options, std::chrono::milliseconds timeout) {
+    if (mkdir(target.c_str(), 0755) != 0 && errno != EEXIST) {
+        LOGW("Cannot create mount point %s: %s", target.c_str(), strerror(errno));
+    }
+
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    auto delay = std::chrono::milliseconds(10);
+    while (true) {
+        bool ok = false;
+        bool attempted = false;
+#if defined(__NR_fsopen) && defined(__NR_fsconfig) && defined(__NR_fsmount) && \
+        defined(__NR_move_mount)
+        if (g_fs_api_supported && !(options.flags & (MS_BIND | MS_REMOUNT))) {
+            ok = MountWithFsApi(source, target, type, options);
+            attempted = ok || errno != ENOSYS;
+        }
+#endif
+        if (!attempted) {
+            ok = mount(source.c_str(), target.c_str(), type.c_str(), options.flags,
+                       options.data.empty() ? nullptr : options.data.c_str()) == 0;
+        }
+        if (ok) {
+            LOGI("__mount(source=%s,target=%s,type=%s)=0: Success.", source.c_str(),
+                 target.c_str(), type.c_str());
+            return true;
+        }
+
+        int err = errno;
+        if (!IsTransientMountError(err) || std::chrono::steady_clock::now() >= deadline) {
+            LOGE("__mount(source=%s,target=%s,type=%s)=1: Failed. Error: %s.", source.c_str(),
+                 target.c_str(), type.c_str(), strerror(err));
+            return false;
+        }
+        LOGD("Mounting %s on %s failed (%s); retrying.", source.c_str(), target.c_str(),
+             strerror(err));
+        std::this_thread::sleep_for(delay);
+        delay = std::min(delay * 2, std::chrono::milliseconds(200));
+    }
+}
+
+}  // namespace
+
+bool WaitForDevice(const std::string& device, std::chrono::milliseconds timeout) {
+    auto deadline = std::chrono::steady_clock::now() + timeout;
+    auto delay = std::chrono::milliseconds(5);
+    while (access(device.c_str(), F_OK) != 0) {
+        if (errno != ENOENT || std::chrono::steady_clock::now() >= deadline) return false;
+        std::this_thread::sleep_for(delay);
+        delay = std::min(delay * 2, std::chrono::milliseconds(100));
+    }
     return true;
 }
 
+MountOptions ParseMountOptions(const std::string& options) {
+    MountOptions parsed;
+    std::stringstream stream(options);
+    for (std::string option; std::getline(stream, option, ',');) {
+        if (option.empty() || option.rfind("modules=", 0) == 0) continue;
+        if (std::find_if(std::begin(kInitOptions), std::end(kInitOptions),
+                         [&](const char* name) { return option == name; }) !=
+            std::end(kInitOptions)) {
+            continue;
+        }
+        auto flag = std::find_if(std::begin(kFlagOptions), std::end(kFlagOptions),
+                                 [&](const FlagOption& entry) { return option == entry.name; });
+        if (flag != std::end(kFlagOptions)) {
+            parsed.flags = (parsed.flags & ~flag->clear) | flag->set;
+            continue;
+        }
+        if (!parsed.data.empty()) parsed.data += ',';
+        parsed.data += option;
+    }
+    return parsed;
+}
+
 bool MountPartition(const std::string& device, const std::string& mount_point,
                     const std::string& filesystem, const std::string& options) {
-    if (filesystem == "ext4" || filesystem == "fat32") {
-        if (!FsckPartition(device, filesystem)) {
-            LOGE("Filesystem check failed on %s with type %s.", device.c_str(), filesystem.c_str());
-            return false;
-        }
-    } else if (filesystem == "overlay") {
+    init::ScopedBootTrace trace(init::kTraceMount, mount_point);
+    auto type = kKernelFsTypes.find(filesystem);
+    if (type == kKernelFsTypes.end()) {
+        LOGW("Unsupported filesystem type %s on %s. Mount skipped.", filesystem.c_str(),
+             device.c_str());
+        return false;
+    }
+    if (filesystem == "overlay") {
         LOGI("Delegating overlay filesystem mounting to MountOverlayFs for %s.",
              mount_point.c_str());
-        if (!MountOverlayFs(mount_point)) {
+        if (!MountOverlayFs(mount_point, options)) {
             LOGE("Failed to mount overlay filesystem at %s.", mount_point.c_str());
             return false;
         }
-        LOGI("Successfully mounted overlay filesystem at %s.", mount_point.c_str());
         return true;
-    } else {
-        LOGW("Unsupported filesystem type %s on %s. Mount skipped.", filesystem.c_str(),
-             device.c_str());
-        return false;
     }
 
+    // ext2/3/4 and FAT were checked beforehand, see FsckPartitions().
     LOGI("Attempting to mount %s at %s with filesystem type %s and options: %s.", device.c_str(),
          mount_point.c_str(), filesystem.c_str(), options.c_str());
 
-    // TODO: Add real mount logic here when needed
-    /*
-    int ret = mount(device.c_str(), mount_point.c_str(), filesystem.c_str(),
-        MS_RELATIME, options.c_str());
-    if (ret != 0) {
-    LOGE("__mount(source=%s,target=%s,type=%s)=1: Failed. Error: %s.",
-    device.c_str(), mount_point.c_str(), filesystem.c_str(), strerror(errno));
-    return false;
+    if (filesystem != "tmpfs" && !WaitForDevice(device, kDeviceWaitTimeout)) {
+        LOGE("Device %s did not appear within %lld ms.", device.c_str(),
+             static_cast<long long>(
+                     std::chrono::milliseconds(kDeviceWaitTimeout).count()));
+        return false;
     }
 
-    LOGI("__mount(source=%s,target=%s,type=%s)=0: Success.",
-    device.c_str(), mount_point.c_str(), filesystem.c_str());
-    */
-
-    // Simulate mount success for logging purposes
-    LOGI("__mount(source=%s,target=%s,type=%s)=0: Success.", device.c_str(), mount_point.c_str(),
-         filesystem.c_str());
+    if (!DoMount(device, mount_point, type->second, ParseMountOptions(options),
+                 kDeviceWaitTimeout)) {
+        return false;
+    }
     LOGI("Mount operation completed for %s at %s.", device.c_str(), mount_point.c_str());
     return true;
 }
 
-bool MountOverlayFs(const std::string& mount_point) {
+bool MountOverlayFs(const std::string& mount_point, const std::string& options) {
     LOGI("Preparing to mount overlay filesystem at %s.", mount_point.c_str());
 
-    const std::vector<std::string> dirs = {"./mnt/overlay/lower", "./mnt/overlay/updater",
-                                           "./mnt/overlay/upper", "./mnt/overlay/work",
-                                           mount_point};
+    const std::string base = std::string(".") + kOverlayDir;
+    const std::vector<std::string> dirs = {base + "/lower", base + "/updater", base + "/upper",
+                                           base + "/work", mount_point};
 
     // Create directories if they do not exist
     for (const auto& dir : dirs) {
@@ -156,17 +592,17 @@ bool MountOverlayFs(const std::string& mount_point) {
         }
     }
 
-    const std::string overlay_options =
+    MountOptions parsed = ParseMountOptions(options);
+    std::string overlay_options =
             "lowerdir=" + dirs[0] + ":" + dirs[1] + ",upperdir=" + dirs[2] + ",workdir=" + dirs[3];
+    if (!parsed.data.empty()) overlay_options += "," + parsed.data;
+    parsed.data = overlay_options;
 
     LOGI("Mounting overlay with options: %s", overlay_options.c_str());
 
-    // Perform the mount operation
-    // if (mount("overlay", mount_point.c_str(), "overlay", MS_NODEV | MS_NOEXEC | MS_NOSUID,
-    //          overlay_options.c_str()) != 0) {
-    //    LOGE("Failed to mount overlay filesystem at %s: %s", mount_point.c_str(),
-    //    strerror(errno)); return false;
-    //}
+    if (!DoMount("overlay", mount_point, "overlay", parsed, std::chrono::milliseconds(0))) {
+        return false;
+    }
 
     LOGI("Successfully mounted overlay filesystem at %s", mount_point.c_str());
     return true;
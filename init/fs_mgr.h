@@ -1,7 +1,10 @@
 #ifndef FS_MGR_H
 #define FS_MGR_H
 
+#include <chrono>
+#include <functional>
 #include <string>
+#include <vector>
 
 namespace minimal_systems {
 namespace fs_mgr {
@@ -12,28 +15,107 @@ bool GetKernelCmdline(const std::string& key, std::string* value);
 // Reads the bootconfig file and searches for the specified key
 bool GetBootconfig(const std::string& key, std::string* value);
 
+// Longest a single fsck run may take before it is killed.
+constexpr std::chrono::minutes kFsckTimeout{10};
+
+// Filesystem state as recorded in the superblock.
+enum class FsState { kClean, kDirty, kUnknown };
+
+/**
+ * @brief Reads whether a filesystem was cleanly unmounted, without forking.
+ *
+ * ext2/3/4: s_state must be valid with no errors, no journal replay pending
+ * and no periodic check due. FAT: neither the boot sector nor FAT[1] may mark
+ * the volume dirty.
+ *
+ * @return kUnknown for other filesystems or an unreadable superblock.
+ */
+FsState ReadFilesystemState(const std::string& device, const std::string& filesystem);
+
 /**
  * @brief Runs a filesystem check on a specified device based on its filesystem
  * type.
  *
+ * Filesystems whose superblock says they are clean are not checked. Others
+ * run e2fsck or fsck.fat through the external handler runner.
+ *
  * @param device The path to the device to be checked.
  * @param filesystem The filesystem type (e.g., ext4, fat32).
  * @return True if the filesystem check is successful, false otherwise.
  */
 bool FsckPartition(const std::string& device, const std::string& filesystem);
 
-// Handles mounting a partition
+// A filesystem to check before mounting; `pass` is the fstab fsck pass (0 = never).
+struct FsckEntry {
+    std::string device;
+    std::string filesystem;
+    int pass = 0;
+    std::function<void()> prepare;  // Optional, e.g. loads the device's drivers.
+};
+
+/**
+ * @brief Checks filesystems grouped by pass, the way fsck -A does.
+ *
+ * Passes run in ascending order. Within a pass each entry is prepared, its
+ * device waited for (up to kDeviceWaitTimeout) and checked in parallel with
+ * the others, skipping clean filesystems as FsckPartition() does. A device
+ * that does not appear counts as a failed check.
+ *
+ * @param failed Receives the devices whose check failed.
+ * @return True if every check passed.
+ */
+bool FsckPartitions(const std::vector<FsckEntry>& entries, std::vector<std::string>* failed);
+
+// Longest MountPartition() waits for a block device to appear and mount.
+constexpr std::chrono::seconds kDeviceWaitTimeout{5};
+
+// Polls for a device node with backoff; false if it has not appeared after `timeout`.
+bool WaitForDevice(const std::string& device, std::chrono::milliseconds timeout);
+
+// fstab options split into mount(2) flags and filesystem-specific data.
+struct MountOptions {
+    unsigned long flags = 0;
+    std::string data;
+};
+
+/**
+ * @brief Splits a comma-separated fstab option string.
+ *
+ * Generic options (ro, nosuid, noatime, bind, ...) become MS_* flags, later
+ * ones overriding earlier ones; options that only direct init (wait, check,
+ * nofail, verify, dm_verity, modules=...) are dropped; the rest are kept, in
+ * order, as filesystem data.
+ */
+MountOptions ParseMountOptions(const std::string& options);
+
+/**
+ * @brief Mounts a partition.
+ *
+ * Waits up to kDeviceWaitTimeout for the device node, creates the mount
+ * point if needed and mounts with fsopen()/fsmount()/move_mount(), falling
+ * back to mount(2) on kernels without the new API. Mounts failing because
+ * the device or filesystem driver is not ready yet are retried.
+ *
+ * @return True if the filesystem is mounted.
+ */
 bool MountPartition(const std::string& device, const std::string& mount_point,
                     const std::string& filesystem, const std::string& options);
 
+// Directory, relative to /, holding the lower, upper and work directories of every overlay.
+constexpr char kOverlayDir[] = "/mnt/overlay";
+
 /**
  * @brief Prepares and mounts an overlay filesystem.
  *
+ * Its layers are the lower, updater, upper and work directories under
+ * kOverlayDir, created if missing.
+ *
  * @param mount_point The target mount point for the overlay filesystem.
- * @return True if the overlay filesystem was successfully mounted (or
- * simulated), false otherwise.
+ * @param options fstab options, applied on top of the layer directories.
+ * @return True if the overlay filesystem was successfully mounted, false
+ * otherwise.
  */
-bool MountOverlayFs(const std::string& mount_point);
+bool MountOverlayFs(const std::string& mount_point, const std::string& options = "");
 
 /**
  * Extracts a key-value pair from a boot configuration string.
@@ -8,16 +8,19 @@
 #include <map>
 #include <unordered_map>
 
+#include "boot_trace.h"
+#include "bootchart.h"
 #include "first_stage_init.h"
 #include "first_stage_mount.h"
 #include "init_parser.h"
 #include "property_manager.h"
 #include "selinux.h"
+#include "ueventd.h"
 #include "vold.h"
 #include "util.h"
 
 #define LOG_TAG "init"
-#include "log_new.h"
+#include <init/log.h>
 #include "action_manager.h"
 
 namespace minimal_systems {
@@ -55,7 +58,10 @@ int SecondStageMain(int argc, char** argv) {
         props.loadProperties("usr/share/etc/prop.default");
 
         // Initialize SELinux policy, contexts, and transitions
-        SetupSelinux(argv);
+        {
+            ScopedBootPhase phase("init.selinux");
+            SetupSelinux(argv);
+        }
         LOGI("SELinux configuration loaded.");
 
         if (auto username_opt = getHomeUser(); username_opt.has_value()) {
@@ -86,10 +92,19 @@ int SecondStageMain(int argc, char** argv) {
         }
 
         // Parse init.rc or similar boot scripts
-        if (!parse_init()) {
+        bool parsed;
+        {
+            ScopedBootPhase phase("init.parse");
+            parsed = parse_init();
+        }
+        if (!parsed) {
             LOGE("Parsing init configurations failed. Exiting...");
             return EXIT_FAILURE;
         }
+
+        // ueventd.rc rules and firmware_directories are known now
+        StartUeventd();
+
         am.QueueBuiltinAction([]() {
             LOGI("SetupCgroups running...");
             // perform setup
@@ -104,6 +119,8 @@ int SecondStageMain(int argc, char** argv) {
         // Simulate main loop
         while (true) {
             am.ExecuteNext();
+            BootTraceCheckDump();
+            BootchartCheckStop();
         }
     
         LOGI("Initialization configurations parsed successfully.");
@@ -0,0 +1,103 @@
+// init_logfmt.cpp — Formats a binary boot log as text, on the host or on device
+//
+// Usage: init_logfmt [-v <format>]... <file>
+//
+// -v takes the same format names and modifiers as logcat (threadtime, color,
+// usec, monotonic, ...). Without it lines are printed as "threadtime".
+
+#include <log/logprint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "binary_log.h"
+#include "log_pipeline.h"
+
+using namespace minimal_systems::init;
+
+static void Usage(const char* argv0) {
+    fprintf(stderr, "usage: %s [-v <format>]... <file>\n", argv0);
+}
+
+int main(int argc, char** argv) {
+    LinuxLogFormat* format = linux_log_format_new();
+    bool monotonic = false;
+    bool format_set = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "v:h")) != -1) {
+        if (opt != 'v') {
+            Usage(argv[0]);
+            return opt == 'h' ? 0 : 1;
+        }
+        LinuxLogPrintFormat print_format = linux_log_formatFromString(optarg);
+        if (print_format == FORMAT_OFF) {
+            fprintf(stderr, "%s: unknown format '%s'\n", argv[0], optarg);
+            return 1;
+        }
+        if (print_format == FORMAT_MODIFIER_MONOTONIC) monotonic = true;
+        if (print_format < FORMAT_MODIFIER_COLOR) format_set = true;
+        linux_log_setPrintFormat(format, print_format);
+    }
+    if (optind + 1 != argc) {
+        Usage(argv[0]);
+        return 1;
+    }
+    if (!format_set) linux_log_setPrintFormat(format, FORMAT_THREADTIME);
+
+    BinaryLogSummary summary;
+    std::string err;
+    bool ok;
+    bool written;
+    int write_errno;
+    {
+        // Lines are formatted into large buffers and written with writev()
+        // from a second thread while decoding goes on; short writes are
+        // resumed there. The pipeline must go before the format.
+        LogPipeline::Options options;
+        options.threaded = true;
+        LogPipeline pipeline(format, options);
+
+        ok = BinaryLogDecode(
+                argv[optind],
+                [&](const BinaryLogLine& line) {
+                    // Wall-clock time is reconstructed from the offset taken when
+                    // the log was created; -v monotonic prints seconds since boot.
+                    int64_t ns = static_cast<int64_t>(line.timestamp_ns);
+                    if (!monotonic) ns += summary.realtime_offset_ns;
+
+                    LinuxLogEntry entry = {};
+                    entry.tv_sec = ns / 1000000000;
+                    entry.tv_nsec = ns % 1000000000;
+                    entry.priority = static_cast<linux_LogPriority>(line.prio);
+                    entry.uid = 0;
+                    entry.pid = line.pid;
+                    entry.tid = line.tid;
+                    entry.tag = line.tag.c_str();
+                    entry.tagLen = line.tag.size();
+                    entry.message = line.message.c_str();
+                    entry.messageLen = line.message.size();
+                    pipeline.Add(entry);
+                },
+                &summary, &err);
+        written = pipeline.Flush();
+        write_errno = pipeline.error();
+    }
+    linux_log_format_free(format);
+
+    if (!ok) {
+        fprintf(stderr, "%s: %s\n", argv[0], err.c_str());
+        return 1;
+    }
+    if (!written) {
+        fprintf(stderr, "%s: write failed: %s\n", argv[0], strerror(write_errno));
+        return 1;
+    }
+    if (summary.dropped) {
+        fprintf(stderr, "%s: %u lines did not fit in the log and were written as text\n",
+                argv[0], summary.dropped);
+    }
+    return 0;
+}
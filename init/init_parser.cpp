@@ -19,7 +19,8 @@
 #include <string>
 #include <vector>
 
-#include "log_new.h"
+#include <init/log.h>
+#include "boot_trace.h"
 #include "property_manager.h"
 #include "service.h"
 #include "ueventhandler.h"
@@ -98,6 +99,7 @@ bool starts_with(const std::string& line, const std::string& prefix) {
  * @return true if the file was parsed successfully, false otherwise
  */
 bool parse_rc_file(const std::string& filepath) {
+    ScopedBootTrace trace(kTraceParse, filepath);
     std::ifstream file(filepath);
     std::string line;
     std::string current_block;
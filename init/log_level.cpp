@@ -0,0 +1,61 @@
+// log_level.cpp — Per-tag runtime log levels read from log.tag.<TAG> properties
+
+#include <init/log.h>
+
+#include <ctype.h>
+
+#include <string>
+
+#include "property_manager.h"
+
+namespace minimal_systems {
+namespace init {
+
+namespace {
+
+// Maps a logcat-style level ("D", "debug", "S", ...) to a priority, or -1.
+int ParseLevel(const std::string& value) {
+    if (value.empty()) return -1;
+    switch (toupper(static_cast<unsigned char>(value[0]))) {
+        case 'V':
+            return LINUX_LOG_VERBOSE;
+        case 'D':
+            return LINUX_LOG_DEBUG;
+        case 'I':
+            return LINUX_LOG_INFO;
+        case 'W':
+            return LINUX_LOG_WARN;
+        case 'E':
+            return LINUX_LOG_ERROR;
+        case 'F':
+        case 'A':
+            return LINUX_LOG_FATAL;
+        case 'S':
+            return LINUX_LOG_SILENT;
+        default:
+            return -1;
+    }
+}
+
+}  // namespace
+
+uint64_t LogTagLevel::CurrentGeneration() {
+    return PropertyManager::instance().generation();
+}
+
+void LogTagLevel::Refresh() {
+    // Read the generation first: a change racing with the lookups below
+    // leaves the cache stale by one generation and triggers another refresh.
+    uint64_t generation = CurrentGeneration();
+    auto& properties = PropertyManager::instance();
+
+    int level = ParseLevel(properties.get(std::string("log.tag.") + tag_));
+    if (level < 0) level = ParseLevel(properties.get("log.tag"));
+    if (level < 0) level = LINUX_LOG_VERBOSE;
+
+    level_.store(level, std::memory_order_relaxed);
+    generation_.store(generation, std::memory_order_relaxed);
+}
+
+}  // namespace init
+}  // namespace minimal_systems
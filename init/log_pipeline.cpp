@@ -0,0 +1,346 @@
+// log_pipeline.cpp — Batched read → filter → format → writev pipeline over logprint
+
+#include "log_pipeline.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+
+namespace minimal_systems {
+namespace init {
+
+namespace {
+
+// Room kept free at the end of an arena; lines that need more are malloc()ed
+// by linux_log_formatLogLine() and written from their own buffer.
+constexpr size_t kArenaSlack = 4096;
+
+// Input chunks queued ahead of the formatter before Submit() blocks.
+constexpr size_t kMaxQueuedInput = 8;
+
+// Scratch for event-log entries rendered to text.
+constexpr size_t kBinaryMessageSize = 4096;
+
+#ifdef IOV_MAX
+constexpr size_t kMaxIov = IOV_MAX;
+#else
+constexpr size_t kMaxIov = 1024;
+#endif
+
+}  // namespace
+
+LogPipeline::LogPipeline(LinuxLogFormat* format, const Options& options)
+    : format_(format), options_(options), binary_msg_(kBinaryMessageSize) {
+    options_.arena_size = std::max(options_.arena_size, 2 * kArenaSlack);
+    options_.num_arenas = std::max<size_t>(options_.num_arenas, 2);
+    if (!options_.threaded) {
+        options_.num_arenas = 1;
+    }
+    for (size_t i = 0; i < options_.num_arenas; ++i) {
+        char* arena = static_cast<char*>(malloc(options_.arena_size));
+        if (!arena) break;
+        all_arenas_.push_back(arena);
+        free_arenas_.push_back(arena);
+    }
+    if (all_arenas_.empty()) {
+        Fail(ENOMEM);
+        options_.threaded = false;
+        return;
+    }
+
+    if (options_.threaded) {
+        formatter_ = std::thread(&LogPipeline::FormatLoop, this);
+        writer_ = std::thread(&LogPipeline::WriteLoop, this);
+    }
+}
+
+LogPipeline::~LogPipeline() {
+    Flush();
+    if (options_.threaded) {
+        {
+            std::lock_guard<std::mutex> lock(lock_);
+            stopping_ = true;
+        }
+        cv_.notify_all();
+        formatter_.join();
+        writer_.join();
+    }
+    for (char* line : current_.owned) free(line);
+    for (auto& batch : output_) {
+        for (char* line : batch.owned) free(line);
+    }
+    for (char* arena : all_arenas_) free(arena);
+}
+
+bool LogPipeline::Submit(const void* data, size_t len) {
+    if (error()) return false;
+    const char* bytes = static_cast<const char*>(data);
+
+    if (!options_.threaded) {
+        std::vector<char> input(bytes, bytes + len);
+        Process(input);
+        return !error();
+    }
+
+    std::unique_lock<std::mutex> lock(lock_);
+    cv_.wait(lock, [this] { return input_.size() < kMaxQueuedInput || error(); });
+    if (error()) return false;
+    input_.emplace_back(bytes, bytes + len);
+    lock.unlock();
+    cv_.notify_all();
+    return true;
+}
+
+bool LogPipeline::Add(const LinuxLogEntry& entry) {
+    if (error()) return false;
+    stats_.entries++;
+    FormatLine(entry);
+    return !error();
+}
+
+bool LogPipeline::Flush() {
+    if (!options_.threaded) {
+        if (!error()) Dispatch();
+        return !error();
+    }
+
+    std::unique_lock<std::mutex> lock(lock_);
+    uint64_t target = ++flush_requests_;
+    cv_.notify_all();
+    cv_.wait(lock, [this, target] { return flushes_done_ >= target || error(); });
+    return !error();
+}
+
+void LogPipeline::FormatLoop() {
+    std::unique_lock<std::mutex> lock(lock_);
+    uint64_t flushes_seen = 0;
+    while (true) {
+        cv_.wait(lock, [this, flushes_seen] {
+            return !input_.empty() || flush_requests_ > flushes_seen || stopping_;
+        });
+        if (!input_.empty()) {
+            std::vector<char> input = std::move(input_.front());
+            input_.pop_front();
+            lock.unlock();
+            cv_.notify_all();
+            if (!error()) Process(input);
+            lock.lock();
+            continue;
+        }
+        if (flush_requests_ > flushes_seen) {
+            // Everything submitted before the request has been formatted.
+            flushes_seen = flush_requests_;
+            lock.unlock();
+            Dispatch();
+            lock.lock();
+            output_.emplace_back();
+            output_.back().flush_id = flushes_seen;
+            cv_.notify_all();
+            continue;
+        }
+        if (stopping_) return;
+    }
+}
+
+void LogPipeline::WriteLoop() {
+    std::unique_lock<std::mutex> lock(lock_);
+    while (true) {
+        cv_.wait(lock, [this] { return !output_.empty() || stopping_; });
+        if (output_.empty()) return;
+
+        Batch batch = std::move(output_.front());
+        output_.pop_front();
+        if (batch.flush_id) {
+            flushes_done_ = std::max(flushes_done_, batch.flush_id);
+            cv_.notify_all();
+            continue;
+        }
+        lock.unlock();
+        if (!error()) WriteBatch(batch);
+        lock.lock();
+        Recycle(batch);
+        cv_.notify_all();
+    }
+}
+
+void LogPipeline::Process(std::vector<char>& input) {
+    std::vector<char>* buf = &input;
+    if (!pending_.empty()) {
+        pending_.insert(pending_.end(), input.begin(), input.end());
+        buf = &pending_;
+    }
+
+    std::vector<char> aligned;
+    size_t off = 0;
+    size_t size = buf->size();
+    while (size - off >= sizeof(struct logger_entry) && !error()) {
+        char* p = buf->data() + off;
+        struct logger_entry header;
+        memcpy(&header, p, sizeof(header));
+        if (header.hdr_size < sizeof(struct logger_entry)) {
+            // There is no way to find the next entry; the stream is lost.
+            stats_.malformed++;
+            Fail(EBADMSG);
+            return;
+        }
+        size_t total = static_cast<size_t>(header.hdr_size) + header.len;
+        if (size - off < total) break;
+
+        if (reinterpret_cast<uintptr_t>(p) % alignof(struct logger_entry) != 0) {
+            aligned.assign(p, p + total);
+            p = aligned.data();
+        }
+        FormatEntry(reinterpret_cast<struct logger_entry*>(p));
+        off += total;
+    }
+
+    std::vector<char> rest(buf->begin() + off, buf->end());
+    pending_.swap(rest);
+}
+
+void LogPipeline::FormatEntry(struct logger_entry* buf) {
+    stats_.entries++;
+
+    LinuxLogEntry entry;
+    int err;
+    if (buf->lid == LOG_ID_EVENTS || buf->lid == LOG_ID_SECURITY) {
+        err = linux_log_processBinaryLogBuffer(buf, &entry, nullptr, binary_msg_.data(),
+                                               binary_msg_.size());
+    } else {
+        err = linux_log_processLogBuffer(buf, &entry);
+    }
+    if (err < 0) {
+        stats_.malformed++;
+        return;
+    }
+    FormatLine(entry);
+}
+
+void LogPipeline::FormatLine(const LinuxLogEntry& entry) {
+    if (!linux_log_shouldPrintLine(format_, entry.tag, entry.priority)) return;
+    stats_.printed++;
+
+    if (!current_.arena || options_.arena_size - current_.used < kArenaSlack ||
+        current_.iov.size() + 2 > kMaxIov) {
+        Dispatch();
+        if (!current_.arena) current_.arena = TakeArena();
+        if (!current_.arena) return;
+    }
+
+    char* dst = current_.arena + current_.used;
+    size_t len;
+    char* line = linux_log_formatLogLine(format_, dst, options_.arena_size - current_.used, &entry,
+                                         &len);
+    if (!line) {
+        Fail(ENOMEM);
+        return;
+    }
+    if (line != dst) {
+        current_.owned.push_back(line);
+    } else {
+        current_.used += len;
+    }
+    Append(line, len);
+}
+
+void LogPipeline::Append(char* line, size_t len) {
+    // Consecutive lines in the arena share one iovec.
+    if (!current_.iov.empty()) {
+        struct iovec& last = current_.iov.back();
+        if (static_cast<char*>(last.iov_base) + last.iov_len == line) {
+            last.iov_len += len;
+            return;
+        }
+    }
+    current_.iov.push_back({line, len});
+}
+
+void LogPipeline::Dispatch() {
+    if (current_.iov.empty()) return;
+
+    if (!options_.threaded) {
+        // Write in place and keep the arena for the next batch.
+        WriteBatch(current_);
+        for (char* line : current_.owned) free(line);
+        current_.owned.clear();
+        current_.iov.clear();
+        current_.used = 0;
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(lock_);
+        output_.push_back(std::move(current_));
+    }
+    cv_.notify_all();
+    current_ = Batch();
+}
+
+void LogPipeline::WriteBatch(Batch& batch) {
+    struct iovec* iov = batch.iov.data();
+    size_t iovcnt = batch.iov.size();
+    while (iovcnt > 0) {
+        ssize_t n = writev(options_.out_fd, iov, std::min(iovcnt, kMaxIov));
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            Fail(errno);
+            return;
+        }
+        if (n == 0) {
+            // Nothing written and no error; retrying would spin.
+            Fail(EIO);
+            return;
+        }
+        stats_.writes++;
+        stats_.bytes += n;
+        // Skip what was written, resuming inside a partially written iovec.
+        while (iovcnt > 0 && static_cast<size_t>(n) >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+// Frees a written batch's own lines and returns its arena; lock_ held if threaded.
+void LogPipeline::Recycle(Batch& batch) {
+    for (char* line : batch.owned) free(line);
+    batch.owned.clear();
+    batch.iov.clear();
+    batch.used = 0;
+    if (batch.arena) {
+        free_arenas_.push_back(batch.arena);
+        batch.arena = nullptr;
+    }
+}
+
+char* LogPipeline::TakeArena() {
+    std::unique_lock<std::mutex> lock(lock_, std::defer_lock);
+    if (options_.threaded) {
+        lock.lock();
+        // Wait for the writer to hand one back.
+        cv_.wait(lock, [this] { return !free_arenas_.empty() || error(); });
+    }
+    if (free_arenas_.empty()) return nullptr;
+    char* arena = free_arenas_.back();
+    free_arenas_.pop_back();
+    return arena;
+}
+
+// Latches the first error and wakes every waiter; never called with lock_ held.
+void LogPipeline::Fail(int err) {
+    int expected = 0;
+    std::lock_guard<std::mutex> lock(lock_);
+    error_.compare_exchange_strong(expected, err ? err : EIO);
+    cv_.notify_all();
+}
+
+}  // namespace init
+}  // namespace minimal_systems
@@ -0,0 +1,135 @@
+// log_pipeline.h — Batched read → filter → format → writev pipeline over logprint
+#ifndef MINIMAL_SYSTEMS_INIT_LOG_PIPELINE_H_
+#define MINIMAL_SYSTEMS_INIT_LOG_PIPELINE_H_
+
+#include <log/logprint.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace minimal_systems {
+namespace init {
+
+/**
+ * Streams raw logger_entry records to a file descriptor.
+ *
+ * Callers hand over bytes as they read them, in any chunking; entries split
+ * across chunks are reassembled. Readers that decode their own records, such
+ * as init_logfmt, pass LinuxLogEntry values to Add() instead. Each entry is
+ * filtered with
+ * linux_log_shouldPrintLine() and formatted with linux_log_formatLogLine()
+ * straight into a reusable output arena, and full arenas are written with
+ * one writev() each.
+ *
+ * With `threaded` set, parsing and formatting run on one worker and writing
+ * on another, so the caller only copies its input. Add() formats on the
+ * caller's thread and leaves only the writing to a worker; do not mix it with
+ * Submit() on a threaded pipeline. Errors are latched rather
+ * than fatal: once a write fails, later calls return false and error()
+ * reports the errno.
+ *
+ * A pipeline is not itself thread-safe; use one per reader.
+ */
+class LogPipeline {
+  public:
+    struct Options {
+        int out_fd = STDOUT_FILENO;
+        size_t arena_size = 1 << 20;  // Output buffered before a write.
+        size_t num_arenas = 3;        // Arenas in flight when threaded.
+        bool threaded = false;
+    };
+
+    struct Stats {
+        uint64_t entries = 0;  // Entries parsed.
+        uint64_t printed = 0;  // Entries that passed the filter.
+        uint64_t bytes = 0;    // Bytes written.
+        uint64_t writes = 0;   // writev() calls.
+        uint64_t malformed = 0;
+    };
+
+    // `format` must outlive the pipeline and is used only by its formatter.
+    LogPipeline(LinuxLogFormat* format, const Options& options);
+    ~LogPipeline();
+
+    LogPipeline(const LogPipeline&) = delete;
+    LogPipeline& operator=(const LogPipeline&) = delete;
+
+    /**
+     * Queues `len` bytes of back-to-back logger_entry records. A trailing
+     * partial entry is kept until the next call. Returns false if the
+     * pipeline has failed.
+     */
+    bool Submit(const void* data, size_t len);
+
+    /**
+     * Filters and formats one decoded entry. Its strings are copied into the
+     * output before this returns. Returns false if the pipeline has failed.
+     */
+    bool Add(const LinuxLogEntry& entry);
+
+    // Writes out everything submitted so far and waits for it.
+    bool Flush();
+
+    // errno of the first failure, or 0.
+    int error() const { return error_.load(std::memory_order_acquire); }
+
+    // Counters; stable only after Flush().
+    const Stats& stats() const { return stats_; }
+
+  private:
+    struct Batch {
+        char* arena = nullptr;
+        std::vector<struct iovec> iov;
+        std::vector<char*> owned;  // Lines too large for the arena.
+        size_t used = 0;
+        uint64_t flush_id = 0;  // Set on the empty batch that completes a Flush().
+    };
+
+    void FormatLoop();
+    void WriteLoop();
+
+    void Process(std::vector<char>& input);
+    void FormatEntry(struct logger_entry* buf);
+    void FormatLine(const LinuxLogEntry& entry);
+    void Append(char* line, size_t len);
+    void Dispatch();
+    void WriteBatch(Batch& batch);
+    void Recycle(Batch& batch);
+    char* TakeArena();
+    void Fail(int err);
+
+    LinuxLogFormat* format_;
+    Options options_;
+    Stats stats_;
+    std::atomic<int> error_{0};
+
+    std::vector<char> pending_;  // Unparsed tail of the input.
+    Batch current_;
+    std::vector<char> binary_msg_;
+
+    // Threaded mode: input chunks → formatter → batches → writer.
+    std::mutex lock_;
+    std::condition_variable cv_;
+    std::deque<std::vector<char>> input_;
+    std::deque<Batch> output_;
+    std::vector<char*> free_arenas_;
+    std::vector<char*> all_arenas_;
+    uint64_t flush_requests_ = 0;
+    uint64_t flushes_done_ = 0;
+    bool stopping_ = false;
+    std::thread formatter_;
+    std::thread writer_;
+};
+
+}  // namespace init
+}  // namespace minimal_systems
+
+#endif  // MINIMAL_SYSTEMS_INIT_LOG_PIPELINE_H_
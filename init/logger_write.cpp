@@ -1,14 +1,26 @@
 #include <errno.h>
 #include <fcntl.h>
+#include <linux/futex.h>
 #include <log/logprint.h>
 #include <minimal_systems/log.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
 #include <time.h>
 #include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+
+#include "binary_log.h"
+#include "logger_write.h"
+
 #define LOG_BUF_SIZE 1024
 
 /*
@@ -21,7 +33,48 @@
 #define LINUX_COLOR_YELLOW 33
 #define KMSG_PATH "/dev/kmsg"
 
-static bool kernel_logging_enabled = true;
+/*
+ * Log lines are handed to a background writer through a bounded MPSC ring of
+ * fixed-size records. Callers only format their message into a claimed slot;
+ * timestamps, colors and the writes to stderr and /dev/kmsg happen on the
+ * writer thread, which drains the ring in batches with writev(). A caller that
+ * finds the ring full drains a batch itself. In a forked child, or if the
+ * writer cannot be started, lines are written synchronously instead, so
+ * nothing is dropped.
+ */
+#define LOG_RING_SIZE 256  // Must be a power of two.
+#define LOG_BATCH_SIZE 32
+#define LOG_LINE_SIZE (LOG_BUF_SIZE + 96)
+#define LOG_TAG_SIZE 32
+
+struct LogRecord {
+    std::atomic<size_t> seq;  // Slot is free at seq == pos, published at seq == pos + 1.
+    struct timespec ts;
+    int prio;
+    char tag[LOG_TAG_SIZE];
+    char msg[LOG_BUF_SIZE];  // Always ends with a newline.
+};
+
+enum WriterState { WRITER_NOT_STARTED, WRITER_RUNNING, WRITER_SYNCHRONOUS };
+
+static LogRecord log_ring[LOG_RING_SIZE];
+static std::atomic<size_t> enqueue_pos{0};
+static std::atomic<int> writer_state{WRITER_NOT_STARTED};
+static std::once_flag writer_once;
+
+// The single consumer: the writer thread, or a flushing caller.
+static std::mutex consumer_lock;
+static size_t dequeue_pos = 0;
+
+// Futex word the writer sleeps on while the ring is empty.
+static std::atomic<uint32_t> writer_wake{0};
+static std::atomic<bool> writer_sleeping{false};
+
+static pid_t cached_pid;
+static uid_t cached_uid;
+
+static std::atomic<int> kmsg_fd{-1};
+static std::atomic<bool> kernel_logging_enabled{true};
 
 static char priorityToChar(int prio) {
     switch (prio) {
@@ -62,123 +115,350 @@ static int colorFromPri(int prio) {
     }
 }
 
-// Format the current timestamp
-static void formatTimestamp(char* buffer, size_t bufferSize) {
-    struct timespec ts;
-    struct tm tm;
-    clock_gettime(CLOCK_REALTIME, &ts);
-    localtime_r(&ts.tv_sec, &tm);
+// Kernel priority levels (0 - emergency, 7 - debug)
+static int kernelPriority(int prio) {
+    switch (prio) {
+        case 2:
+            return 7;
+        case 3:
+            return 6;
+        case 4:
+            return 5;
+        case 5:
+            return 4;
+        case 6:
+            return 3;
+        case 7:
+            return 2;
+        default:
+            return 5;
+    }
+}
 
-    snprintf(buffer, bufferSize, "%02d-%02d %02d:%02d:%02d.%03ld", tm.tm_mon + 1, tm.tm_mday,
-             tm.tm_hour, tm.tm_min, tm.tm_sec, ts.tv_nsec / 1000000);
+// Formatted local time of the last second seen by one consumer. init never
+// changes TZ after boot, so only the second is checked.
+struct TimestampCache {
+    time_t sec = -1;
+    char prefix[32];  // "MM-DD HH:MM:SS."
+};
+
+// Format a record's timestamp as "MM-DD HH:MM:SS.mmm"
+static void formatTimestamp(const struct timespec& ts, TimestampCache* cache, char* buffer) {
+    if (ts.tv_sec != cache->sec) {
+        struct tm tm;
+        localtime_r(&ts.tv_sec, &tm);
+        snprintf(cache->prefix, sizeof(cache->prefix), "%02d-%02d %02d:%02d:%02d.",
+                 tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec);
+        cache->sec = ts.tv_sec;
+    }
+    memcpy(buffer, cache->prefix, 15);
+    long ms = ts.tv_nsec / 1000000;
+    buffer[15] = '0' + ms / 100;
+    buffer[16] = '0' + ms / 10 % 10;
+    buffer[17] = '0' + ms % 10;
+    buffer[18] = '\0';
 }
 
-// Log to kernel message buffer
-static void log_to_kernel(int prio, const char* message) {
-    // If kernel logging is disabled due to a previous failure, return early
-    if (!kernel_logging_enabled) {
-        return;
+// Format the stderr line for a record; returns its length
+static size_t formatLine(const LogRecord& rec, pid_t pid, uid_t uid, TimestampCache* cache,
+                         char* line) {
+    char timestamp[19];
+    formatTimestamp(rec.ts, cache, timestamp);
+    int len = snprintf(line, LOG_LINE_SIZE, "\033[0;%dm%s %-8s %-8d %-8u %c %s\033[0m",
+                       colorFromPri(rec.prio), timestamp, rec.tag, pid, uid,
+                       priorityToChar(rec.prio), rec.msg);
+    if (len < 0) return 0;
+    return std::min(static_cast<size_t>(len), static_cast<size_t>(LOG_LINE_SIZE - 1));
+}
+
+// Write all of iov, resuming after partial writes
+static void writeFully(int fd, struct iovec* iov, int iovcnt) {
+    while (iovcnt > 0) {
+        ssize_t n = writev(fd, iov, iovcnt);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        while (iovcnt > 0 && static_cast<size_t>(n) >= iov->iov_len) {
+            n -= iov->iov_len;
+            ++iov;
+            --iovcnt;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = static_cast<char*>(iov->iov_base) + n;
+            iov->iov_len -= n;
+        }
     }
+}
 
-    int fd = open(KMSG_PATH, O_WRONLY | O_APPEND);
+// Returns the persistent /dev/kmsg fd, opening it on first use
+static int getKmsgFd() {
+    int fd = kmsg_fd.load(std::memory_order_acquire);
+    if (fd >= 0 || !kernel_logging_enabled.load(std::memory_order_relaxed)) {
+        return fd;
+    }
+    fd = open(KMSG_PATH, O_WRONLY | O_APPEND | O_CLOEXEC);
     if (fd < 0) {
         if (errno == EACCES) {
             // Disable kernel logging to prevent spam
             kernel_logging_enabled = false;
         }
-        perror("Failed to open /dev/kmsg");
-        return;
+        return -1;
     }
+    int expected = -1;
+    if (!kmsg_fd.compare_exchange_strong(expected, fd)) {
+        close(fd);
+        fd = expected;
+    }
+    return fd;
+}
 
-    // Kernel priority levels (0 - emergency, 7 - debug)
-    int kernel_prio;
-    switch (prio) {
-        case 2:
-            kernel_prio = 7;
-            break;
-        case 3:
-            kernel_prio = 6;
-            break;
-        case 4:
-            kernel_prio = 5;
-            break;
-        case 5:
-            kernel_prio = 4;
-            break;
-        case 6:
-            kernel_prio = 3;
-            break;
-        case 7:
-            kernel_prio = 2;
-            break;
-        default:
-            kernel_prio = 5;
-            break;
+// Log to kernel message buffer; each writev() is one kmsg record
+static void log_to_kernel(int prio, const char* message) {
+    int fd = getKmsgFd();
+    if (fd < 0) {
+        return;
     }
 
-    // Ensure no trailing newline before writing
+    char prefix[16];
+    int prefix_len = snprintf(prefix, sizeof(prefix), "<%d>Init: ", kernelPriority(prio));
     size_t len = strlen(message);
-    char msg_clean[LOG_BUF_SIZE];
-
     if (len > 0 && message[len - 1] == '\n') {
-        snprintf(msg_clean, sizeof(msg_clean), "Init: %.*s", (int)(len - 1), message);
-    } else {
-        snprintf(msg_clean, sizeof(msg_clean), "Init: %s", message);
+        len--;
     }
+    struct iovec iov[2] = {{prefix, static_cast<size_t>(prefix_len)},
+                           {const_cast<char*>(message), len}};
+    writeFully(fd, iov, 2);
+}
 
-    // Write formatted message to /dev/kmsg
-    dprintf(fd, "<%d>%s", kernel_prio, msg_clean);
-    close(fd);
+// Writes one record on the calling thread
+static void writeSynchronously(const LogRecord& rec) {
+    TimestampCache cache;
+    char line[LOG_LINE_SIZE];
+    size_t len = formatLine(rec, getpid(), getuid(), &cache, line);
+    struct iovec iov = {line, len};
+    writeFully(STDERR_FILENO, &iov, 1);
+    if (rec.prio >= LINUX_LOG_WARN) {
+        log_to_kernel(rec.prio, rec.msg);
+    }
 }
 
-int __linux_log_print(int prio, const char* tag, const char* fmt, ...) {
-    va_list args;
+static bool ringEmpty() {
+    const LogRecord& rec = log_ring[dequeue_pos & (LOG_RING_SIZE - 1)];
+    return rec.seq.load(std::memory_order_acquire) != dequeue_pos + 1;
+}
 
-    // Start variable argument processing
-    va_start(args, fmt);
+// Writes out up to one batch of records; consumer_lock must be held
+static size_t drainBatch() {
+    static TimestampCache cache;
+    static char lines[LOG_BATCH_SIZE][LOG_LINE_SIZE];
+    struct iovec iov[LOG_BATCH_SIZE];
+    size_t count = 0;
 
-    // Allocate a buffer for the raw log message
-    char buffer[LOG_BUF_SIZE];
-    vsnprintf(buffer, sizeof(buffer), fmt, args);
+    while (count < LOG_BATCH_SIZE && !ringEmpty()) {
+        LogRecord& rec = log_ring[dequeue_pos & (LOG_RING_SIZE - 1)];
+        size_t len = formatLine(rec, cached_pid, cached_uid, &cache, lines[count]);
+        iov[count] = {lines[count], len};
+        if (rec.prio >= LINUX_LOG_WARN) {
+            log_to_kernel(rec.prio, rec.msg);
+        }
+        rec.seq.store(dequeue_pos + LOG_RING_SIZE, std::memory_order_release);
+        dequeue_pos++;
+        count++;
+    }
+    if (count > 0) {
+        writeFully(STDERR_FILENO, iov, static_cast<int>(count));
+    }
+    return count;
+}
 
-    // End variable argument processing
-    va_end(args);
+static void* writerLoop(void*) {
+    sigset_t mask;
+    sigfillset(&mask);
+    pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+
+    while (true) {
+        size_t written;
+        {
+            std::lock_guard<std::mutex> guard(consumer_lock);
+            written = drainBatch();
+        }
+        if (written > 0) continue;
+
+        // Pairs with the fence in __linux_log_print() so either the producer
+        // sees writer_sleeping or we see its record.
+        uint32_t wake = writer_wake.load();
+        writer_sleeping = true;
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool empty;
+        {
+            std::lock_guard<std::mutex> guard(consumer_lock);
+            empty = ringEmpty();
+        }
+        if (empty) {
+            syscall(SYS_futex, &writer_wake, FUTEX_WAIT_PRIVATE, wake, nullptr, nullptr, 0);
+        }
+        writer_sleeping = false;
+    }
+    return nullptr;
+}
+
+// A forked child has no writer thread; it logs synchronously until exec.
+static void onForkChild() {
+    minimal_systems::init::BinaryLogDetach();
+    if (writer_state.load() == WRITER_RUNNING) {
+        writer_state = WRITER_SYNCHRONOUS;
+    }
+}
+
+static void startWriter() {
+    for (size_t i = 0; i < LOG_RING_SIZE; ++i) {
+        log_ring[i].seq.store(i, std::memory_order_relaxed);
+    }
+    cached_pid = getpid();
+    cached_uid = getuid();
+
+    // Later boot stages inherit the binary log from the first stage.
+    if (const char* path = getenv(minimal_systems::init::kBinaryLogEnv)) {
+        minimal_systems::init::BinaryLogOpen(path);
+    }
+
+    pthread_t thread;
+    if (pthread_create(&thread, nullptr, writerLoop, nullptr) != 0) {
+        writer_state = WRITER_SYNCHRONOUS;
+        return;
+    }
+    pthread_setname_np(thread, "logwriter");
+    pthread_detach(thread);
+    pthread_atfork(nullptr, nullptr, onForkChild);
+    atexit(__linux_log_flush);
+    writer_state.store(WRITER_RUNNING, std::memory_order_release);
+}
+
+// Claims a free slot, or returns nullptr if the ring is full
+static LogRecord* claimSlot(size_t* pos_out) {
+    size_t pos = enqueue_pos.load(std::memory_order_relaxed);
+    while (true) {
+        LogRecord* rec = &log_ring[pos & (LOG_RING_SIZE - 1)];
+        size_t seq = rec->seq.load(std::memory_order_acquire);
+        intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+        if (diff == 0) {
+            if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                *pos_out = pos;
+                return rec;
+            }
+        } else if (diff < 0) {
+            return nullptr;
+        } else {
+            pos = enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+// Formats the caller's message into `rec`
+static void fillRecord(LogRecord* rec, int prio, const char* tag, const char* fmt, va_list args) {
+    clock_gettime(CLOCK_REALTIME, &rec->ts);
+    rec->prio = prio;
+    snprintf(rec->tag, sizeof(rec->tag), "%s", tag ? tag : "default");
+
+    int ret = vsnprintf(rec->msg, sizeof(rec->msg), fmt, args);
+    size_t len = ret < 0 ? 0 : std::min(static_cast<size_t>(ret), sizeof(rec->msg) - 1);
 
     // Ensure a newline at the end of the message
-    size_t len = strlen(buffer);
-    if (len == 0 || buffer[len - 1] != '\n') {
-        if (len + 1 < sizeof(buffer)) {
-            buffer[len] = '\n';
-            buffer[len + 1] = '\0';
+    if (len == 0 || rec->msg[len - 1] != '\n') {
+        if (len + 1 < sizeof(rec->msg)) {
+            rec->msg[len] = '\n';
+            rec->msg[len + 1] = '\0';
         } else {
-            buffer[sizeof(buffer) - 2] = '\n';
-            buffer[sizeof(buffer) - 1] = '\0';
+            rec->msg[sizeof(rec->msg) - 2] = '\n';
+            rec->msg[sizeof(rec->msg) - 1] = '\0';
         }
     }
+}
 
-    // Get current timestamp
-    time_t now = time(NULL);
-    struct tm tm_info;
-    localtime_r(&now, &tm_info);
+int __linux_log_open_binary(const char* path) {
+    if (!minimal_systems::init::BinaryLogOpen(path)) {
+        return -1;
+    }
+    setenv(minimal_systems::init::kBinaryLogEnv, path, 1);
+    return 0;
+}
 
-    // Get current timestamp
-    char timestamp[32];
-    formatTimestamp(timestamp, sizeof(timestamp));
+void __linux_log_flush(void) {
+    if (writer_state.load() != WRITER_RUNNING) {
+        return;
+    }
+    // The writer may be the thread that crashed; don't wait on it forever.
+    for (int attempt = 0; attempt < 1000; ++attempt) {
+        if (consumer_lock.try_lock()) {
+            while (drainBatch() > 0) {
+            }
+            consumer_lock.unlock();
+            return;
+        }
+        usleep(100);
+    }
+}
 
-    // Map priority to character and color
-    char prioChar = priorityToChar(prio);
-    int color = colorFromPri(prio);
+int __linux_log_print(int prio, const char* tag, const char* fmt, ...) {
+    va_list args;
 
-    // Get current UID
-    uid_t uid = getuid();
+    if (writer_state.load(std::memory_order_acquire) == WRITER_NOT_STARTED) {
+        std::call_once(writer_once, startWriter);
+    }
+
+    // In binary mode only warnings and errors are also formatted as text
+    if (minimal_systems::init::BinaryLogActive()) {
+        va_start(args, fmt);
+        bool logged = minimal_systems::init::BinaryLogWrite(prio, tag, fmt, args);
+        va_end(args);
+        if (logged && prio < LINUX_LOG_WARN) {
+            return 1;
+        }
+    }
+
+    size_t pos;
+    LogRecord* rec = nullptr;
+    if (writer_state.load(std::memory_order_acquire) == WRITER_RUNNING) {
+        rec = claimSlot(&pos);
+        // Ring full: help the writer drain rather than overtake our own
+        // queued lines. Only give up if the consumer looks stuck.
+        int busy = 0;
+        while (rec == nullptr && busy < 1000) {
+            if (consumer_lock.try_lock()) {
+                drainBatch();
+                consumer_lock.unlock();
+                busy = 0;
+            } else {
+                usleep(100);
+                busy++;
+            }
+            rec = claimSlot(&pos);
+        }
+    }
 
-    // Print the formatted log message with priority, tag, UID, and message
-    fprintf(stderr, "\033[0;%dm%s %-8s %-8d %-8u %c %s\033[0m", color, timestamp,
-            tag ? tag : "default", getpid(), uid, prioChar, buffer);
+    // Start variable argument processing
+    va_start(args, fmt);
+    if (rec == nullptr) {
+        LogRecord local;
+        fillRecord(&local, prio, tag, fmt, args);
+        va_end(args);
+        writeSynchronously(local);
+        return 1;
+    }
+    fillRecord(rec, prio, tag, fmt, args);
+    va_end(args);
+
+    rec->seq.store(pos + 1, std::memory_order_release);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (writer_sleeping.load(std::memory_order_relaxed)) {
+        writer_wake.fetch_add(1);
+        syscall(SYS_futex, &writer_wake, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+    }
 
-    // If the log priority is WARN or higher (>=5), log to the kernel
-    if (prio >= 5) {
-        log_to_kernel(prio, buffer);
+    // The process is about to abort; get everything out first
+    if (prio >= LINUX_LOG_FATAL) {
+        __linux_log_flush();
     }
 
     return 1;  // Return success
@@ -18,4 +18,21 @@
 
 #include <string>
 
-std::string& GetDefaultTag();
\ No newline at end of file
+std::string& GetDefaultTag();
+
+/**
+ * Writes out every queued log line before returning.
+ *
+ * __linux_log_print() hands lines to a background writer thread. Call this
+ * before anything that would lose them: exec, reboot, or _exit. Normal exit()
+ * flushes automatically.
+ */
+void __linux_log_flush(void);
+
+/**
+ * Switches this process and its exec()ed children to the binary log at
+ * `path`, creating it if needed. Lines below LINUX_LOG_WARN are then stored
+ * unformatted and no longer reach stderr or /dev/kmsg; decode them with
+ * init_logfmt. Returns 0 on success, -1 if the log could not be mapped.
+ */
+int __linux_log_open_binary(const char* path);
@@ -1,5 +1,6 @@
 
 #include <assert.h>
+#include <errno.h>
 #include <inttypes.h>
 #include <limits.h>
 #include <log/log.h>
@@ -8,6 +9,12 @@
 #include <private/linux_logger.h>
 #include "logging/list.h"
 
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #include <cctype>
 #include <cstring>
 #include <list>
@@ -17,15 +24,32 @@
 #define MS_PER_NSEC 1000000
 #define US_PER_NSEC 1000
 
+/*
+ * Per-tag filters live in an open-addressing hash table with linear probing,
+ * kept at most half full. An empty slot has mTag == NULL. Filters are never
+ * removed, so lookups can stop at the first empty slot.
+ */
 typedef struct FilterInfo_t {
     char* mTag;
+    uint32_t mHash;
     linux_LogPriority mPri;
-    struct FilterInfo_t* p_next;
 } FilterInfo;
 
+#define FILTER_TABLE_MIN_SIZE 16
+
 struct LinuxLogFormat_t {
     linux_LogPriority global_pri;
     FilterInfo* filters;
+    size_t filter_capacity; /* power of two, 0 until the first rule */
+    size_t filter_count;
+    /*
+     * The last tag looked up, and the filter it matched (NULL for none).
+     * Readers tend to see runs of lines from the same tag, often through the
+     * same pointer; the copy guards against a buffer reused for another tag.
+     */
+    const char* last_tag;
+    char last_tag_copy[64];
+    const FilterInfo* last_filter;
     LinuxLogPrintFormat format;
     bool colored_output;
     bool usec_time_output;
@@ -62,17 +86,79 @@ static bool descriptive_output = false;
 #define LINUX_COLOR_RED 31
 #define LINUX_COLOR_YELLOW 33
 
-static FilterInfo* filterinfo_new(const char* tag, linux_LogPriority pri) {
-    FilterInfo* p_ret;
+/* FNV-1a */
+static uint32_t filterHash(const char* tag) {
+    uint32_t hash = 2166136261u;
+    for (; *tag; tag++) {
+        hash = (hash ^ (unsigned char)*tag) * 16777619u;
+    }
+    return hash;
+}
+
+/*
+ * Returns the slot holding `tag`, or the empty slot where it would go.
+ * The table must have at least one empty slot.
+ */
+static FilterInfo* filterSlot(FilterInfo* filters, size_t capacity, const char* tag,
+                              uint32_t hash) {
+    size_t mask = capacity - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        FilterInfo* p_fi = &filters[i];
+        if (p_fi->mTag == NULL || (p_fi->mHash == hash && 0 == strcmp(p_fi->mTag, tag))) {
+            return p_fi;
+        }
+    }
+}
 
-    p_ret = (FilterInfo*)calloc(1, sizeof(FilterInfo));
-    p_ret->mTag = strdup(tag);
-    p_ret->mPri = pri;
+static bool filterTableGrow(LinuxLogFormat* p_format) {
+    size_t capacity = p_format->filter_capacity ? p_format->filter_capacity * 2
+                                                : FILTER_TABLE_MIN_SIZE;
+    FilterInfo* filters = (FilterInfo*)calloc(capacity, sizeof(FilterInfo));
+    if (filters == NULL) {
+        return false;
+    }
 
-    return p_ret;
+    for (size_t i = 0; i < p_format->filter_capacity; i++) {
+        FilterInfo* p_old = &p_format->filters[i];
+        if (p_old->mTag != NULL) {
+            *filterSlot(filters, capacity, p_old->mTag, p_old->mHash) = *p_old;
+        }
+    }
+    free(p_format->filters);
+    p_format->filters = filters;
+    p_format->filter_capacity = capacity;
+    p_format->last_tag = NULL;
+    return true;
 }
 
-/* balance to above, filterinfo_free left unimplemented */
+/* Adds a filter for `tag`, replacing any earlier one: the last rule wins. */
+static int filterTableSet(LinuxLogFormat* p_format, const char* tag, size_t tagLen,
+                          linux_LogPriority pri) {
+    if ((p_format->filter_count + 1) * 2 > p_format->filter_capacity &&
+        !filterTableGrow(p_format)) {
+        return -1;
+    }
+
+    char* tagName = (char*)malloc(tagLen + 1);
+    if (tagName == NULL) {
+        return -1;
+    }
+    memcpy(tagName, tag, tagLen);
+    tagName[tagLen] = '\0';
+    uint32_t hash = filterHash(tagName);
+    FilterInfo* p_fi = filterSlot(p_format->filters, p_format->filter_capacity, tagName, hash);
+    if (p_fi->mTag != NULL) {
+        free(tagName);
+    } else {
+        p_fi->mTag = tagName;
+        p_fi->mHash = hash;
+        p_format->filter_count++;
+    }
+    p_fi->mPri = pri;
+    /* The cached lookup may be a miss for the tag that was just added */
+    p_format->last_tag = NULL;
+    return 0;
+}
 
 /*
  * Note: also accepts 0-9 priorities
@@ -149,24 +235,40 @@ static int colorFromPri(linux_LogPriority pri) {
 }
 
 static linux_LogPriority filterPriForTag(LinuxLogFormat* p_format, const char* tag) {
-    FilterInfo* p_curFilter;
+    if (p_format->filter_count == 0) {
+        return p_format->global_pri;
+    }
 
-    for (p_curFilter = p_format->filters; p_curFilter != NULL; p_curFilter = p_curFilter->p_next) {
-        if (0 == strcmp(tag, p_curFilter->mTag)) {
-            if (p_curFilter->mPri == LINUX_LOG_DEFAULT) {
-                return p_format->global_pri;
-            } else {
-                return p_curFilter->mPri;
-            }
+    const FilterInfo* p_fi;
+    if (tag == p_format->last_tag && 0 == strcmp(tag, p_format->last_tag_copy)) {
+        p_fi = p_format->last_filter;
+    } else {
+        p_fi = filterSlot(p_format->filters, p_format->filter_capacity, tag, filterHash(tag));
+        if (p_fi->mTag == NULL) {
+            p_fi = NULL;
+        }
+        /* Tags too long for the copy are simply not cached */
+        size_t len = strlen(tag);
+        if (len < sizeof(p_format->last_tag_copy)) {
+            memcpy(p_format->last_tag_copy, tag, len + 1);
+            p_format->last_tag = tag;
+            p_format->last_filter = p_fi;
+        } else {
+            p_format->last_tag = NULL;
         }
     }
 
-    return p_format->global_pri;
+    if (p_fi == NULL || p_fi->mPri == LINUX_LOG_DEFAULT) {
+        return p_format->global_pri;
+    }
+    return p_fi->mPri;
 }
 
 /**
  * returns 1 if this log line should be printed based on its priority
  * and tag, and 0 if it should not
+ *
+ * Not safe to call on the same p_format from several threads at once
  */
 int linux_log_shouldPrintLine(LinuxLogFormat* p_format, const char* tag, linux_LogPriority pri) {
     return pri >= filterPriForTag(p_format, tag);
@@ -197,16 +299,10 @@ LinuxLogFormat* linux_log_format_new() {
 static list_declare(convertHead);
 
 void linux_log_format_free(LinuxLogFormat* p_format) {
-    FilterInfo *p_info, *p_info_old;
-
-    p_info = p_format->filters;
-
-    while (p_info != NULL) {
-        p_info_old = p_info;
-        p_info = p_info->p_next;
-
-        free(p_info_old);
+    for (size_t i = 0; i < p_format->filter_capacity; i++) {
+        free(p_format->filters[i].mTag);
     }
+    free(p_format->filters);
 
     free(p_format);
 
@@ -358,25 +454,9 @@ int LINUX_LOG_addFilterRule(LinuxLogFormat* p_format, const char* filterExpressi
             pri = LINUX_LOG_VERBOSE;
         }
 
-        char* tagName;
-
-/*
- * Presently HAVE_STRNDUP is never defined, so the second case is always taken
- * Darwin doesn't have strndup, everything else does
- */
-#ifdef HAVE_STRNDUP
-        tagName = strndup(filterExpression, tagNameLength);
-#else
-        /* a few extra bytes copied... */
-        tagName = strdup(filterExpression);
-        tagName[tagNameLength] = '\0';
-#endif /*HAVE_STRNDUP*/
-
-        FilterInfo* p_fi = filterinfo_new(tagName, pri);
-        free(tagName);
-
-        p_fi->p_next = p_format->filters;
-        p_format->filters = p_fi;
+        if (filterTableSet(p_format, filterExpression, tagNameLength, pri) < 0) {
+            goto error;
+        }
     }
 
     return 0;
@@ -487,14 +567,13 @@ int linux_log_processLogBuffer(struct logger_entry* buf, LinuxLogEntry* entry) {
     char* msg = reinterpret_cast<char*>(buf) + buf->hdr_size;
     entry->uid = buf->uid;
 
-    for (i = 1; i < buf->len; i++) {
-        if (msg[i] == '\0') {
-            if (msgStart == -1) {
-                msgStart = i + 1;
-            } else {
-                msgEnd = i;
-                break;
-            }
+    /* memchr() is vectorized by libc; the tag and message are NUL-terminated */
+    const char* nul = static_cast<const char*>(memchr(msg + 1, '\0', buf->len - 1));
+    if (nul != NULL) {
+        msgStart = nul - msg + 1;
+        nul = static_cast<const char*>(memchr(msg + msgStart, '\0', buf->len - msgStart));
+        if (nul != NULL) {
+            msgEnd = nul - msg;
         }
     }
 
@@ -1039,6 +1118,80 @@ int linux_log_processBinaryLogBuffer(
     return result;
 }
 
+/*
+ * Bytes that convertPrintable() copies unchanged: printable ASCII except
+ * backslash, plus tab.
+ */
+static inline bool isPlainByte(unsigned char c) {
+    return (c >= ' ' && c < 0x7f && c != '\\') || c == '\t';
+}
+
+/*
+ * Returns the length of the run of plain bytes at the start of src, checking
+ * 32 (AVX2) or 16 (SSE2, NEON) bytes at a time.
+ */
+static size_t plainSpan(const unsigned char* src, size_t n) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    const __m256i space_minus_one = _mm256_set1_epi8(' ' - 1);
+    const __m256i del = _mm256_set1_epi8(0x7f);
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    const __m256i tab = _mm256_set1_epi8('\t');
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        /* Signed compares: bytes >= 0x80 are negative and fail the first test */
+        __m256i plain = _mm256_and_si256(_mm256_cmpgt_epi8(v, space_minus_one),
+                                         _mm256_cmpgt_epi8(del, v));
+        plain = _mm256_andnot_si256(_mm256_cmpeq_epi8(v, backslash), plain);
+        plain = _mm256_or_si256(plain, _mm256_cmpeq_epi8(v, tab));
+        uint32_t mask = ~static_cast<uint32_t>(_mm256_movemask_epi8(plain));
+        if (mask != 0) return i + __builtin_ctz(mask);
+    }
+#endif
+#if defined(__SSE2__)
+    const __m128i space_minus_one16 = _mm_set1_epi8(' ' - 1);
+    const __m128i del16 = _mm_set1_epi8(0x7f);
+    const __m128i backslash16 = _mm_set1_epi8('\\');
+    const __m128i tab16 = _mm_set1_epi8('\t');
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i plain = _mm_and_si128(_mm_cmpgt_epi8(v, space_minus_one16),
+                                      _mm_cmplt_epi8(v, del16));
+        plain = _mm_andnot_si128(_mm_cmpeq_epi8(v, backslash16), plain);
+        plain = _mm_or_si128(plain, _mm_cmpeq_epi8(v, tab16));
+        uint32_t mask = ~static_cast<uint32_t>(_mm_movemask_epi8(plain)) & 0xffff;
+        if (mask != 0) return i + __builtin_ctz(mask);
+    }
+#elif defined(__ARM_NEON)
+    const uint8x16_t space = vdupq_n_u8(' ');
+    const uint8x16_t del = vdupq_n_u8(0x7f);
+    const uint8x16_t backslash = vdupq_n_u8('\\');
+    const uint8x16_t tab = vdupq_n_u8('\t');
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t v = vld1q_u8(src + i);
+        uint8x16_t plain = vandq_u8(vcgeq_u8(v, space), vcltq_u8(v, del));
+        plain = vbicq_u8(plain, vceqq_u8(v, backslash));
+        plain = vorrq_u8(plain, vceqq_u8(v, tab));
+        /* Narrow each byte to a nibble: a 64-bit mask with 4 bits per byte */
+        uint64_t mask = ~vget_lane_u64(
+                vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(plain), 4)), 0);
+        if (mask != 0) return i + (__builtin_ctzll(mask) >> 2);
+    }
+#endif
+    for (; i < n; i++) {
+        if (!isPlainByte(src[i])) break;
+    }
+    return i;
+}
+
+static inline void writeHexEscape(char* dst, unsigned char c) {
+    static const char hex[] = "0123456789ABCDEF";
+    dst[0] = '\\';
+    dst[1] = 'x';
+    dst[2] = hex[c >> 4];
+    dst[3] = hex[c & 0xf];
+}
+
 /*
  * Convert to printable from src to dst buffer, returning dst bytes used.
  * If dst is NULL, do not copy, but still return the dst bytes required.
@@ -1052,13 +1205,14 @@ size_t convertPrintable(char* dst0, const char* src0, size_t n) {
 
     while (n > 0) {
         // ASCII fast path to cover most logging; space and tab aren't escaped,
-        // but backslash is.
-        if ((*src >= ' ' && *src < 0x7f && *src != '\\') || *src == '\t') {
-            if (print) *dst = *src;
-            dst++;
-            src++;
-            n--;
-            continue;
+        // but backslash is. Whole runs are found and copied at once.
+        size_t span = plainSpan(src, n);
+        if (span > 0) {
+            if (print) memcpy(dst, src, span);
+            dst += span;
+            src += span;
+            n -= span;
+            if (n == 0) break;
         }
 
         // Unprintable fast path #1: single-character C escapes.
@@ -1074,7 +1228,7 @@ size_t convertPrintable(char* dst0, const char* src0, size_t n) {
         }
         // Unprintable fast path #2: everything else below space, plus DEL.
         if (*src < ' ' || *src == 0x7f) {
-            if (print) sprintf(dst, "\\x%02X", *src);
+            if (print) writeHexEscape(dst, *src);
             dst += 4;
             src++;
             n--;
@@ -1090,7 +1244,7 @@ size_t convertPrintable(char* dst0, const char* src0, size_t n) {
             n -= len;
         } else {
             // Assume it's just one bad byte, and try again after escaping it.
-            if (print) sprintf(dst, "\\x%02X", *src);
+            if (print) writeHexEscape(dst, *src);
             dst += 4;
             src++;
             n--;
@@ -1356,6 +1510,58 @@ static void convertMonotonic(struct timespec* result, const AndroidLogEntry* ent
 }
 #endif
 
+/*
+ * Per-thread cache of the local date and time of the last second formatted,
+ * so consecutive lines only add their sub-second digits. It is rebuilt when
+ * the second, the year modifier or $TZ changes.
+ */
+struct TimeCache {
+    time_t sec = 0;
+    bool valid = false;
+    bool year = false;
+    bool tzSet = false;
+    std::string tz;
+    struct tm tm;
+    char text[32]; /* "[YYYY-]MM-DD HH:MM:SS" */
+    size_t textLen = 0;
+    char zone[16]; /* " +hhmm" */
+    size_t zoneLen = 0;
+};
+
+static thread_local TimeCache timeCache;
+
+static const TimeCache* localTimeFor(time_t sec, bool year) {
+    TimeCache* cache = &timeCache;
+    const char* tz = getenv("TZ");
+    if (cache->valid && cache->sec == sec && cache->year == year &&
+        cache->tzSet == (tz != NULL) && (tz == NULL || cache->tz == tz)) {
+        return cache;
+    }
+
+    localtime_r(&sec, &cache->tm);
+    cache->textLen =
+            strftime(cache->text, sizeof(cache->text), &"%Y-%m-%d %H:%M:%S"[year ? 0 : 3],
+                     &cache->tm);
+    cache->zoneLen = strftime(cache->zone, sizeof(cache->zone), " %z", &cache->tm);
+    cache->sec = sec;
+    cache->year = year;
+    cache->tzSet = tz != NULL;
+    cache->tz = tz ? tz : "";
+    cache->valid = true;
+    return cache;
+}
+
+/* Writes '.' and `digits` zero-padded digits of value, which must fit */
+static size_t formatFraction(char* buf, unsigned long value, int digits) {
+    buf[0] = '.';
+    for (int i = digits; i > 0; i--) {
+        buf[i] = '0' + value % 10;
+        value /= 10;
+    }
+    buf[digits + 1] = '\0';
+    return digits + 1;
+}
+
 /**
  * Formats a log message into a buffer
  *
@@ -1367,8 +1573,7 @@ static void convertMonotonic(struct timespec* result, const AndroidLogEntry* ent
 char* linux_log_formatLogLine(LinuxLogFormat* p_format, char* defaultBuffer,
                               size_t defaultBufferSize, const LinuxLogEntry* entry,
                               size_t* p_outLength) {
-    struct tm tmBuf;
-    struct tm* ptm;
+    const struct tm* ptm;
     /* good margin, 23+nul for msec, 26+nul for usec, 29+nul to nsec */
     char timeBuf[64];
     char prefixBuf[128], suffixBuf[128];
@@ -1403,21 +1608,32 @@ char* linux_log_formatLogLine(LinuxLogFormat* p_format, char* defaultBuffer,
         ptm = NULL;
         snprintf(timeBuf, sizeof(timeBuf), p_format->monotonic_output ? "%6lld" : "%19lld",
                  (long long)now);
+        len = strlen(timeBuf);
     } else {
-        ptm = localtime_r(&now, &tmBuf);
-        strftime(timeBuf, sizeof(timeBuf), &"%Y-%m-%d %H:%M:%S"[p_format->year_output ? 0 : 3],
-                 ptm);
+        const TimeCache* cache = localTimeFor(now, p_format->year_output);
+        ptm = &cache->tm;
+        memcpy(timeBuf, cache->text, cache->textLen + 1);
+        len = cache->textLen;
     }
-    len = strlen(timeBuf);
-    if (p_format->nsec_time_output) {
-        len += snprintf(timeBuf + len, sizeof(timeBuf) - len, ".%09ld", nsec);
+    if (now < 0) {
+        /* nsec may have carried into a tenth digit; keep the historical output */
+        if (p_format->nsec_time_output) {
+            len += snprintf(timeBuf + len, sizeof(timeBuf) - len, ".%09ld", nsec);
+        } else if (p_format->usec_time_output) {
+            len += snprintf(timeBuf + len, sizeof(timeBuf) - len, ".%06ld", nsec / US_PER_NSEC);
+        } else {
+            len += snprintf(timeBuf + len, sizeof(timeBuf) - len, ".%03ld", nsec / MS_PER_NSEC);
+        }
+    } else if (p_format->nsec_time_output) {
+        len += formatFraction(timeBuf + len, nsec, 9);
     } else if (p_format->usec_time_output) {
-        len += snprintf(timeBuf + len, sizeof(timeBuf) - len, ".%06ld", nsec / US_PER_NSEC);
+        len += formatFraction(timeBuf + len, nsec / US_PER_NSEC, 6);
     } else {
-        len += snprintf(timeBuf + len, sizeof(timeBuf) - len, ".%03ld", nsec / MS_PER_NSEC);
+        len += formatFraction(timeBuf + len, nsec / MS_PER_NSEC, 3);
     }
     if (p_format->zone_output && ptm) {
-        strftime(timeBuf + len, sizeof(timeBuf) - len, " %z", ptm);
+        const TimeCache* cache = &timeCache;
+        memcpy(timeBuf + len, cache->zone, cache->zoneLen + 1);
     }
 
     /*
@@ -1547,9 +1763,12 @@ char* linux_log_formatLogLine(LinuxLogFormat* p_format, char* defaultBuffer,
          * The line-end finding here must match the line-end finding
          * in for ( ... numLines...) loop below
          */
-        while (pm < (entry->message + entry->messageLen)) {
-            if (*pm++ == '\n') numLines++;
+        const char* end = entry->message + entry->messageLen;
+        while ((pm = static_cast<const char*>(memchr(pm, '\n', end - pm))) != NULL) {
+            numLines++;
+            pm++;
         }
+        pm = end;
         /* plus one line for anything not newline-terminated at the end */
         if (pm > entry->message && *(pm - 1) != '\n') numLines++;
     }
@@ -1599,7 +1818,9 @@ char* linux_log_formatLogLine(LinuxLogFormat* p_format, char* defaultBuffer,
             lineStart = pm;
 
             /* Find the next end-of-line in message */
-            while (pm < (entry->message + entry->messageLen) && *pm != '\n') pm++;
+            const char* end = entry->message + entry->messageLen;
+            pm = static_cast<const char*>(memchr(pm, '\n', end - pm));
+            if (pm == NULL) pm = end;
             lineLen = pm - lineStart;
 
             strcat(p, prefixBuf);
@@ -1624,20 +1845,21 @@ char* linux_log_formatLogLine(LinuxLogFormat* p_format, char* defaultBuffer,
     return ret;
 }
 
+/*
+ * Returns the number of bytes written. On failure this is short of the line
+ * length (0 if the line could not be formatted) and errno is set; the caller
+ * decides whether that is fatal, since this also runs inside init.
+ */
 size_t linux_log_printLogLine(LinuxLogFormat* p_format, FILE* fp, const LinuxLogEntry* entry) {
     char buf[4096] __attribute__((__uninitialized__));
     size_t line_length;
     char* line = linux_log_formatLogLine(p_format, buf, sizeof(buf), entry, &line_length);
     if (!line) {
-        fprintf(stderr, "linux_log_formatLogLine failed\n");
-        exit(1);
+        errno = ENOMEM;
+        return 0;
     }
 
     size_t bytesWritten = fwrite(line, 1, line_length, fp);
-    if (bytesWritten != line_length) {
-        perror("fwrite failed");
-        exit(1);
-    }
 
     if (line != buf) free(line);
     return bytesWritten;
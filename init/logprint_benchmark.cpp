@@ -0,0 +1,244 @@
+// logprint_benchmark.cpp — Per-line costs of filtering and formatting in logprint.cpp
+//
+// The formatting benchmarks replay a log corpus: set LOGPRINT_CORPUS to a text
+// dump (dmesg, logcat, a boot log) to measure real data. Without it a
+// synthetic boot log is generated.
+
+#include <fcntl.h>
+#include <log/logprint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include "log_pipeline.h"
+
+size_t convertPrintable(char* dst, const char* src, size_t n);
+
+namespace {
+
+constexpr int kNumTags = 256;
+
+std::vector<std::string> MakeTags() {
+    std::vector<std::string> tags;
+    for (int i = 0; i < kNumTags; ++i) {
+        char tag[32];
+        snprintf(tag, sizeof(tag), "vendor.subsystem%03d", i);
+        tags.emplace_back(tag);
+    }
+    return tags;
+}
+
+// A format with state.range(0) "TAG:LEVEL" rules covering the first tags.
+LinuxLogFormat* MakeFormat(const std::vector<std::string>& tags, int num_filters) {
+    LinuxLogFormat* format = linux_log_format_new();
+    LINUX_LOG_addFilterRule(format, "*:I");
+    for (int i = 0; i < num_filters; ++i) {
+        std::string rule = tags[i] + (i % 2 ? ":V" : ":W");
+        LINUX_LOG_addFilterRule(format, rule.c_str());
+    }
+    return format;
+}
+
+// Lines from tags in random order, as when reading an interleaved buffer.
+void BM_ShouldPrintLineMixed(benchmark::State& state) {
+    std::vector<std::string> tags = MakeTags();
+    LinuxLogFormat* format = MakeFormat(tags, state.range(0));
+    std::mt19937 rng(42);
+    std::vector<const char*> lines(4096);
+    for (auto& line : lines) line = tags[rng() % kNumTags].c_str();
+
+    size_t next = 0;
+    for (auto _ : state) {
+        const char* tag = lines[next++ % lines.size()];
+        benchmark::DoNotOptimize(linux_log_shouldPrintLine(format, tag, LINUX_LOG_DEBUG));
+    }
+    state.SetItemsProcessed(state.iterations());
+    linux_log_format_free(format);
+}
+BENCHMARK(BM_ShouldPrintLineMixed)->Arg(0)->Arg(4)->Arg(16)->Arg(64)->Arg(256);
+
+// Runs of lines from one tag, which the last-tag cache serves.
+void BM_ShouldPrintLineRuns(benchmark::State& state) {
+    std::vector<std::string> tags = MakeTags();
+    LinuxLogFormat* format = MakeFormat(tags, state.range(0));
+
+    size_t next = 0;
+    for (auto _ : state) {
+        const char* tag = tags[(next++ / 64) % kNumTags].c_str();
+        benchmark::DoNotOptimize(linux_log_shouldPrintLine(format, tag, LINUX_LOG_DEBUG));
+    }
+    state.SetItemsProcessed(state.iterations());
+    linux_log_format_free(format);
+}
+BENCHMARK(BM_ShouldPrintLineRuns)->Arg(0)->Arg(4)->Arg(16)->Arg(64)->Arg(256);
+
+std::vector<std::string> LoadCorpus() {
+    std::vector<std::string> lines;
+    if (const char* path = getenv("LOGPRINT_CORPUS")) {
+        std::ifstream in(path);
+        for (std::string line; std::getline(in, line);) lines.push_back(line);
+        if (!lines.empty()) return lines;
+        fprintf(stderr, "LOGPRINT_CORPUS=%s is empty or unreadable\n", path);
+    }
+
+    // Mostly ASCII, with the occasional tab, path, UTF-8 name and control byte.
+    std::mt19937 rng(7);
+    const char* templates[] = {
+            "Loaded module %d from /lib/modules/6.1.0/kernel/drivers/net/m%d.ko in 12ms",
+            "Service 'vendor.hal%d' (pid %d) exited with status 0",
+            "uevent: action=add devpath=/devices/platform/soc/%d.i2c/i2c-%d subsystem=i2c",
+            "\tproperty: ro.boot.slot_suffix=_a ro.build.id=MSYS.%d.%d",
+            "fs_mgr: mounted /dev/block/by-name/userdata on /data (ext4, \xc3\xa9t\xc3\xa9 %d %d)",
+            "avc: denied { read } for pid=%d comm=\"init\" \x1b[0m dev=\"dm-%d\"",
+    };
+    for (int i = 0; i < 20000; ++i) {
+        char line[256];
+        snprintf(line, sizeof(line), templates[rng() % 6], rng() % 1000, rng() % 100);
+        lines.emplace_back(line);
+    }
+    return lines;
+}
+
+const std::vector<std::string>& Corpus() {
+    static const std::vector<std::string> corpus = LoadCorpus();
+    return corpus;
+}
+
+size_t CorpusBytes() {
+    size_t bytes = 0;
+    for (const auto& line : Corpus()) bytes += line.size();
+    return bytes;
+}
+
+// Escapes every corpus line, as "logcat -v printable" does.
+void BM_ConvertPrintable(benchmark::State& state) {
+    std::vector<char> out(16 * 1024);
+    for (auto _ : state) {
+        for (const auto& line : Corpus()) {
+            if (line.size() * 4 + 1 > out.size()) out.resize(line.size() * 4 + 1);
+            benchmark::DoNotOptimize(convertPrintable(out.data(), line.data(), line.size()));
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * CorpusBytes());
+}
+BENCHMARK(BM_ConvertPrintable);
+
+// The corpus as wire-format entries, one buffer each.
+std::vector<std::vector<char>> CorpusEntries() {
+    std::vector<std::vector<char>> entries;
+    for (const auto& line : Corpus()) {
+        size_t len = std::min<size_t>(1 + 8 + line.size() + 1, UINT16_MAX);
+        std::vector<char> raw(sizeof(logger_entry) + len);
+        auto* entry = reinterpret_cast<logger_entry*>(raw.data());
+        entry->len = len;
+        entry->hdr_size = sizeof(logger_entry);
+        char* msg = raw.data() + sizeof(logger_entry);
+        msg[0] = LINUX_LOG_INFO;
+        memcpy(msg + 1, "initlog", 8);
+        memcpy(msg + 9, line.data(), len - 10);
+        msg[len - 1] = '\0';
+        entries.push_back(std::move(raw));
+    }
+    return entries;
+}
+
+// Splits wire-format entries into tag and message.
+void BM_ProcessLogBuffer(benchmark::State& state) {
+    std::vector<std::vector<char>> entries = CorpusEntries();
+    for (auto _ : state) {
+        for (auto& raw : entries) {
+            LinuxLogEntry entry;
+            benchmark::DoNotOptimize(
+                    linux_log_processLogBuffer(reinterpret_cast<logger_entry*>(raw.data()), &entry));
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * CorpusBytes());
+}
+BENCHMARK(BM_ProcessLogBuffer);
+
+// Formats every corpus line as "threadtime", optionally with "printable".
+void BM_FormatLogLine(benchmark::State& state) {
+    LinuxLogFormat* format = linux_log_format_new();
+    linux_log_setPrintFormat(format, FORMAT_THREADTIME);
+    if (state.range(0)) linux_log_setPrintFormat(format, FORMAT_MODIFIER_PRINTABLE);
+    char buf[4096];
+    for (auto _ : state) {
+        for (const auto& line : Corpus()) {
+            LinuxLogEntry entry = {};
+            entry.tv_sec = 1700000000;
+            entry.priority = LINUX_LOG_INFO;
+            entry.pid = 1;
+            entry.tid = 1;
+            entry.tag = "init";
+            entry.tagLen = 4;
+            entry.message = line.c_str();
+            entry.messageLen = line.size();
+            size_t len;
+            char* out = linux_log_formatLogLine(format, buf, sizeof(buf), &entry, &len);
+            benchmark::DoNotOptimize(out);
+            if (out != buf) free(out);
+        }
+    }
+    state.SetBytesProcessed(state.iterations() * CorpusBytes());
+    linux_log_format_free(format);
+}
+BENCHMARK(BM_FormatLogLine)->ArgName("printable")->Arg(0)->Arg(1);
+
+// Dumps the corpus to /dev/null one entry at a time with linux_log_printLogLine().
+void BM_DumpPrintLogLine(benchmark::State& state) {
+    std::vector<std::vector<char>> entries = CorpusEntries();
+    LinuxLogFormat* format = linux_log_format_new();
+    linux_log_setPrintFormat(format, FORMAT_THREADTIME);
+    FILE* out = fopen("/dev/null", "we");
+    for (auto _ : state) {
+        for (auto& raw : entries) {
+            std::vector<char> copy = raw;
+            LinuxLogEntry entry;
+            linux_log_processLogBuffer(reinterpret_cast<logger_entry*>(copy.data()), &entry);
+            if (linux_log_shouldPrintLine(format, entry.tag, entry.priority)) {
+                linux_log_printLogLine(format, out, &entry);
+            }
+        }
+        fflush(out);
+    }
+    state.SetBytesProcessed(state.iterations() * CorpusBytes());
+    fclose(out);
+    linux_log_format_free(format);
+}
+BENCHMARK(BM_DumpPrintLogLine)->UseRealTime();
+
+// Dumps the corpus to /dev/null through LogPipeline, in 64 KiB reads.
+void BM_DumpPipeline(benchmark::State& state) {
+    std::vector<char> stream;
+    for (const auto& raw : CorpusEntries()) stream.insert(stream.end(), raw.begin(), raw.end());
+    LinuxLogFormat* format = linux_log_format_new();
+    linux_log_setPrintFormat(format, FORMAT_THREADTIME);
+    int out = open("/dev/null", O_WRONLY | O_CLOEXEC);
+
+    minimal_systems::init::LogPipeline::Options options;
+    options.out_fd = out;
+    options.threaded = state.range(0);
+    minimal_systems::init::LogPipeline pipeline(format, options);
+    for (auto _ : state) {
+        for (size_t off = 0; off < stream.size(); off += 64 * 1024) {
+            pipeline.Submit(stream.data() + off, std::min<size_t>(64 * 1024, stream.size() - off));
+        }
+        if (!pipeline.Flush()) state.SkipWithError("pipeline failed");
+    }
+    state.SetBytesProcessed(state.iterations() * CorpusBytes());
+    close(out);
+    linux_log_format_free(format);
+}
+BENCHMARK(BM_DumpPipeline)->ArgName("threaded")->Arg(0)->Arg(1)->UseRealTime();
+
+}  // namespace
+
+BENCHMARK_MAIN();
@@ -0,0 +1,114 @@
+// modalias_handler.cpp — Batches MODALIAS uevents into modprobe calls on a worker pool
+
+#define LOG_TAG "ueventd"
+
+#include "modalias_handler.h"
+
+#include <algorithm>
+#include <chrono>
+
+#include <init/log.h>
+
+namespace minimal_systems {
+namespace init {
+
+ModaliasHandler::ModaliasHandler(std::vector<std::string> base_paths, size_t num_workers,
+                                 std::chrono::milliseconds batch_window)
+    : base_paths_(std::move(base_paths)),
+      batch_window_(batch_window),
+      pool_(num_workers, "modalias") {}
+
+void ModaliasHandler::HandleUevent(const Uevent& uevent) {
+    if (uevent.action != "add" || uevent.modalias.empty()) return;
+    if (base_paths_.empty()) return;
+
+    std::lock_guard<std::mutex> guard(lock_);
+    if (!seen_aliases_.emplace(uevent.modalias).second) return;
+    if (pending_.empty()) batch_start_ = std::chrono::steady_clock::now();
+    pending_.emplace_back(uevent.modalias);
+}
+
+size_t ModaliasHandler::PendingCount() {
+    std::lock_guard<std::mutex> guard(lock_);
+    return pending_.size();
+}
+
+std::optional<std::chrono::milliseconds> ModaliasHandler::TimeUntilFlush() {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (pending_.empty()) return std::nullopt;
+    if (pending_.size() >= kBatchSize) return std::chrono::milliseconds(0);
+    auto left = batch_start_ + batch_window_ - std::chrono::steady_clock::now();
+    // Rounded up, so a poll with this timeout does not wake just short of the deadline.
+    return std::max(std::chrono::ceil<std::chrono::milliseconds>(left),
+                    std::chrono::milliseconds(0));
+}
+
+void ModaliasHandler::DispatchRound(const UeventPoller& poll,
+                                    const std::function<void(const Uevent&)>& handle) {
+    poll(
+            [&](const Uevent& uevent) {
+                bool idle = !TimeUntilFlush();
+                handle(uevent);
+                HandleUevent(uevent);
+                auto left = TimeUntilFlush();
+                return left && (idle || left->count() == 0) ? ListenerAction::kStop
+                                                            : ListenerAction::kContinue;
+            },
+            TimeUntilFlush());
+
+    // Poll() also returns once the socket has been quiet for the time left.
+    auto left = TimeUntilFlush();
+    if (left && left->count() == 0) Flush();
+}
+
+void ModaliasHandler::Flush() {
+    std::vector<std::string> batch;
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        batch.swap(pending_);
+    }
+    if (batch.empty()) return;
+
+    // Alias resolution walks every modules.alias pattern, so it runs on a
+    // worker rather than on the uevent dispatch thread.
+    pool_.Enqueue([this, batch = std::move(batch)] {
+        Modprobe* modprobe = GetModprobe();
+
+        std::vector<std::string> modules;
+        for (const auto& alias : batch) {
+            for (auto& module : modprobe->GetModulesForAlias(alias)) {
+                modules.emplace_back(std::move(module));
+            }
+        }
+
+        std::lock_guard<std::mutex> guard(lock_);
+        for (auto& module : modules) {
+            if (!requested_modules_.emplace(module).second) continue;
+            pool_.Enqueue([this, module = std::move(module)] { LoadModule(module); });
+        }
+    });
+}
+
+Modprobe* ModaliasHandler::GetModprobe() {
+    std::call_once(modprobe_once_, [this] {
+        auto start = std::chrono::steady_clock::now();
+        modprobe_ = std::make_unique<Modprobe>(base_paths_);
+        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now() - start);
+        LOGI("Parsed module configuration for MODALIAS loading (%lld ms)",
+             static_cast<long long>(ms.count()));
+    });
+    return modprobe_.get();
+}
+
+void ModaliasHandler::LoadModule(const std::string& module) {
+    Modprobe* modprobe = GetModprobe();
+    if (modprobe->IsModuleLoaded(module) || modprobe->IsBlocklisted(module)) return;
+
+    if (!modprobe->LoadWithAliases(module, true)) {
+        LOGE("Failed to load module %s for MODALIAS", module.c_str());
+    }
+}
+
+}  // namespace init
+}  // namespace minimal_systems
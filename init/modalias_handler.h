@@ -0,0 +1,100 @@
+// modalias_handler.h — Loads drivers for devices announced with a MODALIAS uevent
+
+#ifndef MINIMAL_SYSTEMS_INIT_MODALIAS_HANDLER_H_
+#define MINIMAL_SYSTEMS_INIT_MODALIAS_HANDLER_H_
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include <modprobe/modprobe.h>
+
+#include "thread_pool.h"
+#include "uevent.h"
+#include "uevent_listener.h"
+
+namespace minimal_systems {
+namespace init {
+
+// UeventListener::Poll(), or a stand-in for it.
+using UeventPoller = std::function<void(const ListenerCallback& callback,
+                                        std::optional<std::chrono::milliseconds> timeout)>;
+
+class ModaliasHandler {
+  public:
+    /**
+     * @param base_paths Module directories holding modules.dep / modules.alias.
+     * @param num_workers Number of modules that may be probed at once.
+     * @param batch_window How long a batch collects aliases after its first one.
+     */
+    ModaliasHandler(std::vector<std::string> base_paths, size_t num_workers,
+                    std::chrono::milliseconds batch_window);
+
+    /**
+     * Records the MODALIAS of an "add" uevent for the next batch.
+     *
+     * Aliases already seen are dropped: coldboot replays one event per device
+     * and many devices of the same kind share an alias.
+     */
+    void HandleUevent(const Uevent& uevent);
+
+    /** Number of aliases waiting for Flush(). */
+    size_t PendingCount();
+
+    /** Number of pending aliases at which the dispatch loop should flush early. */
+    static constexpr size_t kBatchSize = 64;
+
+    /**
+     * Time left before the pending batch is due for Flush(): nullopt when
+     * nothing is pending, zero once the batch is full or its window has passed.
+     */
+    std::optional<std::chrono::milliseconds> TimeUntilFlush();
+
+    /**
+     * Runs one round of the uevent dispatch loop: polls, handing each uevent
+     * to `handle` and then to this handler, and flushes if the batch is due.
+     *
+     * Polling stops as soon as the first alias of a batch is queued, so the
+     * next round's poll is bounded by the batch window and a single hotplugged
+     * device gets its driver without waiting for more events.
+     */
+    void DispatchRound(const UeventPoller& poll, const std::function<void(const Uevent&)>& handle);
+
+    /**
+     * Resolves the pending aliases to modules and queues one load per module
+     * not yet requested. Dependencies are loaded ahead of each module by
+     * Modprobe, so independent modules probe concurrently.
+     */
+    void Flush();
+
+    /** Blocks until every queued load has finished. */
+    void Wait() { pool_.Wait(); }
+
+  private:
+    Modprobe* GetModprobe();
+    void LoadModule(const std::string& module);
+
+    std::vector<std::string> base_paths_;
+    std::chrono::milliseconds batch_window_;
+
+    std::once_flag modprobe_once_;
+    std::unique_ptr<Modprobe> modprobe_;
+
+    std::mutex lock_;
+    std::vector<std::string> pending_;
+    std::chrono::steady_clock::time_point batch_start_;  // When pending_ became non-empty.
+    std::unordered_set<std::string> seen_aliases_;
+    std::unordered_set<std::string> requested_modules_;
+
+    ThreadPool pool_;
+};
+
+}  // namespace init
+}  // namespace minimal_systems
+
+#endif  // MINIMAL_SYSTEMS_INIT_MODALIAS_HANDLER_H_
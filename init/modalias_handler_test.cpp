@@ -0,0 +1,134 @@
+// modalias_handler_test.cpp — Batching of MODALIAS uevents by the dispatch loop
+
+#include "modalias_handler.h"
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <optional>
+#include <string>
+#include <thread>
+
+#include <gtest/gtest.h>
+
+namespace minimal_systems {
+namespace init {
+namespace {
+
+using std::chrono::milliseconds;
+using std::chrono::steady_clock;
+
+constexpr milliseconds kWindow{20};
+// Scheduling slack allowed on top of the window.
+constexpr milliseconds kSlack{500};
+
+class ModaliasHandlerTest : public ::testing::Test {
+  protected:
+    void SetUp() override {
+        char path[] = "/tmp/modalias_test.XXXXXX";
+        ASSERT_NE(mkdtemp(path), nullptr);
+        module_dir_ = path;
+    }
+
+    void TearDown() override { rmdir(module_dir_.c_str()); }
+
+    static Uevent AddEvent(const std::string& modalias) {
+        Uevent uevent;
+        uevent.action = "add";
+        uevent.modalias = modalias;
+        return uevent;
+    }
+
+    std::string module_dir_;
+};
+
+// A poll that never returns without a timeout would hang ueventd; fail instead.
+void WaitOrFail(std::optional<milliseconds> timeout) {
+    if (!timeout) {
+        ADD_FAILURE() << "Poll() would block with aliases pending";
+        return;
+    }
+    std::this_thread::sleep_for(*timeout);
+}
+
+}  // namespace
+
+TEST_F(ModaliasHandlerTest, SingleModaliasIsFlushedWithinWindow) {
+    ModaliasHandler handler({module_dir_}, 1, kWindow);
+    bool sent = false;
+    auto poll = [&](const ListenerCallback& callback, std::optional<milliseconds> timeout) {
+        if (!sent) {
+            sent = true;
+            if (callback(AddEvent("pci:v00008086d000010D3sv*sd*bc*sc*i*")) ==
+                ListenerAction::kStop) {
+                return;
+            }
+        }
+        // The socket stays quiet after the one hotplug event.
+        WaitOrFail(timeout);
+    };
+
+    auto start = steady_clock::now();
+    for (int round = 0; round < 4 && (!sent || handler.PendingCount() > 0); ++round) {
+        handler.DispatchRound(poll, [](const Uevent&) {});
+    }
+    EXPECT_EQ(handler.PendingCount(), 0u);
+    EXPECT_LT(steady_clock::now() - start, kWindow + kSlack);
+    handler.Wait();
+}
+
+TEST_F(ModaliasHandlerTest, BusySocketDoesNotDelayFlush) {
+    ModaliasHandler handler({module_dir_}, 1, kWindow);
+    bool sent = false;
+    int handled = 0;
+    auto poll = [&](const ListenerCallback& callback, std::optional<milliseconds>) {
+        if (!sent) {
+            sent = true;
+            if (callback(AddEvent("usb:v0BDAp8153d*dc*dsc*dp*ic*isc*ip*in*")) ==
+                ListenerAction::kStop) {
+                return;
+            }
+        }
+        // Events without a MODALIAS keep arriving faster than the window.
+        for (int i = 0; i < 1000; ++i) {
+            std::this_thread::sleep_for(milliseconds(2));
+            Uevent change;
+            change.action = "change";
+            if (callback(change) == ListenerAction::kStop) return;
+        }
+        ADD_FAILURE() << "dispatch never stopped for the pending batch";
+    };
+
+    auto start = steady_clock::now();
+    for (int round = 0; round < 4 && (!sent || handler.PendingCount() > 0); ++round) {
+        handler.DispatchRound(poll, [&](const Uevent&) { ++handled; });
+    }
+    EXPECT_EQ(handler.PendingCount(), 0u);
+    EXPECT_GT(handled, 1);
+    EXPECT_LT(steady_clock::now() - start, kWindow + kSlack);
+    handler.Wait();
+}
+
+TEST_F(ModaliasHandlerTest, FullBatchIsFlushedImmediately) {
+    ModaliasHandler handler({module_dir_}, 1, std::chrono::hours(1));
+    size_t next = 0;
+    auto poll = [&](const ListenerCallback& callback, std::optional<milliseconds> timeout) {
+        while (next < ModaliasHandler::kBatchSize) {
+            if (callback(AddEvent("virtio:d" + std::to_string(next++))) == ListenerAction::kStop) {
+                return;
+            }
+        }
+        WaitOrFail(timeout);
+    };
+
+    for (int round = 0; round < 3 && next < ModaliasHandler::kBatchSize; ++round) {
+        handler.DispatchRound(poll, [](const Uevent&) {});
+    }
+    EXPECT_EQ(next, ModaliasHandler::kBatchSize);
+    EXPECT_EQ(handler.PendingCount(), 0u);
+    handler.Wait();
+}
+
+}  // namespace init
+}  // namespace minimal_systems
@@ -0,0 +1,129 @@
+// module_loader.cpp — Background kernel module loading for first stage
+
+#define LOG_TAG "init"
+
+#include "module_loader.h"
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include <modprobe/modprobe.h>
+
+#include <init/log.h>
+
+namespace minimal_systems {
+namespace init {
+
+namespace {
+
+// Whether the kernel already knows the module, however it got loaded.
+bool IsModuleLive(std::string name) {
+    std::replace(name.begin(), name.end(), '-', '_');
+    return access(("/sys/module/" + name).c_str(), F_OK) == 0;
+}
+
+// Loads `module` through `modprobe`, which the loader thread may be using at
+// the same time; Modprobe supports concurrent loads.
+bool TryLoad(Modprobe* modprobe, const std::string& module) {
+    auto candidates = modprobe->GetModulesForAlias(module);
+    if (candidates.empty()) candidates.emplace_back(module);
+
+    auto any_loaded = [&] {
+        return std::any_of(candidates.begin(), candidates.end(), [&](const auto& name) {
+            return modprobe->IsModuleLoaded(name) || IsModuleLive(name);
+        });
+    };
+    if (any_loaded()) return true;
+
+    modprobe->LoadWithAliases(module, false);
+    return any_loaded();
+}
+
+}  // namespace
+
+ModuleLoader& ModuleLoader::instance() {
+    static ModuleLoader loader;
+    return loader;
+}
+
+ModuleLoader::~ModuleLoader() {
+    if (thread_.joinable()) thread_.join();
+}
+
+void ModuleLoader::Start(std::function<bool()> load) {
+    std::lock_guard<std::mutex> guard(lock_);
+    if (started_) return;
+    started_ = true;
+
+    thread_ = std::thread([this, load = std::move(load)] {
+        bool result = load();
+        std::lock_guard<std::mutex> guard(lock_);
+        done_ = true;
+        result_ = result;
+        cv_.notify_all();
+    });
+    pthread_setname_np(thread_.native_handle(), "modloader");
+}
+
+void ModuleLoader::Attach(Modprobe* modprobe) {
+    std::unique_lock<std::mutex> lock(lock_);
+    // Take the old instance away from new waiters first, then let the ones
+    // still loading through it finish before it can be destroyed.
+    modprobe_ = nullptr;
+    cv_.wait(lock, [this] { return users_ == 0; });
+    modprobe_ = modprobe;
+    generation_++;
+    cv_.notify_all();
+}
+
+bool ModuleLoader::WaitForModule(const std::string& module, std::chrono::milliseconds timeout) {
+    auto start = std::chrono::steady_clock::now();
+    auto deadline = start + timeout;
+
+    std::unique_lock<std::mutex> lock(lock_);
+    uint64_t tried = 0;
+    while (true) {
+        if (IsModuleLive(module)) return true;
+
+        // Each module directory gets its own Modprobe; retry whenever a new
+        // one is attached since the module may live in a later directory.
+        if (modprobe_ && generation_ != tried) {
+            tried = generation_;
+            Modprobe* modprobe = modprobe_;
+            // finit_module can take a while; don't hold up other waiters or
+            // the loader's Attach() for it.
+            users_++;
+            lock.unlock();
+            bool loaded = TryLoad(modprobe, module);
+            lock.lock();
+            if (--users_ == 0) cv_.notify_all();
+
+            if (loaded) {
+                auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        std::chrono::steady_clock::now() - start);
+                LOGI("Module %s ready after %lld ms", module.c_str(),
+                     static_cast<long long>(ms.count()));
+                return true;
+            }
+            continue;
+        }
+
+        if (!started_ || done_) return IsModuleLive(module);
+
+        if (cv_.wait_until(lock, deadline) == std::cv_status::timeout) {
+            LOGE("Timed out waiting for module %s", module.c_str());
+            return false;
+        }
+    }
+}
+
+bool ModuleLoader::WaitForAll() {
+    if (thread_.joinable()) thread_.join();
+    std::lock_guard<std::mutex> guard(lock_);
+    return result_;
+}
+
+}  // namespace init
+}  // namespace minimal_systems
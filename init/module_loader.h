@@ -0,0 +1,87 @@
+// module_loader.h — Background kernel module loading for first stage
+
+#ifndef MINIMAL_SYSTEMS_INIT_MODULE_LOADER_H_
+#define MINIMAL_SYSTEMS_INIT_MODULE_LOADER_H_
+
+#include <chrono>
+#include <cstdint>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class Modprobe;
+
+namespace minimal_systems {
+namespace init {
+
+/**
+ * Runs first-stage module loading on a background thread.
+ *
+ * FirstStageMain starts the load and goes on to mount; each fstab entry only
+ * waits for the drivers it needs. A waiter does not just poll: while a
+ * Modprobe instance is attached it loads the requested module (and its hard
+ * dependencies) itself, on its own thread and concurrently with the loader,
+ * pulling it ahead of the rest of modules.load.
+ */
+class ModuleLoader {
+  public:
+    static constexpr std::chrono::milliseconds kDefaultWaitTimeout{5000};
+
+    static ModuleLoader& instance();
+
+    ModuleLoader(const ModuleLoader&) = delete;
+    ModuleLoader& operator=(const ModuleLoader&) = delete;
+
+    /** Starts `load` on the loader thread. Only the first call has an effect. */
+    void Start(std::function<bool()> load);
+
+    /**
+     * Makes `modprobe` available to WaitForModule() while the loader uses it.
+     * Detach (nullptr) blocks until no waiter is using the previous instance.
+     */
+    void Attach(Modprobe* modprobe);
+
+    /**
+     * Waits until `module` (a module name or an alias such as "fs-ext4") is
+     * loaded, loading it directly if possible.
+     *
+     * @return true if the module is loaded; false if loading finished or the
+     *         timeout expired without it.
+     */
+    bool WaitForModule(const std::string& module,
+                       std::chrono::milliseconds timeout = kDefaultWaitTimeout);
+
+    /** Joins the loader thread and returns the result of `load`; true if never started. */
+    bool WaitForAll();
+
+  private:
+    ModuleLoader() = default;
+    ~ModuleLoader();
+
+    std::mutex lock_;
+    std::condition_variable cv_;
+    std::thread thread_;
+    Modprobe* modprobe_ = nullptr;
+    uint64_t generation_ = 0;  // Bumped per Attach(); instances may reuse an address.
+    int users_ = 0;  // Waiters loading through modprobe_ outside lock_.
+    bool started_ = false;
+    bool done_ = false;
+    bool result_ = true;
+};
+
+/** Detaches the Modprobe instance from the ModuleLoader when it goes out of scope. */
+class ScopedModuleLoaderAttach {
+  public:
+    explicit ScopedModuleLoaderAttach(Modprobe* modprobe) {
+        ModuleLoader::instance().Attach(modprobe);
+    }
+    ~ScopedModuleLoaderAttach() { ModuleLoader::instance().Attach(nullptr); }
+};
+
+}  // namespace init
+}  // namespace minimal_systems
+
+#endif  // MINIMAL_SYSTEMS_INIT_MODULE_LOADER_H_
@@ -64,6 +64,7 @@ void PropertyManager::loadProperties(const std::string& propertyFile) {
             value.erase(value.find_last_not_of(" \t\r\n") + 1);
 
             properties[key] = value;  // overwrite if already exists
+            generation_.fetch_add(1, std::memory_order_release);
             DEBUG_LOGD("Loaded property: %s = %s", key.c_str(), value.c_str());
         }
     }
@@ -97,6 +98,7 @@ void PropertyManager::resetprop(const std::string& key) {
     std::lock_guard<std::mutex> lock(property_mutex);
 
     if (properties.erase(key)) {
+        generation_.fetch_add(1, std::memory_order_release);
         DEBUG_LOGI("Property reset (removed from memory): %s", key.c_str());
     }
 
@@ -182,6 +184,7 @@ void PropertyManager::set(const std::string& key, const std::string& value) {
     std::lock_guard<std::mutex> lock(property_mutex);
 
     properties[key] = value;
+    generation_.fetch_add(1, std::memory_order_release);
     if (persistentKeys.find(key) != persistentKeys.end()) {
         persistentProperties[key] = value;
     }
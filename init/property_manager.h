@@ -1,6 +1,8 @@
 #ifndef PROPERTY_MANAGER_H
 #define PROPERTY_MANAGER_H
 
+#include <atomic>
+#include <cstdint>
 #include <mutex>
 #include <string>
 #include <unordered_map>
@@ -31,6 +33,9 @@ class PropertyManager {
 
     const std::unordered_map<std::string, std::string>& getAllProperties() const;
 
+    // Incremented on every change to the property set, for callers that cache lookups.
+    uint64_t generation() const { return generation_.load(std::memory_order_acquire); }
+
   private:
     PropertyManager() = default;
 
@@ -38,6 +43,7 @@ class PropertyManager {
     std::unordered_map<std::string, std::string> properties;
     std::unordered_map<std::string, std::string> persistentProperties;
     std::unordered_set<std::string> persistentKeys;
+    std::atomic<uint64_t> generation_{0};
 };
 
 std::string getprop(const std::string& key);
@@ -29,7 +29,8 @@
 #include <vector>
 
 #include "capabilities.h"
-#include "log_new.h"
+#include <init/log.h>
+#include "logger_write.h"
 #include "reboot_utils.h"
 #include "util.h"
 
@@ -111,6 +112,7 @@ void __attribute__((noreturn)) RebootSystem(unsigned int cmd, const std::string&
         exit(0);
     }
 
+    __linux_log_flush();
     switch (cmd) {
         case RB_POWER_OFF:
             reboot(RB_POWER_OFF);
@@ -124,6 +126,7 @@ void __attribute__((noreturn)) RebootSystem(unsigned int cmd, const std::string&
             break;
     }
     LOGE("Reboot call returned unexpectedly, aborting.");
+    __linux_log_flush();
     abort();
 }
 
@@ -20,7 +20,7 @@
 
 #include "boot_clock.h"
 #include "fs_mgr.h"
-#include "log_new.h"
+#include <init/log.h>
 #include "property_manager.h"
 #include "util.h"
 
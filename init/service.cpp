@@ -11,7 +11,8 @@
 #include <grp.h>
 
 #define LOG_TAG "service"
-#include "log_new.h"
+#include <init/log.h>
+#include "boot_trace.h"
 #include "property_manager.h"
 
 namespace minimal_systems {
@@ -90,6 +91,7 @@ void start_service_by_name(const std::string& name) {
 }
 
 void start_service(const ServiceDefinition& service) {
+    ScopedBootTrace trace(kTraceService, service.name);
     pid_t pid = fork();
     if (pid == 0) {
         // Child
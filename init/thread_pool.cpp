@@ -0,0 +1,71 @@
+// thread_pool.cpp — Fixed-size worker pool used by ueventd and first-stage mount
+
+#include "thread_pool.h"
+
+#include <pthread.h>
+
+#include <algorithm>
+
+namespace minimal_systems {
+namespace init {
+
+ThreadPool::ThreadPool(size_t num_threads, const std::string& name) {
+    num_threads = std::max<size_t>(num_threads, 1);
+    workers_.reserve(num_threads);
+    for (size_t i = 0; i < num_threads; ++i) {
+        workers_.emplace_back(&ThreadPool::WorkerLoop, this);
+        std::string thread_name = (name + std::to_string(i)).substr(0, 15);
+        pthread_setname_np(workers_.back().native_handle(), thread_name.c_str());
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        stopping_ = true;
+    }
+    work_cv_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+void ThreadPool::Enqueue(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        tasks_.emplace_back(std::move(task));
+    }
+    work_cv_.notify_one();
+}
+
+void ThreadPool::Wait() {
+    std::unique_lock<std::mutex> lock(lock_);
+    idle_cv_.wait(lock, [this] { return tasks_.empty() && active_ == 0; });
+}
+
+void ThreadPool::WorkerLoop() {
+    std::unique_lock<std::mutex> lock(lock_);
+    while (true) {
+        work_cv_.wait(lock, [this] { return stopping_ || !tasks_.empty(); });
+        if (tasks_.empty()) {
+            // Only reachable once stopping_ is set and the queue has drained.
+            return;
+        }
+
+        auto task = std::move(tasks_.front());
+        tasks_.pop_front();
+        ++active_;
+        lock.unlock();
+
+        task();
+
+        lock.lock();
+        --active_;
+        if (tasks_.empty() && active_ == 0) {
+            idle_cv_.notify_all();
+        }
+    }
+}
+
+}  // namespace init
+}  // namespace minimal_systems
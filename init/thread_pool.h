@@ -0,0 +1,61 @@
+// thread_pool.h — Small fixed-size worker pool for init background work
+
+#ifndef MINIMAL_SYSTEMS_INIT_THREAD_POOL_H_
+#define MINIMAL_SYSTEMS_INIT_THREAD_POOL_H_
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace minimal_systems {
+namespace init {
+
+/**
+ * A fixed set of worker threads draining a shared FIFO of tasks.
+ *
+ * Used wherever init needs to keep one slow operation (a firmware load,
+ * a module probe, a mount) from holding up unrelated work. Tasks must not
+ * throw; the pool does not catch exceptions on behalf of callers.
+ */
+class ThreadPool {
+  public:
+    /**
+     * @param num_threads Number of workers; clamped to at least one.
+     * @param name Thread name prefix (truncated by the kernel to 15 chars).
+     */
+    ThreadPool(size_t num_threads, const std::string& name);
+
+    /** Drains all queued tasks, then joins the workers. */
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    /** Queues a task for execution on any idle worker. */
+    void Enqueue(std::function<void()> task);
+
+    /** Blocks until the queue is empty and no task is running. */
+    void Wait();
+
+    size_t size() const { return workers_.size(); }
+
+  private:
+    void WorkerLoop();
+
+    std::mutex lock_;
+    std::condition_variable work_cv_;
+    std::condition_variable idle_cv_;
+    std::deque<std::function<void()>> tasks_;
+    std::vector<std::thread> workers_;
+    size_t active_ = 0;
+    bool stopping_ = false;
+};
+
+}  // namespace init
+}  // namespace minimal_systems
+
+#endif  // MINIMAL_SYSTEMS_INIT_THREAD_POOL_H_
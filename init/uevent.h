@@ -0,0 +1,33 @@
+// uevent.h — Parsed representation of a kernel uevent
+
+#ifndef MINIMAL_SYSTEMS_INIT_UEVENT_H_
+#define MINIMAL_SYSTEMS_INIT_UEVENT_H_
+
+#include <string>
+
+namespace minimal_systems {
+namespace init {
+
+/**
+ * A single kobject uevent as delivered over NETLINK_KOBJECT_UEVENT.
+ *
+ * Only the keys init cares about are kept; everything else in the
+ * netlink payload is ignored by UeventListener.
+ */
+struct Uevent {
+    std::string action;
+    std::string path;
+    std::string subsystem;
+    std::string firmware;
+    std::string partition_name;
+    std::string device_name;
+    std::string modalias;
+    int partition_num = -1;
+    int major = -1;
+    int minor = -1;
+};
+
+}  // namespace init
+}  // namespace minimal_systems
+
+#endif  // MINIMAL_SYSTEMS_INIT_UEVENT_H_
@@ -0,0 +1,186 @@
+// uevent_listener.cpp — Reads and parses kernel uevents from the netlink socket
+
+#define LOG_TAG "ueventd"
+
+#include "uevent_listener.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/netlink.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstdlib>
+#include <cstring>
+
+#include <init/log.h>
+
+namespace minimal_systems {
+namespace init {
+
+static constexpr size_t kUeventMsgLen = 8192;
+
+/**
+ * Parses a NUL-separated uevent payload ("KEY=value\0KEY=value\0...").
+ *
+ * The first record is the "action@devpath" header which carries no keys
+ * of interest and is skipped by the prefix checks below.
+ */
+static void ParseEvent(const char* msg, size_t len, Uevent* uevent) {
+    uevent->partition_num = -1;
+    uevent->major = -1;
+    uevent->minor = -1;
+    uevent->action.clear();
+    uevent->path.clear();
+    uevent->subsystem.clear();
+    uevent->firmware.clear();
+    uevent->partition_name.clear();
+    uevent->device_name.clear();
+    uevent->modalias.clear();
+
+    const char* end = msg + len;
+    while (msg < end && *msg) {
+        if (!strncmp(msg, "ACTION=", 7)) {
+            msg += 7;
+            uevent->action = msg;
+        } else if (!strncmp(msg, "DEVPATH=", 8)) {
+            msg += 8;
+            uevent->path = msg;
+        } else if (!strncmp(msg, "SUBSYSTEM=", 10)) {
+            msg += 10;
+            uevent->subsystem = msg;
+        } else if (!strncmp(msg, "FIRMWARE=", 9)) {
+            msg += 9;
+            uevent->firmware = msg;
+        } else if (!strncmp(msg, "MAJOR=", 6)) {
+            msg += 6;
+            uevent->major = atoi(msg);
+        } else if (!strncmp(msg, "MINOR=", 6)) {
+            msg += 6;
+            uevent->minor = atoi(msg);
+        } else if (!strncmp(msg, "PARTN=", 6)) {
+            msg += 6;
+            uevent->partition_num = atoi(msg);
+        } else if (!strncmp(msg, "PARTNAME=", 9)) {
+            msg += 9;
+            uevent->partition_name = msg;
+        } else if (!strncmp(msg, "DEVNAME=", 8)) {
+            msg += 8;
+            uevent->device_name = msg;
+        } else if (!strncmp(msg, "MODALIAS=", 9)) {
+            msg += 9;
+            uevent->modalias = msg;
+        }
+
+        // Advance to after the next NUL
+        while (msg < end && *msg++) {
+        }
+    }
+}
+
+UeventListener::UeventListener(size_t buffer_size) {
+    device_fd_ = socket(PF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK,
+                        NETLINK_KOBJECT_UEVENT);
+    if (device_fd_ < 0) {
+        LOGE("Failed to open uevent socket: %s", strerror(errno));
+        return;
+    }
+
+    int size = static_cast<int>(buffer_size);
+    // SO_RCVBUFFORCE ignores rmem_max but requires CAP_NET_ADMIN; fall back otherwise.
+    if (setsockopt(device_fd_, SOL_SOCKET, SO_RCVBUFFORCE, &size, sizeof(size)) != 0) {
+        setsockopt(device_fd_, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    }
+
+    int on = 1;
+    setsockopt(device_fd_, SOL_SOCKET, SO_PASSCRED, &on, sizeof(on));
+
+    struct sockaddr_nl addr{};
+    addr.nl_family = AF_NETLINK;
+    addr.nl_pid = 0;
+    addr.nl_groups = 0xffffffff;
+    if (bind(device_fd_, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) < 0) {
+        LOGE("Failed to bind uevent socket: %s", strerror(errno));
+        close(device_fd_);
+        device_fd_ = -1;
+    }
+}
+
+UeventListener::~UeventListener() {
+    if (device_fd_ >= 0) {
+        close(device_fd_);
+    }
+}
+
+bool UeventListener::ReadUevent(Uevent* uevent) const {
+    char msg[kUeventMsgLen + 2];
+    char cred_msg[CMSG_SPACE(sizeof(struct ucred))];
+    struct sockaddr_nl addr{};
+    struct iovec iov = {msg, kUeventMsgLen};
+    struct msghdr hdr{};
+    hdr.msg_name = &addr;
+    hdr.msg_namelen = sizeof(addr);
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = cred_msg;
+    hdr.msg_controllen = sizeof(cred_msg);
+
+    ssize_t n = TEMP_FAILURE_RETRY(recvmsg(device_fd_, &hdr, 0));
+    if (n <= 0) {
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+            LOGE("Error reading from uevent socket: %s", strerror(errno));
+        }
+        return false;
+    }
+
+    // Only trust messages sent by the kernel (multicast from pid 0, uid 0).
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+    if (cmsg == nullptr || cmsg->cmsg_type != SCM_CREDENTIALS) {
+        return false;
+    }
+    auto* cred = reinterpret_cast<struct ucred*>(CMSG_DATA(cmsg));
+    if (cred->uid != 0 || addr.nl_groups == 0 || addr.nl_pid != 0) {
+        return false;
+    }
+
+    if (static_cast<size_t>(n) >= kUeventMsgLen) {
+        // Overflow -- discard
+        return false;
+    }
+
+    msg[n] = '\0';
+    msg[n + 1] = '\0';
+
+    ParseEvent(msg, static_cast<size_t>(n), uevent);
+    return true;
+}
+
+void UeventListener::Poll(const ListenerCallback& callback,
+                          const std::optional<std::chrono::milliseconds> relative_timeout) const {
+    if (device_fd_ < 0) {
+        return;
+    }
+
+    int timeout_ms = relative_timeout ? static_cast<int>(relative_timeout->count()) : -1;
+
+    while (true) {
+        struct pollfd ufd = {device_fd_, POLLIN, 0};
+        int nr = TEMP_FAILURE_RETRY(poll(&ufd, 1, timeout_ms));
+        if (nr == 0) return;
+        if (nr < 0) {
+            LOGE("poll() of uevent socket failed, continuing: %s", strerror(errno));
+            continue;
+        }
+        if (ufd.revents & POLLIN) {
+            // We're non-blocking, so drain everything queued before polling again.
+            Uevent uevent;
+            while (ReadUevent(&uevent)) {
+                if (callback(uevent) == ListenerAction::kStop) return;
+            }
+        }
+    }
+}
+
+}  // namespace init
+}  // namespace minimal_systems
@@ -0,0 +1,59 @@
+// uevent_listener.h — Netlink socket reader for kernel uevents
+
+#ifndef MINIMAL_SYSTEMS_INIT_UEVENT_LISTENER_H_
+#define MINIMAL_SYSTEMS_INIT_UEVENT_LISTENER_H_
+
+#include <chrono>
+#include <functional>
+#include <optional>
+
+#include "uevent.h"
+
+namespace minimal_systems {
+namespace init {
+
+enum class ListenerAction {
+    kStop = 0,  // Stop polling and return from Poll().
+    kContinue,  // Keep polling for further uevents.
+};
+
+using ListenerCallback = std::function<ListenerAction(const Uevent&)>;
+
+class UeventListener {
+  public:
+    /**
+     * Opens a NETLINK_KOBJECT_UEVENT socket.
+     *
+     * @param buffer_size Requested SO_RCVBUF size; uevent storms during coldboot
+     *                    overflow the default socket buffer.
+     */
+    explicit UeventListener(size_t buffer_size);
+    ~UeventListener();
+
+    UeventListener(const UeventListener&) = delete;
+    UeventListener& operator=(const UeventListener&) = delete;
+
+    /**
+     * Reads and parses a single uevent.
+     *
+     * @return true if a uevent was read, false on EAGAIN or error.
+     */
+    bool ReadUevent(Uevent* uevent) const;
+
+    /**
+     * Dispatches uevents to the callback until it returns kStop or the
+     * relative timeout expires without any event arriving.
+     */
+    void Poll(const ListenerCallback& callback,
+              const std::optional<std::chrono::milliseconds> relative_timeout = {}) const;
+
+    int device_fd() const { return device_fd_; }
+
+  private:
+    int device_fd_ = -1;
+};
+
+}  // namespace init
+}  // namespace minimal_systems
+
+#endif  // MINIMAL_SYSTEMS_INIT_UEVENT_LISTENER_H_
@@ -0,0 +1,142 @@
+// ueventd.cpp — Listens for kernel uevents and hands them to the registered handlers
+
+#define LOG_TAG "ueventd"
+
+#include "ueventd.h"
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/utsname.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "firmware_handler.h"
+#include <init/log.h>
+#include "modalias_handler.h"
+#include "uevent_listener.h"
+#include "ueventhandler.h"
+
+namespace minimal_systems {
+namespace init {
+
+// Large enough to absorb the burst of events seen when drivers bind at boot.
+static constexpr size_t kUeventSocketBufferSize = 16 * 1024 * 1024;
+
+// Firmware loads are I/O bound; a couple of workers keeps one slow blob from
+// delaying the next device without flooding storage.
+static constexpr size_t kFirmwareWorkers = 2;
+
+// Module probing is mostly CPU bound (relocation, init calls) and modules
+// without a dependency between them can load in parallel.
+static const size_t kModaliasWorkers = std::max(2u, std::thread::hardware_concurrency());
+
+// How long the dispatch loop waits for more MODALIAS events before resolving
+// the batch it has collected.
+static constexpr std::chrono::milliseconds kModaliasBatchWindow{20};
+
+static std::once_flag ueventd_once;
+
+/**
+ * Returns the module directories for the running kernel: the release-specific
+ * directory if present, followed by the flat /lib/modules fallback.
+ */
+static std::vector<std::string> GetModuleBasePaths() {
+    std::vector<std::string> paths;
+    struct stat sb{};
+
+    struct utsname uts{};
+    if (uname(&uts) == 0) {
+        std::string release_dir = std::string("/lib/modules/") + uts.release;
+        if (stat(release_dir.c_str(), &sb) == 0 && S_ISDIR(sb.st_mode)) {
+            paths.emplace_back(release_dir);
+        }
+    }
+    if (stat("/lib/modules/modules.dep", &sb) == 0) {
+        paths.emplace_back("/lib/modules");
+    }
+    return paths;
+}
+
+/**
+ * Writes "add" to every uevent file below dir_fd so the kernel replays the
+ * add events for devices that appeared before the listener existed.
+ */
+static void RegenerateUeventsForDir(int dir_fd) {
+    int uevent_fd = openat(dir_fd, "uevent", O_WRONLY | O_CLOEXEC);
+    if (uevent_fd >= 0) {
+        TEMP_FAILURE_RETRY(write(uevent_fd, "add\n", 4));
+        close(uevent_fd);
+    }
+
+    DIR* dir = fdopendir(dir_fd);
+    if (!dir) {
+        close(dir_fd);
+        return;
+    }
+    while (dirent* entry = readdir(dir)) {
+        // Only real directories; /sys is full of symlinks back up the tree.
+        if (entry->d_type != DT_DIR || entry->d_name[0] == '.') continue;
+        int child_fd = openat(dirfd(dir), entry->d_name,
+                              O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (child_fd >= 0) RegenerateUeventsForDir(child_fd);
+    }
+    closedir(dir);
+}
+
+static void Coldboot() {
+    auto start = std::chrono::steady_clock::now();
+    for (const char* path : {"/sys/class", "/sys/block", "/sys/devices"}) {
+        int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd >= 0) RegenerateUeventsForDir(fd);
+    }
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start);
+    LOGI("Coldboot uevents regenerated in %lld ms", static_cast<long long>(ms.count()));
+}
+
+static void UeventdMain() {
+    UeventListener listener(kUeventSocketBufferSize);
+    if (listener.device_fd() < 0) {
+        LOGE("uevent socket unavailable; ueventd not running");
+        return;
+    }
+
+    FirmwareHandler firmware_handler(UeventHandler::firmwareDirectories(), kFirmwareWorkers);
+    ModaliasHandler modalias_handler(GetModuleBasePaths(), kModaliasWorkers,
+                                     kModaliasBatchWindow);
+
+    LOGI("ueventd started");
+    Coldboot();
+
+    auto handle = [&](const Uevent& uevent) {
+        firmware_handler.HandleUevent(uevent);
+        if (uevent.action == "add" && !uevent.device_name.empty()) {
+            UeventHandler::applyRulesToDevice("/dev/" + uevent.device_name);
+        }
+    };
+    auto poll = [&](const ListenerCallback& callback,
+                    std::optional<std::chrono::milliseconds> timeout) {
+        listener.Poll(callback, timeout);
+    };
+
+    // Aliases are flushed when a batch is full or its window has passed.
+    while (true) {
+        modalias_handler.DispatchRound(poll, handle);
+    }
+}
+
+void StartUeventd() {
+    std::call_once(ueventd_once, [] { std::thread(UeventdMain).detach(); });
+}
+
+}  // namespace init
+}  // namespace minimal_systems
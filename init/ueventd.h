@@ -0,0 +1,21 @@
+// ueventd.h — In-process uevent dispatch pipeline
+
+#ifndef MINIMAL_SYSTEMS_INIT_UEVENTD_H_
+#define MINIMAL_SYSTEMS_INIT_UEVENTD_H_
+
+namespace minimal_systems {
+namespace init {
+
+/**
+ * Starts the uevent dispatch thread.
+ *
+ * Must be called after ueventd.rc has been parsed so that permission rules
+ * and firmware_directories are in place. Safe to call more than once; only
+ * the first call starts the thread.
+ */
+void StartUeventd();
+
+}  // namespace init
+}  // namespace minimal_systems
+
+#endif  // MINIMAL_SYSTEMS_INIT_UEVENTD_H_
@@ -15,7 +15,7 @@
 #include <sstream>
 
 #define LOG_TAG "ueventhandler"
-#include "log_new.h"
+#include <init/log.h>
 #include "util.h"
 
 namespace minimal_systems {
@@ -25,6 +25,7 @@ namespace fs = std::filesystem;
 
 std::vector<DevicePermissionRule> device_rules;
 std::vector<SubsystemPermissionRule> subsystem_rules;
+std::vector<std::string> firmware_directories;
 
 static uid_t resolve_uid(const std::string& name) {
     struct passwd* pw = getpwnam(name.c_str());
@@ -175,11 +176,32 @@ void UeventHandler::addSubsystemRule(const std::string& raw_line) {
     }
 }
 
+void UeventHandler::addFirmwareDirectories(const std::string& raw_line) {
+    std::istringstream iss(raw_line);
+    std::string token;
+    iss >> token;  // "firmware_directories"
+
+    while (iss >> token) {
+        firmware_directories.push_back(token);
+        LOGI("Added firmware directory: %s", token.c_str());
+    }
+}
+
+std::vector<std::string> UeventHandler::firmwareDirectories() {
+    if (!firmware_directories.empty()) return firmware_directories;
+    return {"/etc/firmware/", "/usr/lib/firmware/", "/lib/firmware/"};
+}
+
 bool UeventHandler::parseRuleLine(const std::string& line) {
     std::string trimmed = line;
     trim(trimmed);
     if (trimmed.empty() || trimmed[0] == '#') return true;
 
+    if (starts_with(trimmed, "firmware_directories")) {
+        addFirmwareDirectories(trimmed);
+        return true;
+    }
+
     if (starts_with(trimmed, "SUBSYSTEM==")) {
         addSubsystemRule(trimmed);
         return true;
@@ -44,6 +44,18 @@ class UeventHandler {
 
     static void addSubsystemRule(const std::string& raw_line);
 
+    /**
+     * Parses a `firmware_directories <dir> [<dir>...]` line.
+     * Directories are searched in the order they are listed.
+     */
+    static void addFirmwareDirectories(const std::string& raw_line);
+
+    /**
+     * Returns the configured firmware search path, or the built-in defaults
+     * when ueventd.rc does not specify one.
+     */
+    static std::vector<std::string> firmwareDirectories();
+
     static bool parseRuleLine(const std::string& line);
 
     static void applyRulesToDevice(const std::string& device_path);
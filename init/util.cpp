@@ -19,7 +19,7 @@
 #include <string>
 #include <filesystem>
 
-#include "log_new.h"
+#include <init/log.h>
 #include "bootcfg.h"
 #include "property_manager.h"
 
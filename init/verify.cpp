@@ -20,94 +20,291 @@
 
 #include "verify.h"
 
+#include <endian.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/dm-ioctl.h>
+#include <linux/fs.h>
 #include <openssl/evp.h>
+#include <openssl/pem.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
 
-#include <fstream>
-#include <iomanip>
-#include <iostream>
 #include <sstream>
 #include <string>
 #include <vector>
 
-#include "log_new.h"
+#include <init/log.h>
+#include "boot_trace.h"
+#include "bootcfg.h"
+#include "fs_mgr.h"
 #include "property_manager.h"
 
 namespace minimal_systems {
 namespace init {
 
-// Fetch secure boot verification properties
-std::string GetSecureBootSHA() {
-    return getprop("ro.sysboot.secureboot_sha");
+namespace {
+
+constexpr const char* kDmControlPaths[] = {"/dev/mapper/control", "/dev/device-mapper"};
+constexpr const char kDmDir[] = "/dev/mapper";
+
+// Offsets within the metadata block.
+constexpr size_t kMetadataSignatureOffset = 8;
+constexpr size_t kMetadataTableLengthOffset = kMetadataSignatureOffset + kVeritySignatureSize;
+constexpr size_t kMetadataTableOffset = kMetadataTableLengthOffset + 4;
+
+uint32_t ReadLe32(const char* p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return le32toh(value);
 }
 
-std::string GetVerityKeyPath() {
-    return getprop("ro.sysboot.secure_verity_key_path");
+bool IsHex(const std::string& str) {
+    return !str.empty() && str.size() % 2 == 0 &&
+           str.find_first_not_of("0123456789abcdefABCDEF") == std::string::npos;
 }
 
-// Compute SHA256 hash of a given file (typically a partition device)
-std::string ComputeSHA256(const std::string& filepath) {
-    std::ifstream file(filepath, std::ios::binary);
-    if (!file.is_open()) {
-        LOGE("Error: Unable to open file '%s' for SHA256 computation.", filepath.c_str());
-        return "";
+bool IsPowerOfTwo(uint32_t value) {
+    return value && !(value & (value - 1));
+}
+
+bool GetDeviceSize(int fd, uint64_t* size) {
+    struct stat st;
+    if (fstat(fd, &st) != 0) return false;
+    if (S_ISREG(st.st_mode)) {
+        *size = static_cast<uint64_t>(st.st_size);
+        return true;
     }
+    return ioctl(fd, BLKGETSIZE64, size) == 0;
+}
 
-    EVP_MD_CTX* ctx = EVP_MD_CTX_new();
-    if (!ctx) {
-        LOGE("Error: Failed to initialize EVP_MD_CTX.");
-        return "";
+void InitDmIoctl(struct dm_ioctl* io, size_t size, const std::string& name, uint32_t flags) {
+    memset(io, 0, size);
+    io->version[0] = DM_VERSION_MAJOR;
+    io->version[1] = DM_VERSION_MINOR;
+    io->version[2] = DM_VERSION_PATCHLEVEL;
+    io->data_size = static_cast<uint32_t>(size);
+    io->data_start = sizeof(struct dm_ioctl);
+    io->flags = flags;
+    strncpy(io->name, name.c_str(), sizeof(io->name) - 1);
+}
+
+int OpenDmControl() {
+    for (const char* path : kDmControlPaths) {
+        int fd = TEMP_FAILURE_RETRY(open(path, O_RDWR | O_CLOEXEC));
+        if (fd >= 0) return fd;
+    }
+    LOGE("Unable to open the device-mapper control node: %s", strerror(errno));
+    return -1;
+}
+
+void RemoveDmDevice(int control_fd, const std::string& name) {
+    struct dm_ioctl io;
+    InitDmIoctl(&io, sizeof(io), name, 0);
+    if (ioctl(control_fd, DM_DEV_REMOVE, &io) != 0) {
+        LOGW("Failed to remove dm device '%s': %s", name.c_str(), strerror(errno));
+    }
+}
+
+/**
+ * Creates dm device `name` with a single read-only `target` spanning
+ * `sectors`, activates it and returns its device number.
+ */
+bool CreateDmDevice(int control_fd, const std::string& name, const char* target,
+                    uint64_t sectors, const std::string& params, dev_t* dev) {
+    struct dm_ioctl create;
+    InitDmIoctl(&create, sizeof(create), name, 0);
+    if (ioctl(control_fd, DM_DEV_CREATE, &create) != 0) {
+        LOGE("DM_DEV_CREATE '%s' failed: %s", name.c_str(), strerror(errno));
+        return false;
+    }
+
+    // dm_ioctl, one dm_target_spec and its NUL-terminated parameters, 8-byte aligned.
+    size_t spec_offset = sizeof(struct dm_ioctl);
+    size_t params_offset = spec_offset + sizeof(struct dm_target_spec);
+    size_t size = (params_offset + params.size() + 1 + 7) & ~static_cast<size_t>(7);
+    std::vector<char> buffer(size);
+    auto* io = reinterpret_cast<struct dm_ioctl*>(buffer.data());
+    InitDmIoctl(io, size, name, DM_READONLY_FLAG);
+    io->target_count = 1;
+    auto* spec = reinterpret_cast<struct dm_target_spec*>(buffer.data() + spec_offset);
+    spec->sector_start = 0;
+    spec->length = sectors;
+    spec->next = static_cast<uint32_t>(size - spec_offset);
+    strncpy(spec->target_type, target, sizeof(spec->target_type) - 1);
+    memcpy(buffer.data() + params_offset, params.c_str(), params.size() + 1);
+    if (ioctl(control_fd, DM_TABLE_LOAD, io) != 0) {
+        LOGE("DM_TABLE_LOAD '%s' failed: %s", name.c_str(), strerror(errno));
+        RemoveDmDevice(control_fd, name);
+        return false;
     }
 
-    const EVP_MD* sha256 = EVP_sha256();
-    if (!EVP_DigestInit_ex(ctx, sha256, nullptr)) {
-        LOGE("Error: EVP_DigestInit_ex failed for SHA256.");
-        EVP_MD_CTX_free(ctx);
-        return "";
+    // Resuming a device without a live table swaps in the one just loaded.
+    struct dm_ioctl resume;
+    InitDmIoctl(&resume, sizeof(resume), name, 0);
+    if (ioctl(control_fd, DM_DEV_SUSPEND, &resume) != 0) {
+        LOGE("Resuming dm device '%s' failed: %s", name.c_str(), strerror(errno));
+        RemoveDmDevice(control_fd, name);
+        return false;
     }
+    *dev = static_cast<dev_t>(resume.dev);
+    return true;
+}
+
+/**
+ * Number of hash blocks dm-verity expects for `data_blocks`: each level holds
+ * the digests of the one below, as many per block as the largest power of two
+ * that fits, up to a single root block.
+ */
+uint64_t HashTreeBlocks(uint64_t data_blocks, uint32_t hash_block_size, size_t digest_size) {
+    uint64_t per_block = 1;
+    while (per_block * 2 * digest_size <= hash_block_size) per_block *= 2;
+    uint64_t total = 0;
+    uint64_t level = data_blocks;
+    do {
+        level = (level + per_block - 1) / per_block;
+        total += level;
+    } while (level > 1);
+    return total;
+}
 
-    char buffer[4096];
-    while (file.read(buffer, sizeof(buffer)) || file.gcount() > 0) {
-        if (!EVP_DigestUpdate(ctx, buffer, file.gcount())) {
-            LOGE("Error: EVP_DigestUpdate failed.");
-            EVP_MD_CTX_free(ctx);
-            return "";
+/**
+ * Looks up a verity setting in first stage, where properties are not loaded
+ * yet: the kernel command line (through bootcfg) first, then bootconfig,
+ * then the ro.<key> property set later in boot.
+ */
+std::string GetBootSetting(const std::string& key) {
+    std::string value = minimal_systems::bootcfg::Get(key);
+    if (value.empty()) {
+        minimal_systems::fs_mgr::GetBootconfig(key, &value);
+        // Bootconfig values may be quoted.
+        if (value.size() >= 2 && value.front() == '"' && value.back() == '"') {
+            value = value.substr(1, value.size() - 2);
         }
     }
+    return value.empty() ? getprop("ro." + key) : value;
+}
 
-    unsigned char hash[EVP_MAX_MD_SIZE];
-    unsigned int hash_len = 0;
-    if (!EVP_DigestFinal_ex(ctx, hash, &hash_len)) {
-        LOGE("Error: EVP_DigestFinal_ex failed.");
-        EVP_MD_CTX_free(ctx);
-        return "";
+// ueventd is not running yet in first stage, so the node is made here.
+bool MakeDmNode(const std::string& path, dev_t dev) {
+    if (mkdir(kDmDir, 0755) != 0 && errno != EEXIST) {
+        LOGE("Failed to create %s: %s", kDmDir, strerror(errno));
+        return false;
+    }
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0 && S_ISBLK(st.st_mode) && st.st_rdev == dev) return true;
+    unlink(path.c_str());
+    if (mknod(path.c_str(), S_IFBLK | 0600, dev) != 0) {
+        LOGE("Failed to create %s (%u:%u): %s", path.c_str(), major(dev), minor(dev),
+             strerror(errno));
+        return false;
     }
+    return true;
+}
 
-    EVP_MD_CTX_free(ctx);
+}  // namespace
+
+std::string GetSecureBootSHA() {
+    return GetBootSetting("sysboot.secureboot_sha");
+}
+
+std::string GetVerityKeyPath() {
+    return GetBootSetting("sysboot.secure_verity_key_path");
+}
+
+bool ReadVerityMetadata(const std::string& device, std::string* table, std::string* signature) {
+    int fd = TEMP_FAILURE_RETRY(open(device.c_str(), O_RDONLY | O_CLOEXEC));
+    if (fd < 0) {
+        LOGE("Error: Unable to open '%s': %s", device.c_str(), strerror(errno));
+        return false;
+    }
 
-    // Convert hash to hex string
-    std::ostringstream oss;
-    oss << std::hex << std::setw(2) << std::setfill('0');
-    for (unsigned int i = 0; i < hash_len; ++i) {
-        oss << std::setw(2) << static_cast<int>(hash[i]);
+    uint64_t size = 0;
+    std::vector<char> block(kVerityMetadataSize);
+    bool ok = GetDeviceSize(fd, &size) && size >= kVerityMetadataSize;
+    if (ok) {
+        ssize_t n = TEMP_FAILURE_RETRY(
+                pread(fd, block.data(), block.size(), size - kVerityMetadataSize));
+        ok = n == static_cast<ssize_t>(block.size());
+    }
+    close(fd);
+    if (!ok) {
+        LOGE("Error: Unable to read verity metadata from '%s'.", device.c_str());
+        return false;
     }
 
-    std::string hash_str = oss.str();
-    LOGI("SHA256 hash for '%s': %s", filepath.c_str(), hash_str.c_str());
+    if (ReadLe32(block.data()) != kVerityMetadataMagic) {
+        LOGE("Error: '%s' has no verity metadata.", device.c_str());
+        return false;
+    }
+    uint32_t version = ReadLe32(block.data() + 4);
+    uint32_t table_length = ReadLe32(block.data() + kMetadataTableLengthOffset);
+    if (version != 0 || table_length == 0 ||
+        table_length > kVerityMetadataSize - kMetadataTableOffset) {
+        LOGE("Error: Invalid verity metadata on '%s' (version %u, table length %u).",
+             device.c_str(), version, table_length);
+        return false;
+    }
 
-    return hash_str;
+    signature->assign(block.data() + kMetadataSignatureOffset, kVeritySignatureSize);
+    table->assign(block.data() + kMetadataTableOffset, table_length);
+    return true;
 }
 
-// Verify computed hash against expected Secure Boot SHA
-bool VerifySecureBootSHA(const std::string& computed_hash) {
-    std::string expected_sha = GetSecureBootSHA();
+bool ParseVerityTable(const std::string& table, VerityTable* out) {
+    std::istringstream iss(table);
+    std::string data_device, hash_device;
+    VerityTable parsed;
+    if (!(iss >> parsed.version >> data_device >> hash_device >> parsed.data_block_size >>
+          parsed.hash_block_size >> parsed.data_blocks >> parsed.hash_start_block >>
+          parsed.algorithm >> parsed.root_digest >> parsed.salt)) {
+        LOGE("Error: Malformed verity table '%s'.", table.c_str());
+        return false;
+    }
+    size_t num_optional = 0;
+    if (iss >> num_optional) {
+        std::string arg;
+        while (parsed.optional_args.size() < num_optional && iss >> arg) {
+            parsed.optional_args.push_back(arg);
+        }
+    }
+    std::string trailing;
+    if (parsed.optional_args.size() != num_optional || iss >> trailing) {
+        LOGE("Error: Malformed optional arguments in verity table '%s'.", table.c_str());
+        return false;
+    }
 
-    if (expected_sha.empty()) {
-        LOGE("Error: Secure Boot SHA property is not set.");
+    if (parsed.version != 0 && parsed.version != 1) {
+        LOGE("Error: Unsupported verity table version %d.", parsed.version);
         return false;
     }
+    if (!IsPowerOfTwo(parsed.data_block_size) || parsed.data_block_size < 512 ||
+        !IsPowerOfTwo(parsed.hash_block_size) || parsed.hash_block_size < 512) {
+        LOGE("Error: Invalid verity block sizes %u/%u.", parsed.data_block_size,
+             parsed.hash_block_size);
+        return false;
+    }
+    if (parsed.data_blocks == 0 || parsed.algorithm.empty() || !IsHex(parsed.root_digest) ||
+        (parsed.salt != "-" && !IsHex(parsed.salt))) {
+        LOGE("Error: Invalid verity table '%s'.", table.c_str());
+        return false;
+    }
+    *out = std::move(parsed);
+    return true;
+}
+
+bool VerifySecureBootSHA(const std::string& root_digest) {
+    std::string expected_sha = GetSecureBootSHA();
+    if (expected_sha.empty()) {
+        return true;
+    }
 
-    if (computed_hash != expected_sha) {
-        LOGE("Secure Boot SHA mismatch! Computed: '%s', Expected: '%s'.", computed_hash.c_str(),
+    if (strcasecmp(root_digest.c_str(), expected_sha.c_str()) != 0) {
+        LOGE("Secure Boot SHA mismatch! Root digest: '%s', Expected: '%s'.", root_digest.c_str(),
              expected_sha.c_str());
         return false;
     }
@@ -116,70 +313,116 @@ bool VerifySecureBootSHA(const std::string& computed_hash) {
     return true;
 }
 
-// Signature verification using public key
-bool VerifySignature(const std::string& hash) {
+bool VerifySignature(const std::string& data, const std::string& signature) {
     std::string public_key_path = GetVerityKeyPath();
-
     if (public_key_path.empty()) {
-        LOGE("Error: Secure Verity Key Path property is not set.");
+        LOGE("Error: sysboot.secure_verity_key_path is not set.");
         return false;
     }
 
-    LOGI("Verifying signature for hash: '%s' using public key: '%s'.", hash.c_str(),
-         public_key_path.c_str());
+    BIO* bio = BIO_new_file(public_key_path.c_str(), "r");
+    if (!bio) {
+        LOGE("Error: Unable to open verity key '%s'.", public_key_path.c_str());
+        return false;
+    }
+    EVP_PKEY* key = PEM_read_bio_PUBKEY(bio, nullptr, nullptr, nullptr);
+    BIO_free(bio);
+    if (!key) {
+        LOGE("Error: '%s' is not a PEM public key.", public_key_path.c_str());
+        return false;
+    }
 
-    // TODO: Replace with actual signature verification (e.g., RSA or ECDSA)
-    bool simulated_result = true;  // Simulating a successful signature verification
+    EVP_MD_CTX* ctx = EVP_MD_CTX_new();
+    bool ok = ctx && EVP_DigestVerifyInit(ctx, nullptr, EVP_sha256(), nullptr, key) == 1 &&
+              EVP_DigestVerifyUpdate(ctx, data.data(), data.size()) == 1 &&
+              EVP_DigestVerifyFinal(ctx, reinterpret_cast<const unsigned char*>(signature.data()),
+                                    signature.size()) == 1;
+    EVP_MD_CTX_free(ctx);
+    EVP_PKEY_free(key);
 
-    if (!simulated_result) {
-        LOGE("Signature verification failed for hash: '%s'.", hash.c_str());
+    if (!ok) {
+        LOGE("Signature verification failed using public key '%s'.", public_key_path.c_str());
         return false;
     }
 
-    LOGI("Signature verification passed for hash: '%s'.", hash.c_str());
+    LOGI("Signature verification passed using public key '%s'.", public_key_path.c_str());
     return true;
 }
 
-// Perform partition verification (similar to AVB checks)
-bool VerifyPartition(const std::string& device, const std::string& mount_point,
-                     const std::string& filesystem) {
-    LOGI("Starting partition verification: Device='%s', Mount Point='%s', Filesystem='%s'",
-         device.c_str(), mount_point.c_str(), filesystem.c_str());
+bool SetUpVerity(const std::string& device, const std::string& name, std::string* verity_device) {
+    ScopedBootTrace trace(kTraceMount, "verity " + name);
+    LOGI("Setting up dm-verity for '%s' as '%s'.", device.c_str(), name.c_str());
 
-    // Step 1: Ensure the partition device exists
-    std::ifstream device_file(device);
-    if (!device_file.is_open()) {
-        LOGW("Warning: Device '%s' is not accessible or does not exist. Skipping verification.",
-             device.c_str());
-        return true;  // Allow boot to continue even if device is missing
+    std::string table_string, signature;
+    if (!ReadVerityMetadata(device, &table_string, &signature)) {
+        return false;
+    }
+    if (!VerifySignature(table_string, signature)) {
+        LOGE("Critical: Verity table of '%s' is not signed by the verity key.", device.c_str());
+        return false;
+    }
+    VerityTable table;
+    if (!ParseVerityTable(table_string, &table) || !VerifySecureBootSHA(table.root_digest)) {
+        return false;
     }
-    LOGI("Device '%s' is accessible.", device.c_str());
 
-    // Step 2: Compute SHA256 hash of the partition
-    LOGI("Computing SHA256 hash for partition '%s'.", device.c_str());
-    std::string computed_hash = ComputeSHA256(device);
-    if (computed_hash.empty()) {
-        LOGE("Critical: Hash computation failed for partition '%s'. Verification aborted.",
-             device.c_str());
-        return false;  // Stop boot process if hash fails
+    const EVP_MD* md = EVP_get_digestbyname(table.algorithm.c_str());
+    if (!md || static_cast<size_t>(EVP_MD_size(md)) * 2 != table.root_digest.size()) {
+        LOGE("Error: Unsupported verity algorithm '%s' for root digest '%s'.",
+             table.algorithm.c_str(), table.root_digest.c_str());
+        return false;
     }
 
-    // Step 3: Verify hash against Secure Boot SHA
-    if (!VerifySecureBootSHA(computed_hash)) {
-        LOGE("Critical: Secure Boot SHA verification failed for partition '%s'. Boot process "
-             "halted.",
-             device.c_str());
+    // The data, then the whole hash tree, must end before the metadata block.
+    uint64_t size = 0;
+    int fd = TEMP_FAILURE_RETRY(open(device.c_str(), O_RDONLY | O_CLOEXEC));
+    bool sized = fd >= 0 && GetDeviceSize(fd, &size) && size >= kVerityMetadataSize;
+    if (fd >= 0) close(fd);
+    uint64_t limit = sized ? size - kVerityMetadataSize : 0;
+    uint64_t hash_blocks =
+            HashTreeBlocks(table.data_blocks, table.hash_block_size, EVP_MD_size(md));
+    bool fits = sized && table.data_blocks <= limit / table.data_block_size &&
+                table.hash_start_block <= limit / table.hash_block_size &&
+                hash_blocks <= limit / table.hash_block_size - table.hash_start_block;
+    uint64_t data_end = fits ? table.data_blocks * table.data_block_size : 0;
+    if (!fits || data_end % 512 || table.hash_start_block * table.hash_block_size < data_end) {
+        LOGE("Error: Verity table of '%s' does not fit the device.", device.c_str());
         return false;
     }
 
-    // Step 4: Verify hash against stored signature
-    if (!VerifySignature(computed_hash)) {
-        LOGE("Critical: Signature verification failed for partition '%s'. Boot process halted.",
-             device.c_str());
+    // The table's device paths are from build time; both live on `device` here.
+    std::string params = std::to_string(table.version) + " " + device + " " + device + " " +
+                         std::to_string(table.data_block_size) + " " +
+                         std::to_string(table.hash_block_size) + " " +
+                         std::to_string(table.data_blocks) + " " +
+                         std::to_string(table.hash_start_block) + " " + table.algorithm + " " +
+                         table.root_digest + " " + table.salt;
+    if (table.optional_args.empty()) {
+        params += " 1 restart_on_corruption";
+    } else {
+        params += " " + std::to_string(table.optional_args.size());
+        for (const auto& arg : table.optional_args) params += " " + arg;
+    }
+
+    int control_fd = OpenDmControl();
+    if (control_fd < 0) {
+        return false;
+    }
+    dev_t dev = 0;
+    std::string path = std::string(kDmDir) + "/" + name;
+    bool ok = CreateDmDevice(control_fd, name, "verity", data_end / 512, params, &dev);
+    if (ok && !MakeDmNode(path, dev)) {
+        RemoveDmDevice(control_fd, name);
+        ok = false;
+    }
+    close(control_fd);
+    if (!ok) {
         return false;
     }
 
-    LOGI("Partition verification completed successfully for device '%s'.", device.c_str());
+    LOGI("dm-verity device %s (%u:%u) ready for '%s', root digest %s.", path.c_str(), major(dev),
+         minor(dev), device.c_str(), table.root_digest.c_str());
+    *verity_device = path;
     return true;
 }
 
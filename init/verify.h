@@ -1,14 +1,74 @@
 #ifndef VERIFY_H
 #define VERIFY_H
 
+#include <stdint.h>
+
 #include <string>
+#include <vector>
+
+namespace minimal_systems {
+namespace init {
+
+/**
+ * Verified partitions carry a metadata block in their last
+ * kVerityMetadataSize bytes, after the filesystem and its hash tree:
+ *
+ *   uint32_t magic;             // kVerityMetadataMagic, little endian
+ *   uint32_t protocol_version;  // 0
+ *   uint8_t signature[256];     // RSA-2048 PKCS#1 v1.5 / SHA-256 over the table
+ *   uint32_t table_length;
+ *   char table[table_length];   // dm-verity table, see VerityTable
+ *
+ * Only the table's signature is checked at boot; the kernel checks each data
+ * block against the hash tree when it is first read.
+ */
+constexpr uint32_t kVerityMetadataMagic = 0xb001b001;
+constexpr size_t kVerityMetadataSize = 32 * 1024;
+constexpr size_t kVeritySignatureSize = 256;
 
-std::string ComputeSHA256(const std::string& filepath);
-bool VerifyPartition(const std::string& device, const std::string& mount_point,
-                     const std::string& filesystem);
-bool VerifySecureBootSHA(const std::string& computed_hash);
-bool VerifySignature(const std::string& hash);
+// A dm-verity table: "<version> <data_dev> <hash_dev> <data_block_size> <hash_block_size>
+// <num_data_blocks> <hash_start_block> <algorithm> <root_digest> <salt> [<#opt> <opt>...]".
+struct VerityTable {
+    int version = 0;
+    uint32_t data_block_size = 0;
+    uint32_t hash_block_size = 0;
+    uint64_t data_blocks = 0;
+    uint64_t hash_start_block = 0;
+    std::string algorithm;
+    std::string root_digest;
+    std::string salt;
+    std::vector<std::string> optional_args;
+};
+
+// sysboot.secureboot_sha and sysboot.secure_verity_key_path, read from the
+// kernel command line or bootconfig, or from their ro. properties.
 std::string GetSecureBootSHA();
 std::string GetVerityKeyPath();
 
+// Reads the metadata block at the end of `device`; false if there is none.
+bool ReadVerityMetadata(const std::string& device, std::string* table, std::string* signature);
+
+// Parses and sanity-checks a dm-verity table.
+bool ParseVerityTable(const std::string& table, VerityTable* out);
+
+// Checks that the root digest matches GetSecureBootSHA(), when that is set.
+bool VerifySecureBootSHA(const std::string& root_digest);
+
+// Checks `signature` over `data` with the public key at GetVerityKeyPath().
+bool VerifySignature(const std::string& data, const std::string& signature);
+
+/**
+ * Sets up dm-verity over a partition: reads and verifies its metadata, then
+ * creates a read-only device-mapper device `name` hashing against the tree on
+ * the same partition.
+ *
+ * @param verity_device Receives the node to mount, /dev/mapper/<name>.
+ * @return False if the metadata is missing, unsigned or invalid, or the
+ * kernel rejects the table.
+ */
+bool SetUpVerity(const std::string& device, const std::string& name, std::string* verity_device);
+
+}  // namespace init
+}  // namespace minimal_systems
+
 #endif  // VERIFY_H
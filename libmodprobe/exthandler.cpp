@@ -0,0 +1,623 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ */
+
+#include <modprobe/exthandler.h>
+#include "log_new.h"
+
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <grp.h>
+#include <poll.h>
+#include <pwd.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+extern char** environ;
+
+/**
+ * Trims leading and trailing spaces from a string.
+ *
+ * @param str The input string to trim.
+ * @return A string with whitespace removed from both ends.
+ */
+std::string Trim(const std::string& str) {
+    size_t first = str.find_first_not_of(" ");
+    if (first == std::string::npos) return "";
+    size_t last = str.find_last_not_of(" ");
+    return str.substr(first, last - first + 1);
+}
+
+/**
+ * Splits a string into tokens using the specified delimiter.
+ *
+ * @param str The input string.
+ * @param delimiter The delimiter to split on.
+ * @return A vector of substrings.
+ */
+std::vector<std::string> Split(const std::string& str, const std::string& delimiter) {
+    std::vector<std::string> tokens;
+    size_t start = 0, end;
+    while ((end = str.find(delimiter, start)) != std::string::npos) {
+        tokens.push_back(str.substr(start, end - start));
+        start = end + delimiter.length();
+    }
+    tokens.push_back(str.substr(start));
+    return tokens;
+}
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct SpawnedChild {
+    pid_t pid = -1;
+    int stdin_fd = -1;   // Only set for persistent helpers.
+    int stdout_fd = -1;
+    int stderr_fd = -1;
+};
+
+void CloseFd(int* fd) {
+    if (*fd >= 0) {
+        close(*fd);
+        *fd = -1;
+    }
+}
+
+/**
+ * Builds "KEY=value" strings for the child's environment: the current
+ * environment with envs_map entries added or overriding existing keys.
+ */
+std::vector<std::string> BuildEnvironment(
+        const std::unordered_map<std::string, std::string>& envs_map) {
+    std::vector<std::string> env;
+    for (char** e = environ; e && *e; ++e) {
+        const char* eq = strchr(*e, '=');
+        if (eq && envs_map.count(std::string(*e, eq - *e))) continue;
+        env.emplace_back(*e);
+    }
+    for (const auto& [key, value] : envs_map) {
+        env.emplace_back(key + "=" + value);
+    }
+    return env;
+}
+
+std::vector<char*> ToCharPtrs(std::vector<std::string>& strings) {
+    std::vector<char*> ptrs;
+    ptrs.reserve(strings.size() + 1);
+    for (auto& s : strings) ptrs.emplace_back(s.data());
+    ptrs.emplace_back(nullptr);
+    return ptrs;
+}
+
+/**
+ * Starts `args` with the given credentials.
+ *
+ * For one-shot handlers stdout/stderr are pipes and stdin is /dev/null.
+ * Persistent helpers (interactive == true) get a socketpair on stdin and
+ * stdout instead so that writes to a dead helper fail with EPIPE rather
+ * than raising SIGPIPE in init.
+ */
+bool SpawnChild(const std::vector<std::string>& args, uid_t uid, gid_t gid,
+                const std::unordered_map<std::string, std::string>& envs_map, bool interactive,
+                SpawnedChild* child) {
+    if (args.empty() || args[0].empty()) {
+        LOGE("Empty external handler command");
+        return false;
+    }
+
+    int out[2] = {-1, -1};
+    int err[2] = {-1, -1};
+    int in[2] = {-1, -1};
+    bool fds_ok;
+    if (interactive) {
+        fds_ok = socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, in) == 0 &&
+                 pipe2(err, O_CLOEXEC) == 0;
+        // The same socket carries requests in and replies out.
+        out[0] = in[0];
+        out[1] = in[1];
+    } else {
+        fds_ok = pipe2(out, O_CLOEXEC) == 0 && pipe2(err, O_CLOEXEC) == 0;
+    }
+    if (!fds_ok) {
+        LOGE("Failed to create handler pipes: %s", strerror(errno));
+        for (int fd : {out[0], out[1], err[0], err[1]}) {
+            if (fd >= 0) close(fd);
+        }
+        return false;
+    }
+
+    std::vector<std::string> argv_storage(args);
+    std::vector<char*> argv = ToCharPtrs(argv_storage);
+    std::vector<std::string> env_storage = BuildEnvironment(envs_map);
+    std::vector<char*> envp = ToCharPtrs(env_storage);
+
+    bool needs_creds = uid != getuid() || (gid != 0 && gid != getgid());
+    pid_t pid = -1;
+
+    if (!needs_creds) {
+        posix_spawn_file_actions_t actions;
+        posix_spawn_file_actions_init(&actions);
+        if (interactive) {
+            posix_spawn_file_actions_adddup2(&actions, out[1], STDIN_FILENO);
+        } else {
+            posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+        }
+        posix_spawn_file_actions_adddup2(&actions, out[1], STDOUT_FILENO);
+        posix_spawn_file_actions_adddup2(&actions, err[1], STDERR_FILENO);
+
+        posix_spawnattr_t attr;
+        posix_spawnattr_init(&attr);
+        sigset_t default_signals;
+        sigemptyset(&default_signals);
+        sigaddset(&default_signals, SIGCHLD);
+        sigaddset(&default_signals, SIGPIPE);
+        posix_spawnattr_setsigdefault(&attr, &default_signals);
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF);
+
+        int ret = posix_spawn(&pid, argv[0], &actions, &attr, argv.data(), envp.data());
+        posix_spawnattr_destroy(&attr);
+        posix_spawn_file_actions_destroy(&actions);
+        if (ret != 0) {
+            LOGE("posix_spawn(%s) failed: %s", argv[0], strerror(ret));
+            pid = -1;
+        }
+    } else {
+        // posix_spawn cannot change credentials, so drop privileges by hand.
+        int null_fd = interactive ? -1 : open("/dev/null", O_RDONLY | O_CLOEXEC);
+        pid = fork();
+        if (pid == 0) {
+            dup2(interactive ? out[1] : null_fd, STDIN_FILENO);
+            dup2(out[1], STDOUT_FILENO);
+            dup2(err[1], STDERR_FILENO);
+            signal(SIGCHLD, SIG_DFL);
+            signal(SIGPIPE, SIG_DFL);
+
+            if (gid != 0 && setgid(gid) != 0) {
+                fprintf(stderr, "setgid() failed: %s", strerror(errno));
+                _exit(EXIT_FAILURE);
+            }
+            if (setuid(uid) != 0) {
+                fprintf(stderr, "setuid() failed: %s", strerror(errno));
+                _exit(EXIT_FAILURE);
+            }
+
+            execve(argv[0], argv.data(), envp.data());
+            fprintf(stderr, "exec() failed: %s", strerror(errno));
+            _exit(EXIT_FAILURE);
+        }
+        if (null_fd >= 0) close(null_fd);
+        if (pid < 0) {
+            LOGE("fork() failed: %s", strerror(errno));
+        }
+    }
+
+    close(out[1]);
+    close(err[1]);
+    if (pid < 0) {
+        close(out[0]);
+        close(err[0]);
+        return false;
+    }
+
+    fcntl(out[0], F_SETFL, fcntl(out[0], F_GETFL) | O_NONBLOCK);
+    fcntl(err[0], F_SETFL, fcntl(err[0], F_GETFL) | O_NONBLOCK);
+
+    child->pid = pid;
+    child->stdout_fd = out[0];
+    child->stderr_fd = err[0];
+    child->stdin_fd = interactive ? out[0] : -1;
+    return true;
+}
+
+int RemainingMs(Clock::time_point deadline) {
+    auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - Clock::now());
+    return static_cast<int>(std::max<int64_t>(remaining.count(), 0));
+}
+
+/**
+ * Appends everything currently readable on a non-blocking fd.
+ *
+ * @return false once the writer has closed its end (or on error).
+ */
+bool DrainFd(int fd, std::string* content) {
+    char buffer[64 * 1024];
+    while (true) {
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n > 0) {
+            content->append(buffer, static_cast<size_t>(n));
+            continue;
+        }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) return true;
+        return false;
+    }
+}
+
+/**
+ * A pidfd that becomes readable when `pid` exits, or -1 on kernels older
+ * than 5.3.
+ */
+int OpenPidFd(pid_t pid) {
+#ifdef __NR_pidfd_open
+    return static_cast<int>(syscall(__NR_pidfd_open, pid, 0));
+#else
+    (void)pid;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+/**
+ * Collects the exit status of a child that has exited, or is killed first
+ * if `expired` because it outlived its deadline.
+ */
+void ReapChild(pid_t pid, bool expired, ExternalHandlerResult* result) {
+    if (expired) {
+        kill(pid, SIGKILL);
+        result->timed_out = true;
+    }
+    if (TEMP_FAILURE_RETRY(waitpid(pid, &result->status, 0)) != pid) {
+        LOGE("waitpid() failed: %s", strerror(errno));
+    }
+}
+
+void LogHandlerStderr(const std::string& stderr_content) {
+    for (const auto& message : Split(stderr_content, "\n")) {
+        if (!message.empty()) {
+            LOGE("External Handler: %s", message.c_str());
+        }
+    }
+}
+
+}  // namespace
+
+bool ExternalHandlerResult::ok() const {
+    return spawned && !timed_out && WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+}
+
+/**
+ * A helper process kept alive across requests.
+ *
+ * Protocol: one request per line written to the helper's stdin, one reply
+ * per line read from its stdout. Requests to the same helper are serialized.
+ */
+class PersistentHandler {
+  public:
+    PersistentHandler(std::vector<std::string> args, uid_t uid, gid_t gid)
+        : args_(std::move(args)), uid_(uid), gid_(gid) {}
+
+    ~PersistentHandler() { Stop(); }
+
+    bool Request(const std::string& request, std::string* reply,
+                 std::chrono::milliseconds timeout) {
+        std::lock_guard<std::mutex> guard(lock_);
+        auto deadline = Clock::now() + timeout;
+
+        // A helper that exited since the last request is restarted once.
+        for (int attempt = 0; attempt < 2; ++attempt) {
+            if (child_.pid < 0 && !SpawnChild(args_, uid_, gid_, {}, true, &child_)) {
+                return false;
+            }
+            if (Send(request + "\n")) break;
+            Stop();
+            if (attempt == 1) return false;
+        }
+
+        while (true) {
+            size_t nl = pending_.find('\n');
+            if (nl != std::string::npos) {
+                reply->assign(pending_, 0, nl);
+                pending_.erase(0, nl + 1);
+                return true;
+            }
+
+            int timeout_ms = RemainingMs(deadline);
+            if (timeout_ms == 0) {
+                LOGE("Persistent handler '%s' timed out", args_[0].c_str());
+                Stop();
+                return false;
+            }
+
+            struct pollfd fds[2] = {{child_.stdout_fd, POLLIN, 0}, {child_.stderr_fd, POLLIN, 0}};
+            int nr = TEMP_FAILURE_RETRY(poll(fds, 2, timeout_ms));
+            if (nr < 0) {
+                LOGE("poll() on persistent handler failed: %s", strerror(errno));
+                Stop();
+                return false;
+            }
+            if (fds[1].revents) {
+                std::string err;
+                DrainFd(child_.stderr_fd, &err);
+                LogHandlerStderr(err);
+            }
+            if (fds[0].revents && !DrainFd(child_.stdout_fd, &pending_) &&
+                pending_.find('\n') == std::string::npos) {
+                LOGE("Persistent handler '%s' exited", args_[0].c_str());
+                Stop();
+                return false;
+            }
+        }
+    }
+
+    void Stop() {
+        if (child_.pid > 0) {
+            kill(child_.pid, SIGKILL);
+            TEMP_FAILURE_RETRY(waitpid(child_.pid, nullptr, 0));
+        }
+        child_.pid = -1;
+        // stdin and stdout share one socket.
+        child_.stdin_fd = -1;
+        CloseFd(&child_.stdout_fd);
+        CloseFd(&child_.stderr_fd);
+        pending_.clear();
+    }
+
+  private:
+    bool Send(const std::string& data) {
+        size_t off = 0;
+        while (off < data.size()) {
+            ssize_t n = send(child_.stdin_fd, data.data() + off, data.size() - off, MSG_NOSIGNAL);
+            if (n < 0 && (errno == EINTR || errno == EAGAIN)) {
+                struct pollfd pfd = {child_.stdin_fd, POLLOUT, 0};
+                TEMP_FAILURE_RETRY(poll(&pfd, 1, 100));
+                continue;
+            }
+            if (n <= 0) return false;
+            off += static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    std::mutex lock_;
+    std::vector<std::string> args_;
+    uid_t uid_;
+    gid_t gid_;
+    SpawnedChild child_;
+    std::string pending_;
+};
+
+ExternalHandlerRunner& ExternalHandlerRunner::instance() {
+    static ExternalHandlerRunner runner;
+    return runner;
+}
+
+ExternalHandlerRunner::ExternalHandlerRunner()
+    : max_concurrent_(std::max(2u, std::thread::hardware_concurrency())) {
+    // An ignored SIGCHLD, or SA_NOCLDWAIT, makes the kernel reap children
+    // before waitpid() can collect their status. A handler is left alone.
+    struct sigaction action;
+    if (sigaction(SIGCHLD, nullptr, &action) == 0 &&
+        (action.sa_handler == SIG_IGN || (action.sa_flags & SA_NOCLDWAIT))) {
+        LOGW("SIGCHLD is set to auto-reap; restoring the default for external handlers");
+        signal(SIGCHLD, SIG_DFL);
+    }
+}
+
+ExternalHandlerRunner::~ExternalHandlerRunner() {
+    StopPersistentHandlers();
+}
+
+void ExternalHandlerRunner::SetMaxConcurrent(size_t max_concurrent) {
+    {
+        std::lock_guard<std::mutex> guard(slots_lock_);
+        max_concurrent_ = std::max<size_t>(max_concurrent, 1);
+    }
+    slots_cv_.notify_all();
+}
+
+size_t ExternalHandlerRunner::max_concurrent() const {
+    std::lock_guard<std::mutex> guard(slots_lock_);
+    return max_concurrent_;
+}
+
+void ExternalHandlerRunner::AcquireSlot() {
+    std::unique_lock<std::mutex> lock(slots_lock_);
+    slots_cv_.wait(lock, [this] { return running_ < max_concurrent_; });
+    ++running_;
+}
+
+void ExternalHandlerRunner::ReleaseSlot() {
+    {
+        std::lock_guard<std::mutex> guard(slots_lock_);
+        --running_;
+    }
+    slots_cv_.notify_one();
+}
+
+const std::vector<std::string>& ExternalHandlerRunner::ParseCommand(const std::string& handler) {
+    std::lock_guard<std::mutex> guard(commands_lock_);
+    auto it = commands_.find(handler);
+    if (it == commands_.end()) {
+        it = commands_.emplace(handler, Split(handler, " ")).first;
+    }
+    // unordered_map never moves its values, so the reference outlives the lock.
+    return it->second;
+}
+
+ExternalHandlerResult ExternalHandlerRunner::Run(
+        const std::string& handler, uid_t uid, gid_t gid,
+        const std::unordered_map<std::string, std::string>& envs_map,
+        std::chrono::milliseconds timeout) {
+    ExternalHandlerResult result;
+    const auto& args = ParseCommand(handler);
+
+    AcquireSlot();
+    auto deadline = Clock::now() + timeout;
+
+    SpawnedChild child;
+    if (!SpawnChild(args, uid, gid, envs_map, false, &child)) {
+        ReleaseSlot();
+        return result;
+    }
+    result.spawned = true;
+
+    // The child's exit wakes the same epoll loop that drains its output, and
+    // ends it: output a grandchild keeps open is not waited for. Without a
+    // pidfd the child is waited for once it has closed both pipes.
+    int pid_fd = OpenPidFd(child.pid);
+    bool exited = false;
+    bool expired = false;
+
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd < 0) {
+        LOGE("epoll_create1() failed: %s", strerror(errno));
+        kill(child.pid, SIGKILL);
+    } else {
+        int open_fds = 0;
+        for (int fd : {child.stdout_fd, child.stderr_fd, pid_fd}) {
+            if (fd < 0) continue;
+            struct epoll_event ev = {};
+            ev.events = EPOLLIN;
+            ev.data.fd = fd;
+            if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+                if (fd == pid_fd) CloseFd(&pid_fd);
+            } else if (fd != pid_fd) {
+                ++open_fds;
+            }
+        }
+
+        while (pid_fd >= 0 ? !exited : open_fds > 0) {
+            int timeout_ms = RemainingMs(deadline);
+            if (timeout_ms == 0) {
+                expired = true;
+                break;
+            }
+
+            struct epoll_event events[3];
+            int nr = TEMP_FAILURE_RETRY(epoll_wait(epoll_fd, events, 3, timeout_ms));
+            if (nr < 0) {
+                LOGE("epoll_wait() failed: %s", strerror(errno));
+                expired = true;
+                break;
+            }
+            for (int i = 0; i < nr; ++i) {
+                int fd = events[i].data.fd;
+                if (fd == pid_fd) {
+                    exited = true;
+                    continue;
+                }
+                auto* out = fd == child.stdout_fd ? &result.stdout_content
+                                                  : &result.stderr_content;
+                if (!DrainFd(fd, out)) {
+                    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+                    --open_fds;
+                }
+            }
+        }
+        close(epoll_fd);
+
+        // Whatever the child wrote before exiting is still in the pipes.
+        if (exited) {
+            DrainFd(child.stdout_fd, &result.stdout_content);
+            DrainFd(child.stderr_fd, &result.stderr_content);
+        }
+    }
+
+    ReapChild(child.pid, expired, &result);
+    CloseFd(&pid_fd);
+    CloseFd(&child.stdout_fd);
+    CloseFd(&child.stderr_fd);
+    ReleaseSlot();
+
+    if (result.timed_out) {
+        LOGE("External handler '%s' timed out after %lld ms", args[0].c_str(),
+             static_cast<long long>(timeout.count()));
+    }
+    return result;
+}
+
+std::future<ExternalHandlerResult> ExternalHandlerRunner::RunAsync(
+        const std::string& handler, uid_t uid, gid_t gid,
+        const std::unordered_map<std::string, std::string>& envs_map,
+        std::chrono::milliseconds timeout) {
+    return std::async(std::launch::async, [this, handler, uid, gid, envs_map, timeout] {
+        return Run(handler, uid, gid, envs_map, timeout);
+    });
+}
+
+bool ExternalHandlerRunner::Request(const std::string& handler, uid_t uid, gid_t gid,
+                                    const std::string& request, std::string* reply,
+                                    std::chrono::milliseconds timeout) {
+    std::shared_ptr<PersistentHandler> helper;
+    {
+        std::lock_guard<std::mutex> guard(helpers_lock_);
+        std::string key = handler + "|" + std::to_string(uid) + ":" + std::to_string(gid);
+        auto& slot = helpers_[key];
+        if (!slot) {
+            slot = std::make_shared<PersistentHandler>(ParseCommand(handler), uid, gid);
+        }
+        helper = slot;
+    }
+    return helper->Request(request, reply, timeout);
+}
+
+void ExternalHandlerRunner::StopPersistentHandlers() {
+    std::unordered_map<std::string, std::shared_ptr<PersistentHandler>> helpers;
+    {
+        std::lock_guard<std::mutex> guard(helpers_lock_);
+        helpers.swap(helpers_);
+    }
+    for (auto& [unused, helper] : helpers) {
+        helper->Stop();
+    }
+}
+
+/**
+ * Executes an external handler binary with environment overrides and UID/GID.
+ *
+ * Captured stdout is returned as string if execution succeeds.
+ * Captured stderr is logged. All failures result in empty string return.
+ *
+ * @param handler The command to execute (e.g. "/bin/myscript --flag").
+ * @param uid The user ID to switch to before exec.
+ * @param gid The group ID to switch to before exec.
+ * @param envs_map A map of environment variables to apply before exec.
+ * @return The trimmed stdout content on success, empty string otherwise.
+ */
+std::string RunExternalHandler(const std::string& handler, uid_t uid, gid_t gid,
+                               std::unordered_map<std::string, std::string>& envs_map) {
+    auto result = ExternalHandlerRunner::instance().Run(handler, uid, gid, envs_map);
+    if (!result.spawned) {
+        return "";
+    }
+
+    LogHandlerStderr(result.stderr_content);
+
+    if (result.timed_out) {
+        return "";
+    }
+    if (WIFEXITED(result.status)) {
+        if (WEXITSTATUS(result.status) == EXIT_SUCCESS) {
+            return Trim(result.stdout_content);
+        }
+        LOGE("Exited with status %d", WEXITSTATUS(result.status));
+        return "";
+    } else if (WIFSIGNALED(result.status)) {
+        LOGE("Killed by signal %d", WTERMSIG(result.status));
+        return "";
+    }
+
+    LOGE("Unexpected exit status %d", result.status);
+    return "";
+}
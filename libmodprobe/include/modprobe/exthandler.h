@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <sys/types.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * @brief Outcome of a single external handler invocation.
+ */
+struct ExternalHandlerResult {
+    bool spawned = false;    ///< The child was started.
+    bool timed_out = false;  ///< The child was killed after exceeding its timeout.
+    int status = -1;         ///< Raw waitpid() status; valid only if spawned.
+    std::string stdout_content;
+    std::string stderr_content;
+
+    /** True if the child ran to completion and exited with EXIT_SUCCESS. */
+    bool ok() const;
+};
+
+class PersistentHandler;
+
+/**
+ * @brief Runs external handler binaries without blocking the caller on pipe I/O.
+ *
+ * Children are started with posix_spawn() when no credential change is needed
+ * (fork() + setuid() otherwise, since posix_spawn cannot drop privileges). Their
+ * stdout and stderr are drained through epoll while they run, so a chatty
+ * handler can never fill a pipe and deadlock against waitpid(). Each invocation
+ * is bounded by a timeout after which the child is killed, and at most
+ * max_concurrent() handlers run at the same time; further requests queue.
+ *
+ * Handlers that are invoked repeatedly can instead be kept alive with
+ * Request(): the helper is spawned once and served one request per line on
+ * stdin, answering with one line on stdout.
+ */
+class ExternalHandlerRunner {
+  public:
+    static constexpr std::chrono::milliseconds kDefaultTimeout{10000};
+
+    static ExternalHandlerRunner& instance();
+
+    ExternalHandlerRunner(const ExternalHandlerRunner&) = delete;
+    ExternalHandlerRunner& operator=(const ExternalHandlerRunner&) = delete;
+
+    /** Limits how many handler processes may run at once (minimum 1). */
+    void SetMaxConcurrent(size_t max_concurrent);
+    size_t max_concurrent() const;
+
+    /** Runs a handler and waits for it to exit or time out. */
+    ExternalHandlerResult Run(const std::string& handler, uid_t uid, gid_t gid,
+                              const std::unordered_map<std::string, std::string>& envs_map,
+                              std::chrono::milliseconds timeout = kDefaultTimeout);
+
+    /** Same as Run(), on a separate thread; the future resolves when the child is reaped. */
+    std::future<ExternalHandlerResult> RunAsync(
+            const std::string& handler, uid_t uid, gid_t gid,
+            const std::unordered_map<std::string, std::string>& envs_map,
+            std::chrono::milliseconds timeout = kDefaultTimeout);
+
+    /**
+     * Sends one request line to a long-lived helper, starting it on first use
+     * (and again if it died), and returns its single-line reply.
+     *
+     * @param reply Receives the reply without the trailing newline.
+     * @return false if the helper could not be started or did not answer in time.
+     */
+    bool Request(const std::string& handler, uid_t uid, gid_t gid, const std::string& request,
+                 std::string* reply, std::chrono::milliseconds timeout = kDefaultTimeout);
+
+    /** Terminates all long-lived helpers. */
+    void StopPersistentHandlers();
+
+  private:
+    ExternalHandlerRunner();
+    ~ExternalHandlerRunner();
+
+    void AcquireSlot();
+    void ReleaseSlot();
+    const std::vector<std::string>& ParseCommand(const std::string& handler);
+
+    mutable std::mutex slots_lock_;
+    std::condition_variable slots_cv_;
+    size_t max_concurrent_;
+    size_t running_ = 0;
+
+    std::mutex commands_lock_;
+    std::unordered_map<std::string, std::vector<std::string>> commands_;
+
+    std::mutex helpers_lock_;
+    std::unordered_map<std::string, std::shared_ptr<PersistentHandler>> helpers_;
+};
+
+/**
+ * @brief Runs an external binary with specified UID, GID, and environment.
+ *
+ * Convenience wrapper around ExternalHandlerRunner::Run() with the default timeout.
+ *
+ * Captures and returns trimmed stdout if the child exits successfully.
+ * Logs any stderr output from the handler. If the process fails (spawn, exec, crash,
+ * timeout), an empty string is returned.
+ *
+ * @param handler The command line to execute (e.g., "/bin/script --flag").
+ * @param uid The UID to set before executing the command.
+ * @param gid The GID to set before executing the command.
+ * @param envs_map A map of environment variable key-value pairs.
+ * @return Captured stdout output if successful, or empty string on failure.
+ */
+std::string RunExternalHandler(const std::string& handler, uid_t uid, gid_t gid,
+                               std::unordered_map<std::string, std::string>& envs_map);
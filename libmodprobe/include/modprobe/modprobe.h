@@ -16,24 +16,85 @@
 
 #pragma once
 
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
 #include <mutex>
-#include <set>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <unordered_map>
-#include <unordered_set>
 #include <vector>
 
-#include <android-base/thread_annotations.h>
+#include "module_alias_index.h"
+#include "module_config_cache.h"
+#include "module_name_table.h"
+#include "module_prefetcher.h"
+
+/** Timings of one finit_module() call, in nanoseconds on the monotonic clock. */
+struct ModuleLoadStats {
+    std::string name;
+    std::string path;
+    int64_t ready_ns = 0;   // All hard dependencies loaded; 0 if not tracked.
+    int64_t start_ns = 0;   // Insmod() entered.
+    int64_t open_ns = 0;    // Time spent opening the module file.
+    int64_t finit_ns = 0;   // Time spent in finit_module().
+    pid_t tid = 0;          // Thread that ran the load.
+    bool ok = false;
+};
+
+/**
+ * The kernel calls Modprobe makes.
+ *
+ * The base class issues the real syscalls. Tests and benchmarks subclass it to
+ * load modules into a fake kernel; every method follows the syscall convention
+ * of returning -1 and setting errno on failure.
+ */
+class ModprobeKernel {
+  public:
+    virtual ~ModprobeKernel() = default;
+
+    /** Returns the process-wide instance backed by the running kernel. */
+    static ModprobeKernel* Default();
+
+    /** Opens a module file for FinitModule(). */
+    virtual int OpenModule(const std::string& path);
+    virtual int FinitModule(int fd, const std::string& options, int flags);
+    /** Loads a module image that was decompressed in userspace. */
+    virtual int InitModule(const std::vector<char>& image, const std::string& options);
+    virtual int DeleteModule(const std::string& name, int flags);
+    virtual int Stat(const std::string& path, struct stat* st);
+    virtual std::string ReadKernelCmdline();
+};
 
+/**
+ * Loads kernel modules as described by modules.dep, modules.alias and friends.
+ *
+ * The configuration is read-only once the constructor returns, and the state
+ * that loading changes (loaded bits, statistics, the prefetcher) is guarded,
+ * so the Load*() methods may run on several threads at once: e.g. first stage
+ * mount pulls a driver in through LoadWithAliases() while the loader thread
+ * is inside LoadListedModules().
+ */
 class Modprobe {
   public:
+    /**
+     * @param kernel Where modules are loaded; ModprobeKernel::Default() if null.
+     *               Must outlive the Modprobe.
+     */
     Modprobe(const std::vector<std::string>&, const std::string load_file = "modules.load",
-             bool use_blocklist = true);
+             bool use_blocklist = true, ModprobeKernel* kernel = nullptr);
 
     bool LoadModulesParallel(int num_threads);
     bool LoadListedModules(bool strict = true);
     bool LoadWithAliases(const std::string& module_name, bool strict,
                          const std::string& parameters = "");
+    std::vector<std::string> GetModulesForAlias(const std::string& alias);
+    bool IsModuleLoaded(const std::string& module_name);
     bool Remove(const std::string& module_name);
     std::vector<std::string> ListModules(const std::string& pattern);
     bool GetAllDependencies(const std::string& module, std::vector<std::string>* pre_dependencies,
@@ -42,37 +103,68 @@ class Modprobe {
     void ResetModuleCount() { module_count_ = 0; }
     int GetModuleCount() { return module_count_; }
     bool IsBlocklisted(const std::string& module_name);
+    std::vector<ModuleLoadStats> GetLoadStats();
+    bool WriteLoadReport(const std::string& path);
 
   private:
     std::string MakeCanonical(const std::string& module_path);
+    ModuleId InternModule(const std::string& module_path);
+    ModuleId InternCanonical(std::string_view canonical_name);
+    void ResizeModuleTables();
+    ModuleId LookupModule(const std::string& module_path) const { return names_.Lookup(module_path); }
+    bool IsBlocklisted(ModuleId id) const;
+    bool IsModuleLoaded(ModuleId id);
     bool InsmodWithDeps(const std::string& module_name, const std::string& parameters);
     bool Insmod(const std::string& path_name, const std::string& parameters);
     bool Rmmod(const std::string& module_name);
     std::vector<std::string> GetDependencies(const std::string& module);
+    std::vector<std::string> GetLoadOrder();
     bool ModuleExists(const std::string& module_name);
     void AddOption(const std::string& module_name, const std::string& option_name,
                    const std::string& value);
     std::string GetKernelCmdline();
+    static int64_t NowNs();
+    void RecordModuleReady(const std::string& module_name);
+    void RecordLoadStats(ModuleLoadStats stats);
 
-    bool ParseDepCallback(const std::string& base_path, const std::vector<std::string>& args);
-    bool ParseAliasCallback(const std::vector<std::string>& args);
-    bool ParseSoftdepCallback(const std::vector<std::string>& args);
+    static bool ParseDepCallback(const std::string& base_path, ModuleConfig* config,
+                                 const std::vector<std::string>& args);
+    static bool ParseAliasCallback(ModuleConfig* config, const std::vector<std::string>& args);
+    static bool ParseSoftdepCallback(ModuleConfig* config, const std::vector<std::string>& args);
+    static bool ParseOptionsCallback(ModuleConfig* config, const std::vector<std::string>& args);
+    static bool ParseBlocklistCallback(ModuleConfig* config, const std::vector<std::string>& args);
     bool ParseLoadCallback(const std::vector<std::string>& args);
-    bool ParseOptionsCallback(const std::vector<std::string>& args);
-    bool ParseBlocklistCallback(const std::vector<std::string>& args);
+    bool ParseDynOptionsCallback(const std::vector<std::string>& args);
     void ParseKernelCmdlineOptions();
-    void ParseCfg(const std::string& cfg, std::function<bool(const std::vector<std::string>&)> f);
+    void ExtractSequentialFlags();
+    bool ParseCfg(const std::string& cfg, std::function<bool(const std::vector<std::string>&)> f);
+    void MergeConfig(ModuleConfig* config);
+
+    // Every module name is interned at parse time; the per-module vectors
+    // below are indexed by ModuleId and sized to names_.size().
+    ModuleNameTable names_;
+    std::vector<std::string> module_paths_;
+    std::vector<bool> module_listed_;                    // Has its own modules.dep line.
+    std::vector<std::vector<ModuleId>> module_dep_ids_;  // Hard dependencies, modules.dep order.
+    std::vector<std::optional<std::string>> module_options_;
+    std::vector<bool> module_sequential_;  // Had the load_sequential=1 option.
+    std::vector<bool> module_blocklist_;
 
-    std::vector<std::pair<std::string, std::string>> module_aliases_;
-    std::unordered_map<std::string, std::vector<std::string>> module_deps_;
+    ModuleAliasIndex module_aliases_;
     std::vector<std::pair<std::string, std::string>> module_pre_softdep_;
     std::vector<std::pair<std::string, std::string>> module_post_softdep_;
-    std::vector<std::string> module_load_;
-    std::unordered_map<std::string, std::string> module_options_;
-    std::set<std::string> module_blocklist_;
+    std::vector<ModuleId> module_load_;
+
     std::mutex module_loaded_lock_;
-    std::unordered_set<std::string> module_loaded_;
-    std::unordered_set<std::string> module_loaded_paths_;
-    int module_count_ = 0;
+    std::vector<bool> module_loaded_;
+    std::atomic<int> module_count_{0};
+    ModprobeKernel* kernel_;
+    // Set for the duration of a LoadListedModules()/LoadModulesParallel() call
+    // and read by every Insmod(), possibly on other threads; accessed only
+    // through std::atomic_load/atomic_store.
+    std::shared_ptr<ModulePrefetcher> prefetcher_;
+    std::mutex load_stats_lock_;
+    std::unordered_map<std::string, ModuleLoadStats> load_stats_;
+    int64_t load_start_ns_ = 0;
     bool blocklist_enabled = false;
 };
@@ -0,0 +1,71 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <map>
+#include <set>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Lookup structure for modules.alias.
+ *
+ * Aliases without glob characters live in a hash keyed by the full alias.
+ * Glob patterns are grouped by bus (the text before the first ':') and then
+ * by their literal prefix, i.e. everything up to the first '*', '?', '[' or
+ * '\\'. For pci/usb/acpi aliases the literal prefix already pins the vendor
+ * (and usually the device) field, e.g. "pci:v00008086d000010D3", so a lookup
+ * only probes one hash entry per distinct prefix length seen on that bus and
+ * runs fnmatch() on the handful of patterns found there.
+ */
+class ModuleAliasIndex {
+  public:
+    /** Adds one "alias <pattern> <module>" line; module is stored canonicalized. */
+    void Add(const std::string& pattern, std::string canonical_module);
+
+    /**
+     * Returns the canonical names of the modules whose pattern matches `alias`,
+     * without duplicates and in the order their lines appeared.
+     */
+    std::vector<std::string> Find(const std::string& alias) const;
+
+    size_t size() const { return entries_.size(); }
+
+  private:
+    struct Entry {
+        std::string pattern;
+        std::string module;
+    };
+
+    struct PrefixBuckets {
+        // Distinct literal prefix lengths, so a lookup tries each length once.
+        std::set<size_t> prefix_lengths;
+        std::unordered_map<std::string, std::vector<size_t>> by_prefix;
+    };
+
+    static std::string_view BusOf(std::string_view alias);
+    void FindInBuckets(const PrefixBuckets& buckets, const std::string& alias,
+                       std::vector<size_t>* matches) const;
+
+    std::vector<Entry> entries_;
+    std::unordered_map<std::string, std::vector<size_t>> exact_;
+    std::map<std::string, PrefixBuckets, std::less<>> wildcard_by_bus_;
+    // Patterns whose literal prefix does not reach a ':' (e.g. "*" or "of*").
+    PrefixBuckets wildcard_any_bus_;
+};
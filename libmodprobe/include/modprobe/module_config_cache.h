@@ -0,0 +1,109 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "module_name_table.h"
+
+/**
+ * The module configuration of one module directory, as parsed from its
+ * modules.alias, modules.dep, modules.softdep, modules.options and
+ * modules.blocklist. Module IDs are local to the directory; Modprobe maps
+ * them onto its own table when it merges several directories.
+ */
+struct ModuleConfig {
+    ModuleNameTable names;
+    // Per ID. A module's path comes from its own modules.dep line or, failing
+    // that, from the first line naming it as a dependency.
+    std::vector<std::string> paths;
+    std::vector<uint8_t> listed;              // 1 if the module has its own modules.dep line.
+    std::vector<std::vector<ModuleId>> deps;  // Hard dependencies, in modules.dep order.
+
+    std::vector<std::pair<std::string, std::string>> aliases;  // Pattern, canonical module.
+    std::vector<std::pair<std::string, std::string>> pre_softdeps;
+    std::vector<std::pair<std::string, std::string>> post_softdeps;
+    std::vector<std::pair<ModuleId, std::string>> options;
+    // dyn_options lines, without the keyword. Their handlers run on every boot.
+    std::vector<std::vector<std::string>> dyn_options;
+    std::vector<ModuleId> blocklist;
+
+    /** Interns a module name or path; kInvalidModuleId if it is malformed. */
+    ModuleId Intern(std::string_view name_or_path);
+};
+
+/**
+ * Binary cache of the parsed ModuleConfig of one module directory.
+ *
+ * Text parsing (line splitting, tokenizing and canonicalizing tens of
+ * thousands of modules.alias and modules.dep lines) dominates Modprobe
+ * construction. The cache, stored as <base_path>/modules.modprobe.bin, holds
+ * the result instead: the name table, each module's path and dependency IDs,
+ * the alias patterns and the options. It is mmap'd and only trusted while the
+ * size and mtime recorded for every source file still match, so editing or
+ * replacing any modules.* file silently invalidates it. Every count is checked
+ * against the bytes left before anything is allocated, and a hash over the
+ * payload rejects a torn or corrupted file.
+ *
+ * Layout (native endian, all integers fixed width):
+ *   char[8] magic "MODPRBC\0", u32 version, u32 source_count
+ *   per source: u32 name_len, name, i64 size (-1 if absent), i64 mtime_sec, i64 mtime_nsec
+ *   u64 payload_size, u64 payload_hash, then the payload:
+ *   u32 name_count; per name: u32 len, bytes
+ *   per ID: u8 listed, u32 path_len, path, u32 dep_count, u32 dep IDs
+ *   u32 alias_count; per alias: string pattern, string module
+ *   u32 count, string pairs: pre softdeps, then post softdeps
+ *   u32 option_count; per option: u32 ID, string
+ *   u32 dyn_count; per line: u32 token_count, strings
+ *   u32 blocklist_count, u32 IDs
+ */
+class ModuleConfigCache {
+  public:
+    static constexpr const char* kFileName = "modules.modprobe.bin";
+
+    /**
+     * @param base_path Module directory containing the modules.* files.
+     * @param sources File names relative to base_path, e.g. "modules.alias".
+     */
+    ModuleConfigCache(const std::string& base_path, std::vector<std::string> sources);
+
+    /**
+     * Fills `config` from the cache file.
+     *
+     * @return false if the cache is missing, malformed or stale.
+     */
+    bool Read(ModuleConfig* config) const;
+
+    /**
+     * Atomically replaces the cache file. Failure (e.g. a read-only module
+     * directory) is not an error; the text files are simply parsed next time.
+     * The file is not fsync'd: a cache lost or torn by a crash fails its
+     * hash check and is rebuilt.
+     */
+    bool Write(const ModuleConfig& config) const;
+
+  private:
+    std::string SourceStamp() const;
+
+    std::string base_path_;
+    std::string cache_path_;
+    std::vector<std::string> sources_;
+};
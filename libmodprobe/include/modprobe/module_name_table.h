@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using ModuleId = uint32_t;
+constexpr ModuleId kInvalidModuleId = UINT32_MAX;
+
+/**
+ * Interns canonical module names into dense IDs.
+ *
+ * Every name seen while parsing the module configuration gets an ID in
+ * [0, size()), so per-module state (dependencies, options, blocklist, loaded
+ * bit) can live in flat vectors indexed by ID. The table is an open-addressing
+ * hash keyed by string_view; lookups, including canonicalizing a module path
+ * into a stack buffer first, do not allocate.
+ *
+ * Not thread-safe for Intern(); concurrent Find()/Lookup() are fine once
+ * interning is finished.
+ */
+class ModuleNameTable {
+  public:
+    /** Longest canonical name accepted; the kernel's own limit is 56. */
+    static constexpr size_t kMaxNameLen = 255;
+
+    /**
+     * Writes the canonical form of `path` (basename, ".ko" or ".ko.{gz,xz,zst}"
+     * stripped, '-' replaced by '_') into `buf`, which must hold kMaxNameLen
+     * bytes.
+     *
+     * @return A view into `buf`, or an empty view if the name is malformed.
+     */
+    static std::string_view Canonicalize(std::string_view path, char* buf);
+
+    /** Returns the ID of an already canonical name, adding it if new. */
+    ModuleId Intern(std::string_view canonical_name);
+
+    /** Returns the ID of an already canonical name, or kInvalidModuleId. */
+    ModuleId Find(std::string_view canonical_name) const;
+
+    /** Canonicalizes a module name or path and returns its ID, or kInvalidModuleId. */
+    ModuleId Lookup(std::string_view name_or_path) const;
+
+    const std::string& Name(ModuleId id) const { return names_[id]; }
+    size_t size() const { return names_.size(); }
+
+  private:
+    static uint64_t Hash(std::string_view name);
+    void Rehash(size_t capacity);
+
+    std::deque<std::string> names_;  // deque keeps names stable while growing.
+    std::vector<uint64_t> hashes_;   // Per ID, to rehash without rehashing strings.
+    std::vector<ModuleId> slots_;    // Power-of-two sized; kInvalidModuleId marks empty.
+};
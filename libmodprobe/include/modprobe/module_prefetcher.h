@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * Pulls module files into the page cache ahead of finit_module().
+ *
+ * Given the order in which modules will be loaded, a background thread issues
+ * readahead() for the next files while the kernel is still relocating and
+ * initializing earlier ones, so module I/O overlaps module init instead of
+ * adding to it. The thread stays at most `window` files ahead of the loader
+ * to avoid evicting prefetched data on memory-constrained first stage.
+ */
+class ModulePrefetcher {
+  public:
+    static constexpr size_t kDefaultWindow = 16;
+
+    explicit ModulePrefetcher(std::vector<std::string> paths, size_t window = kDefaultWindow);
+
+    /** Stops prefetching and joins the thread. */
+    ~ModulePrefetcher();
+
+    ModulePrefetcher(const ModulePrefetcher&) = delete;
+    ModulePrefetcher& operator=(const ModulePrefetcher&) = delete;
+
+    /** Called after each finit_module(), successful or not, to slide the window. */
+    void ModuleLoaded();
+
+  private:
+    void Run();
+
+    std::vector<std::string> paths_;
+    size_t window_;
+
+    std::mutex lock_;
+    std::condition_variable cv_;
+    size_t loaded_ = 0;
+    bool stopping_ = false;
+
+    std::thread thread_;
+};
@@ -14,115 +14,151 @@
  * limitations under the License.
  */
 
+#include <modprobe/exthandler.h>
 #include <modprobe/modprobe.h>
 
+#include "log_new.h"
+#include "work_stealing_pool.h"
+
+#include <dirent.h>
 #include <fnmatch.h>
+#include <grp.h>
+#include <pwd.h>
 #include <sys/stat.h>
 #include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <iterator>
 #include <map>
+#include <memory>
 #include <set>
+#include <sstream>
 #include <string>
 #include <thread>
+#include <unordered_map>
 #include <vector>
 
-#include <android-base/chrono_utils.h>
-#include <android-base/file.h>
-#include <android-base/logging.h>
-#include <android-base/strings.h>
-#include <android-base/unique_fd.h>
-
 std::string Modprobe::MakeCanonical(const std::string& module_path) {
-    auto start = module_path.find_last_of('/');
-    if (start == std::string::npos) {
-        start = 0;
-    } else {
-        start += 1;
-    }
-    auto end = module_path.size();
-    if (android::base::EndsWith(module_path, ".ko")) {
-        end -= 3;
-    }
-    if ((end - start) <= 1) {
-        LOG(ERROR) << "malformed module name: " << module_path;
+    char buf[ModuleNameTable::kMaxNameLen];
+    auto canonical_name = ModuleNameTable::Canonicalize(module_path, buf);
+    if (canonical_name.empty()) {
+        LOGE("Malformed module name: %s", module_path.c_str());
         return "";
     }
-    std::string module_name = module_path.substr(start, end - start);
-    // module names can have '-', but their file names will have '_'
-    std::replace(module_name.begin(), module_name.end(), '-', '_');
-    return module_name;
+    return std::string(canonical_name);
 }
 
-bool Modprobe::ParseDepCallback(const std::string& base_path,
+// Interns a module name or path, growing the per-module tables to match.
+ModuleId Modprobe::InternModule(const std::string& module_path) {
+    char buf[ModuleNameTable::kMaxNameLen];
+    auto canonical_name = ModuleNameTable::Canonicalize(module_path, buf);
+    if (canonical_name.empty()) {
+        LOGE("Malformed module name: %s", module_path.c_str());
+        return kInvalidModuleId;
+    }
+    return InternCanonical(canonical_name);
+}
+
+ModuleId Modprobe::InternCanonical(std::string_view canonical_name) {
+    ModuleId id = names_.Intern(canonical_name);
+    if (id >= module_paths_.size()) ResizeModuleTables();
+    return id;
+}
+
+void Modprobe::ResizeModuleTables() {
+    size_t count = names_.size();
+    module_paths_.resize(count);
+    module_listed_.resize(count);
+    module_dep_ids_.resize(count);
+    module_options_.resize(count);
+    module_blocklist_.resize(count);
+    module_loaded_.resize(count);
+}
+
+bool Modprobe::ParseDepCallback(const std::string& base_path, ModuleConfig* config,
                                 const std::vector<std::string>& args) {
-    std::vector<std::string> deps;
-    std::string prefix = "";
+    if (args.empty()) return false;
 
-    // Set first item as our modules path
-    std::string::size_type pos = args[0].find(':');
-    if (args[0][0] != '/') {
-        prefix = base_path + "/";
+    size_t pos = args[0].find(':');
+    if (pos == std::string::npos) {
+        LOGE("Dependency lines must start with name followed by ':'");
+        return false;
     }
-    if (pos != std::string::npos) {
-        deps.emplace_back(prefix + args[0].substr(0, pos));
-    } else {
-        LOG(ERROR) << "dependency lines must start with name followed by ':'";
+
+    auto full_path = [&](const std::string& path) {
+        return path[0] == '/' ? path : base_path + "/" + path;
+    };
+
+    std::string module_path = args[0].substr(0, pos);
+    ModuleId id = config->Intern(module_path);
+    if (id == kInvalidModuleId) {
+        LOGE("Malformed module name: %s", module_path.c_str());
         return false;
     }
 
-    // Remaining items are dependencies of our module
+    std::vector<ModuleId> dep_ids;
     for (auto arg = args.begin() + 1; arg != args.end(); ++arg) {
-        if ((*arg)[0] != '/') {
-            prefix = base_path + "/";
-        } else {
-            prefix = "";
+        ModuleId dep_id = config->Intern(*arg);
+        if (dep_id == kInvalidModuleId) {
+            LOGE("Malformed module name: %s", arg->c_str());
+            continue;
         }
-        deps.push_back(prefix + *arg);
+        if (config->paths[dep_id].empty()) config->paths[dep_id] = full_path(*arg);
+        dep_ids.emplace_back(dep_id);
     }
-
-    std::string canonical_name = MakeCanonical(args[0].substr(0, pos));
-    if (canonical_name.empty()) {
-        return false;
-    }
-    this->module_deps_[canonical_name] = deps;
+    config->paths[id] = full_path(module_path);
+    config->listed[id] = 1;
+    config->deps[id] = std::move(dep_ids);
 
     return true;
 }
 
-bool Modprobe::ParseAliasCallback(const std::vector<std::string>& args) {
+bool Modprobe::ParseAliasCallback(ModuleConfig* config, const std::vector<std::string>& args) {
     auto it = args.begin();
     const std::string& type = *it++;
 
     if (type != "alias") {
-        LOG(ERROR) << "non-alias line encountered in modules.alias, found " << type;
+        LOGE("Non-alias line encountered in modules.alias, found: %s", type.c_str());
         return false;
     }
 
     if (args.size() != 3) {
-        LOG(ERROR) << "alias lines in modules.alias must have 3 entries, not " << args.size();
+        LOGE("Alias lines in modules.alias must have 3 entries, not %zu", args.size());
         return false;
     }
 
     const std::string& alias = *it++;
     const std::string& module_name = *it++;
-    this->module_aliases_.emplace_back(alias, module_name);
+    char buf[ModuleNameTable::kMaxNameLen];
+    auto canonical_name = ModuleNameTable::Canonicalize(module_name, buf);
+    if (canonical_name.empty()) {
+        LOGE("Malformed module name: %s", module_name.c_str());
+    }
+    config->aliases.emplace_back(alias, canonical_name);
 
     return true;
 }
 
-bool Modprobe::ParseSoftdepCallback(const std::vector<std::string>& args) {
+bool Modprobe::ParseSoftdepCallback(ModuleConfig* config, const std::vector<std::string>& args) {
     auto it = args.begin();
     const std::string& type = *it++;
     std::string state = "";
 
     if (type != "softdep") {
-        LOG(ERROR) << "non-softdep line encountered in modules.softdep, found " << type;
+        LOGE("Non-softdep line encountered in modules.softdep, found: %s", type.c_str());
         return false;
     }
 
     if (args.size() < 4) {
-        LOG(ERROR) << "softdep lines in modules.softdep must have at least 4 entries";
+        LOGE("Softdep lines in modules.softdep must have at least 4 entries, not %zu", args.size());
         return false;
     }
 
@@ -133,14 +169,14 @@ bool Modprobe::ParseSoftdepCallback(const std::vector<std::string>& args) {
             state = token;
             continue;
         }
-        if (state == "") {
-            LOG(ERROR) << "malformed modules.softdep at token " << token;
+        if (state.empty()) {
+            LOGE("Malformed modules.softdep at token: %s", token.c_str());
             return false;
         }
         if (state == "pre:") {
-            this->module_pre_softdep_.emplace_back(module, token);
+            config->pre_softdeps.emplace_back(module, token);
         } else {
-            this->module_post_softdep_.emplace_back(module, token);
+            config->post_softdeps.emplace_back(module, token);
         }
     }
 
@@ -151,34 +187,41 @@ bool Modprobe::ParseLoadCallback(const std::vector<std::string>& args) {
     auto it = args.begin();
     const std::string& module = *it++;
 
-    const std::string& canonical_name = MakeCanonical(module);
-    if (canonical_name.empty()) {
+    ModuleId id = InternModule(module);
+    if (id == kInvalidModuleId) {
         return false;
     }
-    this->module_load_.emplace_back(canonical_name);
+    this->module_load_.emplace_back(id);
 
     return true;
 }
 
-bool Modprobe::ParseOptionsCallback(const std::vector<std::string>& args) {
+bool Modprobe::ParseOptionsCallback(ModuleConfig* config, const std::vector<std::string>& args) {
     auto it = args.begin();
     const std::string& type = *it++;
 
+    if (type == "dyn_options") {
+        // The handler's output may differ per boot, so only the line is kept.
+        config->dyn_options.emplace_back(it, args.end());
+        return true;
+    }
+
     if (type != "options") {
-        LOG(ERROR) << "non-options line encountered in modules.options";
+        LOGE("Non-options line encountered in modules.options");
         return false;
     }
 
     if (args.size() < 2) {
-        LOG(ERROR) << "lines in modules.options must have at least 2 entries, not " << args.size();
+        LOGE("Lines in modules.options must have at least 2 entries, not %zu", args.size());
         return false;
     }
 
     const std::string& module = *it++;
-    std::string options = "";
+    std::string options;
 
-    const std::string& canonical_name = MakeCanonical(module);
-    if (canonical_name.empty()) {
+    ModuleId id = config->Intern(module);
+    if (id == kInvalidModuleId) {
+        LOGE("Malformed module name: %s", module.c_str());
         return false;
     }
 
@@ -188,68 +231,505 @@ bool Modprobe::ParseOptionsCallback(const std::vector<std::string>& args) {
             options += " ";
         }
     }
+    config->options.emplace_back(id, std::move(options));
+    return true;
+}
 
-    auto [unused, inserted] = this->module_options_.emplace(canonical_name, options);
-    if (!inserted) {
-        LOG(ERROR) << "multiple options lines present for module " << module;
+bool Modprobe::ParseDynOptionsCallback(const std::vector<std::string>& args) {
+    auto it = args.begin();
+
+    if (args.size() < 3) {
+        LOGE("dyn_options lines in modules.options must have at least 3 entries, not %zu",
+             args.size());
+        return false;
+    }
+
+    const std::string& module = *it++;
+
+    ModuleId id = InternModule(module);
+    if (id == kInvalidModuleId) {
+        return false;
+    }
+
+    const std::string& pwnam = *it++;
+    passwd* pwd = getpwnam(pwnam.c_str());
+    if (!pwd) {
+        LOGE("Invalid handler UID: %s", pwnam.c_str());
         return false;
     }
+
+    std::string handler_with_args;
+    for (; it != args.end(); ++it) {
+        handler_with_args += *it + " ";
+    }
+    handler_with_args.erase(std::remove(handler_with_args.begin(), handler_with_args.end(), '"'),
+                            handler_with_args.end());
+
+    LOGD("Launching external module options handler: '%s' for module: %s",
+         handler_with_args.c_str(), module.c_str());
+
+    std::unordered_map<std::string, std::string> envs_map;
+    std::string result = RunExternalHandler(handler_with_args, pwd->pw_uid, 0, envs_map);
+    if (result.empty()) {
+        LOGE("External module handler failed");
+        return false;
+    }
+
+    LOGI("Dynamic options for module %s are '%s'", module.c_str(), result.c_str());
+
+    if (this->module_options_[id]) {
+        LOGE("Multiple options lines present for module %s", module.c_str());
+        return false;
+    }
+    this->module_options_[id] = result;
     return true;
 }
 
-bool Modprobe::ParseBlocklistCallback(const std::vector<std::string>& args) {
+bool Modprobe::ParseBlocklistCallback(ModuleConfig* config, const std::vector<std::string>& args) {
     auto it = args.begin();
     const std::string& type = *it++;
 
     if (type != "blocklist") {
-        LOG(ERROR) << "non-blocklist line encountered in modules.blocklist";
+        LOGE("Non-blocklist line encountered in modules.blocklist");
         return false;
     }
 
     if (args.size() != 2) {
-        LOG(ERROR) << "lines in modules.blocklist must have exactly 2 entries, not " << args.size();
+        LOGE("Lines in modules.blocklist must have exactly 2 entries, not %zu", args.size());
         return false;
     }
 
     const std::string& module = *it++;
 
-    const std::string& canonical_name = MakeCanonical(module);
-    if (canonical_name.empty()) {
+    ModuleId id = config->Intern(module);
+    if (id == kInvalidModuleId) {
+        LOGE("Malformed module name: %s", module.c_str());
         return false;
     }
-    this->module_blocklist_.emplace(canonical_name);
+    config->blocklist.emplace_back(id);
 
     return true;
 }
 
-void Modprobe::ParseCfg(const std::string& cfg,
+bool Modprobe::ParseCfg(const std::string& cfg,
                         std::function<bool(const std::vector<std::string>&)> f) {
-    std::string cfg_contents;
-    if (!android::base::ReadFileToString(cfg, &cfg_contents, false)) {
-        return;
+    std::ifstream file(cfg);
+    if (!file.is_open()) {
+        return false;
     }
 
-    std::vector<std::string> lines = android::base::Split(cfg_contents, "\n");
-    for (const auto& line : lines) {
+    std::string line;
+    while (std::getline(file, line)) {
         if (line.empty() || line[0] == '#') {
             continue;
         }
-        const std::vector<std::string> args = android::base::Split(line, " ");
-        if (args.empty()) continue;
-        f(args);
+        std::istringstream iss(line);
+        std::vector<std::string> args{std::istream_iterator<std::string>{iss},
+                                      std::istream_iterator<std::string>{}};
+        if (!args.empty()) {
+            f(args);
+        }
+    }
+    return true;
+}
+
+// Adds one directory's configuration to the module tables. A module's own
+// modules.dep line in a later directory replaces an earlier one, as it did
+// when every directory's text files were parsed straight into the tables.
+void Modprobe::MergeConfig(ModuleConfig* config) {
+    std::vector<ModuleId> ids;
+    if (names_.size() == 0) {
+        // The first directory's IDs can be adopted as they are.
+        names_ = std::move(config->names);
+        ResizeModuleTables();
+        ids.resize(names_.size());
+        for (ModuleId id = 0; id < ids.size(); ++id) ids[id] = id;
+    } else {
+        ids.reserve(config->names.size());
+        for (ModuleId id = 0; id < config->names.size(); ++id) {
+            ids.emplace_back(InternCanonical(config->names.Name(id)));
+        }
+    }
+
+    for (ModuleId local = 0; local < ids.size(); ++local) {
+        ModuleId id = ids[local];
+        if (config->listed[local]) {
+            module_paths_[id] = std::move(config->paths[local]);
+            module_listed_[id] = true;
+            auto& dep_ids = module_dep_ids_[id];
+            dep_ids.clear();
+            for (ModuleId dep : config->deps[local]) dep_ids.emplace_back(ids[dep]);
+        } else if (module_paths_[id].empty()) {
+            module_paths_[id] = std::move(config->paths[local]);
+        }
+    }
+
+    for (auto& [pattern, module] : config->aliases) {
+        module_aliases_.Add(pattern, std::move(module));
+    }
+    std::move(config->pre_softdeps.begin(), config->pre_softdeps.end(),
+              std::back_inserter(module_pre_softdep_));
+    std::move(config->post_softdeps.begin(), config->post_softdeps.end(),
+              std::back_inserter(module_post_softdep_));
+
+    for (auto& [local, options] : config->options) {
+        auto& module_options = module_options_[ids[local]];
+        if (module_options) {
+            LOGE("Multiple options lines present for module %s", names_.Name(ids[local]).c_str());
+            continue;
+        }
+        module_options = std::move(options);
+    }
+    for (const auto& args : config->dyn_options) {
+        ParseDynOptionsCallback(args);
+    }
+    for (ModuleId local : config->blocklist) {
+        module_blocklist_[ids[local]] = true;
     }
-    return;
+}
+
+bool Modprobe::IsBlocklisted(const std::string& module_name) {
+    if (!blocklist_enabled) return false;
+
+    ModuleId id = LookupModule(module_name);
+    return id != kInvalidModuleId && IsBlocklisted(id);
+}
+
+bool Modprobe::IsBlocklisted(ModuleId id) const {
+    if (!blocklist_enabled) return false;
+    if (module_blocklist_[id]) return true;
+
+    for (ModuleId dep : module_dep_ids_[id]) {
+        if (module_blocklist_[dep]) return true;
+    }
+    return false;
+}
+
+namespace {
+
+// One module in the dependency graph built by LoadModulesParallel().
+struct LoadNode {
+    ModuleId module = kInvalidModuleId;
+    std::string path;                // Module file from modules.dep.
+    std::vector<size_t> deps;             // Nodes this one needs loaded.
+    std::vector<size_t> dependents;       // Nodes that need this one loaded.
+    std::vector<size_t> soft_dependents;  // Pre-softdep users: wait, but load regardless.
+    std::atomic<size_t> pending_deps{0};
+    std::atomic<bool> dep_failed{false};
+    bool sequential = false;
+    bool building = false;
+    // Listed in modules.load or needed by a module that is. Other nodes are only
+    // there as softdeps, whose failures do not fail the load.
+    bool required = false;
+};
+
+}  // namespace
+
+// Loads the modules from the load list, and their hard dependencies, as a DAG.
+// Every module carries a count of unloaded dependencies and is handed to a
+// work-stealing pool the moment that count drops to zero, so one slow
+// finit_module only delays the modules that actually depend on it. Modules
+// with the load_sequential=1 option never load concurrently with each other.
+// A module whose dependency failed is not attempted. Blocklisted modules
+// are ignored; a blocklisted hard dependency is an error.
+//
+// Softdeps are honoured as InsmodWithDeps() does: pre-softdeps that exist are
+// edges that do not propagate failure, and post-softdeps are loaded through
+// LoadWithAliases() once their module is in. Neither fails the load. A listed
+// module missing on disk is loaded through LoadWithAliases() too, so it fails,
+// or resolves through an alias, exactly as in LoadListedModules().
+bool Modprobe::LoadModulesParallel(int num_threads) {
+    load_start_ns_ = NowNs();
+    std::vector<std::unique_ptr<LoadNode>> nodes;
+    std::vector<ssize_t> node_ids(names_.size(), -1);
+
+    // Drops the nodes from `mark` on, and every edge into them, after a
+    // softdep's part of the graph could not be built.
+    auto rollback = [&](size_t mark) {
+        for (size_t id = mark; id < nodes.size(); ++id) node_ids[nodes[id]->module] = -1;
+        nodes.resize(mark);
+        auto added = [mark](size_t id) { return id >= mark; };
+        for (auto& node : nodes) {
+            for (auto* edges : {&node->dependents, &node->soft_dependents}) {
+                edges->erase(std::remove_if(edges->begin(), edges->end(), added), edges->end());
+            }
+        }
+    };
+
+    // The modules LoadWithAliases(name, false) would load for a softdep.
+    auto softdep_modules = [&](const std::string& name) {
+        std::set<ModuleId> modules;
+        ModuleId id = LookupModule(name);
+        if (id != kInvalidModuleId) modules.emplace(id);
+        for (const auto& aliased : GetModulesForAlias(name)) {
+            id = LookupModule(aliased);
+            if (id != kInvalidModuleId) modules.emplace(id);
+        }
+        for (auto it = modules.begin(); it != modules.end();) {
+            it = ModuleExists(names_.Name(*it)) ? std::next(it) : modules.erase(it);
+        }
+        return modules;
+    };
+
+    // Returns the node index for a module, adding it and its dependencies
+    // first if needed, or -1 if the graph cannot be built.
+    auto get_node = [&](auto& self, ModuleId module) -> ssize_t {
+        if (node_ids[module] >= 0) {
+            if (nodes[node_ids[module]]->building) {
+                LOGE("LMP: Dependency cycle through module %s", names_.Name(module).c_str());
+                return -1;
+            }
+            return node_ids[module];
+        }
+
+        if (!module_listed_[module]) {
+            LOGE("LMP: Module %s not in dependency file", names_.Name(module).c_str());
+            return -1;
+        }
+
+        size_t id = nodes.size();
+        nodes.emplace_back(std::make_unique<LoadNode>());
+        node_ids[module] = id;
+        LoadNode* node = nodes.back().get();
+        node->module = module;
+        node->path = module_paths_[module];
+        node->building = true;
+
+        node->sequential = module_sequential_[module];
+
+        // modules.dep lists the full transitive closure, so every entry is an edge.
+        std::set<size_t> dep_ids;
+        for (ModuleId dep : module_dep_ids_[module]) {
+            if (blocklist_enabled && module_blocklist_[dep]) {
+                LOGV("LMP: Blocklist error: Module %s is blocklisted", names_.Name(dep).c_str());
+                return -1;
+            }
+            ssize_t dep_id = self(self, dep);
+            if (dep_id < 0) return -1;
+            dep_ids.emplace(static_cast<size_t>(dep_id));
+        }
+
+        const std::string& name = names_.Name(module);
+        std::set<size_t> soft_ids;
+        for (const auto& [it_module, it_softdep] : module_pre_softdep_) {
+            if (it_module != name) continue;
+            for (ModuleId soft : softdep_modules(it_softdep)) {
+                size_t mark = nodes.size();
+                ssize_t soft_id = self(self, soft);
+                if (soft_id < 0) {
+                    LOGD("LMP: Not waiting for soft pre-dep %s of %s",
+                         names_.Name(soft).c_str(), name.c_str());
+                    rollback(mark);
+                } else if (!dep_ids.count(soft_id)) {
+                    soft_ids.emplace(static_cast<size_t>(soft_id));
+                }
+            }
+        }
+
+        for (size_t dep_id : dep_ids) {
+            nodes[dep_id]->dependents.emplace_back(id);
+        }
+        node->deps.assign(dep_ids.begin(), dep_ids.end());
+        for (size_t soft_id : soft_ids) {
+            nodes[soft_id]->soft_dependents.emplace_back(id);
+        }
+        node->pending_deps = dep_ids.size() + soft_ids.size();
+        node->building = false;
+        return id;
+    };
+
+    auto require = [&](auto& self, size_t id) -> void {
+        if (nodes[id]->required) return;
+        nodes[id]->required = true;
+        for (size_t dep_id : nodes[id]->deps) self(self, dep_id);
+    };
+
+    for (ModuleId module : module_load_) {
+        if (IsBlocklisted(module)) {
+            LOGV("LMP: Blocklist error: Module %s is blocklisted", names_.Name(module).c_str());
+            continue;
+        }
+        ssize_t id = get_node(get_node, module);
+        if (id < 0) {
+            return false;
+        }
+        require(require, id);
+    }
+    if (nodes.empty()) return true;
+
+    // Several loads are in flight at once, so prefetch correspondingly further ahead.
+    auto prefetcher = std::make_shared<ModulePrefetcher>(
+            GetLoadOrder(), ModulePrefetcher::kDefaultWindow + std::max(num_threads, 1));
+    std::atomic_store(&prefetcher_, std::move(prefetcher));
+
+    std::atomic<bool> ret = true;
+    std::mutex done_lock;
+    std::condition_variable done_cv;
+    size_t remaining = nodes.size();
+    // Sequential modules form a chain: at most one is submitted at a time and
+    // each one submits the next ready one when it finishes, so none of them
+    // ties up a worker while waiting for its turn.
+    std::mutex sequential_lock;
+    std::deque<size_t> sequential_ready;
+    bool sequential_running = false;
+
+    // Declared after the completion state so the workers are joined first.
+    minimal_systems::init::WorkStealingPool pool(num_threads, "modprobe");
+
+    std::function<void(size_t)> run, submit;
+    auto load = [&](size_t id) {
+        LoadNode& node = *nodes[id];
+        bool ok = false;
+        const std::string& name = names_.Name(node.module);
+        if (node.dep_failed) {
+            LOGE("LMP: Not loading %s, a dependency failed to load", name.c_str());
+        } else {
+            ok = IsModuleLoaded(node.module) ||
+                 (ModuleExists(name) ? Insmod(node.path, "") : LoadWithAliases(name, true));
+        }
+        if (!ok && node.required) ret = false;
+
+        if (ok) {
+            for (const auto& [it_module, it_softdep] : module_post_softdep_) {
+                if (it_module != name) continue;
+                LOGD("LMP: Loading soft post-dep for '%s': %s", name.c_str(), it_softdep.c_str());
+                LoadWithAliases(it_softdep, false);
+            }
+        }
+
+        if (node.sequential) {
+            ssize_t next = -1;
+            {
+                std::lock_guard<std::mutex> guard(sequential_lock);
+                if (sequential_ready.empty()) {
+                    sequential_running = false;
+                } else {
+                    next = sequential_ready.front();
+                    sequential_ready.pop_front();
+                }
+            }
+            if (next >= 0) run(next);
+        }
+
+        auto release = [&](size_t dependent) {
+            if (nodes[dependent]->pending_deps.fetch_sub(1) == 1) {
+                RecordModuleReady(names_.Name(nodes[dependent]->module));
+                submit(dependent);
+            }
+        };
+        for (size_t dependent : node.dependents) {
+            if (!ok) nodes[dependent]->dep_failed = true;
+            release(dependent);
+        }
+        for (size_t dependent : node.soft_dependents) {
+            release(dependent);
+        }
+
+        std::lock_guard<std::mutex> guard(done_lock);
+        if (--remaining == 0) done_cv.notify_all();
+    };
+    run = [&](size_t id) { pool.Submit([&load, id] { load(id); }); };
+    submit = [&](size_t id) {
+        if (nodes[id]->sequential) {
+            std::lock_guard<std::mutex> guard(sequential_lock);
+            if (sequential_running) {
+                sequential_ready.emplace_back(id);
+                return;
+            }
+            sequential_running = true;
+        }
+        run(id);
+    };
+
+    // Collect the roots before releasing any, since releasing one can make
+    // later nodes ready while we are still iterating.
+    std::vector<size_t> roots;
+    for (size_t id = 0; id < nodes.size(); ++id) {
+        if (nodes[id]->pending_deps == 0) roots.emplace_back(id);
+    }
+    for (size_t id : roots) {
+        RecordModuleReady(names_.Name(nodes[id]->module));
+        submit(id);
+    }
+
+    {
+        std::unique_lock<std::mutex> lock(done_lock);
+        done_cv.wait(lock, [&] { return remaining == 0; });
+    }
+    std::atomic_store(&prefetcher_, std::shared_ptr<ModulePrefetcher>());
+    return ret;
+}
+
+bool Modprobe::LoadListedModules(bool strict) {
+    bool ret = true;
+    load_start_ns_ = NowNs();
+    std::atomic_store(&prefetcher_, std::make_shared<ModulePrefetcher>(GetLoadOrder()));
+    for (ModuleId module : module_load_) {
+        if (!LoadWithAliases(names_.Name(module), true)) {
+            if (IsBlocklisted(module)) continue;
+            ret = false;
+            if (strict) break;
+        }
+    }
+    std::atomic_store(&prefetcher_, std::shared_ptr<ModulePrefetcher>());
+    return ret;
+}
+
+bool Modprobe::LoadWithAliases(const std::string& module_name, bool strict,
+                               const std::string& parameters) {
+    std::set<std::string> modules_to_load;
+    ModuleId id = LookupModule(module_name);
+    if (id != kInvalidModuleId) {
+        if (IsModuleLoaded(id)) return true;
+        modules_to_load.emplace(names_.Name(id));
+    }
+    bool module_loaded = false;
+
+    for (const auto& aliased_module : GetModulesForAlias(module_name)) {
+        LOGD("Found alias for '%s': '%s'", module_name.c_str(), aliased_module.c_str());
+        if (IsModuleLoaded(aliased_module)) continue;
+        modules_to_load.emplace(aliased_module);
+    }
+
+    for (const auto& module : modules_to_load) {
+        if (!ModuleExists(module)) continue;
+        if (InsmodWithDeps(module, parameters)) module_loaded = true;
+    }
+
+    if (strict && !module_loaded) {
+        LOGE("LoadWithAliases was unable to load %s", module_name.c_str());
+        return false;
+    }
+    return true;
+}
+
+// Returns the canonical names of every module whose modules.alias pattern
+// matches `alias` (e.g. a uevent MODALIAS), in alias file order.
+std::vector<std::string> Modprobe::GetModulesForAlias(const std::string& alias) {
+    return module_aliases_.Find(alias);
+}
+
+bool Modprobe::IsModuleLoaded(const std::string& module_name) {
+    ModuleId id = LookupModule(module_name);
+    return id != kInvalidModuleId && IsModuleLoaded(id);
+}
+
+bool Modprobe::IsModuleLoaded(ModuleId id) {
+    std::lock_guard<std::mutex> guard(module_loaded_lock_);
+    return module_loaded_[id];
 }
 
 void Modprobe::AddOption(const std::string& module_name, const std::string& option_name,
                          const std::string& value) {
-    auto canonical_name = MakeCanonical(module_name);
-    auto options_iter = module_options_.find(canonical_name);
+    ModuleId id = InternModule(module_name);
+    if (id == kInvalidModuleId) return;
+
+    auto& options = module_options_[id];
     auto option_str = option_name + "=" + value;
-    if (options_iter != module_options_.end()) {
-        options_iter->second = options_iter->second + " " + option_str;
+    if (options) {
+        *options += " " + option_str;
     } else {
-        module_options_.emplace(canonical_name, option_str);
+        options = option_str;
     }
 }
 
@@ -262,9 +742,9 @@ void Modprobe::ParseKernelCmdlineOptions(void) {
     bool in_option = false;
     bool in_value = false;
     bool in_quotes = false;
-    int start = 0;
+    size_t start = 0;
 
-    for (int i = 0; i < cmdline.size(); i++) {
+    for (size_t i = 0; i < cmdline.size(); i++) {
         if (cmdline[i] == '"') {
             in_quotes = !in_quotes;
         }
@@ -316,265 +796,161 @@ void Modprobe::ParseKernelCmdlineOptions(void) {
 }
 
 Modprobe::Modprobe(const std::vector<std::string>& base_paths, const std::string load_file,
-                   bool use_blocklist)
-    : blocklist_enabled(use_blocklist) {
+                   bool use_blocklist, ModprobeKernel* kernel)
+    : kernel_(kernel ? kernel : ModprobeKernel::Default()), blocklist_enabled(use_blocklist) {
     using namespace std::placeholders;
 
-    for (const auto& base_path : base_paths) {
-        auto alias_callback = std::bind(&Modprobe::ParseAliasCallback, this, _1);
-        ParseCfg(base_path + "/modules.alias", alias_callback);
-
-        auto dep_callback = std::bind(&Modprobe::ParseDepCallback, this, base_path, _1);
-        ParseCfg(base_path + "/modules.dep", dep_callback);
+    // Files whose parsed contents modules.modprobe.bin holds. The load list is
+    // always read from text since it differs per boot mode.
+    static const std::vector<std::string> kCachedCfgs = {
+            "modules.alias", "modules.dep", "modules.softdep", "modules.options",
+            "modules.blocklist"};
 
-        auto softdep_callback = std::bind(&Modprobe::ParseSoftdepCallback, this, _1);
-        ParseCfg(base_path + "/modules.softdep", softdep_callback);
+    for (const auto& base_path : base_paths) {
+        ModuleConfigCache cache(base_path, kCachedCfgs);
+        ModuleConfig config;
+        if (!cache.Read(&config)) {
+            auto cfg = [&](const std::string& name) { return base_path + "/" + name; };
+            bool any_cfg = false;
+            any_cfg |= ParseCfg(cfg("modules.alias"),
+                                std::bind(&Modprobe::ParseAliasCallback, &config, _1));
+            any_cfg |= ParseCfg(cfg("modules.dep"),
+                                std::bind(&Modprobe::ParseDepCallback, base_path, &config, _1));
+            any_cfg |= ParseCfg(cfg("modules.softdep"),
+                                std::bind(&Modprobe::ParseSoftdepCallback, &config, _1));
+            any_cfg |= ParseCfg(cfg("modules.options"),
+                                std::bind(&Modprobe::ParseOptionsCallback, &config, _1));
+            any_cfg |= ParseCfg(cfg("modules.blocklist"),
+                                std::bind(&Modprobe::ParseBlocklistCallback, &config, _1));
+            if (any_cfg) cache.Write(config);
+        }
+        MergeConfig(&config);
 
         auto load_callback = std::bind(&Modprobe::ParseLoadCallback, this, _1);
         ParseCfg(base_path + "/" + load_file, load_callback);
-
-        auto options_callback = std::bind(&Modprobe::ParseOptionsCallback, this, _1);
-        ParseCfg(base_path + "/modules.options", options_callback);
-
-        auto blocklist_callback = std::bind(&Modprobe::ParseBlocklistCallback, this, _1);
-        ParseCfg(base_path + "/modules.blocklist", blocklist_callback);
     }
 
     ParseKernelCmdlineOptions();
+    ExtractSequentialFlags();
+}
+
+// load_sequential=1 is an instruction to LoadModulesParallel(), not a module
+// parameter. It is taken out of the options once, here, so that nothing
+// mutates the options after construction.
+void Modprobe::ExtractSequentialFlags() {
+    const std::string sequential_flag = "load_sequential=1";
+    module_sequential_.assign(names_.size(), false);
+    for (ModuleId id = 0; id < names_.size(); ++id) {
+        auto& options = module_options_[id];
+        auto option_pos = options ? options->find(sequential_flag) : std::string::npos;
+        if (option_pos != std::string::npos) {
+            options->erase(option_pos, sequential_flag.length());
+            module_sequential_[id] = true;
+        }
+    }
 }
 
 std::vector<std::string> Modprobe::GetDependencies(const std::string& module) {
-    auto it = module_deps_.find(module);
-    if (it == module_deps_.end()) {
+    ModuleId id = LookupModule(module);
+    if (id == kInvalidModuleId || !module_listed_[id]) {
         return {};
     }
-    return it->second;
+    std::vector<std::string> dependencies{module_paths_[id]};
+    for (ModuleId dep : module_dep_ids_[id]) {
+        dependencies.emplace_back(module_paths_[dep]);
+    }
+    return dependencies;
+}
+
+// Module files in the order LoadListedModules() will finit them: each module's
+// hard dependencies, deepest first, followed by the module itself.
+std::vector<std::string> Modprobe::GetLoadOrder() {
+    std::vector<std::string> order;
+    std::vector<bool> seen(names_.size());
+    for (ModuleId module : module_load_) {
+        if (IsBlocklisted(module)) continue;
+        if (!module_listed_[module]) continue;
+        const auto& dep_ids = module_dep_ids_[module];
+        for (auto dep = dep_ids.rbegin(); dep != dep_ids.rend(); ++dep) {
+            if (seen[*dep]) continue;
+            seen[*dep] = true;
+            order.emplace_back(module_paths_[*dep]);
+        }
+        if (!seen[module]) {
+            seen[module] = true;
+            order.emplace_back(module_paths_[module]);
+        }
+    }
+    return order;
 }
 
 bool Modprobe::InsmodWithDeps(const std::string& module_name, const std::string& parameters) {
     if (module_name.empty()) {
-        LOG(ERROR) << "Need valid module name, given: " << module_name;
+        LOGE("Need valid module name, given: %s", module_name.c_str());
         return false;
     }
 
-    auto dependencies = GetDependencies(module_name);
-    if (dependencies.empty()) {
-        LOG(ERROR) << "Module " << module_name << " not in dependency file";
+    ModuleId id = LookupModule(module_name);
+    if (id == kInvalidModuleId || !module_listed_[id]) {
+        LOGE("Module %s not in dependency file", module_name.c_str());
         return false;
     }
+    const auto& dep_ids = module_dep_ids_[id];
 
-    // load module dependencies in reverse order
-    for (auto dep = dependencies.rbegin(); dep != dependencies.rend() - 1; ++dep) {
-        LOG(VERBOSE) << "Loading hard dep for '" << module_name << "': " << *dep;
-        if (!LoadWithAliases(*dep, true)) {
+    for (auto dep = dep_ids.rbegin(); dep != dep_ids.rend(); ++dep) {
+        const std::string& dep_path = module_paths_[*dep];
+        LOGD("Loading hard dep for '%s': %s", module_name.c_str(), dep_path.c_str());
+        if (!LoadWithAliases(dep_path, true)) {
             return false;
         }
     }
 
-    // try to load soft pre-dependencies
     for (const auto& [module, softdep] : module_pre_softdep_) {
         if (module_name == module) {
-            LOG(VERBOSE) << "Loading soft pre-dep for '" << module << "': " << softdep;
+            LOGD("Loading soft pre-dep for '%s': %s", module.c_str(), softdep.c_str());
             LoadWithAliases(softdep, false);
         }
     }
 
-    // load target module itself with args
-    if (!Insmod(dependencies[0], parameters)) {
+    if (!Insmod(module_paths_[id], parameters)) {
         return false;
     }
 
-    // try to load soft post-dependencies
     for (const auto& [module, softdep] : module_post_softdep_) {
         if (module_name == module) {
-            LOG(VERBOSE) << "Loading soft post-dep for '" << module << "': " << softdep;
+            LOGD("Loading soft post-dep for '%s': %s", module.c_str(), softdep.c_str());
             LoadWithAliases(softdep, false);
         }
     }
 
     return true;
 }
-
-bool Modprobe::LoadWithAliases(const std::string& module_name, bool strict,
-                               const std::string& parameters) {
-    auto canonical_name = MakeCanonical(module_name);
-    if (module_loaded_.count(canonical_name)) {
-        return true;
-    }
-
-    std::set<std::string> modules_to_load = {canonical_name};
-    bool module_loaded = false;
-
-    // use aliases to expand list of modules to load (multiple modules
-    // may alias themselves to the requested name)
-    for (const auto& [alias, aliased_module] : module_aliases_) {
-        if (fnmatch(alias.c_str(), module_name.c_str(), 0) != 0) continue;
-        LOG(VERBOSE) << "Found alias for '" << module_name << "': '" << aliased_module;
-        if (module_loaded_.count(MakeCanonical(aliased_module))) continue;
-        modules_to_load.emplace(aliased_module);
-    }
-
-    // attempt to load all modules aliased to this name
-    for (const auto& module : modules_to_load) {
-        if (!ModuleExists(module)) continue;
-        if (InsmodWithDeps(module, parameters)) module_loaded = true;
-    }
-
-    if (strict && !module_loaded) {
-        LOG(ERROR) << "LoadWithAliases was unable to load " << module_name
-                   << ", tried: " << android::base::Join(modules_to_load, ", ");
-        return false;
-    }
-    return true;
-}
-
-bool Modprobe::IsBlocklisted(const std::string& module_name) {
-    if (!blocklist_enabled) return false;
-
-    auto canonical_name = MakeCanonical(module_name);
-    auto dependencies = GetDependencies(canonical_name);
-    for (auto dep = dependencies.begin(); dep != dependencies.end(); ++dep) {
-        if (module_blocklist_.count(MakeCanonical(*dep))) return true;
-    }
-
-    return module_blocklist_.count(canonical_name) > 0;
-}
-
-// Another option to load kernel modules. load independent modules dependencies
-// in parallel and then update dependency list of other remaining modules,
-// repeat these steps until all modules are loaded.
-// Discard all blocklist.
-// Softdeps are taken care in InsmodWithDeps().
-bool Modprobe::LoadModulesParallel(int num_threads) {
-    bool ret = true;
-    std::map<std::string, std::vector<std::string>> mod_with_deps;
-
-    // Get dependencies
-    for (const auto& module : module_load_) {
-        // Skip blocklist modules
-        if (IsBlocklisted(module)) {
-            LOG(VERBOSE) << "LMP: Blocklist: Module " << module << " skipping...";
-            continue;
-        }
-        auto dependencies = GetDependencies(MakeCanonical(module));
-        if (dependencies.empty()) {
-            LOG(ERROR) << "LMP: Hard-dep: Module " << module
-                       << " not in .dep file";
-            return false;
-        }
-        mod_with_deps[MakeCanonical(module)] = dependencies;
-    }
-
-    while (!mod_with_deps.empty()) {
-        std::vector<std::thread> threads;
-        std::vector<std::string> mods_path_to_load;
-        std::mutex vector_lock;
-
-        // Find independent modules
-        for (const auto& [it_mod, it_dep] : mod_with_deps) {
-            auto itd_last = it_dep.rbegin();
-            if (itd_last == it_dep.rend())
-                continue;
-
-            auto cnd_last = MakeCanonical(*itd_last);
-            // Hard-dependencies cannot be blocklisted
-            if (IsBlocklisted(cnd_last)) {
-                LOG(ERROR) << "LMP: Blocklist: Module-dep " << cnd_last
-                           << " : failed to load module " << it_mod;
-                return false;
-            }
-
-            std::string str = "load_sequential=1";
-            auto it = module_options_[cnd_last].find(str);
-            if (it != std::string::npos) {
-                module_options_[cnd_last].erase(it, it + str.size());
-
-                if (!LoadWithAliases(cnd_last, true)) {
-                    return false;
-                }
-            } else {
-                if (std::find(mods_path_to_load.begin(), mods_path_to_load.end(),
-                            cnd_last) == mods_path_to_load.end()) {
-                    mods_path_to_load.emplace_back(cnd_last);
-                }
-            }
-        }
-
-        // Load independent modules in parallel
-        auto thread_function = [&] {
-            std::unique_lock lk(vector_lock);
-            while (!mods_path_to_load.empty()) {
-                auto ret_load = true;
-                auto mod_to_load = std::move(mods_path_to_load.back());
-                mods_path_to_load.pop_back();
-
-                lk.unlock();
-                ret_load &= LoadWithAliases(mod_to_load, true);
-                lk.lock();
-                if (!ret_load) {
-                    ret &= ret_load;
-                }
-            }
-        };
-
-        std::generate_n(std::back_inserter(threads), num_threads,
-                        [&] { return std::thread(thread_function); });
-
-        // Wait for the threads.
-        for (auto& thread : threads) {
-            thread.join();
-        }
-
-        if (!ret) return ret;
-
-        std::lock_guard guard(module_loaded_lock_);
-        // Remove loaded module form mod_with_deps and soft dependencies of other modules
-        for (const auto& module_loaded : module_loaded_)
-            mod_with_deps.erase(module_loaded);
-
-        // Remove loaded module form dependencies of other modules which are not loaded yet
-        for (const auto& module_loaded_path : module_loaded_paths_) {
-            for (auto& [mod, deps] : mod_with_deps) {
-                auto it = std::find(deps.begin(), deps.end(), module_loaded_path);
-                if (it != deps.end()) {
-                    deps.erase(it);
-                }
-            }
-        }
-    }
-
-    return ret;
-}
-
-bool Modprobe::LoadListedModules(bool strict) {
-    auto ret = true;
-    for (const auto& module : module_load_) {
-        if (!LoadWithAliases(module, true)) {
-            if (IsBlocklisted(module)) continue;
-            ret = false;
-            if (strict) break;
-        }
-    }
-    return ret;
-}
-
 bool Modprobe::Remove(const std::string& module_name) {
-    auto dependencies = GetDependencies(MakeCanonical(module_name));
-    for (auto dep = dependencies.begin(); dep != dependencies.end(); ++dep) {
-        Rmmod(*dep);
+    auto dependencies = GetDependencies(module_name);
+    if (dependencies.empty()) {
+        // Not in modules.dep; remove it by the name given.
+        Rmmod(module_name);
+    }
+    // dependencies[0] is the module itself.
+    for (const auto& dep : dependencies) {
+        Rmmod(dep);
     }
-    Rmmod(module_name);
     return true;
 }
 
 std::vector<std::string> Modprobe::ListModules(const std::string& pattern) {
     std::vector<std::string> rv;
-    for (const auto& [module, deps] : module_deps_) {
+    for (ModuleId id = 0; id < names_.size(); ++id) {
+        if (!module_listed_[id]) continue;
         // Attempt to match both the canonical module name and the module filename.
+        const std::string& module = names_.Name(id);
+        const std::string& path = module_paths_[id];
+        auto slash = path.find_last_of('/');
+        std::string basename = slash == std::string::npos ? path : path.substr(slash + 1);
         if (!fnmatch(pattern.c_str(), module.c_str(), 0)) {
             rv.emplace_back(module);
-        } else if (!fnmatch(pattern.c_str(), android::base::Basename(deps[0]).c_str(), 0)) {
-            rv.emplace_back(deps[0]);
+        } else if (!fnmatch(pattern.c_str(), basename.c_str(), 0)) {
+            rv.emplace_back(path);
         }
     }
     return rv;
@@ -599,9 +975,7 @@ bool Modprobe::GetAllDependencies(const std::string& module,
         if (hard_deps.empty()) {
             return false;
         }
-        for (auto dep = hard_deps.rbegin(); dep != hard_deps.rend(); dep++) {
-            dependencies->emplace_back(*dep);
-        }
+        dependencies->assign(hard_deps.rbegin(), hard_deps.rend());
     }
     if (post_dependencies) {
         for (const auto& [it_module, it_softdep] : module_post_softdep_) {
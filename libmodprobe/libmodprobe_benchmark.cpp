@@ -0,0 +1,202 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <benchmark/benchmark.h>
+
+#include <modprobe/modprobe.h>
+
+namespace {
+
+constexpr int kNumModules = 10000;
+
+// Simulated time a module spends in finit_module().
+constexpr std::chrono::microseconds kFinitLatency(20);
+
+// A kernel that accepts every module after a fixed delay.
+class FakeKernel : public ModprobeKernel {
+  public:
+    int FinitModule(int, const std::string&, int) override {
+        std::this_thread::sleep_for(kFinitLatency);
+        return 0;
+    }
+    int InitModule(const std::vector<char>&, const std::string&) override { return 0; }
+    int DeleteModule(const std::string&, int) override { return 0; }
+    std::string ReadKernelCmdline() override { return ""; }
+};
+
+/**
+ * A modules.dep/modules.alias/modules.load tree of empty module files.
+ *
+ * Module i depends on its parent (i - 1) / 4 and, as depmod writes it, on
+ * every ancestor after that, so the graph is a 4-ary tree about seven levels
+ * deep. Each module has one exact PCI alias and every tenth also has a
+ * wildcard OF alias, which is roughly the mix a vendor kernel ships.
+ */
+class SyntheticTree {
+  public:
+    explicit SyntheticTree(int num_modules) {
+        char dir[] = "/tmp/modprobe_bench.XXXXXX";
+        if (!mkdtemp(dir)) abort();
+        path_ = dir;
+        std::filesystem::create_directories(path_ + "/kernel/drivers");
+
+        std::ofstream dep(path_ + "/modules.dep");
+        std::ofstream alias(path_ + "/modules.alias");
+        std::ofstream load(path_ + "/modules.load");
+        for (int i = 0; i < num_modules; ++i) {
+            std::string file = ModuleFile(i);
+            close(open((path_ + "/" + file).c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644));
+
+            dep << file << ":";
+            for (int parent = i; parent > 0;) {
+                parent = (parent - 1) / 4;
+                dep << " " << ModuleFile(parent);
+            }
+            dep << "\n";
+
+            std::string name = ModuleName(i);
+            alias << "alias " << PciAlias(i, "*", "*") << " " << name << "\n";
+            if (i % 10 == 0) {
+                alias << "alias of:N*T*Cvendor,dev" << i << "* " << name << "\n";
+            }
+            load << file << "\n";
+            queries_.emplace_back(PciAlias(i, "00001234", "00005678"));
+        }
+        for (auto* file : {"modules.softdep", "modules.options", "modules.blocklist"}) {
+            std::ofstream(path_ + "/" + file);
+        }
+    }
+
+    ~SyntheticTree() { std::filesystem::remove_all(path_); }
+
+    const std::string& path() const { return path_; }
+    const std::vector<std::string>& queries() const { return queries_; }
+
+    void DropConfigCache() const { unlink((path_ + "/modules.modprobe.bin").c_str()); }
+
+  private:
+    static std::string ModuleName(int i) {
+        char name[16];
+        snprintf(name, sizeof(name), "m%05d", i);
+        return name;
+    }
+    static std::string ModuleFile(int i) { return "kernel/drivers/" + ModuleName(i) + ".ko"; }
+    static std::string PciAlias(int i, const char* subvendor, const char* subdevice) {
+        char alias[96];
+        snprintf(alias, sizeof(alias), "pci:v%08Xd%08Xsv%ssd%sbc02sc00i00", 0x8000 + i / 100, i,
+                 subvendor, subdevice);
+        return alias;
+    }
+
+    std::string path_;
+    std::vector<std::string> queries_;
+};
+
+const SyntheticTree& Tree() {
+    static SyntheticTree tree(kNumModules);
+    return tree;
+}
+
+// Parses every configuration file from text, as on first boot.
+void BM_ParseConfig(benchmark::State& state) {
+    FakeKernel kernel;
+    for (auto _ : state) {
+        state.PauseTiming();
+        Tree().DropConfigCache();
+        state.ResumeTiming();
+        Modprobe m({Tree().path()}, "modules.load", true, &kernel);
+        benchmark::DoNotOptimize(m);
+    }
+}
+BENCHMARK(BM_ParseConfig)->Unit(benchmark::kMillisecond);
+
+// Replays the configuration from modules.modprobe.bin.
+void BM_ParseConfigCached(benchmark::State& state) {
+    FakeKernel kernel;
+    Modprobe warm({Tree().path()}, "modules.load", true, &kernel);
+    for (auto _ : state) {
+        Modprobe m({Tree().path()}, "modules.load", true, &kernel);
+        benchmark::DoNotOptimize(m);
+    }
+}
+BENCHMARK(BM_ParseConfigCached)->Unit(benchmark::kMillisecond);
+
+// Resolves uevent MODALIAS strings, as ueventd does during coldboot.
+void BM_AliasResolution(benchmark::State& state) {
+    FakeKernel kernel;
+    Modprobe m({Tree().path()}, "modules.load", true, &kernel);
+    std::vector<std::string> queries = Tree().queries();
+    std::shuffle(queries.begin(), queries.end(), std::mt19937(42));
+    size_t next = 0;
+    for (auto _ : state) {
+        auto modules = m.GetModulesForAlias(queries[next++ % queries.size()]);
+        benchmark::DoNotOptimize(modules);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_AliasResolution);
+
+// Loads the whole tree one module at a time.
+void BM_LoadListedModules(benchmark::State& state) {
+    FakeKernel kernel;
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto m = std::make_unique<Modprobe>(std::vector<std::string>{Tree().path()},
+                                            "modules.load", true, &kernel);
+        state.ResumeTiming();
+        if (!m->LoadListedModules()) state.SkipWithError("load failed");
+    }
+    state.SetItemsProcessed(state.iterations() * kNumModules);
+}
+BENCHMARK(BM_LoadListedModules)->Unit(benchmark::kMillisecond)->UseRealTime();
+
+// Loads the whole tree as a dependency DAG with state.range(0) workers.
+void BM_LoadModulesParallel(benchmark::State& state) {
+    FakeKernel kernel;
+    for (auto _ : state) {
+        state.PauseTiming();
+        auto m = std::make_unique<Modprobe>(std::vector<std::string>{Tree().path()},
+                                            "modules.load", true, &kernel);
+        state.ResumeTiming();
+        if (!m->LoadModulesParallel(state.range(0))) state.SkipWithError("load failed");
+    }
+    state.SetItemsProcessed(state.iterations() * kNumModules);
+}
+BENCHMARK(BM_LoadModulesParallel)
+        ->RangeMultiplier(2)
+        ->Range(1, 16)
+        ->Unit(benchmark::kMillisecond)
+        ->UseRealTime();
+
+}  // namespace
+
+BENCHMARK_MAIN();
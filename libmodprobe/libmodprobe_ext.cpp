@@ -14,92 +14,181 @@
  * limitations under the License.
  */
 
+#include <modprobe/modprobe.h>
+
+#include "log_new.h"
+#include "module_decompress.h"
+
+#include <fcntl.h>
 #include <sys/stat.h>
 #include <sys/syscall.h>
+#include <unistd.h>
 
-#include <android-base/file.h>
-#include <android-base/logging.h>
-#include <android-base/unique_fd.h>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
 
-#include <modprobe/modprobe.h>
+#ifndef MODULE_INIT_COMPRESSED_FILE
+#define MODULE_INIT_COMPRESSED_FILE 4
+#endif
 
-std::string Modprobe::GetKernelCmdline(void) {
-    std::string cmdline;
-    if (!android::base::ReadFileToString("/proc/cmdline", &cmdline)) {
+namespace {
+
+// Loads a compressed module, letting the kernel decompress it when it can.
+// Otherwise the image is inflated here, on the loader's worker thread, so
+// independent modules decompress in parallel.
+int LoadCompressedModule(ModprobeKernel* kernel, int fd, ModuleCompression compression,
+                         const std::string& options) {
+    if (KernelSupportsModuleCompression(compression)) {
+        int ret = kernel->FinitModule(fd, options, MODULE_INIT_COMPRESSED_FILE);
+        if (ret == 0 || (errno != EINVAL && errno != EOPNOTSUPP && errno != ENOPKG)) {
+            return ret;
+        }
+    }
+    std::vector<char> image;
+    if (!DecompressModule(fd, compression, &image)) {
+        errno = ENOEXEC;
+        return -1;
+    }
+    return kernel->InitModule(image, options);
+}
+
+}  // namespace
+
+ModprobeKernel* ModprobeKernel::Default() {
+    static ModprobeKernel kernel;
+    return &kernel;
+}
+
+int ModprobeKernel::OpenModule(const std::string& path) {
+    return TEMP_FAILURE_RETRY(open(path.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC));
+}
+
+int ModprobeKernel::FinitModule(int fd, const std::string& options, int flags) {
+    return syscall(__NR_finit_module, fd, options.c_str(), flags);
+}
+
+int ModprobeKernel::InitModule(const std::vector<char>& image, const std::string& options) {
+    return syscall(__NR_init_module, image.data(), image.size(), options.c_str());
+}
+
+int ModprobeKernel::DeleteModule(const std::string& name, int flags) {
+    return syscall(__NR_delete_module, name.c_str(), flags);
+}
+
+int ModprobeKernel::Stat(const std::string& path, struct stat* st) {
+    return stat(path.c_str(), st);
+}
+
+std::string ModprobeKernel::ReadKernelCmdline() {
+    std::ifstream file("/proc/cmdline");
+    if (!file.is_open()) {
         return "";
     }
+    std::string cmdline;
+    std::getline(file, cmdline);
     return cmdline;
 }
 
+std::string Modprobe::GetKernelCmdline() {
+    return kernel_->ReadKernelCmdline();
+}
+
 bool Modprobe::Insmod(const std::string& path_name, const std::string& parameters) {
-    android::base::unique_fd fd(
-            TEMP_FAILURE_RETRY(open(path_name.c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC)));
+    ModuleLoadStats stats;
+    stats.path = path_name;
+    stats.tid = static_cast<pid_t>(syscall(SYS_gettid));
+    stats.start_ns = NowNs();
+
+    int fd = kernel_->OpenModule(path_name);
     if (fd == -1) {
-        PLOG(ERROR) << "Could not open module '" << path_name << "'";
+        LOGE("Could not open module '%s': %s", path_name.c_str(), strerror(errno));
         return false;
     }
+    int64_t opened_ns = NowNs();
+    stats.open_ns = opened_ns - stats.start_ns;
 
-    auto canonical_name = MakeCanonical(path_name);
+    ModuleId id = LookupModule(path_name);
+    stats.name = id != kInvalidModuleId ? names_.Name(id) : MakeCanonical(path_name);
     std::string options = "";
-    auto options_iter = module_options_.find(canonical_name);
-    if (options_iter != module_options_.end()) {
-        options = options_iter->second;
+    if (id != kInvalidModuleId && module_options_[id]) {
+        options = *module_options_[id];
     }
     if (!parameters.empty()) {
         options = options + " " + parameters;
     }
 
-    LOG(INFO) << "Loading module " << path_name << " with args '" << options << "'";
-    int ret = syscall(__NR_finit_module, fd.get(), options.c_str(), 0);
+    LOGI("Loading module %s with args '%s'", path_name.c_str(), options.c_str());
+    int ret;
+    ModuleCompression compression = GetModuleCompression(path_name);
+    if (compression == ModuleCompression::kNone) {
+        ret = kernel_->FinitModule(fd, options, 0);
+    } else {
+        ret = LoadCompressedModule(kernel_, fd, compression, options);
+    }
+    int saved_errno = errno;
+    stats.finit_ns = NowNs() - opened_ns;
+    close(fd);
+    if (auto prefetcher = std::atomic_load(&prefetcher_)) prefetcher->ModuleLoaded();
+
+    stats.ok = ret == 0 || saved_errno == EEXIST;
+    RecordLoadStats(stats);
+
     if (ret != 0) {
-        if (errno == EEXIST) {
-            // Module already loaded
+        if (saved_errno == EEXIST) {
             std::lock_guard guard(module_loaded_lock_);
-            module_loaded_paths_.emplace(path_name);
-            module_loaded_.emplace(canonical_name);
+            if (id != kInvalidModuleId) module_loaded_[id] = true;
             return true;
         }
-        PLOG(ERROR) << "Failed to insmod '" << path_name << "' with args '" << options << "'";
+        LOGE("Failed to insmod '%s' with args '%s': %s", path_name.c_str(), options.c_str(),
+             strerror(saved_errno));
         return false;
     }
 
-    LOG(INFO) << "Loaded kernel module " << path_name;
+    LOGI("Loaded kernel module %s (%.1f ms)", path_name.c_str(),
+         static_cast<double>(stats.finit_ns) / 1e6);
     std::lock_guard guard(module_loaded_lock_);
-    module_loaded_paths_.emplace(path_name);
-    module_loaded_.emplace(canonical_name);
+    if (id != kInvalidModuleId) module_loaded_[id] = true;
     module_count_++;
     return true;
 }
 
 bool Modprobe::Rmmod(const std::string& module_name) {
     auto canonical_name = MakeCanonical(module_name);
-    int ret = syscall(__NR_delete_module, canonical_name.c_str(), O_NONBLOCK);
+    int ret = kernel_->DeleteModule(canonical_name, O_NONBLOCK);
     if (ret != 0) {
-        PLOG(ERROR) << "Failed to remove module '" << module_name << "'";
+        LOGE("Failed to remove module '%s': %s", module_name.c_str(), strerror(errno));
         return false;
     }
+    ModuleId id = LookupModule(canonical_name);
     std::lock_guard guard(module_loaded_lock_);
-    module_loaded_.erase(canonical_name);
+    if (id != kInvalidModuleId) module_loaded_[id] = false;
     return true;
 }
 
 bool Modprobe::ModuleExists(const std::string& module_name) {
-    struct stat fileStat {};
-    if (blocklist_enabled && module_blocklist_.count(module_name)) {
-        LOG(INFO) << "module " << module_name << " is blocklisted";
+    struct stat fileStat{};
+    ModuleId id = LookupModule(module_name);
+    if (id == kInvalidModuleId) {
+        return false;
+    }
+    if (blocklist_enabled && module_blocklist_[id]) {
+        LOGI("module %s is blocklisted", module_name.c_str());
         return false;
     }
-    auto deps = GetDependencies(module_name);
-    if (deps.empty()) {
-        // missing deps can happen in the case of an alias
+    if (!module_listed_[id]) {
         return false;
     }
-    if (stat(deps.front().c_str(), &fileStat)) {
-        PLOG(INFO) << "module " << module_name << " can't be loaded; can't access " << deps.front();
+    const std::string& path = module_paths_[id];
+    if (kernel_->Stat(path, &fileStat)) {
+        LOGI("module %s can't be loaded; can't access %s", module_name.c_str(), path.c_str());
         return false;
     }
     if (!S_ISREG(fileStat.st_mode)) {
-        LOG(INFO) << "module " << module_name << " is not a regular file";
+        LOGI("module %s is not a regular file", module_name.c_str());
         return false;
     }
     return true;
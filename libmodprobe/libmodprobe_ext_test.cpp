@@ -14,70 +14,92 @@
  * limitations under the License.
  */
 
+#include <fcntl.h>
 #include <sys/stat.h>
-#include <sys/syscall.h>
+#include <unistd.h>
 
+#include <algorithm>
 #include <string>
 #include <vector>
 
-#include <android-base/logging.h>
 #include <android-base/strings.h>
-#include <android-base/unique_fd.h>
 #include <gtest/gtest.h>
 
 #include <modprobe/modprobe.h>
+#include <modprobe/module_name_table.h>
 
 #include "libmodprobe_test.h"
 
-std::string Modprobe::GetKernelCmdline(void) {
+namespace {
+
+bool IsTestModule(const std::string& path) {
+    return std::find(test_modules.begin(), test_modules.end(), path) != test_modules.end();
+}
+
+std::string Canonical(const std::string& path) {
+    char buf[ModuleNameTable::kMaxNameLen];
+    return std::string(ModuleNameTable::Canonicalize(path, buf));
+}
+
+}  // namespace
+
+std::string TestModprobeKernel::ReadKernelCmdline() {
     return kernel_cmdline;
 }
 
-bool Modprobe::Insmod(const std::string& path_name, const std::string& parameters) {
-    auto deps = GetDependencies(MakeCanonical(path_name));
-    if (deps.empty()) {
-        return false;
+int TestModprobeKernel::OpenModule(const std::string& path) {
+    if (!IsTestModule(path)) {
+        errno = ENOENT;
+        return -1;
     }
-    if (std::find(test_modules.begin(), test_modules.end(), deps.front()) == test_modules.end()) {
-        return false;
+    int fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (fd != -1) open_modules_[fd] = path;
+    return fd;
+}
+
+int TestModprobeKernel::FinitModule(int fd, const std::string& options, int) {
+    auto it = open_modules_.find(fd);
+    if (it == open_modules_.end()) {
+        errno = EBADF;
+        return -1;
     }
-    for (auto it = modules_loaded.begin(); it != modules_loaded.end(); ++it) {
-        if (android::base::StartsWith(*it, path_name)) {
-            return true;
+    std::string path_name = it->second;
+    open_modules_.erase(it);
+
+    for (const auto& module : modules_loaded) {
+        if (android::base::StartsWith(module, path_name)) {
+            errno = EEXIST;
+            return -1;
         }
     }
-    std::string options;
-    auto options_iter = module_options_.find(MakeCanonical(path_name));
-    if (options_iter != module_options_.end()) {
-        options = " " + options_iter->second;
-    }
-    if (!parameters.empty()) {
-        options = options + " " + parameters;
-    }
+    modules_loaded.emplace_back(options.empty() ? path_name : path_name + " " + options);
+    return 0;
+}
 
-    modules_loaded.emplace_back(path_name + options);
-    module_count_++;
-    return true;
+int TestModprobeKernel::InitModule(const std::vector<char>&, const std::string&) {
+    errno = ENOSYS;
+    return -1;
 }
 
-bool Modprobe::Rmmod(const std::string& module_name) {
+int TestModprobeKernel::DeleteModule(const std::string& name, int) {
+    // Entries are "<path> <options>"; match on the module name, or on the whole
+    // entry when a test removes one by its modules_loaded string.
     for (auto it = modules_loaded.begin(); it != modules_loaded.end(); it++) {
-        if (*it == module_name || android::base::StartsWith(*it, module_name + " ")) {
+        if (Canonical(it->substr(0, it->find(' '))) == name || Canonical(*it) == name) {
             modules_loaded.erase(it);
-            return true;
+            return 0;
         }
     }
-    return false;
+    errno = ENOENT;
+    return -1;
 }
 
-bool Modprobe::ModuleExists(const std::string& module_name) {
-    auto deps = GetDependencies(module_name);
-    if (blocklist_enabled && module_blocklist_.count(module_name)) {
-        return false;
-    }
-    if (deps.empty()) {
-        // missing deps can happen in the case of an alias
-        return false;
+int TestModprobeKernel::Stat(const std::string& path, struct stat* st) {
+    if (!IsTestModule(path)) {
+        errno = ENOENT;
+        return -1;
     }
-    return std::find(test_modules.begin(), test_modules.end(), deps.front()) != test_modules.end();
+    *st = {};
+    st->st_mode = S_IFREG | 0644;
+    return 0;
 }
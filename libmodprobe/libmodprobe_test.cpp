@@ -14,7 +14,15 @@
  * limitations under the License.
  */
 
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
 #include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <thread>
 
 #include <android-base/file.h>
 #include <android-base/macros.h>
@@ -34,62 +42,111 @@ std::vector<std::string> modules_loaded;
 // Used by libmodprobe_ext_test to fake a kernel commandline
 std::string kernel_cmdline;
 
-TEST(libmodprobe, Test) {
-    kernel_cmdline =
-            "flag1 flag2 test1.option1=50 test4.option3=\"set x\" test1.option2=60 "
-            "test8. test5.option1= test10.option1=1";
-    test_modules = {
-            "/test1.ko",  "/test2.ko",  "/test3.ko",  "/test4.ko",  "/test5.ko",
-            "/test6.ko",  "/test7.ko",  "/test8.ko",  "/test9.ko",  "/test10.ko",
-            "/test11.ko", "/test12.ko", "/test13.ko", "/test14.ko", "/test15.ko",
-    };
+namespace {
+
+// A kernel that LoadModulesParallel() workers can share. Every module but the
+// ones in `missing` exists; the ones in `failing` fail finit_module() with EINVAL.
+class ParallelTestKernel : public ModprobeKernel {
+  public:
+    ParallelTestKernel(std::set<std::string> failing, std::set<std::string> sequential,
+                       std::set<std::string> missing = {})
+        : failing_(std::move(failing)),
+          sequential_(std::move(sequential)),
+          missing_(std::move(missing)) {}
+
+    int OpenModule(const std::string& path) override {
+        if (missing_.count(Basename(path))) {
+            errno = ENOENT;
+            return -1;
+        }
+        int fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        std::lock_guard<std::mutex> guard(lock_);
+        if (fd != -1) open_modules_[fd] = path;
+        return fd;
+    }
 
-    std::vector<std::string> expected_modules_loaded = {
-            "/test14.ko",
-            "/test15.ko",
-            "/test3.ko",
-            "/test4.ko option3=\"set x\"",
-            "/test1.ko option1=50 option2=60",
-            "/test6.ko",
-            "/test2.ko",
-            "/test5.ko option1=",
-            "/test8.ko",
-            "/test7.ko param1=4",
-            "/test9.ko param_x=1 param_y=2 param_z=3",
-            "/test10.ko option1=1",
-            "/test12.ko",
-            "/test11.ko",
-            "/test13.ko",
-    };
+    int FinitModule(int fd, const std::string&, int) override {
+        std::string path;
+        bool sequential;
+        {
+            std::lock_guard<std::mutex> guard(lock_);
+            path = open_modules_[fd];
+            attempted_.emplace_back(path);
+            sequential = sequential_.count(Basename(path)) > 0;
+            if (sequential && sequential_in_flight_++ > 0) sequential_overlapped_ = true;
+        }
+        usleep(1000);
+        std::lock_guard<std::mutex> guard(lock_);
+        if (sequential) sequential_in_flight_--;
+        if (failing_.count(Basename(path))) {
+            errno = EINVAL;
+            return -1;
+        }
+        if (std::find(loaded_.begin(), loaded_.end(), Basename(path)) != loaded_.end()) {
+            errno = EEXIST;
+            return -1;
+        }
+        loaded_.emplace_back(Basename(path));
+        return 0;
+    }
 
-    std::vector<std::string> expected_after_remove = {
-            "/test14.ko",
-            "/test15.ko",
-            "/test1.ko option1=50 option2=60",
-            "/test6.ko",
-            "/test2.ko",
-            "/test5.ko option1=",
-            "/test8.ko",
-            "/test7.ko param1=4",
-            "/test9.ko param_x=1 param_y=2 param_z=3",
-            "/test10.ko option1=1",
-            "/test12.ko",
-            "/test11.ko",
-            "/test13.ko",
-    };
+    int InitModule(const std::vector<char>&, const std::string&) override {
+        errno = ENOSYS;
+        return -1;
+    }
 
-    std::vector<std::string> expected_modules_blocklist_enabled = {
-            "/test1.ko option1=50 option2=60",
-            "/test6.ko",
-            "/test2.ko",
-            "/test5.ko option1=",
-            "/test8.ko",
-            "/test7.ko param1=4",
-            "/test12.ko",
-            "/test11.ko",
-            "/test13.ko",
-    };
+    int Stat(const std::string& path, struct stat* st) override {
+        if (missing_.count(Basename(path))) {
+            errno = ENOENT;
+            return -1;
+        }
+        *st = {};
+        st->st_mode = S_IFREG | 0644;
+        return 0;
+    }
 
+    std::string ReadKernelCmdline() override { return ""; }
+
+    std::vector<std::string> loaded() {
+        std::lock_guard<std::mutex> guard(lock_);
+        return loaded_;
+    }
+    size_t attempts() {
+        std::lock_guard<std::mutex> guard(lock_);
+        return attempted_.size();
+    }
+    bool sequential_overlapped() const { return sequential_overlapped_; }
+
+  private:
+    static std::string Basename(const std::string& path) {
+        return path.substr(path.find_last_of('/') + 1);
+    }
+
+    std::set<std::string> failing_;
+    std::set<std::string> sequential_;
+    std::set<std::string> missing_;
+    std::mutex lock_;
+    std::map<int, std::string> open_modules_;
+    std::vector<std::string> attempted_;
+    std::vector<std::string> loaded_;
+    int sequential_in_flight_ = 0;
+    bool sequential_overlapped_ = false;
+};
+
+void WriteModuleConfig(const TemporaryDir& dir, const std::string& dep,
+                       const std::string& options, const std::string& load) {
+    std::string dir_path = dir.path;
+    ASSERT_TRUE(android::base::WriteStringToFile(dep, dir_path + "/modules.dep", 0600, getuid(),
+                                                 getgid()));
+    ASSERT_TRUE(android::base::WriteStringToFile(options, dir_path + "/modules.options", 0600,
+                                                 getuid(), getgid()));
+    ASSERT_TRUE(android::base::WriteStringToFile(load, dir_path + "/modules.load", 0600, getuid(),
+                                                 getgid()));
+}
+
+// modules.* files of the libmodprobe.Test fixture: hard deps, softdeps
+// (including one through an alias), options and a blocklist.
+void WriteTestFixture(const TemporaryDir& dir) {
     const std::string modules_dep =
             "test1.ko:\n"
             "test2.ko:\n"
@@ -138,8 +195,7 @@ TEST(libmodprobe, Test) {
             "test9.ko\n"
             "test11.ko\n";
 
-    TemporaryDir dir;
-    auto dir_path = std::string(dir.path);
+    std::string dir_path = dir.path;
     ASSERT_TRUE(android::base::WriteStringToFile(modules_alias, dir_path + "/modules.alias", 0600,
                                                  getuid(), getgid()));
 
@@ -153,12 +209,79 @@ TEST(libmodprobe, Test) {
                                                  getuid(), getgid()));
     ASSERT_TRUE(android::base::WriteStringToFile(modules_blocklist, dir_path + "/modules.blocklist",
                                                  0600, getuid(), getgid()));
+}
+
+size_t Position(const std::vector<std::string>& loaded, const std::string& module) {
+    return std::find(loaded.begin(), loaded.end(), module) - loaded.begin();
+}
+
+}  // namespace
+
+TEST(libmodprobe, Test) {
+    kernel_cmdline =
+            "flag1 flag2 test1.option1=50 test4.option3=\"set x\" test1.option2=60 "
+            "test8. test5.option1= test10.option1=1";
+    test_modules = {
+            "/test1.ko",  "/test2.ko",  "/test3.ko",  "/test4.ko",  "/test5.ko",
+            "/test6.ko",  "/test7.ko",  "/test8.ko",  "/test9.ko",  "/test10.ko",
+            "/test11.ko", "/test12.ko", "/test13.ko", "/test14.ko", "/test15.ko",
+    };
+
+    std::vector<std::string> expected_modules_loaded = {
+            "/test14.ko",
+            "/test15.ko",
+            "/test3.ko",
+            "/test4.ko option3=\"set x\"",
+            "/test1.ko option1=50 option2=60",
+            "/test6.ko",
+            "/test2.ko",
+            "/test5.ko option1=",
+            "/test8.ko",
+            "/test7.ko param1=4",
+            "/test9.ko param_x=1 param_y=2 param_z=3",
+            "/test10.ko option1=1",
+            "/test12.ko",
+            "/test11.ko",
+            "/test13.ko",
+    };
+
+    std::vector<std::string> expected_after_remove = {
+            "/test14.ko",
+            "/test15.ko",
+            "/test1.ko option1=50 option2=60",
+            "/test6.ko",
+            "/test2.ko",
+            "/test5.ko option1=",
+            "/test8.ko",
+            "/test7.ko param1=4",
+            "/test9.ko param_x=1 param_y=2 param_z=3",
+            "/test10.ko option1=1",
+            "/test12.ko",
+            "/test11.ko",
+            "/test13.ko",
+    };
+
+    std::vector<std::string> expected_modules_blocklist_enabled = {
+            "/test1.ko option1=50 option2=60",
+            "/test6.ko",
+            "/test2.ko",
+            "/test5.ko option1=",
+            "/test8.ko",
+            "/test7.ko param1=4",
+            "/test12.ko",
+            "/test11.ko",
+            "/test13.ko",
+    };
+
+    TemporaryDir dir;
+    WriteTestFixture(dir);
 
     for (auto i = test_modules.begin(); i != test_modules.end(); ++i) {
         *i = dir.path + *i;
     }
 
-    Modprobe m({dir.path}, "modules.load", false);
+    TestModprobeKernel kernel;
+    Modprobe m({dir.path}, "modules.load", false, &kernel);
     EXPECT_TRUE(m.LoadListedModules());
 
     GTEST_LOG_(INFO) << "Expected modules loaded (in order):";
@@ -188,7 +311,7 @@ TEST(libmodprobe, Test) {
 
     EXPECT_TRUE(modules_loaded == expected_after_remove);
 
-    Modprobe m2({dir.path});
+    Modprobe m2({dir.path}, "modules.load", true, &kernel);
 
     EXPECT_FALSE(m2.LoadWithAliases("test4", true));
     while (modules_loaded.size() > 0) EXPECT_TRUE(m2.Remove(modules_loaded.front()));
@@ -216,6 +339,163 @@ TEST(libmodprobe, ModuleDepLineWithoutColonIsSkipped) {
     kernel_cmdline = "";
     test_modules = {dir_path + "/no_colon.ko"};
 
-    Modprobe m({dir.path});
+    TestModprobeKernel kernel;
+    Modprobe m({dir.path}, "modules.load", true, &kernel);
     EXPECT_FALSE(m.LoadWithAliases("no_colon", true));
 }
+
+TEST(libmodprobe, LoadModulesParallelLoadsDependenciesFirst) {
+    // modules.dep lists every module's transitive dependencies.
+    const std::string modules_dep =
+            "top.ko: left.ko right.ko base.ko\n"
+            "left.ko: base.ko\n"
+            "right.ko: base.ko\n"
+            "base.ko:\n"
+            "seq1.ko:\n"
+            "seq2.ko:\n"
+            "seq3.ko: base.ko\n"
+            "lone.ko:\n";
+    const std::string modules_options =
+            "options seq1 load_sequential=1\n"
+            "options seq2 load_sequential=1\n"
+            "options seq3 load_sequential=1\n";
+    const std::string modules_load = "top.ko\nseq1.ko\nseq2.ko\nseq3.ko\nlone.ko\n";
+
+    TemporaryDir dir;
+    WriteModuleConfig(dir, modules_dep, modules_options, modules_load);
+    ParallelTestKernel kernel({}, {"seq1.ko", "seq2.ko", "seq3.ko"});
+    Modprobe m({dir.path}, "modules.load", true, &kernel);
+    EXPECT_TRUE(m.LoadModulesParallel(4));
+
+    auto loaded = kernel.loaded();
+    std::vector<std::string> sorted = loaded;
+    std::sort(sorted.begin(), sorted.end());
+    EXPECT_EQ(sorted, (std::vector<std::string>{"base.ko", "left.ko", "lone.ko", "right.ko",
+                                                "seq1.ko", "seq2.ko", "seq3.ko", "top.ko"}));
+    EXPECT_LT(Position(loaded, "base.ko"), Position(loaded, "left.ko"));
+    EXPECT_LT(Position(loaded, "base.ko"), Position(loaded, "right.ko"));
+    EXPECT_LT(Position(loaded, "left.ko"), Position(loaded, "top.ko"));
+    EXPECT_LT(Position(loaded, "right.ko"), Position(loaded, "top.ko"));
+    EXPECT_LT(Position(loaded, "base.ko"), Position(loaded, "seq3.ko"));
+    EXPECT_FALSE(kernel.sequential_overlapped());
+    EXPECT_EQ(m.GetModuleCount(), 8);
+}
+
+TEST(libmodprobe, LoadModulesParallelSkipsDependentsOfFailedModule) {
+    const std::string modules_dep =
+            "broken.ko:\n"
+            "user.ko: broken.ko\n"
+            "indirect.ko: user.ko broken.ko\n"
+            "seq_user.ko: broken.ko\n"
+            "seq_ok.ko:\n"
+            "fine.ko:\n";
+    const std::string modules_options =
+            "options seq_user load_sequential=1\n"
+            "options seq_ok load_sequential=1\n";
+    const std::string modules_load = "indirect.ko\nseq_user.ko\nseq_ok.ko\nfine.ko\n";
+
+    TemporaryDir dir;
+    WriteModuleConfig(dir, modules_dep, modules_options, modules_load);
+    ParallelTestKernel kernel({"broken.ko"}, {"seq_user.ko", "seq_ok.ko"});
+    Modprobe m({dir.path}, "modules.load", true, &kernel);
+    EXPECT_FALSE(m.LoadModulesParallel(3));
+
+    // Only broken.ko itself reached the kernel; its dependents were never tried.
+    auto loaded = kernel.loaded();
+    std::sort(loaded.begin(), loaded.end());
+    EXPECT_EQ(loaded, (std::vector<std::string>{"fine.ko", "seq_ok.ko"}));
+    EXPECT_EQ(kernel.attempts(), 3u);
+}
+
+TEST(libmodprobe, LoadModulesParallelHonoursSoftdeps) {
+    TemporaryDir dir;
+    WriteTestFixture(dir);
+    ParallelTestKernel kernel({}, {});
+    Modprobe m({dir.path}, "modules.load", false, &kernel);
+    EXPECT_TRUE(m.LoadModulesParallel(4));
+
+    // Softdeps load as in libmodprobe.Test, through aliases too; test16 is not in modules.dep.
+    auto loaded = kernel.loaded();
+    std::vector<std::string> sorted = loaded;
+    std::sort(sorted.begin(), sorted.end());
+    EXPECT_EQ(sorted, (std::vector<std::string>{"test1.ko", "test10.ko", "test11.ko", "test12.ko",
+                                                "test13.ko", "test14.ko", "test15.ko", "test2.ko",
+                                                "test3.ko", "test4.ko", "test5.ko", "test6.ko",
+                                                "test7.ko", "test8.ko", "test9.ko"}));
+    EXPECT_LT(Position(loaded, "test8.ko"), Position(loaded, "test7.ko"));
+    EXPECT_LT(Position(loaded, "test9.ko"), Position(loaded, "test10.ko"));
+    EXPECT_LT(Position(loaded, "test12.ko"), Position(loaded, "test11.ko"));
+    EXPECT_LT(Position(loaded, "test11.ko"), Position(loaded, "test13.ko"));
+    EXPECT_LT(Position(loaded, "test14.ko"), Position(loaded, "test3.ko"));
+    EXPECT_LT(Position(loaded, "test15.ko"), Position(loaded, "test3.ko"));
+    EXPECT_LT(Position(loaded, "test3.ko"), Position(loaded, "test4.ko"));
+}
+
+TEST(libmodprobe, LoadModulesParallelIgnoresFailedSoftdeps) {
+    TemporaryDir dir;
+    WriteTestFixture(dir);
+    ParallelTestKernel kernel({"test8.ko", "test10.ko", "test14.ko"}, {});
+    Modprobe m({dir.path}, "modules.load", false, &kernel);
+    EXPECT_TRUE(m.LoadModulesParallel(4));
+
+    // Like LoadWithAliases(softdep, false): the users of failed softdeps still load.
+    auto loaded = kernel.loaded();
+    for (const char* module : {"test7.ko", "test9.ko", "test3.ko", "test4.ko", "test15.ko"}) {
+        EXPECT_NE(Position(loaded, module), loaded.size()) << module;
+    }
+    for (const char* module : {"test8.ko", "test10.ko", "test14.ko"}) {
+        EXPECT_EQ(Position(loaded, module), loaded.size()) << module;
+    }
+}
+
+TEST(libmodprobe, LoadModulesParallelMatchesSequentialForMissingModule) {
+    const std::string modules_dep =
+            "gone.ko:\n"
+            "user.ko: gone.ko\n"
+            "fine.ko:\n";
+    const std::string modules_load = "gone.ko\nuser.ko\nfine.ko\n";
+
+    TemporaryDir dir;
+    WriteModuleConfig(dir, modules_dep, "", modules_load);
+    ParallelTestKernel sequential_kernel({}, {}, {"gone.ko"});
+    Modprobe sequential({dir.path}, "modules.load", true, &sequential_kernel);
+    bool sequential_ok = sequential.LoadListedModules(false);
+
+    ParallelTestKernel parallel_kernel({}, {}, {"gone.ko"});
+    Modprobe parallel({dir.path}, "modules.load", true, &parallel_kernel);
+    EXPECT_EQ(parallel.LoadModulesParallel(3), sequential_ok);
+    EXPECT_FALSE(sequential_ok);
+
+    // The module is reported, its dependent skipped, and the rest still loads.
+    EXPECT_EQ(parallel_kernel.loaded(), sequential_kernel.loaded());
+    EXPECT_EQ(parallel_kernel.loaded(), std::vector<std::string>{"fine.ko"});
+}
+
+TEST(libmodprobe, LoadWithAliasesWhileLoadingInParallel) {
+    // First stage mount pulls drivers in from its own thread while the loader
+    // thread works through modules.load.
+    std::string modules_dep, modules_load;
+    for (int i = 0; i < 40; ++i) {
+        std::string name = "m" + std::to_string(i) + ".ko";
+        modules_dep += name + ":" + (i % 4 ? " m" + std::to_string(i - 1) + ".ko" : "") + "\n";
+        modules_load += name + "\n";
+    }
+    const std::string modules_options = "options m7 load_sequential=1 x=1\n";
+
+    TemporaryDir dir;
+    WriteModuleConfig(dir, modules_dep, modules_options, modules_load);
+    ParallelTestKernel kernel({}, {});
+    Modprobe m({dir.path}, "modules.load", true, &kernel);
+
+    std::thread loader([&] { EXPECT_TRUE(m.LoadModulesParallel(3)); });
+    for (int i : {7, 39, 34, 29, 24, 19, 14, 9}) {
+        EXPECT_TRUE(m.LoadWithAliases("m" + std::to_string(i), true));
+    }
+    loader.join();
+
+    auto loaded = kernel.loaded();
+    std::sort(loaded.begin(), loaded.end());
+    EXPECT_EQ(loaded.size(), 40u);
+    EXPECT_EQ(std::unique(loaded.begin(), loaded.end()), loaded.end());
+    for (int i = 0; i < 40; ++i) EXPECT_TRUE(m.IsModuleLoaded("m" + std::to_string(i))) << i;
+}
@@ -16,9 +16,27 @@
 
 #pragma once
 
+#include <map>
 #include <string>
 #include <vector>
 
+#include <modprobe/modprobe.h>
+
 extern std::string kernel_cmdline;
 extern std::vector<std::string> test_modules;
 extern std::vector<std::string> modules_loaded;
+
+// Loads modules into modules_loaded instead of the kernel. Only paths listed in
+// test_modules exist.
+class TestModprobeKernel : public ModprobeKernel {
+  public:
+    int OpenModule(const std::string& path) override;
+    int FinitModule(int fd, const std::string& options, int flags) override;
+    int InitModule(const std::vector<char>& image, const std::string& options) override;
+    int DeleteModule(const std::string& name, int flags) override;
+    int Stat(const std::string& path, struct stat* st) override;
+    std::string ReadKernelCmdline() override;
+
+  private:
+    std::map<int, std::string> open_modules_;
+};
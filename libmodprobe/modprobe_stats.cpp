@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <modprobe/modprobe.h>
+
+#include "log_new.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace {
+
+std::string JsonEscape(const std::string& str) {
+    std::string out;
+    for (char c : str) {
+        if (c == '"' || c == '\\') out += '\\';
+        if (static_cast<unsigned char>(c) < 0x20) continue;
+        out += c;
+    }
+    return out;
+}
+
+double ToMs(int64_t ns) {
+    return static_cast<double>(ns) / 1e6;
+}
+
+int64_t FinishNs(const ModuleLoadStats& stats) {
+    return stats.start_ns + stats.open_ns + stats.finit_ns;
+}
+
+}  // namespace
+
+int64_t Modprobe::NowNs() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+}
+
+void Modprobe::RecordModuleReady(const std::string& module_name) {
+    std::lock_guard<std::mutex> guard(load_stats_lock_);
+    load_stats_[module_name].ready_ns = NowNs();
+}
+
+void Modprobe::RecordLoadStats(ModuleLoadStats stats) {
+    std::lock_guard<std::mutex> guard(load_stats_lock_);
+    auto& entry = load_stats_[stats.name];
+    if (entry.ready_ns) stats.ready_ns = entry.ready_ns;
+    entry = std::move(stats);
+}
+
+std::vector<ModuleLoadStats> Modprobe::GetLoadStats() {
+    std::vector<ModuleLoadStats> stats;
+    {
+        std::lock_guard<std::mutex> guard(load_stats_lock_);
+        for (const auto& [name, entry] : load_stats_) {
+            if (entry.start_ns) stats.emplace_back(entry);
+        }
+    }
+    std::sort(stats.begin(), stats.end(),
+              [](const auto& a, const auto& b) { return a.start_ns < b.start_ns; });
+    return stats;
+}
+
+// Writes a JSON report of every finit_module() this instance issued plus the
+// critical path: starting from the module that finished last, repeatedly step
+// to the hard dependency that finished last, i.e. the one that gated it. Only
+// dependencies that finished strictly earlier count, which also ends the walk
+// on a dependency cycle or on modules.dep entries loaded out of order.
+bool Modprobe::WriteLoadReport(const std::string& path) {
+    auto stats = GetLoadStats();
+    if (stats.empty()) return true;
+
+    int64_t origin = load_start_ns_ ? load_start_ns_ : stats.front().start_ns;
+    std::unordered_map<std::string, const ModuleLoadStats*> by_name;
+    for (const auto& entry : stats) by_name[entry.name] = &entry;
+
+    std::vector<const ModuleLoadStats*> critical_path;
+    const ModuleLoadStats* current = &*std::max_element(
+            stats.begin(), stats.end(),
+            [](const auto& a, const auto& b) { return FinishNs(a) < FinishNs(b); });
+    while (current) {
+        critical_path.emplace_back(current);
+        const ModuleLoadStats* gate = nullptr;
+        ModuleId id = LookupModule(current->name);
+        if (id != kInvalidModuleId) {
+            for (ModuleId dep : module_dep_ids_[id]) {
+                auto it = by_name.find(names_.Name(dep));
+                if (it == by_name.end() || FinishNs(*it->second) >= FinishNs(*current)) continue;
+                if (!gate || FinishNs(*it->second) > FinishNs(*gate)) gate = it->second;
+            }
+        }
+        current = gate;
+    }
+    std::reverse(critical_path.begin(), critical_path.end());
+
+    std::string json = "{\n  \"modules\": [\n";
+    char buf[512];
+    for (size_t i = 0; i < stats.size(); ++i) {
+        const auto& entry = stats[i];
+        int64_t ready = entry.ready_ns ? entry.ready_ns : entry.start_ns;
+        snprintf(buf, sizeof(buf),
+                 "    {\"name\": \"%s\", \"start_ms\": %.3f, \"ready_ms\": %.3f, "
+                 "\"queue_ms\": %.3f, \"open_ms\": %.3f, \"finit_ms\": %.3f, \"tid\": %d, "
+                 "\"ok\": %s}%s\n",
+                 JsonEscape(entry.name).c_str(), ToMs(entry.start_ns - origin),
+                 ToMs(ready - origin), ToMs(entry.start_ns - ready), ToMs(entry.open_ns),
+                 ToMs(entry.finit_ns), static_cast<int>(entry.tid), entry.ok ? "true" : "false",
+                 i + 1 < stats.size() ? "," : "");
+        json += buf;
+    }
+
+    int64_t critical_ns = 0;
+    json += "  ],\n  \"critical_path\": [";
+    for (size_t i = 0; i < critical_path.size(); ++i) {
+        critical_ns += critical_path[i]->open_ns + critical_path[i]->finit_ns;
+        json += (i ? ", \"" : "\"") + JsonEscape(critical_path[i]->name) + "\"";
+    }
+    snprintf(buf, sizeof(buf),
+             "],\n  \"critical_path_ms\": %.3f,\n  \"total_ms\": %.3f\n}\n", ToMs(critical_ns),
+             ToMs(FinishNs(*critical_path.back()) - origin));
+    json += buf;
+
+    LOGI("Module load critical path: %zu modules, %.1f ms of %.1f ms total (ends at %s)",
+         critical_path.size(), ToMs(critical_ns), ToMs(FinishNs(*critical_path.back()) - origin),
+         critical_path.back()->name.c_str());
+
+    int fd = TEMP_FAILURE_RETRY(
+            open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_NOFOLLOW, 0644));
+    if (fd < 0) {
+        LOGE("Could not open module load report %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    bool ok = true;
+    for (size_t off = 0; off < json.size();) {
+        ssize_t n = TEMP_FAILURE_RETRY(write(fd, json.data() + off, json.size() - off));
+        if (n <= 0) {
+            ok = false;
+            break;
+        }
+        off += static_cast<size_t>(n);
+    }
+    close(fd);
+    if (!ok) LOGE("Failed to write module load report %s", path.c_str());
+    return ok;
+}
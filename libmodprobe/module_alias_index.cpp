@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <modprobe/module_alias_index.h>
+
+#include <fnmatch.h>
+
+#include <algorithm>
+
+std::string_view ModuleAliasIndex::BusOf(std::string_view alias) {
+    auto colon = alias.find(':');
+    return colon == std::string_view::npos ? std::string_view() : alias.substr(0, colon);
+}
+
+void ModuleAliasIndex::Add(const std::string& pattern, std::string canonical_module) {
+    size_t id = entries_.size();
+    entries_.push_back({pattern, std::move(canonical_module)});
+
+    size_t literal_len = pattern.find_first_of("*?[\\");
+    if (literal_len == std::string::npos) {
+        exact_[pattern].emplace_back(id);
+        return;
+    }
+
+    std::string prefix = pattern.substr(0, literal_len);
+    std::string_view bus = BusOf(prefix);
+    PrefixBuckets* buckets;
+    if (bus.empty()) {
+        buckets = &wildcard_any_bus_;
+    } else {
+        auto it = wildcard_by_bus_.find(bus);
+        if (it == wildcard_by_bus_.end()) {
+            it = wildcard_by_bus_.emplace(std::string(bus), PrefixBuckets()).first;
+        }
+        buckets = &it->second;
+    }
+    buckets->prefix_lengths.emplace(prefix.size());
+    buckets->by_prefix[prefix].emplace_back(id);
+}
+
+void ModuleAliasIndex::FindInBuckets(const PrefixBuckets& buckets, const std::string& alias,
+                                     std::vector<size_t>* matches) const {
+    std::string key;
+    for (size_t len : buckets.prefix_lengths) {
+        if (len > alias.size()) break;
+        key.assign(alias, 0, len);
+        auto it = buckets.by_prefix.find(key);
+        if (it == buckets.by_prefix.end()) continue;
+        for (size_t id : it->second) {
+            if (fnmatch(entries_[id].pattern.c_str(), alias.c_str(), 0) == 0) {
+                matches->emplace_back(id);
+            }
+        }
+    }
+}
+
+std::vector<std::string> ModuleAliasIndex::Find(const std::string& alias) const {
+    std::vector<size_t> matches;
+
+    auto exact = exact_.find(alias);
+    if (exact != exact_.end()) {
+        matches = exact->second;
+    }
+
+    std::string_view bus = BusOf(alias);
+    if (!bus.empty()) {
+        auto it = wildcard_by_bus_.find(bus);
+        if (it != wildcard_by_bus_.end()) FindInBuckets(it->second, alias, &matches);
+    }
+    FindInBuckets(wildcard_any_bus_, alias, &matches);
+
+    // Restore modules.alias order, which callers rely on for load ordering.
+    std::sort(matches.begin(), matches.end());
+
+    std::vector<std::string> modules;
+    for (size_t id : matches) {
+        const auto& module = entries_[id].module;
+        if (std::find(modules.begin(), modules.end(), module) == modules.end()) {
+            modules.emplace_back(module);
+        }
+    }
+    return modules;
+}
@@ -0,0 +1,233 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fnmatch.h>
+
+#include <algorithm>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <gtest/gtest.h>
+
+#include <modprobe/module_alias_index.h>
+
+namespace {
+
+// An excerpt of a modules.alias from an x86_64 distribution kernel.
+const char kModulesAlias[] =
+        "# Aliases extracted from modules themselves.\n"
+        "alias pci:v00008086d000010D3sv*sd*bc*sc*i* e1000e\n"
+        "alias pci:v00008086d00001502sv*sd*bc*sc*i* e1000e\n"
+        "alias pci:v00008086d000015B8sv*sd*bc*sc*i* e1000e\n"
+        "alias pci:v*d*sv*sd*bc0Csc03i30* xhci_pci\n"
+        "alias pci:v*d*sv*sd*bc0Csc03i20* ehci_pci\n"
+        "alias pci:v00008086d*sv*sd*bc04sc03i00* snd_hda_intel\n"
+        "alias pci:v00001002d*sv*sd*bc04sc03i00* snd_hda_intel\n"
+        "alias pci:v00008086d0000A0C8sv*sd*bc*sc*i* snd_hda_intel\n"
+        "alias pci:v000010ECd00008168sv*sd*bc*sc*i* r8169\n"
+        "alias pci:v00001AF4d00001000sv*sd*bc*sc*i* virtio_pci\n"
+        "alias pci:v00001AF4d*sv*sd*bc*sc*i* virtio_pci\n"
+        "alias usb:v*p*d*dc*dsc*dp*ic08isc06ip50in* usb_storage\n"
+        "alias usb:v0BDAp8153d*dc*dsc*dp*ic*isc*ip*in* r8152\n"
+        "alias usb:v*p*d*dc*dsc*dp*ic03isc*ip*in* usbhid\n"
+        "alias usb:v046DpC52Bd*dc*dsc*dp*ic*isc*ip*in* usbhid\n"
+        "alias hid:b0003g*v0000046Dp0000C52B hid_logitech_dj\n"
+        "alias hid:b0003g*v*p* hid_generic\n"
+        "alias input:b*v*p*e*-e*1,*2,*k*r*0,*1,*a*m*l*s*f*w* joydev\n"
+        "alias acpi*:PNP0C0A:* battery\n"
+        "alias acpi*:ACPI0003:* ac\n"
+        "alias dmi*:svnLENOVO:*pvrThinkPad* thinkpad_acpi\n"
+        "alias of:N*T*Cnvidia,tegra210-i2cC* i2c_tegra\n"
+        "alias of:N*T*Cnvidia,tegra210-i2c i2c_tegra\n"
+        "alias virtio:d00000001v* virtio_net\n"
+        "alias virtio:d00000002v* virtio_blk\n"
+        "alias scsi:t-0x00* sd_mod\n"
+        "alias scsi:t-0x05* sr_mod\n"
+        "alias cpu:type:x86,ven*fam*mod*:feature:*0099* aesni_intel\n"
+        "alias platform:serial8250 8250\n"
+        "alias devname:fuse fuse\n"
+        "alias char-major-10-229 fuse\n"
+        "alias block-major-7-* loop\n"
+        "alias fs-ext4 ext4\n"
+        "alias fs-ext3 ext4\n"
+        "alias crypto-sha256 sha256_generic\n"
+        "alias crypto-sha256-generic sha256_generic\n";
+
+// Modaliases as uevents report them.
+const char* const kModaliases[] = {
+        "pci:v00008086d000010D3sv00001028sd0000040Bbc02sc00i00",
+        "pci:v00008086d000015B8sv000017AAsd00002279bc02sc00i00",
+        "pci:v00008086d0000A0C8sv000017AAsd000022D8bc04sc03i00",
+        "pci:v00001002d0000AB38sv00001002sd0000AB38bc04sc03i00",
+        "pci:v00001B21d00001142sv00001B21sd00001142bc0Csc03i30",
+        "pci:v00008086d00001E26sv0000103Csd00001791bc0Csc03i20",
+        "pci:v000010ECd00008168sv00001043sd000085F2bc02sc00i00",
+        "pci:v00001AF4d00001000sv00001AF4sd00000001bc02sc00i00",
+        "pci:v00001AF4d00001001sv00001AF4sd00000002bc01sc00i00",
+        "pci:v000010DEd00001C82sv00001043sd00008613bc03sc00i00",
+        "usb:v0781p5581d0100dc00dsc00dp00ic08isc06ip50in00",
+        "usb:v0BDAp8153d3000dc00dsc00dp00icFFisc00ip00in00",
+        "usb:v046DpC52Bd1211dc00dsc00dp00ic03isc01ip01in00",
+        "usb:v046DpC52Bd1211dc00dsc00dp00icFFisc00ip00in02",
+        "hid:b0003g0001v0000046Dp0000C52B",
+        "hid:b0003g0001v0000045Ep000007A5",
+        "input:b0003v045Ep028Ee0110-e0,1,3,15,k130,131,132,r0,1,a0,1,2,m4,lsfw",
+        "acpi:PNP0C0A:",
+        "acpi:ACPI0003:",
+        "acpi:LNXPWRBN:",
+        "dmi:bvnLENOVO:bvrN2HET50W:svnLENOVO:pn20QDCTO1WW:pvrThinkPadX1Carbon7th:",
+        "of:Ni2cT(null)Cnvidia,tegra210-i2cCnvidia,tegra114-i2c",
+        "of:Ni2cT(null)Cnvidia,tegra210-i2c",
+        "virtio:d00000001v00001AF4",
+        "virtio:d00000003v00001AF4",
+        "scsi:t-0x00",
+        "scsi:t-0x05",
+        "scsi:t-0x0d",
+        "cpu:type:x86,ven0000fam0006mod008E:feature:,0000,0001,0099,00E3",
+        "platform:serial8250",
+        "platform:serial8251",
+        "devname:fuse",
+        "char-major-10-229",
+        "block-major-7-0",
+        "block-major-8-0",
+        "fs-ext4",
+        "fs-ext",
+        "crypto-sha256",
+        "",
+};
+
+std::vector<std::pair<std::string, std::string>> ParseAliases(const std::string& text) {
+    std::vector<std::pair<std::string, std::string>> aliases;
+    std::istringstream lines(text);
+    for (std::string line; std::getline(lines, line);) {
+        std::istringstream fields(line);
+        std::string keyword, pattern, module;
+        if (fields >> keyword >> pattern >> module && keyword == "alias") {
+            aliases.emplace_back(pattern, module);
+        }
+    }
+    return aliases;
+}
+
+ModuleAliasIndex BuildIndex(const std::vector<std::pair<std::string, std::string>>& aliases) {
+    ModuleAliasIndex index;
+    for (const auto& [pattern, module] : aliases) index.Add(pattern, module);
+    return index;
+}
+
+// What a linear fnmatch() scan over modules.alias finds, in line order without duplicates.
+std::vector<std::string> ScanAliases(
+        const std::vector<std::pair<std::string, std::string>>& aliases, const std::string& alias) {
+    std::vector<std::string> modules;
+    for (const auto& [pattern, module] : aliases) {
+        if (fnmatch(pattern.c_str(), alias.c_str(), 0) == 0 &&
+            std::find(modules.begin(), modules.end(), module) == modules.end()) {
+            modules.emplace_back(module);
+        }
+    }
+    return modules;
+}
+
+using Modules = std::vector<std::string>;
+
+}  // namespace
+
+TEST(module_alias_index, ExactHits) {
+    ModuleAliasIndex index;
+    index.Add("test141516", "test14");
+    index.Add("test141516", "test15");
+    index.Add("fs-ext4", "ext4");
+    index.Add("fs-ext3", "ext4");
+    index.Add("test141516", "test14");
+
+    EXPECT_EQ(index.size(), 5u);
+    EXPECT_EQ(index.Find("test141516"), (Modules{"test14", "test15"}));
+    EXPECT_EQ(index.Find("fs-ext4"), (Modules{"ext4"}));
+    EXPECT_EQ(index.Find("fs-ext3"), (Modules{"ext4"}));
+    EXPECT_TRUE(index.Find("fs-ext").empty());
+    EXPECT_TRUE(index.Find("fs-ext44").empty());
+    EXPECT_TRUE(index.Find("test14").empty());
+    EXPECT_TRUE(index.Find("").empty());
+}
+
+TEST(module_alias_index, BusPrefixBuckets) {
+    ModuleAliasIndex index;
+    index.Add("pci:v00008086d000010D3sv*sd*bc*sc*i*", "e1000e");
+    index.Add("pci:v00008086d*sv*sd*bc04sc03i00*", "snd_hda_intel");
+    index.Add("pci:v*d*sv*sd*bc0Csc03i30*", "xhci_pci");
+    index.Add("usb:v*p*d*dc*dsc*dp*ic08isc06ip50in*", "usb_storage");
+    index.Add("pci:v00008086d0000A0C8sv*sd*bc*sc*i*", "snd_hda_intel");
+    index.Add("pcie:*", "pcie_only");
+
+    // Patterns of different literal prefix lengths on one bus.
+    EXPECT_EQ(index.Find("pci:v00008086d000010D3sv00001028sd0000040Bbc02sc00i00"),
+              (Modules{"e1000e"}));
+    EXPECT_EQ(index.Find("pci:v00008086d0000A0C8sv000017AAsd000022D8bc04sc03i00"),
+              (Modules{"snd_hda_intel"}));
+    EXPECT_EQ(index.Find("pci:v00008086d00001E31sv0000103Csd00001791bc0Csc03i30"),
+              (Modules{"xhci_pci"}));
+    EXPECT_TRUE(index.Find("pci:v000010DEd00001C82sv00001043sd00008613bc03sc00i00").empty());
+
+    // Buckets are per bus: "pci:v*" patterns never see usb or pcie aliases.
+    EXPECT_EQ(index.Find("usb:v0781p5581d0100dc00dsc00dp00ic08isc06ip50in00"),
+              (Modules{"usb_storage"}));
+    EXPECT_EQ(index.Find("pcie:v00008086"), (Modules{"pcie_only"}));
+    EXPECT_TRUE(index.Find("pci").empty());
+    EXPECT_TRUE(index.Find("pci:").empty());
+    EXPECT_TRUE(index.Find("usb:v0781p5581d0100dc00dsc00dp00ic03isc01ip01in00").empty());
+}
+
+TEST(module_alias_index, WildcardOnlyPatterns) {
+    ModuleAliasIndex index;
+    index.Add("acpi*:PNP0C0A:*", "battery");
+    index.Add("*", "everything");
+    index.Add("?ci:v*", "any_bus_letter");
+    index.Add("[pu][cs][ib]:*", "bracket");
+    index.Add("dmi*:svnLENOVO:*", "thinkpad_acpi");
+    index.Add("block-major-7-*", "loop");
+
+    EXPECT_EQ(index.Find("acpi:PNP0C0A:"), (Modules{"battery", "everything"}));
+    EXPECT_EQ(index.Find("acpipnp:PNP0C0A:"), (Modules{"battery", "everything"}));
+    EXPECT_EQ(index.Find("pci:v00008086"), (Modules{"everything", "any_bus_letter", "bracket"}));
+    EXPECT_EQ(index.Find("usb:v0781"), (Modules{"everything", "bracket"}));
+    EXPECT_EQ(index.Find("dmi:bvnLENOVO:svnLENOVO:pn20QD:"),
+              (Modules{"everything", "thinkpad_acpi"}));
+    EXPECT_EQ(index.Find("block-major-7-3"), (Modules{"everything", "loop"}));
+    EXPECT_EQ(index.Find(""), (Modules{"everything"}));
+}
+
+TEST(module_alias_index, AgreesWithFnmatchOnModulesAlias) {
+    auto aliases = ParseAliases(kModulesAlias);
+    ASSERT_FALSE(aliases.empty());
+    ModuleAliasIndex index = BuildIndex(aliases);
+    EXPECT_EQ(index.size(), aliases.size());
+
+    size_t hits = 0;
+    for (const char* alias : kModaliases) {
+        Modules expected = ScanAliases(aliases, alias);
+        EXPECT_EQ(index.Find(alias), expected) << alias;
+        hits += !expected.empty();
+    }
+    // The sample must exercise matches, not only misses.
+    EXPECT_GT(hits, std::size(kModaliases) / 2);
+
+    // Patterns fed back as aliases, so that literal "*" and "?" are matched too.
+    for (const auto& [pattern, module] : aliases) {
+        EXPECT_EQ(index.Find(pattern), ScanAliases(aliases, pattern)) << pattern;
+    }
+}
@@ -0,0 +1,319 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <modprobe/module_config_cache.h>
+#include "log_new.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstring>
+
+namespace {
+
+constexpr char kMagic[8] = {'M', 'O', 'D', 'P', 'R', 'B', 'C', '\0'};
+constexpr uint32_t kVersion = 2;
+
+template <typename T>
+void Append(std::string* out, T value) {
+    out->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void AppendString(std::string* out, const std::string& str) {
+    Append<uint32_t>(out, static_cast<uint32_t>(str.size()));
+    out->append(str);
+}
+
+void AppendPairs(std::string* out, const std::vector<std::pair<std::string, std::string>>& pairs) {
+    Append<uint32_t>(out, static_cast<uint32_t>(pairs.size()));
+    for (const auto& [first, second] : pairs) {
+        AppendString(out, first);
+        AppendString(out, second);
+    }
+}
+
+// Word-at-a-time multiplicative hash; only guards against torn or corrupted files.
+uint64_t PayloadHash(const char* data, size_t size) {
+    uint64_t hash = 0x9e3779b97f4a7c15ULL ^ size;
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        hash = (hash ^ word) * 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 32;
+    }
+    for (; i < size; ++i) {
+        hash = (hash ^ static_cast<unsigned char>(data[i])) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+// Bounds-checked reader over the mapped cache.
+class Cursor {
+  public:
+    Cursor(const char* data, size_t size) : data_(data), end_(data + size) {}
+
+    template <typename T>
+    bool Read(T* value) {
+        if (remaining() < sizeof(T)) return false;
+        memcpy(value, data_, sizeof(T));
+        data_ += sizeof(T);
+        return true;
+    }
+
+    bool ReadString(std::string* str) {
+        uint32_t len;
+        if (!Read(&len) || remaining() < len) return false;
+        str->assign(data_, len);
+        data_ += len;
+        return true;
+    }
+
+    /**
+     * Reads an element count, rejecting any that could not fit in the bytes
+     * left given each element's smallest encoding, so a corrupt count never
+     * reaches resize().
+     */
+    bool ReadCount(size_t min_element_size, uint32_t* count) {
+        return Read(count) && *count <= remaining() / min_element_size;
+    }
+
+    bool ReadPairs(std::vector<std::pair<std::string, std::string>>* pairs) {
+        uint32_t count;
+        if (!ReadCount(2 * sizeof(uint32_t), &count)) return false;
+        pairs->resize(count);
+        for (auto& [first, second] : *pairs) {
+            if (!ReadString(&first) || !ReadString(&second)) return false;
+        }
+        return true;
+    }
+
+    size_t remaining() const { return static_cast<size_t>(end_ - data_); }
+    bool at_end() const { return data_ == end_; }
+
+  private:
+    const char* data_;
+    const char* end_;
+};
+
+bool ReadPayload(Cursor* cursor, ModuleConfig* config) {
+    uint32_t name_count;
+    if (!cursor->ReadCount(sizeof(uint32_t), &name_count)) return false;
+    std::string name;
+    for (uint32_t id = 0; id < name_count; ++id) {
+        if (!cursor->ReadString(&name) || name.empty() ||
+            name.size() > ModuleNameTable::kMaxNameLen || config->names.Intern(name) != id) {
+            return false;
+        }
+    }
+
+    // Each module takes at least its listed byte, path length and dependency count.
+    if (cursor->remaining() / (1 + 2 * sizeof(uint32_t)) < name_count) return false;
+    config->paths.resize(name_count);
+    config->listed.resize(name_count);
+    config->deps.resize(name_count);
+    for (uint32_t id = 0; id < name_count; ++id) {
+        uint32_t dep_count;
+        if (!cursor->Read(&config->listed[id]) || !cursor->ReadString(&config->paths[id]) ||
+            !cursor->ReadCount(sizeof(ModuleId), &dep_count)) {
+            return false;
+        }
+        auto& deps = config->deps[id];
+        deps.resize(dep_count);
+        for (auto& dep : deps) {
+            if (!cursor->Read(&dep) || dep >= name_count) return false;
+        }
+    }
+
+    if (!cursor->ReadPairs(&config->aliases) || !cursor->ReadPairs(&config->pre_softdeps) ||
+        !cursor->ReadPairs(&config->post_softdeps)) {
+        return false;
+    }
+
+    uint32_t count;
+    if (!cursor->ReadCount(2 * sizeof(uint32_t), &count)) return false;
+    config->options.resize(count);
+    for (auto& [id, options] : config->options) {
+        if (!cursor->Read(&id) || id >= name_count || !cursor->ReadString(&options)) return false;
+    }
+
+    if (!cursor->ReadCount(sizeof(uint32_t), &count)) return false;
+    config->dyn_options.resize(count);
+    for (auto& line : config->dyn_options) {
+        uint32_t token_count;
+        if (!cursor->ReadCount(sizeof(uint32_t), &token_count)) return false;
+        line.resize(token_count);
+        for (auto& token : line) {
+            if (!cursor->ReadString(&token)) return false;
+        }
+    }
+
+    if (!cursor->ReadCount(sizeof(ModuleId), &count)) return false;
+    config->blocklist.resize(count);
+    for (auto& id : config->blocklist) {
+        if (!cursor->Read(&id) || id >= name_count) return false;
+    }
+    return cursor->at_end();
+}
+
+}  // namespace
+
+ModuleId ModuleConfig::Intern(std::string_view name_or_path) {
+    char buf[ModuleNameTable::kMaxNameLen];
+    auto canonical_name = ModuleNameTable::Canonicalize(name_or_path, buf);
+    if (canonical_name.empty()) return kInvalidModuleId;
+
+    ModuleId id = names.Intern(canonical_name);
+    if (id >= paths.size()) {
+        paths.resize(names.size());
+        listed.resize(names.size());
+        deps.resize(names.size());
+    }
+    return id;
+}
+
+ModuleConfigCache::ModuleConfigCache(const std::string& base_path,
+                                     std::vector<std::string> sources)
+    : base_path_(base_path),
+      cache_path_(base_path + "/" + kFileName),
+      sources_(std::move(sources)) {}
+
+std::string ModuleConfigCache::SourceStamp() const {
+    std::string stamp(kMagic, sizeof(kMagic));
+    Append<uint32_t>(&stamp, kVersion);
+    Append<uint32_t>(&stamp, static_cast<uint32_t>(sources_.size()));
+    for (const auto& source : sources_) {
+        struct stat sb{};
+        bool exists = stat((base_path_ + "/" + source).c_str(), &sb) == 0;
+        AppendString(&stamp, source);
+        Append<int64_t>(&stamp, exists ? static_cast<int64_t>(sb.st_size) : -1);
+        Append<int64_t>(&stamp, exists ? static_cast<int64_t>(sb.st_mtim.tv_sec) : 0);
+        Append<int64_t>(&stamp, exists ? static_cast<int64_t>(sb.st_mtim.tv_nsec) : 0);
+    }
+    return stamp;
+}
+
+bool ModuleConfigCache::Read(ModuleConfig* config) const {
+    int fd = TEMP_FAILURE_RETRY(open(cache_path_.c_str(), O_RDONLY | O_CLOEXEC));
+    if (fd < 0) return false;
+
+    struct stat sb{};
+    if (fstat(fd, &sb) != 0 || sb.st_size <= 0) {
+        close(fd);
+        return false;
+    }
+    size_t size = static_cast<size_t>(sb.st_size);
+    void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        LOGE("Could not map %s: %s", cache_path_.c_str(), strerror(errno));
+        return false;
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
+
+    const char* data = static_cast<const char*>(map);
+    std::string stamp = SourceStamp();
+    bool ok = size >= stamp.size() && memcmp(data, stamp.data(), stamp.size()) == 0;
+    if (!ok) {
+        LOGV("%s is stale, reparsing module configuration", cache_path_.c_str());
+    }
+
+    ModuleConfig result;
+    if (ok) {
+        Cursor header(data + stamp.size(), size - stamp.size());
+        uint64_t payload_size = 0, payload_hash = 0;
+        ok = header.Read(&payload_size) && header.Read(&payload_hash) &&
+             payload_size == header.remaining();
+        const char* payload = data + (size - header.remaining());
+        ok = ok && PayloadHash(payload, payload_size) == payload_hash;
+        if (ok) {
+            Cursor cursor(payload, payload_size);
+            ok = ReadPayload(&cursor, &result);
+        }
+        if (!ok) {
+            LOGW("%s is corrupt, reparsing module configuration", cache_path_.c_str());
+        }
+    }
+
+    munmap(map, size);
+    if (!ok) return false;
+
+    *config = std::move(result);
+    return true;
+}
+
+bool ModuleConfigCache::Write(const ModuleConfig& config) const {
+    std::string payload;
+    Append<uint32_t>(&payload, static_cast<uint32_t>(config.names.size()));
+    for (ModuleId id = 0; id < config.names.size(); ++id) {
+        AppendString(&payload, config.names.Name(id));
+    }
+    for (ModuleId id = 0; id < config.names.size(); ++id) {
+        Append<uint8_t>(&payload, config.listed[id]);
+        AppendString(&payload, config.paths[id]);
+        Append<uint32_t>(&payload, static_cast<uint32_t>(config.deps[id].size()));
+        for (ModuleId dep : config.deps[id]) Append<ModuleId>(&payload, dep);
+    }
+    AppendPairs(&payload, config.aliases);
+    AppendPairs(&payload, config.pre_softdeps);
+    AppendPairs(&payload, config.post_softdeps);
+    Append<uint32_t>(&payload, static_cast<uint32_t>(config.options.size()));
+    for (const auto& [id, options] : config.options) {
+        Append<ModuleId>(&payload, id);
+        AppendString(&payload, options);
+    }
+    Append<uint32_t>(&payload, static_cast<uint32_t>(config.dyn_options.size()));
+    for (const auto& line : config.dyn_options) {
+        Append<uint32_t>(&payload, static_cast<uint32_t>(line.size()));
+        for (const auto& token : line) AppendString(&payload, token);
+    }
+    Append<uint32_t>(&payload, static_cast<uint32_t>(config.blocklist.size()));
+    for (ModuleId id : config.blocklist) Append<ModuleId>(&payload, id);
+
+    std::string buffer = SourceStamp();
+    Append<uint64_t>(&buffer, payload.size());
+    Append<uint64_t>(&buffer, PayloadHash(payload.data(), payload.size()));
+    buffer += payload;
+
+    std::string tmp_path = cache_path_ + ".tmp";
+    int fd = TEMP_FAILURE_RETRY(
+            open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+    if (fd < 0) {
+        LOGV("Not caching module configuration in %s: %s", base_path_.c_str(), strerror(errno));
+        return false;
+    }
+
+    bool ok = true;
+    for (size_t off = 0; off < buffer.size();) {
+        ssize_t n = TEMP_FAILURE_RETRY(write(fd, buffer.data() + off, buffer.size() - off));
+        if (n <= 0) {
+            ok = false;
+            break;
+        }
+        off += static_cast<size_t>(n);
+    }
+    close(fd);
+
+    if (!ok || rename(tmp_path.c_str(), cache_path_.c_str()) != 0) {
+        LOGE("Failed to write %s: %s", cache_path_.c_str(), strerror(errno));
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
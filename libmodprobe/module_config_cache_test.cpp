@@ -0,0 +1,244 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include <android-base/file.h>
+#include <gtest/gtest.h>
+
+#include <modprobe/module_config_cache.h>
+#include <modprobe/modprobe.h>
+
+#include "libmodprobe_test.h"
+
+namespace {
+
+const std::vector<std::string> kSources = {"modules.alias", "modules.dep", "modules.softdep",
+                                           "modules.options", "modules.blocklist"};
+
+const char kModulesDep[] =
+        "kernel/fs/ext4.ko: kernel/lib/crc16.ko kernel/fs/mbcache.ko kernel/fs/jbd2/jbd2.ko\n"
+        "kernel/fs/mbcache.ko:\n"
+        "kernel/fs/jbd2/jbd2.ko:\n"
+        "kernel/drivers/block/virtio_blk.ko: kernel/drivers/virtio/virtio-ring.ko\n"
+        "kernel/drivers/virtio/virtio-ring.ko:\n"
+        "kernel/sound/snd-hda-intel.ko.zst: kernel/sound/snd.ko\n"
+        "kernel/sound/snd.ko:\n";
+
+const char kModulesAlias[] =
+        "alias fs-ext4 ext4\n"
+        "alias virtio:d00000002v* virtio_blk\n"
+        "alias pci:v00008086d*sv*sd*bc04sc03i00* snd-hda-intel\n";
+
+const char kModulesSoftdep[] = "softdep ext4 pre: crc32c\n";
+
+const char kModulesOptions[] =
+        "options snd_hda_intel power_save=1 model=auto\n"
+        "options ext4 debug=0\n";
+
+const char kModulesBlocklist[] = "blocklist snd\n";
+
+void WriteFile(const std::string& path, const std::string& content) {
+    ASSERT_TRUE(android::base::WriteStringToFile(content, path, 0600, getuid(), getgid()));
+}
+
+void WriteModuleDir(const std::string& dir) {
+    WriteFile(dir + "/modules.dep", kModulesDep);
+    WriteFile(dir + "/modules.alias", kModulesAlias);
+    WriteFile(dir + "/modules.softdep", kModulesSoftdep);
+    WriteFile(dir + "/modules.options", kModulesOptions);
+    WriteFile(dir + "/modules.blocklist", kModulesBlocklist);
+}
+
+ModuleConfig MakeConfig() {
+    ModuleConfig config;
+    ModuleId ext4 = config.Intern("/lib/modules/ext4.ko");
+    ModuleId jbd2 = config.Intern("jbd2");
+    ModuleId crc16 = config.Intern("crc16.ko.xz");
+    config.paths[ext4] = "/lib/modules/ext4.ko";
+    config.paths[jbd2] = "/lib/modules/jbd2.ko";
+    config.paths[crc16] = "/lib/modules/crc16.ko.xz";
+    config.listed[ext4] = 1;
+    config.listed[jbd2] = 1;
+    config.deps[ext4] = {crc16, jbd2};
+    config.aliases = {{"fs-ext4", "ext4"}, {"fs-ext3", "ext4"}};
+    config.pre_softdeps = {{"ext4", "crc32c"}};
+    config.post_softdeps = {{"jbd2", "crc16"}};
+    config.options = {{ext4, "debug=0"}};
+    config.dyn_options = {{"ext4", "root", "/bin/echo", "\"debug=1\""}};
+    config.blocklist = {crc16};
+    return config;
+}
+
+void ExpectEqual(const ModuleConfig& a, const ModuleConfig& b) {
+    ASSERT_EQ(a.names.size(), b.names.size());
+    for (ModuleId id = 0; id < a.names.size(); ++id) {
+        EXPECT_EQ(a.names.Name(id), b.names.Name(id));
+    }
+    EXPECT_EQ(a.paths, b.paths);
+    EXPECT_EQ(a.listed, b.listed);
+    EXPECT_EQ(a.deps, b.deps);
+    EXPECT_EQ(a.aliases, b.aliases);
+    EXPECT_EQ(a.pre_softdeps, b.pre_softdeps);
+    EXPECT_EQ(a.post_softdeps, b.post_softdeps);
+    EXPECT_EQ(a.options, b.options);
+    EXPECT_EQ(a.dyn_options, b.dyn_options);
+    EXPECT_EQ(a.blocklist, b.blocklist);
+}
+
+std::string CachePath(const TemporaryDir& dir) {
+    return std::string(dir.path) + "/" + ModuleConfigCache::kFileName;
+}
+
+}  // namespace
+
+TEST(module_config_cache, RoundTrip) {
+    TemporaryDir dir;
+    WriteModuleDir(dir.path);
+    ModuleConfigCache cache(dir.path, kSources);
+    ModuleConfig config = MakeConfig();
+
+    ASSERT_TRUE(cache.Write(config));
+    ModuleConfig read;
+    ASSERT_TRUE(cache.Read(&read));
+    ExpectEqual(config, read);
+    EXPECT_EQ(read.names.Find("crc16"), config.names.Find("crc16"));
+
+    // An empty configuration is still a valid cache.
+    ASSERT_TRUE(cache.Write(ModuleConfig()));
+    ModuleConfig empty;
+    ASSERT_TRUE(cache.Read(&empty));
+    ExpectEqual(ModuleConfig(), empty);
+}
+
+TEST(module_config_cache, ModprobeFromCacheMatchesText) {
+    TemporaryDir dir;
+    std::string dir_path = dir.path;
+    WriteModuleDir(dir_path);
+    WriteFile(dir_path + "/modules.load", "ext4.ko\nvirtio_blk.ko\n");
+    kernel_cmdline = "";
+    test_modules = {};
+    TestModprobeKernel kernel;
+
+    Modprobe from_text({dir_path}, "modules.load", true, &kernel);
+    struct stat st;
+    ASSERT_EQ(stat(CachePath(dir).c_str(), &st), 0);
+    Modprobe from_cache({dir_path}, "modules.load", true, &kernel);
+
+    for (const char* module : {"ext4", "mbcache", "virtio_blk", "snd_hda_intel", "snd", "nope"}) {
+        std::vector<std::string> text_pre, text_deps, text_post;
+        std::vector<std::string> cache_pre, cache_deps, cache_post;
+        EXPECT_EQ(from_text.GetAllDependencies(module, &text_pre, &text_deps, &text_post),
+                  from_cache.GetAllDependencies(module, &cache_pre, &cache_deps, &cache_post));
+        EXPECT_EQ(text_pre, cache_pre) << module;
+        EXPECT_EQ(text_deps, cache_deps) << module;
+        EXPECT_EQ(text_post, cache_post) << module;
+        EXPECT_EQ(from_text.IsBlocklisted(module), from_cache.IsBlocklisted(module)) << module;
+    }
+    EXPECT_EQ(from_cache.GetModulesForAlias("fs-ext4"), std::vector<std::string>{"ext4"});
+    EXPECT_EQ(from_cache.GetModulesForAlias("pci:v00008086d0000A0C8sv0sd0bc04sc03i00"),
+              std::vector<std::string>{"snd_hda_intel"});
+    EXPECT_EQ(from_text.ListModules("*"), from_cache.ListModules("*"));
+    EXPECT_TRUE(from_cache.IsBlocklisted("snd_hda_intel"));
+}
+
+TEST(module_config_cache, StaleSourceIsRejected) {
+    TemporaryDir dir;
+    std::string dir_path = dir.path;
+    WriteModuleDir(dir_path);
+    ModuleConfigCache cache(dir_path, kSources);
+    ASSERT_TRUE(cache.Write(MakeConfig()));
+    ModuleConfig config;
+    ASSERT_TRUE(cache.Read(&config));
+
+    // A rewritten source of a different size.
+    WriteFile(dir_path + "/modules.dep", std::string(kModulesDep) + "kernel/extra.ko:\n");
+    EXPECT_FALSE(cache.Read(&config));
+    ASSERT_TRUE(cache.Write(MakeConfig()));
+    ASSERT_TRUE(cache.Read(&config));
+
+    // Same size, new mtime.
+    struct timespec times[2] = {{0, UTIME_OMIT}, {1234, 5678}};
+    ASSERT_EQ(utimensat(AT_FDCWD, (dir_path + "/modules.alias").c_str(), times, 0), 0);
+    EXPECT_FALSE(cache.Read(&config));
+    ASSERT_TRUE(cache.Write(MakeConfig()));
+    ASSERT_TRUE(cache.Read(&config));
+
+    // A source that did not exist when the cache was written.
+    ASSERT_EQ(unlink((dir_path + "/modules.blocklist").c_str()), 0);
+    ASSERT_TRUE(cache.Write(MakeConfig()));
+    ASSERT_TRUE(cache.Read(&config));
+    WriteFile(dir_path + "/modules.blocklist", kModulesBlocklist);
+    EXPECT_FALSE(cache.Read(&config));
+
+    // A different set of sources.
+    ModuleConfigCache fewer(dir_path, {"modules.dep"});
+    EXPECT_FALSE(fewer.Read(&config));
+}
+
+TEST(module_config_cache, CorruptCacheIsRejected) {
+    TemporaryDir dir;
+    WriteModuleDir(dir.path);
+    ModuleConfigCache cache(dir.path, kSources);
+    ASSERT_TRUE(cache.Write(MakeConfig()));
+    std::string valid;
+    ASSERT_TRUE(android::base::ReadFileToString(CachePath(dir), &valid));
+
+    ModuleConfig untouched = MakeConfig();
+    auto expect_rejected = [&](const std::string& content, const std::string& what) {
+        WriteFile(CachePath(dir), content);
+        ModuleConfig config = MakeConfig();
+        EXPECT_FALSE(cache.Read(&config)) << what;
+        // A rejected cache leaves the output alone.
+        ExpectEqual(untouched, config);
+    };
+
+    for (size_t size = 0; size < valid.size(); ++size) {
+        expect_rejected(valid.substr(0, size), "truncated to " + std::to_string(size));
+    }
+    for (size_t i = 0; i < valid.size(); ++i) {
+        std::string flipped = valid;
+        flipped[i] ^= 0x40;
+        expect_rejected(flipped, "byte " + std::to_string(i) + " flipped");
+    }
+    expect_rejected(valid + '\0', "trailing byte");
+    expect_rejected(std::string(valid.size(), '\xff'), "all ones");
+}
+
+TEST(module_config_cache, CorruptCacheFallsBackToText) {
+    TemporaryDir dir;
+    std::string dir_path = dir.path;
+    WriteModuleDir(dir_path);
+    kernel_cmdline = "";
+    test_modules = {};
+    TestModprobeKernel kernel;
+
+    Modprobe from_text({dir_path}, "modules.load", true, &kernel);
+    std::string valid;
+    ASSERT_TRUE(android::base::ReadFileToString(CachePath(dir), &valid));
+    WriteFile(CachePath(dir), valid.substr(0, valid.size() / 2));
+
+    Modprobe reparsed({dir_path}, "modules.load", true, &kernel);
+    EXPECT_EQ(from_text.ListModules("*"), reparsed.ListModules("*"));
+    std::string rewritten;
+    ASSERT_TRUE(android::base::ReadFileToString(CachePath(dir), &rewritten));
+    EXPECT_EQ(rewritten, valid);
+}
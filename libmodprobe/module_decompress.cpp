@@ -0,0 +1,207 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "module_decompress.h"
+#include "log_new.h"
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <string>
+
+#ifdef MODPROBE_HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef MODPROBE_HAVE_LZMA
+#include <lzma.h>
+#endif
+#ifdef MODPROBE_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace {
+
+// Output grows in steps of this size while decompressing.
+constexpr size_t kChunkSize = 256 * 1024;
+
+bool EndsWith(std::string_view str, std::string_view suffix) {
+    return str.size() >= suffix.size() &&
+           str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+#ifdef MODPROBE_HAVE_ZLIB
+bool InflateGzip(const uint8_t* in, size_t in_size, std::vector<char>* out) {
+    z_stream strm{};
+    // 16 + MAX_WBITS selects the gzip wrapper.
+    if (inflateInit2(&strm, 16 + MAX_WBITS) != Z_OK) return false;
+    strm.next_in = const_cast<uint8_t*>(in);
+    strm.avail_in = static_cast<uInt>(in_size);
+
+    int ret = Z_OK;
+    size_t produced = 0;
+    while (ret != Z_STREAM_END) {
+        out->resize(produced + kChunkSize);
+        strm.next_out = reinterpret_cast<uint8_t*>(out->data() + produced);
+        strm.avail_out = kChunkSize;
+        ret = inflate(&strm, Z_NO_FLUSH);
+        produced = out->size() - strm.avail_out;
+        if (ret != Z_OK && ret != Z_STREAM_END) break;
+        if (ret == Z_OK && strm.avail_in == 0 && strm.avail_out != 0) {
+            ret = Z_DATA_ERROR;  // Truncated input.
+            break;
+        }
+    }
+    inflateEnd(&strm);
+    out->resize(produced);
+    return ret == Z_STREAM_END;
+}
+#endif
+
+#ifdef MODPROBE_HAVE_LZMA
+bool DecodeXz(const uint8_t* in, size_t in_size, std::vector<char>* out) {
+    lzma_stream strm = LZMA_STREAM_INIT;
+    if (lzma_stream_decoder(&strm, UINT64_MAX, LZMA_CONCATENATED) != LZMA_OK) return false;
+    strm.next_in = in;
+    strm.avail_in = in_size;
+
+    lzma_ret ret = LZMA_OK;
+    size_t produced = 0;
+    while (ret == LZMA_OK) {
+        out->resize(produced + kChunkSize);
+        strm.next_out = reinterpret_cast<uint8_t*>(out->data() + produced);
+        strm.avail_out = kChunkSize;
+        ret = lzma_code(&strm, strm.avail_in ? LZMA_RUN : LZMA_FINISH);
+        produced = out->size() - strm.avail_out;
+    }
+    lzma_end(&strm);
+    out->resize(produced);
+    return ret == LZMA_STREAM_END;
+}
+#endif
+
+#ifdef MODPROBE_HAVE_ZSTD
+bool DecodeZstd(const uint8_t* in, size_t in_size, std::vector<char>* out) {
+    ZSTD_DStream* stream = ZSTD_createDStream();
+    if (!stream) return false;
+    ZSTD_initDStream(stream);
+
+    ZSTD_inBuffer input = {in, in_size, 0};
+    size_t ret = 1;
+    size_t produced = 0;
+    while (input.pos < input.size || ret != 0) {
+        out->resize(produced + kChunkSize);
+        ZSTD_outBuffer output = {out->data() + produced, kChunkSize, 0};
+        ret = ZSTD_decompressStream(stream, &output, &input);
+        produced += output.pos;
+        if (ZSTD_isError(ret)) break;
+        if (input.pos == input.size && output.pos == 0 && ret != 0) {
+            ret = static_cast<size_t>(-1);  // Truncated input.
+            break;
+        }
+    }
+    ZSTD_freeDStream(stream);
+    out->resize(produced);
+    return ret == 0;
+}
+#endif
+
+}  // namespace
+
+ModuleCompression GetModuleCompression(std::string_view path) {
+    if (EndsWith(path, ".ko.gz")) return ModuleCompression::kGzip;
+    if (EndsWith(path, ".ko.xz")) return ModuleCompression::kXz;
+    if (EndsWith(path, ".ko.zst")) return ModuleCompression::kZstd;
+    return ModuleCompression::kNone;
+}
+
+const char* ModuleCompressionName(ModuleCompression compression) {
+    switch (compression) {
+        case ModuleCompression::kGzip:
+            return "gzip";
+        case ModuleCompression::kXz:
+            return "xz";
+        case ModuleCompression::kZstd:
+            return "zstd";
+        case ModuleCompression::kNone:
+            break;
+    }
+    return "none";
+}
+
+bool KernelSupportsModuleCompression(ModuleCompression compression) {
+    static std::once_flag once;
+    static std::string kernel_compression;
+    std::call_once(once, [] {
+        std::ifstream file("/sys/module/compression");
+        std::getline(file, kernel_compression);
+    });
+    return compression != ModuleCompression::kNone &&
+           kernel_compression == ModuleCompressionName(compression);
+}
+
+bool DecompressModule(int fd, ModuleCompression compression, std::vector<char>* image) {
+    struct stat sb{};
+    if (fstat(fd, &sb) != 0 || sb.st_size <= 0) {
+        LOGE("Could not stat compressed module: %s", strerror(errno));
+        return false;
+    }
+    size_t size = static_cast<size_t>(sb.st_size);
+    void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        LOGE("Could not map compressed module: %s", strerror(errno));
+        return false;
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
+
+    [[maybe_unused]] const auto* in = static_cast<const uint8_t*>(map);
+    bool ok = false;
+    bool supported = true;
+    image->clear();
+    image->reserve(size * 4);  // Typical ratio for kernel modules.
+    switch (compression) {
+#ifdef MODPROBE_HAVE_ZLIB
+        case ModuleCompression::kGzip:
+            ok = InflateGzip(in, size, image);
+            break;
+#endif
+#ifdef MODPROBE_HAVE_LZMA
+        case ModuleCompression::kXz:
+            ok = DecodeXz(in, size, image);
+            break;
+#endif
+#ifdef MODPROBE_HAVE_ZSTD
+        case ModuleCompression::kZstd:
+            ok = DecodeZstd(in, size, image);
+            break;
+#endif
+        default:
+            supported = false;
+            break;
+    }
+    munmap(map, size);
+
+    if (!supported) {
+        LOGE("%s-compressed modules are not supported by this build",
+             ModuleCompressionName(compression));
+    } else if (!ok) {
+        LOGE("Corrupt %s-compressed module", ModuleCompressionName(compression));
+    }
+    return ok;
+}
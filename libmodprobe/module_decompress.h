@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <string_view>
+#include <vector>
+
+enum class ModuleCompression {
+    kNone,
+    kGzip,  // .ko.gz
+    kXz,    // .ko.xz
+    kZstd,  // .ko.zst
+};
+
+/** Returns the compression implied by a module file's suffix. */
+ModuleCompression GetModuleCompression(std::string_view path);
+
+const char* ModuleCompressionName(ModuleCompression compression);
+
+/**
+ * Whether finit_module(MODULE_INIT_COMPRESSED_FILE) can take this format.
+ *
+ * Kernels built with CONFIG_MODULE_DECOMPRESS report their single supported
+ * format in /sys/module/compression; it is read once and cached.
+ */
+bool KernelSupportsModuleCompression(ModuleCompression compression);
+
+/**
+ * Decompresses a whole module file in userspace for init_module().
+ *
+ * Only formats whose library was available at build time are supported
+ * (MODPROBE_HAVE_ZLIB, MODPROBE_HAVE_LZMA, MODPROBE_HAVE_ZSTD).
+ *
+ * @param fd Open module file; read from offset 0.
+ * @param image Receives the uncompressed ELF image.
+ * @return false on I/O or format errors, or if the format is not built in.
+ */
+bool DecompressModule(int fd, ModuleCompression compression, std::vector<char>* image);
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <modprobe/module_name_table.h>
+
+std::string_view ModuleNameTable::Canonicalize(std::string_view path, char* buf) {
+    auto start = path.find_last_of('/');
+    start = start == std::string_view::npos ? 0 : start + 1;
+    auto end = path.size();
+    for (std::string_view suffix : {".ko", ".ko.gz", ".ko.xz", ".ko.zst"}) {
+        if (end - start >= suffix.size() &&
+            path.compare(end - suffix.size(), suffix.size(), suffix) == 0) {
+            end -= suffix.size();
+            break;
+        }
+    }
+    size_t len = end - start;
+    if (len <= 1 || len > kMaxNameLen) {
+        return {};
+    }
+    for (size_t i = 0; i < len; ++i) {
+        char c = path[start + i];
+        buf[i] = c == '-' ? '_' : c;
+    }
+    return std::string_view(buf, len);
+}
+
+uint64_t ModuleNameTable::Hash(std::string_view name) {
+    // FNV-1a; names are short and this is cheaper than std::hash's setup.
+    uint64_t hash = 14695981039346656037ULL;
+    for (unsigned char c : name) {
+        hash = (hash ^ c) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+void ModuleNameTable::Rehash(size_t capacity) {
+    slots_.assign(capacity, kInvalidModuleId);
+    size_t mask = capacity - 1;
+    for (ModuleId id = 0; id < names_.size(); ++id) {
+        size_t slot = hashes_[id] & mask;
+        while (slots_[slot] != kInvalidModuleId) slot = (slot + 1) & mask;
+        slots_[slot] = id;
+    }
+}
+
+ModuleId ModuleNameTable::Find(std::string_view canonical_name) const {
+    if (slots_.empty()) return kInvalidModuleId;
+    size_t mask = slots_.size() - 1;
+    for (size_t slot = Hash(canonical_name) & mask;; slot = (slot + 1) & mask) {
+        ModuleId id = slots_[slot];
+        if (id == kInvalidModuleId || names_[id] == canonical_name) return id;
+    }
+}
+
+ModuleId ModuleNameTable::Intern(std::string_view canonical_name) {
+    // Keep the load factor at or below one half.
+    if ((names_.size() + 1) * 2 > slots_.size()) {
+        Rehash(slots_.empty() ? 256 : slots_.size() * 2);
+    }
+
+    uint64_t hash = Hash(canonical_name);
+    size_t mask = slots_.size() - 1;
+    size_t slot = hash & mask;
+    for (; slots_[slot] != kInvalidModuleId; slot = (slot + 1) & mask) {
+        if (names_[slots_[slot]] == canonical_name) return slots_[slot];
+    }
+
+    ModuleId id = static_cast<ModuleId>(names_.size());
+    names_.emplace_back(canonical_name);
+    hashes_.emplace_back(hash);
+    slots_[slot] = id;
+    return id;
+}
+
+ModuleId ModuleNameTable::Lookup(std::string_view name_or_path) const {
+    char buf[kMaxNameLen];
+    auto canonical_name = Canonicalize(name_or_path, buf);
+    if (canonical_name.empty()) return kInvalidModuleId;
+    return Find(canonical_name);
+}
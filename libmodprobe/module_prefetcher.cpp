@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <modprobe/module_prefetcher.h>
+#include "log_new.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cstring>
+
+ModulePrefetcher::ModulePrefetcher(std::vector<std::string> paths, size_t window)
+    : paths_(std::move(paths)), window_(window ? window : 1) {
+    if (paths_.empty()) return;
+    thread_ = std::thread(&ModulePrefetcher::Run, this);
+    pthread_setname_np(thread_.native_handle(), "modprefetch");
+}
+
+ModulePrefetcher::~ModulePrefetcher() {
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        stopping_ = true;
+    }
+    cv_.notify_all();
+    if (thread_.joinable()) thread_.join();
+}
+
+void ModulePrefetcher::ModuleLoaded() {
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        ++loaded_;
+    }
+    cv_.notify_all();
+}
+
+void ModulePrefetcher::Run() {
+    for (size_t i = 0; i < paths_.size(); ++i) {
+        {
+            std::unique_lock<std::mutex> lock(lock_);
+            cv_.wait(lock, [&] { return stopping_ || i < loaded_ + window_; });
+            if (stopping_) return;
+        }
+
+        int fd = TEMP_FAILURE_RETRY(open(paths_[i].c_str(), O_RDONLY | O_NOFOLLOW | O_CLOEXEC));
+        if (fd < 0) continue;
+
+        struct stat sb{};
+        if (fstat(fd, &sb) == 0 && sb.st_size > 0) {
+            // readahead() blocks until the I/O is queued, which is what keeps
+            // this thread from racing ahead of the device. Filesystems that
+            // don't support it get the asynchronous hint instead.
+            if (readahead(fd, 0, static_cast<size_t>(sb.st_size)) != 0) {
+                posix_fadvise(fd, 0, sb.st_size, POSIX_FADV_WILLNEED);
+            }
+        }
+        close(fd);
+    }
+}
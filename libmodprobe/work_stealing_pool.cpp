@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// work_stealing_pool.cpp — Worker pool with per-thread deques for dependency-driven work
+
+#include "work_stealing_pool.h"
+
+#include <pthread.h>
+
+#include <algorithm>
+
+namespace minimal_systems {
+namespace init {
+
+namespace {
+
+// Identifies the pool and deque of the calling worker thread, if any.
+thread_local const WorkStealingPool* current_pool = nullptr;
+thread_local size_t current_index = 0;
+
+}  // namespace
+
+WorkStealingPool::WorkStealingPool(size_t num_threads, const std::string& name) {
+    num_threads = std::max<size_t>(num_threads, 1);
+    for (size_t i = 0; i < num_threads; ++i) {
+        queues_.emplace_back(std::make_unique<WorkerQueue>());
+    }
+    workers_.reserve(num_threads);
+    for (size_t i = 0; i < num_threads; ++i) {
+        workers_.emplace_back(&WorkStealingPool::WorkerLoop, this, i);
+        std::string thread_name = (name + std::to_string(i)).substr(0, 15);
+        pthread_setname_np(workers_.back().native_handle(), thread_name.c_str());
+    }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    Wait();
+    {
+        std::lock_guard<std::mutex> guard(sleep_lock_);
+        stopping_ = true;
+    }
+    work_cv_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+void WorkStealingPool::Submit(std::function<void()> task) {
+    size_t index = current_pool == this
+                           ? current_index
+                           : next_queue_.fetch_add(1, std::memory_order_relaxed) % queues_.size();
+
+    unfinished_.fetch_add(1);
+    {
+        // queued_ changes under the deque lock, together with the deque, so a
+        // thief can never pop the task and decrement before it is counted.
+        std::lock_guard<std::mutex> guard(queues_[index]->lock);
+        queued_.fetch_add(1);
+        queues_[index]->tasks.emplace_back(std::move(task));
+    }
+
+    // Taking the lock orders this wakeup after a sleeper's predicate check.
+    { std::lock_guard<std::mutex> guard(sleep_lock_); }
+    work_cv_.notify_one();
+}
+
+void WorkStealingPool::Wait() {
+    std::unique_lock<std::mutex> lock(sleep_lock_);
+    done_cv_.wait(lock, [this] { return unfinished_.load() == 0; });
+}
+
+bool WorkStealingPool::PopLocal(size_t index, std::function<void()>* task) {
+    auto& queue = *queues_[index];
+    std::lock_guard<std::mutex> guard(queue.lock);
+    if (queue.tasks.empty()) return false;
+    *task = std::move(queue.tasks.back());
+    queue.tasks.pop_back();
+    queued_.fetch_sub(1);
+    return true;
+}
+
+bool WorkStealingPool::Steal(size_t index, std::function<void()>* task) {
+    for (size_t n = 1; n < queues_.size(); ++n) {
+        auto& victim = *queues_[(index + n) % queues_.size()];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (victim.tasks.empty()) continue;
+        *task = std::move(victim.tasks.front());
+        victim.tasks.pop_front();
+        queued_.fetch_sub(1);
+        return true;
+    }
+    return false;
+}
+
+void WorkStealingPool::WorkerLoop(size_t index) {
+    current_pool = this;
+    current_index = index;
+
+    while (true) {
+        std::function<void()> task;
+        if (PopLocal(index, &task) || Steal(index, &task)) {
+            task();
+            if (unfinished_.fetch_sub(1) == 1) {
+                std::lock_guard<std::mutex> guard(sleep_lock_);
+                done_cv_.notify_all();
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleep_lock_);
+        work_cv_.wait(lock, [this] { return stopping_ || queued_.load() > 0; });
+        if (stopping_ && queued_.load() == 0) return;
+    }
+}
+
+}  // namespace init
+}  // namespace minimal_systems
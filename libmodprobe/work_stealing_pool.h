@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2024 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// work_stealing_pool.h — Worker pool with per-thread deques for dependency-driven work
+
+#ifndef MINIMAL_SYSTEMS_INIT_WORK_STEALING_POOL_H_
+#define MINIMAL_SYSTEMS_INIT_WORK_STEALING_POOL_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace minimal_systems {
+namespace init {
+
+/**
+ * A fixed set of workers, each owning a task deque.
+ *
+ * Tasks submitted from a worker go to that worker's own deque and are popped
+ * LIFO, so a task that unblocks follow-up work (e.g. a module whose load
+ * releases its dependents) usually runs that work next on a warm thread.
+ * Idle workers steal the oldest task from another worker's deque. Tasks
+ * submitted from outside the pool are spread round-robin.
+ */
+class WorkStealingPool {
+  public:
+    /**
+     * @param num_threads Number of workers; clamped to at least one.
+     * @param name Thread name prefix (truncated by the kernel to 15 chars).
+     */
+    WorkStealingPool(size_t num_threads, const std::string& name);
+
+    /** Runs all submitted tasks to completion, then joins the workers. */
+    ~WorkStealingPool();
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    void Submit(std::function<void()> task);
+
+    /** Blocks until every submitted task, including ones they submit, has run. */
+    void Wait();
+
+    size_t size() const { return workers_.size(); }
+
+  private:
+    struct WorkerQueue {
+        std::mutex lock;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    void WorkerLoop(size_t index);
+    bool PopLocal(size_t index, std::function<void()>* task);
+    bool Steal(size_t index, std::function<void()>* task);
+
+    std::vector<std::unique_ptr<WorkerQueue>> queues_;
+    std::vector<std::thread> workers_;
+    std::atomic<size_t> next_queue_{0};
+
+    // Tasks sitting in a deque, and tasks submitted but not yet finished.
+    std::atomic<size_t> queued_{0};
+    std::atomic<size_t> unfinished_{0};
+
+    std::mutex sleep_lock_;
+    std::condition_variable work_cv_;
+    std::condition_variable done_cv_;
+    bool stopping_ = false;
+};
+
+}  // namespace init
+}  // namespace minimal_systems
+
+#endif  // MINIMAL_SYSTEMS_INIT_WORK_STEALING_POOL_H_